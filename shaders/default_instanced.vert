@@ -0,0 +1,42 @@
+#version 450
+
+//default.vert for instanced draws: the object comes from the instance buffer instead of the push constants.
+//vertex inputs are Mesh::vertex_description (Vertex or CompactVertex, both expand to the same types), the outputs are
+//the ones default.frag reads. see GPUInstanceData in src/vk_engine.h
+layout(location = 0) in vec3 vPosition;
+layout(location = 1) in vec3 vNormal;
+layout(location = 2) in vec3 vColor;
+layout(location = 3) in vec2 vTexCoord;
+
+layout(location = 0) out vec3 outColor;
+layout(location = 1) out vec3 outNormal;
+layout(location = 2) out vec2 outTexCoord;
+layout(location = 3) out vec3 outFragPos;
+
+layout(set = 0, binding = 0) uniform CameraBuffer {
+	mat4 view;
+	mat4 proj;
+	mat4 viewproj;
+	vec4 viewPos;
+} cameraData;
+
+struct InstanceData {
+	//compact meshes have their position dequantization folded in
+	mat4 renderMatrix;
+	vec4 objectColor;
+};
+
+layout(std430, set = 2, binding = 0) readonly buffer Instances { InstanceData instances[]; };
+
+void main()
+{
+	//gl_InstanceIndex includes the firstInstance of the draw, the offset of its run in the buffer
+	InstanceData instance = instances[gl_InstanceIndex];
+	vec4 worldPos = instance.renderMatrix * vec4(vPosition, 1.0);
+	gl_Position = cameraData.viewproj * worldPos;
+	//what default.vert takes from the push constants
+	outColor = instance.objectColor.rgb;
+	outNormal = mat3(transpose(inverse(instance.renderMatrix))) * vNormal;
+	outTexCoord = vTexCoord;
+	outFragPos = worldPos.xyz;
+}
@@ -1,9 +1,16 @@
 #include <iostream>
 #include <glm/glm.hpp>
 #include <vk_engine.h>
+#include <vk_bench.h>
+#include <cstring>
 
 int main(int argc, char** argv)
 {
+    for (int i = 1; i < argc; i++)
+    {
+        if (strcmp(argv[i], "--bench") == 0)
+            return vkbench::run(argc, argv);
+    }
 
     VulkanEngine engine;
     engine.init();
@@ -0,0 +1,363 @@
+#include <vk_allocator.h>
+#include <iostream>
+#include <algorithm>
+
+static VkDeviceSize align_up(VkDeviceSize value, VkDeviceSize alignment)
+{
+	return (value + alignment - 1) & ~(alignment - 1);
+}
+
+void MemoryAllocator::init(VkPhysicalDevice physicalDevice, VkDevice device, VkDeviceSize blockSize)
+{
+	_device = device;
+	vkGetPhysicalDeviceMemoryProperties(physicalDevice, &_memProperties);
+
+	VkPhysicalDeviceProperties props{};
+	vkGetPhysicalDeviceProperties(physicalDevice, &props);
+	_bufferImageGranularity = std::max<VkDeviceSize>(props.limits.bufferImageGranularity, 1);
+
+	//buddy blocks have to be a power of two multiple of the minimum allocation
+	_blockSize = MIN_ALLOCATION;
+	_maxOrder = 0;
+	while (_blockSize < blockSize) {
+		_blockSize <<= 1;
+		_maxOrder++;
+	}
+
+	_pools.clear();
+	_pools.resize(_memProperties.memoryTypeCount);
+}
+
+void MemoryAllocator::cleanup()
+{
+	for (auto& pools : _pools) {
+		for (auto& block : pools.buddy) {
+			vkFreeMemory(_device, block.memory, nullptr);
+		}
+		for (auto& block : pools.linear) {
+			vkFreeMemory(_device, block.memory, nullptr);
+		}
+		for (auto& block : pools.dedicated) {
+			if (block.memory != VK_NULL_HANDLE)
+				vkFreeMemory(_device, block.memory, nullptr);
+		}
+	}
+	_pools.clear();
+	_deviceAllocations = 0;
+}
+
+uint32_t MemoryAllocator::findMemoryType(uint32_t typeFilter, VkMemoryPropertyFlags properties) const
+{
+	for (uint32_t i = 0; i < _memProperties.memoryTypeCount; i++)
+	{
+		if (typeFilter & (1 << i) && (_memProperties.memoryTypes[i].propertyFlags & properties) == properties)
+			return i;
+	}
+
+	return UINT32_MAX;
+}
+
+uint32_t MemoryAllocator::orderForSize(VkDeviceSize size) const
+{
+	uint32_t order = 0;
+	VkDeviceSize orderSize = MIN_ALLOCATION;
+	while (orderSize < size) {
+		orderSize <<= 1;
+		order++;
+	}
+	return order;
+}
+
+VkDeviceMemory MemoryAllocator::allocateDeviceMemory(VkDeviceSize size, uint32_t memoryType, char** outMapped)
+{
+	VkMemoryAllocateInfo allocInfo{};
+	allocInfo.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
+	allocInfo.allocationSize = size;
+	allocInfo.memoryTypeIndex = memoryType;
+
+	VkDeviceMemory memory = VK_NULL_HANDLE;
+	if (vkAllocateMemory(_device, &allocInfo, nullptr, &memory) != VK_SUCCESS) {
+		std::cout << "Failed to allocate " << size << " bytes from memory type " << memoryType << std::endl;
+		return VK_NULL_HANDLE;
+	}
+	_deviceAllocations++;
+
+	*outMapped = nullptr;
+	//host visible blocks stay mapped for their whole lifetime, mapping the same memory twice is not allowed
+	if (_memProperties.memoryTypes[memoryType].propertyFlags & VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT) {
+		void* mapped = nullptr;
+		if (vkMapMemory(_device, memory, 0, VK_WHOLE_SIZE, 0, &mapped) == VK_SUCCESS) {
+			*outMapped = static_cast<char*>(mapped);
+		}
+	}
+	return memory;
+}
+
+bool MemoryAllocator::allocate(const VkMemoryRequirements& requirements, VkMemoryPropertyFlags properties, Allocation& outAllocation, bool transient)
+{
+	uint32_t memoryType = findMemoryType(requirements.memoryTypeBits, properties);
+	if (memoryType == UINT32_MAX) {
+		std::cout << "No memory type with the requested properties" << std::endl;
+		return false;
+	}
+
+	//aligning everything to the granularity keeps linear and optimal resources off the same page
+	VkDeviceSize alignment = std::max(requirements.alignment, _bufferImageGranularity);
+	VkDeviceSize size = align_up(requirements.size, alignment);
+
+	if (size > _blockSize / 2) {
+		return allocateDedicated(memoryType, size, outAllocation);
+	}
+	if (transient) {
+		return allocateLinear(memoryType, size, alignment, outAllocation);
+	}
+	return allocateBuddy(memoryType, std::max(size, alignment), outAllocation);
+}
+
+bool MemoryAllocator::buddyAlloc(BuddyBlock& block, uint32_t order, VkDeviceSize& outOffset)
+{
+	uint32_t current = order;
+	while (current <= _maxOrder && block.freeLists[current].empty()) {
+		current++;
+	}
+	if (current > _maxOrder) {
+		return false;
+	}
+
+	VkDeviceSize offset = *block.freeLists[current].begin();
+	block.freeLists[current].erase(block.freeLists[current].begin());
+
+	//split until we reach the requested order, the upper halves go back to the free lists
+	while (current > order) {
+		current--;
+		block.freeLists[current].insert(offset + (MIN_ALLOCATION << current));
+	}
+
+	outOffset = offset;
+	return true;
+}
+
+void MemoryAllocator::buddyFree(BuddyBlock& block, VkDeviceSize offset, uint32_t order)
+{
+	while (order < _maxOrder) {
+		VkDeviceSize buddy = offset ^ (MIN_ALLOCATION << order);
+		auto it = block.freeLists[order].find(buddy);
+		if (it == block.freeLists[order].end()) {
+			break;
+		}
+		block.freeLists[order].erase(it);
+		offset = std::min(offset, buddy);
+		order++;
+	}
+	block.freeLists[order].insert(offset);
+}
+
+bool MemoryAllocator::allocateBuddy(uint32_t memoryType, VkDeviceSize size, Allocation& out)
+{
+	uint32_t order = orderForSize(size);
+	auto& blocks = _pools[memoryType].buddy;
+
+	for (uint32_t i = 0; i <= blocks.size(); i++) {
+		if (i == blocks.size()) {
+			BuddyBlock newBlock;
+			newBlock.memory = allocateDeviceMemory(_blockSize, memoryType, &newBlock.mapped);
+			if (newBlock.memory == VK_NULL_HANDLE) {
+				return false;
+			}
+			newBlock.freeLists.resize(_maxOrder + 1);
+			newBlock.freeLists[_maxOrder].insert(0);
+			blocks.push_back(std::move(newBlock));
+		}
+
+		VkDeviceSize offset = 0;
+		if (buddyAlloc(blocks[i], order, offset)) {
+			BuddyBlock& block = blocks[i];
+			block.usedBytes += MIN_ALLOCATION << order;
+			block.allocationCount++;
+
+			out.memory = block.memory;
+			out.offset = offset;
+			out.size = MIN_ALLOCATION << order;
+			out.mapped = block.mapped ? block.mapped + offset : nullptr;
+			out.memoryType = memoryType;
+			out.block = i;
+			out.pool = POOL_BUDDY;
+			return true;
+		}
+	}
+	return false;
+}
+
+bool MemoryAllocator::allocateLinear(uint32_t memoryType, VkDeviceSize size, VkDeviceSize alignment, Allocation& out)
+{
+	auto& blocks = _pools[memoryType].linear;
+
+	for (uint32_t i = 0; i <= blocks.size(); i++) {
+		if (i == blocks.size()) {
+			LinearBlock newBlock;
+			newBlock.memory = allocateDeviceMemory(_blockSize, memoryType, &newBlock.mapped);
+			if (newBlock.memory == VK_NULL_HANDLE) {
+				return false;
+			}
+			blocks.push_back(newBlock);
+		}
+
+		LinearBlock& block = blocks[i];
+		VkDeviceSize offset = align_up(block.head, alignment);
+		if (offset + size <= _blockSize) {
+			block.head = offset + size;
+			block.allocationCount++;
+
+			out.memory = block.memory;
+			out.offset = offset;
+			out.size = size;
+			out.mapped = block.mapped ? block.mapped + offset : nullptr;
+			out.memoryType = memoryType;
+			out.block = i;
+			out.pool = POOL_LINEAR;
+			return true;
+		}
+	}
+	return false;
+}
+
+bool MemoryAllocator::allocateDedicated(uint32_t memoryType, VkDeviceSize size, Allocation& out)
+{
+	auto& blocks = _pools[memoryType].dedicated;
+
+	//reuse a released slot so block indices stay stable
+	uint32_t slot = 0;
+	while (slot < blocks.size() && blocks[slot].memory != VK_NULL_HANDLE) {
+		slot++;
+	}
+	if (slot == blocks.size()) {
+		blocks.push_back({});
+	}
+
+	char* mapped = nullptr;
+	VkDeviceMemory memory = allocateDeviceMemory(size, memoryType, &mapped);
+	if (memory == VK_NULL_HANDLE) {
+		return false;
+	}
+	blocks[slot].memory = memory;
+	blocks[slot].size = size;
+
+	out.memory = memory;
+	out.offset = 0;
+	out.size = size;
+	out.mapped = mapped;
+	out.memoryType = memoryType;
+	out.block = slot;
+	out.pool = POOL_DEDICATED;
+	return true;
+}
+
+void MemoryAllocator::free(const Allocation& allocation)
+{
+	if (allocation.memory == VK_NULL_HANDLE || allocation.memoryType >= _pools.size()) {
+		return;
+	}
+
+	TypePools& pools = _pools[allocation.memoryType];
+	switch (allocation.pool) {
+	case POOL_BUDDY: {
+		BuddyBlock& block = pools.buddy[allocation.block];
+		buddyFree(block, allocation.offset, orderForSize(allocation.size));
+		block.usedBytes -= allocation.size;
+		block.allocationCount--;
+		break;
+	}
+	case POOL_LINEAR: {
+		LinearBlock& block = pools.linear[allocation.block];
+		//the block rewinds once every transient allocation in it is released
+		if (--block.allocationCount == 0) {
+			block.head = 0;
+		}
+		break;
+	}
+	case POOL_DEDICATED: {
+		DedicatedBlock& block = pools.dedicated[allocation.block];
+		vkFreeMemory(_device, block.memory, nullptr);
+		block.memory = VK_NULL_HANDLE;
+		block.size = 0;
+		_deviceAllocations--;
+		break;
+	}
+	default:
+		break;
+	}
+}
+
+void MemoryAllocator::getHeapStats(std::vector<HeapStats>& outStats) const
+{
+	outStats.clear();
+	outStats.resize(_memProperties.memoryHeapCount);
+	for (uint32_t h = 0; h < _memProperties.memoryHeapCount; h++) {
+		outStats[h] = {};
+		outStats[h].heapIndex = h;
+		outStats[h].heapSize = _memProperties.memoryHeaps[h].size;
+	}
+
+	std::vector<VkDeviceSize> freeBytes(_memProperties.memoryHeapCount, 0);
+
+	for (uint32_t type = 0; type < _pools.size(); type++) {
+		HeapStats& stats = outStats[_memProperties.memoryTypes[type].heapIndex];
+		VkDeviceSize& heapFree = freeBytes[_memProperties.memoryTypes[type].heapIndex];
+		const TypePools& pools = _pools[type];
+
+		for (const auto& block : pools.buddy) {
+			stats.blockCount++;
+			stats.allocationCount += block.allocationCount;
+			stats.reservedBytes += _blockSize;
+			stats.usedBytes += block.usedBytes;
+			heapFree += _blockSize - block.usedBytes;
+			for (uint32_t order = _maxOrder + 1; order-- > 0;) {
+				if (!block.freeLists[order].empty()) {
+					stats.largestFreeRange = std::max(stats.largestFreeRange, MIN_ALLOCATION << order);
+					break;
+				}
+			}
+		}
+		for (const auto& block : pools.linear) {
+			stats.blockCount++;
+			stats.allocationCount += block.allocationCount;
+			stats.reservedBytes += _blockSize;
+			stats.usedBytes += block.head;
+			heapFree += _blockSize - block.head;
+			stats.largestFreeRange = std::max(stats.largestFreeRange, _blockSize - block.head);
+		}
+		for (const auto& block : pools.dedicated) {
+			if (block.memory == VK_NULL_HANDLE)
+				continue;
+			stats.dedicatedCount++;
+			stats.allocationCount++;
+			stats.reservedBytes += block.size;
+			stats.usedBytes += block.size;
+		}
+	}
+
+	for (uint32_t h = 0; h < outStats.size(); h++) {
+		outStats[h].fragmentation = freeBytes[h] > 0 ? 1.0f - float(outStats[h].largestFreeRange) / float(freeBytes[h]) : 0.0f;
+	}
+}
+
+void MemoryAllocator::printStats() const
+{
+	std::vector<HeapStats> stats;
+	getHeapStats(stats);
+
+	std::cout << "GPU memory: " << _deviceAllocations << " vkAllocateMemory calls alive" << std::endl;
+	for (const auto& heap : stats) {
+		if (heap.reservedBytes == 0)
+			continue;
+		std::cout << "  heap " << heap.heapIndex
+			<< ": blocks " << heap.blockCount
+			<< ", dedicated " << heap.dedicatedCount
+			<< ", allocations " << heap.allocationCount
+			<< ", used " << heap.usedBytes / 1024 << " KiB"
+			<< " / reserved " << heap.reservedBytes / 1024 << " KiB"
+			<< " (heap " << heap.heapSize / (1024 * 1024) << " MiB)"
+			<< ", largest free " << heap.largestFreeRange / 1024 << " KiB"
+			<< ", fragmentation " << heap.fragmentation * 100.0f << "%" << std::endl;
+	}
+}
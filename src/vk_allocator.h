@@ -0,0 +1,99 @@
+#pragma once
+
+#include <vk_types.h>
+#include <vector>
+#include <set>
+
+//block based GPU memory sub-allocator.
+//every memory type owns a list of large VkDeviceMemory blocks, long-lived resources are placed with a buddy allocator
+//and transient ones (staging) are bump allocated from linear blocks that rewind once all their allocations are freed.
+class MemoryAllocator {
+public:
+	enum PoolType : uint32_t {
+		POOL_BUDDY = 0,
+		POOL_LINEAR = 1,
+		POOL_DEDICATED = 2
+	};
+
+	struct HeapStats {
+		uint32_t heapIndex;
+		VkDeviceSize heapSize;
+		uint32_t blockCount;
+		uint32_t dedicatedCount;
+		uint32_t allocationCount;
+		//bytes of VkDeviceMemory owned by the allocator
+		VkDeviceSize reservedBytes;
+		//bytes handed out, including alignment/buddy rounding
+		VkDeviceSize usedBytes;
+		VkDeviceSize largestFreeRange;
+		//1 - largestFreeRange/freeBytes, 0 means all free space is contiguous
+		float fragmentation;
+	};
+
+	void init(VkPhysicalDevice physicalDevice, VkDevice device, VkDeviceSize blockSize = 64ull * 1024 * 1024);
+
+	void cleanup();
+
+	//returns false if no memory type matches or the driver is out of memory
+	bool allocate(const VkMemoryRequirements& requirements, VkMemoryPropertyFlags properties, Allocation& outAllocation, bool transient = false);
+
+	void free(const Allocation& allocation);
+
+	uint32_t findMemoryType(uint32_t typeFilter, VkMemoryPropertyFlags properties) const;
+
+	void getHeapStats(std::vector<HeapStats>& outStats) const;
+
+	void printStats() const;
+
+	uint32_t deviceAllocationCount() const { return _deviceAllocations; }
+
+private:
+	struct BuddyBlock {
+		VkDeviceMemory memory{ VK_NULL_HANDLE };
+		char* mapped{ nullptr };
+		//free offsets per order, order 0 is the minimum allocation size
+		std::vector<std::set<VkDeviceSize>> freeLists;
+		VkDeviceSize usedBytes{ 0 };
+		uint32_t allocationCount{ 0 };
+	};
+
+	struct LinearBlock {
+		VkDeviceMemory memory{ VK_NULL_HANDLE };
+		char* mapped{ nullptr };
+		VkDeviceSize head{ 0 };
+		uint32_t allocationCount{ 0 };
+	};
+
+	struct DedicatedBlock {
+		VkDeviceMemory memory{ VK_NULL_HANDLE };
+		VkDeviceSize size{ 0 };
+	};
+
+	struct TypePools {
+		std::vector<BuddyBlock> buddy;
+		std::vector<LinearBlock> linear;
+		std::vector<DedicatedBlock> dedicated;
+	};
+
+	VkDeviceMemory allocateDeviceMemory(VkDeviceSize size, uint32_t memoryType, char** outMapped);
+
+	bool allocateBuddy(uint32_t memoryType, VkDeviceSize size, Allocation& out);
+	bool allocateLinear(uint32_t memoryType, VkDeviceSize size, VkDeviceSize alignment, Allocation& out);
+	bool allocateDedicated(uint32_t memoryType, VkDeviceSize size, Allocation& out);
+
+	bool buddyAlloc(BuddyBlock& block, uint32_t order, VkDeviceSize& outOffset);
+	void buddyFree(BuddyBlock& block, VkDeviceSize offset, uint32_t order);
+
+	uint32_t orderForSize(VkDeviceSize size) const;
+
+	VkDevice _device{ VK_NULL_HANDLE };
+	VkPhysicalDeviceMemoryProperties _memProperties{};
+	VkDeviceSize _bufferImageGranularity{ 1 };
+	VkDeviceSize _blockSize{ 0 };
+	uint32_t _maxOrder{ 0 };
+	uint32_t _deviceAllocations{ 0 };
+
+	std::vector<TypePools> _pools;
+
+	static constexpr VkDeviceSize MIN_ALLOCATION = 256;
+};
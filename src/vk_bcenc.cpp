@@ -0,0 +1,353 @@
+#include <vk_bcenc.h>
+#include <vk_threadpool.h>
+#include <algorithm>
+#include <cstring>
+#include <cmath>
+
+uint32_t vkbc::block_bytes(BlockFormat format)
+{
+	return format == BlockFormat::BC1 || format == BlockFormat::BC4 ? 8 : 16;
+}
+
+size_t vkbc::encoded_size(BlockFormat format, uint32_t width, uint32_t height)
+{
+	return size_t((width + 3) / 4) * ((height + 3) / 4) * block_bytes(format);
+}
+
+VkFormat vkbc::vk_format(BlockFormat format, bool srgb)
+{
+	switch (format) {
+	case BlockFormat::BC1:
+		return srgb ? VK_FORMAT_BC1_RGB_SRGB_BLOCK : VK_FORMAT_BC1_RGB_UNORM_BLOCK;
+	case BlockFormat::BC3:
+		return srgb ? VK_FORMAT_BC3_SRGB_BLOCK : VK_FORMAT_BC3_UNORM_BLOCK;
+	case BlockFormat::BC4:
+		return VK_FORMAT_BC4_UNORM_BLOCK;
+	case BlockFormat::BC5:
+		return VK_FORMAT_BC5_UNORM_BLOCK;
+	}
+	return VK_FORMAT_UNDEFINED;
+}
+
+vkbc::BlockFormat vkbc::color_format_for(const uint8_t* rgba, size_t pixelCount)
+{
+	for (size_t i = 0; i < pixelCount; i++) {
+		if (rgba[i * 4 + 3] != 255) {
+			return BlockFormat::BC3;
+		}
+	}
+	return BlockFormat::BC1;
+}
+
+namespace {
+
+	uint16_t pack_565(const float color[3])
+	{
+		uint32_t r = static_cast<uint32_t>(std::min(std::max(color[0], 0.0f), 255.0f) * 31.0f / 255.0f + 0.5f);
+		uint32_t g = static_cast<uint32_t>(std::min(std::max(color[1], 0.0f), 255.0f) * 63.0f / 255.0f + 0.5f);
+		uint32_t b = static_cast<uint32_t>(std::min(std::max(color[2], 0.0f), 255.0f) * 31.0f / 255.0f + 0.5f);
+		return static_cast<uint16_t>((r << 11) | (g << 5) | b);
+	}
+
+	void unpack_565(uint16_t value, int color[3])
+	{
+		int r = (value >> 11) & 31;
+		int g = (value >> 5) & 63;
+		int b = value & 31;
+		color[0] = (r << 3) | (r >> 2);
+		color[1] = (g << 2) | (g >> 4);
+		color[2] = (b << 3) | (b >> 2);
+	}
+
+	void write_u16(uint8_t* out, uint16_t value)
+	{
+		out[0] = static_cast<uint8_t>(value);
+		out[1] = static_cast<uint8_t>(value >> 8);
+	}
+
+	//the 4 palette entries of a BC1 block in 4 color mode
+	void bc1_palette(uint16_t c0, uint16_t c1, int palette[4][3])
+	{
+		unpack_565(c0, palette[0]);
+		unpack_565(c1, palette[1]);
+		for (int c = 0; c < 3; c++) {
+			palette[2][c] = (2 * palette[0][c] + palette[1][c]) / 3;
+			palette[3][c] = (palette[0][c] + 2 * palette[1][c]) / 3;
+		}
+	}
+
+	void bc4_palette(uint8_t a0, uint8_t a1, int palette[8])
+	{
+		palette[0] = a0;
+		palette[1] = a1;
+		//the encoder always writes a0 > a1, the 6 value mode is only read
+		if (a0 > a1) {
+			for (int i = 1; i < 7; i++) {
+				palette[i + 1] = ((7 - i) * a0 + i * a1) / 7;
+			}
+		}
+		else {
+			for (int i = 1; i < 5; i++) {
+				palette[i + 1] = ((5 - i) * a0 + i * a1) / 5;
+			}
+			palette[6] = 0;
+			palette[7] = 255;
+		}
+	}
+
+	//16 texels of the block at (bx, by), texels past the edge repeat the last row/column
+	void gather_block(const uint8_t* rgba, uint32_t width, uint32_t height, uint32_t bx, uint32_t by, uint8_t block[64])
+	{
+		for (uint32_t y = 0; y < 4; y++) {
+			uint32_t sy = std::min(by * 4 + y, height - 1);
+			for (uint32_t x = 0; x < 4; x++) {
+				uint32_t sx = std::min(bx * 4 + x, width - 1);
+				memcpy(block + (y * 4 + x) * 4, rgba + (size_t(sy) * width + sx) * 4, 4);
+			}
+		}
+	}
+}
+
+void vkbc::encode_bc1_block(const uint8_t* pixels, uint8_t* out)
+{
+	//principal axis of the block colors by power iteration on the covariance
+	float mean[3] = { 0.0f, 0.0f, 0.0f };
+	for (int i = 0; i < 16; i++) {
+		for (int c = 0; c < 3; c++) {
+			mean[c] += pixels[i * 4 + c];
+		}
+	}
+	for (int c = 0; c < 3; c++) {
+		mean[c] /= 16.0f;
+	}
+	float cov[6] = { 0.0f, 0.0f, 0.0f, 0.0f, 0.0f, 0.0f };
+	for (int i = 0; i < 16; i++) {
+		float r = pixels[i * 4] - mean[0];
+		float g = pixels[i * 4 + 1] - mean[1];
+		float b = pixels[i * 4 + 2] - mean[2];
+		cov[0] += r * r;
+		cov[1] += r * g;
+		cov[2] += r * b;
+		cov[3] += g * g;
+		cov[4] += g * b;
+		cov[5] += b * b;
+	}
+	float axis[3] = { 1.0f, 1.0f, 1.0f };
+	for (int iteration = 0; iteration < 8; iteration++) {
+		float next[3] = {
+			cov[0] * axis[0] + cov[1] * axis[1] + cov[2] * axis[2],
+			cov[1] * axis[0] + cov[3] * axis[1] + cov[4] * axis[2],
+			cov[2] * axis[0] + cov[4] * axis[1] + cov[5] * axis[2],
+		};
+		float length = std::max(std::abs(next[0]), std::max(std::abs(next[1]), std::abs(next[2])));
+		if (length < 1e-6f) {
+			break;
+		}
+		for (int c = 0; c < 3; c++) {
+			axis[c] = next[c] / length;
+		}
+	}
+
+	float minProjection = 1e30f;
+	float maxProjection = -1e30f;
+	for (int i = 0; i < 16; i++) {
+		float projection = 0.0f;
+		for (int c = 0; c < 3; c++) {
+			projection += (pixels[i * 4 + c] - mean[c]) * axis[c];
+		}
+		minProjection = std::min(minProjection, projection);
+		maxProjection = std::max(maxProjection, projection);
+	}
+	float axisLength2 = axis[0] * axis[0] + axis[1] * axis[1] + axis[2] * axis[2];
+	//endpoints pulled in by 1/16 of the range, the extremes are rarely hit exactly after 565 rounding
+	float inset = (maxProjection - minProjection) / 16.0f;
+	float endpoint0[3];
+	float endpoint1[3];
+	for (int c = 0; c < 3; c++) {
+		endpoint0[c] = mean[c] + axis[c] * (maxProjection - inset) / axisLength2;
+		endpoint1[c] = mean[c] + axis[c] * (minProjection + inset) / axisLength2;
+	}
+
+	uint16_t c0 = pack_565(endpoint0);
+	uint16_t c1 = pack_565(endpoint1);
+	//c0 > c1 selects 4 color mode, equal endpoints only ever use index 0
+	if (c0 < c1) {
+		std::swap(c0, c1);
+	}
+	write_u16(out, c0);
+	write_u16(out + 2, c1);
+
+	uint32_t indices = 0;
+	if (c0 != c1) {
+		int palette[4][3];
+		bc1_palette(c0, c1, palette);
+		for (int i = 0; i < 16; i++) {
+			int best = 0;
+			int bestError = INT32_MAX;
+			for (int p = 0; p < 4; p++) {
+				int dr = pixels[i * 4] - palette[p][0];
+				int dg = pixels[i * 4 + 1] - palette[p][1];
+				int db = pixels[i * 4 + 2] - palette[p][2];
+				int error = dr * dr + dg * dg + db * db;
+				if (error < bestError) {
+					bestError = error;
+					best = p;
+				}
+			}
+			indices |= uint32_t(best) << (i * 2);
+		}
+	}
+	for (int i = 0; i < 4; i++) {
+		out[4 + i] = static_cast<uint8_t>(indices >> (i * 8));
+	}
+}
+
+void vkbc::encode_bc4_block(const uint8_t* pixels, uint32_t channel, uint8_t* out)
+{
+	uint8_t minValue = 255;
+	uint8_t maxValue = 0;
+	for (int i = 0; i < 16; i++) {
+		minValue = std::min(minValue, pixels[i * 4 + channel]);
+		maxValue = std::max(maxValue, pixels[i * 4 + channel]);
+	}
+	out[0] = maxValue;
+	out[1] = minValue;
+
+	uint64_t indices = 0;
+	if (maxValue != minValue) {
+		int palette[8];
+		bc4_palette(maxValue, minValue, palette);
+		for (int i = 0; i < 16; i++) {
+			int value = pixels[i * 4 + channel];
+			int best = 0;
+			int bestError = INT32_MAX;
+			for (int p = 0; p < 8; p++) {
+				int error = std::abs(value - palette[p]);
+				if (error < bestError) {
+					bestError = error;
+					best = p;
+				}
+			}
+			indices |= uint64_t(best) << (i * 3);
+		}
+	}
+	for (int i = 0; i < 6; i++) {
+		out[2 + i] = static_cast<uint8_t>(indices >> (i * 8));
+	}
+}
+
+void vkbc::encode(BlockFormat format, const uint8_t* rgba, uint32_t width, uint32_t height, uint8_t* out, ThreadPool* pool)
+{
+	const uint32_t blocksX = (width + 3) / 4;
+	const uint32_t blocksY = (height + 3) / 4;
+	const uint32_t blockSize = block_bytes(format);
+
+	auto encodeRow = [&](uint32_t by) {
+		uint8_t block[64];
+		uint8_t* dst = out + size_t(by) * blocksX * blockSize;
+		for (uint32_t bx = 0; bx < blocksX; bx++, dst += blockSize) {
+			gather_block(rgba, width, height, bx, by, block);
+			switch (format) {
+			case BlockFormat::BC1:
+				encode_bc1_block(block, dst);
+				break;
+			case BlockFormat::BC3:
+				encode_bc4_block(block, 3, dst);
+				encode_bc1_block(block, dst + 8);
+				break;
+			case BlockFormat::BC4:
+				encode_bc4_block(block, 0, dst);
+				break;
+			case BlockFormat::BC5:
+				encode_bc4_block(block, 0, dst);
+				encode_bc4_block(block, 1, dst + 8);
+				break;
+			}
+		}
+	};
+
+	if (pool != nullptr && blocksY > 1) {
+		pool->parallel_for(blocksY, encodeRow);
+	}
+	else {
+		for (uint32_t by = 0; by < blocksY; by++) {
+			encodeRow(by);
+		}
+	}
+}
+
+namespace {
+
+	void decode_bc1_block(const uint8_t* block, uint8_t* pixels)
+	{
+		uint16_t c0 = uint16_t(block[0] | (block[1] << 8));
+		uint16_t c1 = uint16_t(block[2] | (block[3] << 8));
+		uint32_t indices = uint32_t(block[4]) | (uint32_t(block[5]) << 8) | (uint32_t(block[6]) << 16) | (uint32_t(block[7]) << 24);
+		int palette[4][3];
+		bc1_palette(c0, c1, palette);
+		if (c0 <= c1) {
+			//3 color mode: midpoint and black
+			for (int c = 0; c < 3; c++) {
+				palette[2][c] = (palette[0][c] + palette[1][c]) / 2;
+				palette[3][c] = 0;
+			}
+		}
+		for (int i = 0; i < 16; i++) {
+			int index = (indices >> (i * 2)) & 3;
+			for (int c = 0; c < 3; c++) {
+				pixels[i * 4 + c] = static_cast<uint8_t>(palette[index][c]);
+			}
+		}
+	}
+
+	void decode_bc4_block(const uint8_t* block, uint32_t channel, uint8_t* pixels)
+	{
+		int palette[8];
+		bc4_palette(block[0], block[1], palette);
+		uint64_t indices = 0;
+		for (int i = 0; i < 6; i++) {
+			indices |= uint64_t(block[2 + i]) << (i * 8);
+		}
+		for (int i = 0; i < 16; i++) {
+			pixels[i * 4 + channel] = static_cast<uint8_t>(palette[(indices >> (i * 3)) & 7]);
+		}
+	}
+}
+
+void vkbc::decode(BlockFormat format, const uint8_t* blocks, uint32_t width, uint32_t height, uint8_t* rgba)
+{
+	const uint32_t blocksX = (width + 3) / 4;
+	const uint32_t blocksY = (height + 3) / 4;
+	const uint32_t blockSize = block_bytes(format);
+	for (uint32_t by = 0; by < blocksY; by++) {
+		for (uint32_t bx = 0; bx < blocksX; bx++) {
+			const uint8_t* block = blocks + (size_t(by) * blocksX + bx) * blockSize;
+			uint8_t pixels[64];
+			for (int i = 0; i < 16; i++) {
+				pixels[i * 4] = pixels[i * 4 + 1] = pixels[i * 4 + 2] = 0;
+				pixels[i * 4 + 3] = 255;
+			}
+			switch (format) {
+			case BlockFormat::BC1:
+				decode_bc1_block(block, pixels);
+				break;
+			case BlockFormat::BC3:
+				decode_bc4_block(block, 3, pixels);
+				decode_bc1_block(block + 8, pixels);
+				break;
+			case BlockFormat::BC4:
+				decode_bc4_block(block, 0, pixels);
+				break;
+			case BlockFormat::BC5:
+				decode_bc4_block(block, 0, pixels);
+				decode_bc4_block(block + 8, 1, pixels);
+				break;
+			}
+			for (uint32_t y = 0; y < 4 && by * 4 + y < height; y++) {
+				for (uint32_t x = 0; x < 4 && bx * 4 + x < width; x++) {
+					memcpy(rgba + ((size_t(by) * 4 + y) * width + bx * 4 + x) * 4, pixels + (y * 4 + x) * 4, 4);
+				}
+			}
+		}
+	}
+}
@@ -0,0 +1,42 @@
+#pragma once
+
+#include <vk_types.h>
+#include <vector>
+
+class ThreadPool;
+
+//block compression of rgba8 images into the BCn formats every desktop GPU samples natively
+namespace vkbc {
+
+	enum class BlockFormat : uint32_t {
+		//rgb 5:6:5 endpoints, 2 bit indices. 8 bytes per 4x4 block, opaque only
+		BC1 = 0,
+		//BC1 color plus a BC4 alpha block, 16 bytes
+		BC3 = 1,
+		//one channel (red), 8 bytes
+		BC4 = 2,
+		//two BC4 channels (red, green), 16 bytes. meant for tangent space normal maps
+		BC5 = 3,
+	};
+
+	uint32_t block_bytes(BlockFormat format);
+
+	//bytes of one encoded image, partial blocks at the edges count as whole blocks
+	size_t encoded_size(BlockFormat format, uint32_t width, uint32_t height);
+
+	VkFormat vk_format(BlockFormat format, bool srgb);
+
+	//BC1 when every texel is opaque, BC3 otherwise
+	BlockFormat color_format_for(const uint8_t* rgba, size_t pixelCount);
+
+	//encodes tightly packed rgba8 into out (encoded_size bytes). block rows are spread over the pool when given
+	void encode(BlockFormat format, const uint8_t* rgba, uint32_t width, uint32_t height, uint8_t* out, ThreadPool* pool = nullptr);
+
+	//back to rgba8 for quality checks, channels a format does not store come back as 0 (alpha 255)
+	void decode(BlockFormat format, const uint8_t* blocks, uint32_t width, uint32_t height, uint8_t* rgba);
+
+	//single blocks, pixels are 16 rgba8 texels in row order
+	void encode_bc1_block(const uint8_t* pixels, uint8_t* out);
+	//channel selects r/g/b/a of the rgba8 pixels
+	void encode_bc4_block(const uint8_t* pixels, uint32_t channel, uint8_t* out);
+}
@@ -0,0 +1,702 @@
+#include <vk_bench.h>
+#include <vk_mesh.h>
+#include <vk_threadpool.h>
+#include <vk_meshcache.h>
+#include <vk_culling.h>
+#include <vk_bvh.h>
+#include <vk_renderqueue.h>
+#include <vk_meshlet.h>
+#include <vk_lod.h>
+#include <vk_hiz.h>
+#include <vk_gltfloader.h>
+#include <vk_texture.h>
+#include <iostream>
+#include <chrono>
+#include <cstring>
+#include <string>
+#include <cmath>
+#include <unordered_set>
+#include <glm/glm.hpp>
+#include <glm/gtc/matrix_transform.hpp>
+#include <random>
+
+namespace {
+
+	template<typename F>
+	double best_of(int runs, F&& func)
+	{
+		double best = 1e30;
+		for (int i = 0; i < runs; i++) {
+			auto start = std::chrono::high_resolution_clock::now();
+			func();
+			auto end = std::chrono::high_resolution_clock::now();
+			best = std::min(best, std::chrono::duration<double, std::milli>(end - start).count());
+		}
+		return best;
+	}
+
+	uint32_t index_at(const Mesh& mesh, size_t i)
+	{
+		if (mesh._cookedFile && mesh._indexType == VK_INDEX_TYPE_UINT16) {
+			return static_cast<const uint16_t*>(mesh.index_data())[i];
+		}
+		return static_cast<const uint32_t*>(mesh.index_data())[i];
+	}
+
+	bool same_mesh(const Mesh& a, const Mesh& b)
+	{
+		if (a._format != b._format || a.vertex_count() != b.vertex_count() || a.index_count() != b.index_count() ||
+			memcmp(a.vertex_data(), b.vertex_data(), a.vertex_count() * Mesh::vertex_stride(a._format)) != 0) {
+			return false;
+		}
+		for (size_t i = 0; i < a.index_count(); i++) {
+			if (index_at(a, i) != index_at(b, i)) {
+				return false;
+			}
+		}
+		return true;
+	}
+
+	int bench_obj(const char* filename, ThreadPool& pool)
+	{
+		const int runs = 3;
+		Mesh serial, parallel;
+		bool ok = true;
+
+		double serialMs = best_of(runs, [&]() { serial = Mesh{}; ok &= serial.load_from_obj(filename); });
+		double parallelMs = best_of(runs, [&]() { parallel = Mesh{}; ok &= parallel.load_from_obj(filename, &pool); });
+
+		if (!ok) {
+			std::cout << "bench: failed to load " << filename << std::endl;
+			return 1;
+		}
+
+		//cooked meshes are stored optimized, so they are compared against an optimized copy
+		Mesh optimized;
+		double optimizeMs = best_of(1, [&]() { optimized = serial; optimized.optimize(true); });
+
+		//make sure the cache is current, then time mapping it
+		Mesh cooked;
+		std::string cookedPath = vkcook::cooked_path(filename);
+		ok &= cooked.load_cached(filename, &pool, VertexFormat::Full);
+		double cookedMs = best_of(runs, [&]() { cooked = Mesh{}; ok &= vkcook::load(cookedPath.c_str(), filename, cooked, VertexFormat::Full); });
+
+		//compact encode, and the largest position error it introduces
+		Mesh compacted;
+		double compactMs = best_of(runs, [&]() { compacted = serial; compacted.compact(&pool); });
+		glm::mat4 dequantize = compacted.dequantize_matrix();
+		float maxError = 0.0f;
+		for (size_t i = 0; i < compacted._compactVertices.size(); i++) {
+			const int16_t* q = compacted._compactVertices[i].position;
+			glm::vec4 p = dequantize * glm::vec4(std::max(q[0] / 32767.0f, -1.0f), std::max(q[1] / 32767.0f, -1.0f), std::max(q[2] / 32767.0f, -1.0f), 1.0f);
+			glm::vec3 d = glm::abs(glm::vec3(p) - serial._vertices[i].position);
+			maxError = std::max(maxError, std::max(d.x, std::max(d.y, d.z)));
+		}
+
+		bool identical = same_mesh(serial, parallel);
+		bool cookedIdentical = ok && same_mesh(optimized, cooked);
+		std::cout << "obj load " << filename << " (best of " << runs << ")" << std::endl;
+		std::cout << "  1 thread:  " << serialMs << " ms" << std::endl;
+		std::cout << "  " << pool.concurrency() << " threads: " << parallelMs << " ms, speedup " << serialMs / parallelMs << "x" << std::endl;
+		std::cout << "  cooked (map only, pages fault in during upload): " << cookedMs << " ms, speedup " << serialMs / cookedMs << "x" << std::endl;
+		std::cout << "  optimize: " << optimizeMs << " ms" << std::endl;
+		std::cout << "  compact encode: " << compactMs << " ms, " << serial._vertices.size() * sizeof(Vertex) / 1024 << " KiB -> "
+			<< compacted._compactVertices.size() * sizeof(CompactVertex) / 1024 << " KiB, max position error " << maxError << std::endl;
+		std::cout << "  output " << (identical ? "identical" : "DIFFERS") << ", cooked " << (cookedIdentical ? "identical" : "DIFFERS") << std::endl;
+		return identical && cookedIdentical ? 0 : 1;
+	}
+
+	//memory traffic of one screen tile sampling a 2048x2048 rgba8 texture at a fixed minification with a cold texture cache.
+	//texels are stored in 4x4 tiles of 64 bytes as in the tiled layouts of GPUs, every distinct tile touched is one fetch
+	double texture_bytes_per_pixel(float minification, bool mipmapped)
+	{
+		const uint32_t textureSize = 2048;
+		const uint32_t screenTile = 128;
+		float lod = mipmapped ? std::max(std::log2(minification), 0.0f) : 0.0f;
+		uint32_t baseLevel = static_cast<uint32_t>(lod);
+		//trilinear reads the two closest mips
+		uint32_t lastLevel = mipmapped && lod > float(baseLevel) ? baseLevel + 1 : baseLevel;
+
+		std::unordered_set<uint64_t> tiles;
+		for (uint32_t level = baseLevel; level <= lastLevel; level++) {
+			uint32_t levelSize = std::max(textureSize >> level, 1u);
+			float scale = minification / float(1u << level);
+			for (uint32_t y = 0; y < screenTile; y++) {
+				for (uint32_t x = 0; x < screenTile; x++) {
+					//bilinear footprint around the sample position
+					int64_t u = static_cast<int64_t>(std::floor((x + 0.5f) * scale - 0.5f));
+					int64_t v = static_cast<int64_t>(std::floor((y + 0.5f) * scale - 0.5f));
+					for (int64_t dv = 0; dv < 2; dv++) {
+						for (int64_t du = 0; du < 2; du++) {
+							uint64_t tu = static_cast<uint64_t>((u + du + levelSize) % levelSize) / 4;
+							uint64_t tv = static_cast<uint64_t>((v + dv + levelSize) % levelSize) / 4;
+							tiles.insert((uint64_t(level) << 48) | (tv << 24) | tu);
+						}
+					}
+				}
+			}
+		}
+		return double(tiles.size()) * 64.0 / double(screenTile * screenTile);
+	}
+
+	void bench_textures()
+	{
+		std::cout << "texture fetch model, 2048^2 rgba8, bytes per pixel (single mip -> mip chain)" << std::endl;
+		for (float minification : { 1.0f, 2.0f, 4.0f, 8.0f, 16.0f }) {
+			double single = texture_bytes_per_pixel(minification, false);
+			double mipped = texture_bytes_per_pixel(minification, true);
+			std::cout << "  1/" << minification << " scale: " << single << " -> " << mipped << ", " << single / mipped << "x less" << std::endl;
+		}
+	}
+
+	//the rgb -> rgba expansion of decoded glTF images, 2048^2 random pixels plus a length that leaves a tail
+	int bench_rgb_expand()
+	{
+		const size_t pixelCount = 2048 * 2048 + 7;
+		const int runs = 10;
+		std::mt19937 rng(1234);
+		std::vector<uint8_t> rgb(pixelCount * 3);
+		for (uint8_t& byte : rgb) {
+			byte = static_cast<uint8_t>(rng());
+		}
+		std::vector<uint8_t> scalar(pixelCount * 4), simd(pixelCount * 4);
+		double scalarMs = best_of(runs, [&]() { vkutil::expand_rgb_to_rgba_scalar(rgb.data(), scalar.data(), pixelCount); });
+		double simdMs = best_of(runs, [&]() { vkutil::expand_rgb_to_rgba(rgb.data(), simd.data(), pixelCount); });
+
+		bool identical = scalar == simd;
+		std::cout << "rgb to rgba expansion of " << pixelCount << " pixels (best of " << runs << ")" << std::endl;
+		std::cout << "  scalar: " << scalarMs << " ms" << std::endl;
+		std::cout << "  simd:   " << simdMs << " ms, speedup " << scalarMs / simdMs << "x, " << (identical ? "identical" : "DIFFERS") << std::endl;
+		return identical ? 0 : 1;
+	}
+
+	//the decode half of GLTFLoader::loadImages, one image after the other against all of them on the pool. the upload
+	//half needs a device and is left out
+	int bench_gltf_images(const char* filename, ThreadPool& pool)
+	{
+		tinygltf::Model model;
+		if (!GLTFLoader::loadModel(filename, model)) {
+			std::cout << "gltf images: could not open " << filename << ", skipped" << std::endl;
+			return 0;
+		}
+		const uint32_t imageCount = static_cast<uint32_t>(model.images.size());
+		size_t encodedBytes = 0;
+		for (const tinygltf::Image& image : model.images) {
+			encodedBytes += image.image.size();
+		}
+
+		//decodeImage consumes the encoded bytes, every run starts from a copy
+		const int runs = 3;
+		auto decode_all = [&](bool parallel, size_t& decodedBytes, uint32_t& failed) {
+			double best = 1e30;
+			for (int run = 0; run < runs; run++) {
+				std::vector<tinygltf::Image> images = model.images;
+				std::vector<GLTFLoader::DecodedImage> decoded(imageCount);
+				auto start = std::chrono::high_resolution_clock::now();
+				if (parallel) {
+					pool.parallel_for(imageCount, [&](uint32_t i) { GLTFLoader::decodeImage(images[i], decoded[i]); });
+				}
+				else {
+					for (uint32_t i = 0; i < imageCount; i++) {
+						GLTFLoader::decodeImage(images[i], decoded[i]);
+					}
+				}
+				auto end = std::chrono::high_resolution_clock::now();
+				best = std::min(best, std::chrono::duration<double, std::milli>(end - start).count());
+				decodedBytes = 0;
+				failed = 0;
+				for (GLTFLoader::DecodedImage& image : decoded) {
+					decodedBytes += image.size;
+					failed += image.pixels == nullptr ? 1 : 0;
+					image.release();
+				}
+			}
+			return best;
+		};
+		size_t serialBytes = 0, parallelBytes = 0;
+		uint32_t serialFailed = 0, parallelFailed = 0;
+		double serialMs = decode_all(false, serialBytes, serialFailed);
+		double parallelMs = decode_all(true, parallelBytes, parallelFailed);
+
+		bool identical = serialBytes == parallelBytes && serialFailed == parallelFailed;
+		std::cout << "gltf image decode " << filename << ", " << imageCount << " images, " << encodedBytes / (1024 * 1024) << " MB encoded -> "
+			<< serialBytes / (1024 * 1024) << " MB rgba8 (best of " << runs << "), " << serialFailed << " failed" << std::endl;
+		std::cout << "  serial:    " << serialMs << " ms" << std::endl;
+		std::cout << "  " << pool.concurrency() << " threads: " << parallelMs << " ms, speedup " << serialMs / parallelMs << "x, "
+			<< (identical ? "identical" : "DIFFERS") << std::endl;
+		return identical ? 0 : 1;
+	}
+
+	//100k random spheres in a 400 unit cube seen by the engine's default projection
+	int bench_culling()
+	{
+		const size_t objectCount = 100000;
+		const int runs = 10;
+		std::mt19937 rng(1234);
+		std::uniform_real_distribution<float> position(-200.0f, 200.0f);
+		std::uniform_real_distribution<float> size(0.1f, 4.0f);
+		vkcull::SphereSet spheres;
+		spheres.reserve(objectCount);
+		for (size_t i = 0; i < objectCount; i++) {
+			spheres.push(glm::vec3(position(rng), position(rng), position(rng)), size(rng));
+		}
+
+		glm::mat4 view = glm::lookAt(glm::vec3(0.0f, 2.0f, 10.0f), glm::vec3(0.0f, 2.0f, 0.0f), glm::vec3(0.0f, 1.0f, 0.0f));
+		glm::mat4 projection = glm::perspective(glm::radians(70.f), 1700.f / 900.f, 0.1f, 200.0f);
+		projection[1][1] *= -1;
+		vkcull::Frustum frustum = vkcull::extract_frustum(projection * view);
+
+		std::vector<uint32_t> scalarVisible(objectCount), simdVisible(objectCount);
+		size_t scalarCount = 0, simdCount = 0;
+		double scalarMs = best_of(runs, [&]() { scalarCount = vkcull::cull_spheres_scalar(frustum, spheres, scalarVisible.data()); });
+		double simdMs = best_of(runs, [&]() { simdCount = vkcull::cull_spheres(frustum, spheres, simdVisible.data()); });
+
+		bool identical = scalarCount == simdCount && std::equal(scalarVisible.begin(), scalarVisible.begin() + scalarCount, simdVisible.begin());
+		std::cout << "frustum culling " << objectCount << " spheres (best of " << runs << "), " << simdCount << " visible" << std::endl;
+		std::cout << "  scalar: " << scalarMs << " ms" << std::endl;
+		std::cout << "  simd:   " << simdMs << " ms, speedup " << scalarMs / simdMs << "x, " << (identical ? "identical" : "DIFFERS") << std::endl;
+		return identical ? 0 : 1;
+	}
+
+	bool aabb_visible(const vkcull::Frustum& frustum, const glm::vec3& boundsMin, const glm::vec3& boundsMax)
+	{
+		glm::vec3 center = (boundsMin + boundsMax) * 0.5f;
+		glm::vec3 extent = (boundsMax - boundsMin) * 0.5f;
+		for (const glm::vec4& plane : frustum.planes) {
+			if (glm::dot(glm::vec3(plane), center) + plane.w + glm::dot(glm::abs(glm::vec3(plane)), extent) < 0.0f) {
+				return false;
+			}
+		}
+		return true;
+	}
+
+	//100k random boxes: SAH build, refit after moving a tenth of them, frustum and ray queries checked against brute force
+	int bench_bvh()
+	{
+		const uint32_t objectCount = 100000;
+		const uint32_t rayCount = 10000;
+		const int runs = 5;
+		std::mt19937 rng(4321);
+		std::uniform_real_distribution<float> position(-200.0f, 200.0f);
+		std::uniform_real_distribution<float> size(0.1f, 4.0f);
+		std::vector<glm::vec3> boundsMin(objectCount), boundsMax(objectCount);
+		for (uint32_t i = 0; i < objectCount; i++) {
+			glm::vec3 center(position(rng), position(rng), position(rng));
+			glm::vec3 extent(size(rng), size(rng), size(rng));
+			boundsMin[i] = center - extent;
+			boundsMax[i] = center + extent;
+		}
+
+		Bvh bvh;
+		double buildMs = best_of(runs, [&]() { bvh.build(boundsMin, boundsMax); });
+
+		std::uniform_real_distribution<float> offset(-1.0f, 1.0f);
+		for (uint32_t i = 0; i < objectCount; i += 10) {
+			glm::vec3 move(offset(rng), offset(rng), offset(rng));
+			boundsMin[i] += move;
+			boundsMax[i] += move;
+		}
+		double refitMs = best_of(1, [&]() {
+			for (uint32_t i = 0; i < objectCount; i += 10) {
+				bvh.updateItem(i, boundsMin[i], boundsMax[i]);
+			}
+			bvh.refit();
+		});
+		double refitAllMs = best_of(runs, [&]() { bvh.refitAll(); });
+
+		glm::mat4 view = glm::lookAt(glm::vec3(0.0f, 2.0f, 10.0f), glm::vec3(0.0f, 2.0f, 0.0f), glm::vec3(0.0f, 1.0f, 0.0f));
+		glm::mat4 projection = glm::perspective(glm::radians(70.f), 1700.f / 900.f, 0.1f, 200.0f);
+		projection[1][1] *= -1;
+		vkcull::Frustum frustum = vkcull::extract_frustum(projection * view);
+
+		std::vector<uint32_t> bvhVisible;
+		bvhVisible.reserve(objectCount);
+		double cullMs = best_of(runs, [&]() { bvhVisible.clear(); bvh.cullFrustum(frustum, bvhVisible); });
+		std::vector<uint32_t> bruteVisible;
+		double bruteMs = best_of(runs, [&]() {
+			bruteVisible.clear();
+			for (uint32_t i = 0; i < objectCount; i++) {
+				if (aabb_visible(frustum, boundsMin[i], boundsMax[i])) {
+					bruteVisible.push_back(i);
+				}
+			}
+		});
+		std::sort(bvhVisible.begin(), bvhVisible.end());
+		bool cullMatches = bvhVisible == bruteVisible;
+
+		std::vector<glm::vec3> directions(rayCount);
+		for (glm::vec3& direction : directions) {
+			direction = glm::normalize(glm::vec3(offset(rng), offset(rng), offset(rng)) + glm::vec3(0.0f, 0.0f, 1e-3f));
+		}
+		glm::vec3 origin(0.0f);
+		uint32_t hits = 0;
+		double rayMs = best_of(runs, [&]() {
+			hits = 0;
+			for (const glm::vec3& direction : directions) {
+				uint32_t item;
+				float distance;
+				hits += bvh.raycast(origin, direction, 1000.0f, item, distance) ? 1 : 0;
+			}
+		});
+		//brute force nearest hit for the first rays
+		bool raysMatch = true;
+		for (uint32_t r = 0; r < 200; r++) {
+			glm::vec3 invDir = 1.0f / directions[r];
+			float best = 1000.0f;
+			bool bruteHit = false;
+			for (uint32_t i = 0; i < objectCount; i++) {
+				glm::vec3 t0 = (boundsMin[i] - origin) * invDir;
+				glm::vec3 t1 = (boundsMax[i] - origin) * invDir;
+				glm::vec3 tNear = glm::min(t0, t1);
+				glm::vec3 tFar = glm::max(t0, t1);
+				float enter = std::max(std::max(tNear.x, tNear.y), std::max(tNear.z, 0.0f));
+				float exit = std::min(std::min(tFar.x, tFar.y), std::min(tFar.z, best));
+				if (enter <= exit) {
+					best = enter;
+					bruteHit = true;
+				}
+			}
+			uint32_t item;
+			float distance = 0.0f;
+			bool hit = bvh.raycast(origin, directions[r], 1000.0f, item, distance);
+			raysMatch &= hit == bruteHit && (!hit || distance == best);
+		}
+
+		std::cout << "bvh over " << objectCount << " boxes, " << bvh.nodes().size() << " nodes (best of " << runs << ")" << std::endl;
+		std::cout << "  SAH build: " << buildMs << " ms" << std::endl;
+		std::cout << "  refit " << objectCount / 10 << " moved items: " << refitMs << " ms, full refit: " << refitAllMs << " ms" << std::endl;
+		std::cout << "  frustum query: " << cullMs << " ms vs " << bruteMs << " ms brute force, " << bvhVisible.size() << " visible, "
+			<< (cullMatches ? "identical" : "DIFFERS") << std::endl;
+		std::cout << "  " << rayCount << " rays: " << rayMs << " ms, " << rayCount / (rayMs * 1000.0) << " Mrays/s, " << hits << " hits, "
+			<< (raysMatch ? "identical" : "DIFFERS") << std::endl;
+		return cullMatches && raysMatch ? 0 : 1;
+	}
+
+	struct DrawState {
+		uint32_t pipeline;
+		uint32_t set;
+		uint32_t mesh;
+	};
+
+	//pipeline, set and mesh changes walking the draws in the given order
+	uint32_t count_state_changes(const std::vector<DrawState>& draws, const std::vector<RenderQueue::DrawItem>& order)
+	{
+		uint32_t changes = 0;
+		DrawState last = { UINT32_MAX, UINT32_MAX, UINT32_MAX };
+		for (const RenderQueue::DrawItem& item : order) {
+			const DrawState& draw = draws[item.object];
+			changes += (draw.pipeline != last.pipeline) + (draw.set != last.set) + (draw.mesh != last.mesh);
+			last = draw;
+		}
+		return changes;
+	}
+
+	//100k draws over 8 pipelines, 64 material sets and 256 meshes: radix sort against std::stable_sort, binds before and after
+	int bench_render_queue()
+	{
+		const uint32_t drawCount = 100000;
+		const int runs = 10;
+		std::mt19937 rng(2468);
+		std::uniform_int_distribution<uint32_t> pipeline(0, 7), set(0, 63), mesh(0, 255);
+		std::uniform_real_distribution<float> depth(0.0f, 1.0f);
+		std::vector<DrawState> draws(drawCount);
+		std::vector<RenderQueue::DrawItem> items(drawCount);
+		for (uint32_t i = 0; i < drawCount; i++) {
+			draws[i] = { pipeline(rng), set(rng), mesh(rng) };
+			items[i] = { RenderQueue::makeKey(RenderQueue::PASS_OPAQUE, draws[i].pipeline, draws[i].set, draws[i].mesh, depth(rng)), i };
+		}
+
+		std::vector<RenderQueue::DrawItem> radixSorted, stdSorted, scratch;
+		double radixMs = best_of(runs, [&]() { radixSorted = items; RenderQueue::radix_sort(radixSorted, scratch); });
+		double stdMs = best_of(runs, [&]() {
+			stdSorted = items;
+			std::stable_sort(stdSorted.begin(), stdSorted.end(), [](const RenderQueue::DrawItem& a, const RenderQueue::DrawItem& b) { return a.key < b.key; });
+		});
+		bool identical = std::equal(radixSorted.begin(), radixSorted.end(), stdSorted.begin(),
+			[](const RenderQueue::DrawItem& a, const RenderQueue::DrawItem& b) { return a.key == b.key && a.object == b.object; });
+
+		std::cout << "render queue of " << drawCount << " draws (best of " << runs << ")" << std::endl;
+		std::cout << "  radix sort: " << radixMs << " ms, std::stable_sort: " << stdMs << " ms, " << (identical ? "identical" : "DIFFERS") << std::endl;
+		std::cout << "  state changes: " << count_state_changes(draws, items) << " unsorted, " << count_state_changes(draws, radixSorted) << " sorted" << std::endl;
+		return identical ? 0 : 1;
+	}
+
+	//meshlets of the bench mesh seen from 16 cameras around it. every front facing triangle with a corner inside the
+	//frustum has to survive the cluster culling
+	int bench_meshlets(const char* filename)
+	{
+		Mesh mesh;
+		if (!mesh.load_from_obj(filename)) {
+			return 1;
+		}
+		mesh.optimize();
+		mesh.compute_bounds();
+		const int runs = 3;
+		vkmeshlet::MeshletSet set;
+		double buildMs = best_of(runs, [&]() {
+			vkmeshlet::build_meshlets(mesh._indices.data(), mesh._indices.size(), &mesh._vertices[0].position, sizeof(Vertex), mesh._vertices.size(), set);
+		});
+
+		glm::vec3 center = (mesh._boundsMin + mesh._boundsMax) * 0.5f;
+		float extent = glm::length(mesh._boundsMax - mesh._boundsMin) * 0.5f;
+		glm::mat4 projection = glm::perspective(glm::radians(70.f), 1700.f / 900.f, 0.1f, extent * 4.0f);
+		projection[1][1] *= -1;
+
+		const int views = 16;
+		size_t keptTriangles = 0, missed = 0;
+		double cullMs = 0.0;
+		std::vector<uint32_t> indices;
+		indices.reserve(mesh._indices.size());
+		for (int v = 0; v < views; v++) {
+			float angle = v * 6.2831853f / views;
+			glm::vec3 eye = center + glm::vec3(std::cos(angle), std::sin(angle), v % 2 ? 0.5f : -0.5f) * extent * 0.8f;
+			glm::vec3 target = center + glm::vec3(std::sin(angle * 3.0f), 0.0f, 0.0f) * extent * 0.3f;
+			glm::vec3 up = std::abs(glm::normalize(target - eye).z) > 0.9f ? glm::vec3(0.0f, 1.0f, 0.0f) : glm::vec3(0.0f, 0.0f, 1.0f);
+			vkcull::Frustum frustum = vkcull::extract_frustum(projection * glm::lookAt(eye, target, up));
+			vkmeshlet::CullView view = vkmeshlet::make_cull_view(frustum, glm::mat4(1.0f), eye);
+
+			cullMs += best_of(runs, [&]() { indices.clear(); vkmeshlet::cull_meshlets(set, view, indices); }) / views;
+			keptTriangles += indices.size() / 3;
+
+			for (size_t m = 0; m < set.meshlets.size(); m++) {
+				if (vkmeshlet::meshlet_visible(view, set.bounds[m])) {
+					continue;
+				}
+				const vkmeshlet::Meshlet& meshlet = set.meshlets[m];
+				for (uint32_t t = 0; t < meshlet.triangleCount; t++) {
+					glm::vec3 p[3];
+					bool inside = false;
+					for (int corner = 0; corner < 3; corner++) {
+						p[corner] = mesh._vertices[set.vertices[meshlet.vertexOffset + set.triangles[(meshlet.triangleOffset + t) * 3 + corner]]].position;
+						inside |= vkcull::sphere_visible(frustum, p[corner], 0.0f);
+					}
+					bool frontFacing = glm::dot(glm::cross(p[1] - p[0], p[2] - p[0]), eye - p[0]) > 0.0f;
+					missed += inside && frontFacing ? 1 : 0;
+				}
+			}
+		}
+
+		size_t triangles = mesh._indices.size() / 3;
+		std::cout << "meshlets of " << filename << ": " << set.meshlets.size() << " clusters, " << float(set.vertices.size()) / set.meshlets.size()
+			<< " vertices and " << float(triangles) / set.meshlets.size() << " triangles each, built in " << buildMs << " ms" << std::endl;
+		std::cout << "  cluster culling over " << views << " views: " << cullMs << " ms per view, " << 100.0 * keptTriangles / (double(triangles) * views)
+			<< "% of the triangles kept, " << (missed == 0 ? "conservative" : "MISSES VISIBLE TRIANGLES") << std::endl;
+		return missed == 0 ? 0 : 1;
+	}
+
+	//LOD chain of the bench mesh, and the triangles 1000 copies of it cost when spread over 1 to 100 mesh sizes from the
+	//camera. a camera oscillating around a LOD boundary checks that the hysteresis holds the choice
+	int bench_lods(const char* filename)
+	{
+		Mesh mesh;
+		if (!mesh.load_from_obj(filename)) {
+			return 1;
+		}
+		mesh.optimize();
+		mesh.compute_bounds();
+		auto start = std::chrono::high_resolution_clock::now();
+		mesh.build_lods();
+		double buildMs = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - start).count();
+		std::cout << "LOD chain of " << filename << " built in " << buildMs << " ms:";
+		for (const vklod::LodRange& range : mesh._lods) {
+			std::cout << " " << range.indexCount / 3 << " (" << range.error << ")";
+		}
+		std::cout << " triangles (error)" << std::endl;
+		if (mesh._lods.size() < 2) {
+			return 0;
+		}
+
+		//every range has to stay a valid triangle list over the same vertices with errors growing along the chain
+		bool valid = true;
+		std::vector<uint32_t> all(mesh._indices);
+		all.insert(all.end(), mesh._lodIndices.begin(), mesh._lodIndices.end());
+		for (size_t level = 0; level < mesh._lods.size(); level++) {
+			const vklod::LodRange& range = mesh._lods[level];
+			valid &= range.indexCount % 3 == 0 && range.firstIndex + range.indexCount <= all.size();
+			valid &= level == 0 || (range.error >= mesh._lods[level - 1].error && range.indexCount < mesh._lods[level - 1].indexCount);
+			for (uint32_t i = 0; valid && i < range.indexCount; i++) {
+				valid &= all[range.firstIndex + i] < mesh._vertices.size();
+			}
+		}
+
+		glm::vec3 center = (mesh._boundsMin + mesh._boundsMax) * 0.5f;
+		float size = glm::length(mesh._boundsMax - mesh._boundsMin);
+		glm::mat4 projection = glm::perspective(glm::radians(70.f), 1700.f / 900.f, 0.1f, 200.0f);
+		vklod::LodView view = vklod::make_lod_view(glm::vec3(0.0f), projection, 900.0f, 1.0f, 0.25f);
+		const int copies = 1000;
+		uint64_t full = 0, submitted = 0;
+		for (int i = 0; i < copies; i++) {
+			float distance = size * (1.0f + 99.0f * i / (copies - 1));
+			uint32_t lod = vklod::select_lod(view, mesh._lods.data(), mesh.lod_count(), center + glm::vec3(0.0f, 0.0f, distance), size * 0.5f, 1.0f, 0);
+			full += mesh._lods[0].indexCount / 3;
+			submitted += mesh._lods[lod].indexCount / 3;
+		}
+
+		//find the first boundary and wobble the camera around it by 5%
+		vklod::LodView noHysteresis = view;
+		noHysteresis.hysteresis = 0.0f;
+		float boundary = 0.0f;
+		for (float distance = size * 0.01f; distance < size * 1000.0f && boundary == 0.0f; distance *= 1.01f) {
+			if (vklod::select_lod(noHysteresis, mesh._lods.data(), mesh.lod_count(), glm::vec3(0.0f, 0.0f, distance), 0.0f, 1.0f, 0) != 0) {
+				boundary = distance;
+			}
+		}
+		uint32_t lod = 0, switches = 0, switchesWithout = 0, lodWithout = 0;
+		for (int frame = 0; frame < 1000; frame++) {
+			float distance = boundary * (1.0f + 0.05f * std::sin(frame * 0.1f));
+			uint32_t next = vklod::select_lod(view, mesh._lods.data(), mesh.lod_count(), glm::vec3(0.0f, 0.0f, distance), 0.0f, 1.0f, lod);
+			uint32_t nextWithout = vklod::select_lod(noHysteresis, mesh._lods.data(), mesh.lod_count(), glm::vec3(0.0f, 0.0f, distance), 0.0f, 1.0f, lodWithout);
+			switches += next != lod ? 1 : 0;
+			switchesWithout += nextWithout != lodWithout ? 1 : 0;
+			lod = next;
+			lodWithout = nextWithout;
+		}
+
+		std::cout << "  " << copies << " copies at 1-100 sizes: " << submitted << " triangles with LOD, " << full << " without ("
+			<< 100.0 * submitted / full << "%), " << (valid ? "ranges valid" : "INVALID RANGES") << std::endl;
+		std::cout << "  camera wobbling 5% around a boundary for 1000 frames: " << switches << " switches with hysteresis, "
+			<< switchesWithout << " without" << std::endl;
+		return valid ? 0 : 1;
+	}
+
+	//ray/box slab test, the distance to the first hit along dir or -1
+	float ray_box(const glm::vec3& origin, const glm::vec3& dir, const glm::vec3& boundsMin, const glm::vec3& boundsMax)
+	{
+		glm::vec3 inv = 1.0f / dir;
+		glm::vec3 t0 = (boundsMin - origin) * inv;
+		glm::vec3 t1 = (boundsMax - origin) * inv;
+		glm::vec3 tNear = glm::min(t0, t1), tFar = glm::max(t0, t1);
+		float enter = std::max(std::max(tNear.x, tNear.y), std::max(tNear.z, 0.0f));
+		float exit = std::min(std::min(tFar.x, tFar.y), tFar.z);
+		return enter <= exit ? enter : -1.0f;
+	}
+
+	//a depth buffer of walls ray traced at pixel centers, reduced to a pyramid and checked texel by texel. then 10000
+	//small boxes are tested against it: a box with any pixel in front of the walls must never be reported occluded
+	int bench_hiz()
+	{
+		const uint32_t width = 640, height = 360;
+		glm::mat4 projection = glm::perspective(glm::radians(70.f), float(width) / height, 0.1f, 200.0f);
+		projection[1][1] *= -1;
+		glm::vec3 eye(0.0f, 1.5f, 0.0f);
+		glm::mat4 viewProj = projection * glm::lookAt(eye, glm::vec3(0.0f, 1.5f, -1.0f), glm::vec3(0.0f, 1.0f, 0.0f));
+		glm::mat4 inverseViewProj = glm::inverse(viewProj);
+
+		std::mt19937 rng(23);
+		std::uniform_real_distribution<float> unit(0.0f, 1.0f);
+		std::vector<glm::vec3> wallMin, wallMax;
+		for (int i = 0; i < 12; i++) {
+			glm::vec3 center(-30.0f + 60.0f * unit(rng), 0.0f, -5.0f - 40.0f * unit(rng));
+			glm::vec3 half(1.0f + 6.0f * unit(rng), 1.0f + 4.0f * unit(rng), 0.2f + 0.5f * unit(rng));
+			wallMin.push_back(center - half);
+			wallMax.push_back(center + half);
+		}
+
+		//per pixel: view ray, distance to the walls and the depth the rasterizer would store
+		std::vector<glm::vec3> rays(size_t(width) * height);
+		std::vector<float> wallDistance(rays.size()), depth(rays.size());
+		for (uint32_t y = 0; y < height; y++) {
+			for (uint32_t x = 0; x < width; x++) {
+				glm::vec4 farPoint = inverseViewProj * glm::vec4(2.0f * (x + 0.5f) / width - 1.0f, 2.0f * (y + 0.5f) / height - 1.0f, 1.0f, 1.0f);
+				glm::vec3 dir = glm::normalize(glm::vec3(farPoint) / farPoint.w - eye);
+				float nearest = 1e30f;
+				for (size_t w = 0; w < wallMin.size(); w++) {
+					float t = ray_box(eye, dir, wallMin[w], wallMax[w]);
+					if (t >= 0.0f) {
+						nearest = std::min(nearest, t);
+					}
+				}
+				size_t pixel = size_t(y) * width + x;
+				rays[pixel] = dir;
+				wallDistance[pixel] = nearest;
+				glm::vec4 clip = viewProj * glm::vec4(eye + dir * nearest, 1.0f);
+				depth[pixel] = nearest < 1e30f ? glm::clamp(clip.z / clip.w, 0.0f, 1.0f) : 1.0f;
+			}
+		}
+
+		vkhiz::Pyramid pyramid;
+		double buildMs = best_of(10, [&]() { vkhiz::build_pyramid(depth.data(), width, height, pyramid); });
+		bool pyramidValid = pyramid.levels.back().width == 1 && pyramid.levels.back().height == 1;
+		for (uint32_t level = 0; level < pyramid.levels.size() && pyramidValid; level++) {
+			uint32_t shift = level + 1;
+			for (uint32_t ty = 0; ty < pyramid.levels[level].height; ty++) {
+				for (uint32_t tx = 0; tx < pyramid.levels[level].width; tx++) {
+					float farthest = 0.0f;
+					for (uint32_t y = ty << shift; y < std::min((ty + 1) << shift, height); y++) {
+						for (uint32_t x = tx << shift; x < std::min((tx + 1) << shift, width); x++) {
+							farthest = std::max(farthest, depth[size_t(y) * width + x]);
+						}
+					}
+					pyramidValid &= pyramid.texel(level, tx, ty) == farthest;
+				}
+			}
+		}
+
+		const int boxCount = 10000;
+		std::vector<glm::vec3> boxMin, boxMax;
+		for (int i = 0; i < boxCount; i++) {
+			glm::vec3 center(-25.0f + 50.0f * unit(rng), 3.0f * unit(rng), -3.0f - 60.0f * unit(rng));
+			glm::vec3 half(0.1f + 0.6f * unit(rng));
+			boxMin.push_back(center - half);
+			boxMax.push_back(center + half);
+		}
+		std::vector<uint8_t> occluded(boxCount);
+		double testMs = best_of(10, [&]() {
+			for (int i = 0; i < boxCount; i++) {
+				occluded[i] = vkhiz::box_occluded(pyramid, viewProj, boxMin[i], boxMax[i]) ? 1 : 0;
+			}
+		});
+
+		//exact answer at pixel resolution: a box is visible when a ray of its screen rect hits it before the walls
+		uint32_t culled = 0, hidden = 0, missed = 0;
+		for (int i = 0; i < boxCount; i++) {
+			vkhiz::ScreenRect rect;
+			bool visible = !vkhiz::project_box(viewProj, boxMin[i], boxMax[i], width, height, rect);
+			for (int32_t y = rect.y0; y <= rect.y1 && !visible; y++) {
+				for (int32_t x = rect.x0; x <= rect.x1 && !visible; x++) {
+					size_t pixel = size_t(y) * width + x;
+					float t = ray_box(eye, rays[pixel], boxMin[i], boxMax[i]);
+					visible = t >= 0.0f && t <= wallDistance[pixel];
+				}
+			}
+			culled += occluded[i];
+			hidden += visible ? 0 : 1;
+			missed += occluded[i] && visible ? 1 : 0;
+		}
+
+		std::cout << "hi-z occlusion, " << width << "x" << height << " depth, " << pyramid.levels.size() << " levels (best of 10)" << std::endl;
+		std::cout << "  pyramid build: " << buildMs << " ms, " << (pyramidValid ? "texels match" : "TEXELS DIFFER") << std::endl;
+		std::cout << "  " << boxCount << " box tests: " << testMs << " ms, " << culled << " occluded of " << hidden << " hidden at pixel level, "
+			<< (missed == 0 ? "conservative" : "CULLS VISIBLE BOXES") << std::endl;
+		return pyramidValid && missed == 0 ? 0 : 1;
+	}
+}
+
+int vkbench::run(int argc, char** argv)
+{
+	const char* objFile = "../../assets/lost_empire.obj";
+	const char* gltfFile = "../../assets/glTF-Sample-Models-master/glTF-Sample-Models-master/2.0/Sponza/glTF/sponza.gltf";
+	for (int i = 1; i + 1 < argc; i++) {
+		if (strcmp(argv[i], "--bench") == 0) {
+			objFile = argv[i + 1];
+		}
+		else if (strcmp(argv[i], "--gltf") == 0) {
+			gltfFile = argv[i + 1];
+		}
+	}
+
+	ThreadPool pool;
+	pool.init();
+	int result = bench_obj(objFile, pool);
+	bench_textures();
+	result |= bench_rgb_expand();
+	result |= bench_gltf_images(gltfFile, pool);
+	result |= bench_culling();
+	result |= bench_bvh();
+	result |= bench_render_queue();
+	result |= bench_meshlets(objFile);
+	result |= bench_lods(objFile);
+	result |= bench_hiz();
+	pool.cleanup();
+	return result;
+}
@@ -0,0 +1,8 @@
+#pragma once
+
+//command line benchmarks that run without a window or device, started with --bench
+namespace vkbench {
+
+	//returns the process exit code
+	int run(int argc, char** argv);
+}
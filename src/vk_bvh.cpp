@@ -0,0 +1,331 @@
+#include <vk_bvh.h>
+#include <algorithm>
+#include <limits>
+
+static_assert(sizeof(Bvh::Node) == 32, "two nodes per cache line");
+
+namespace {
+
+	const uint32_t SAH_BINS = 12;
+	//relative cost of one traversal step vs one item test
+	const float TRAVERSAL_COST = 1.0f;
+
+	struct Box {
+		glm::vec3 min{ std::numeric_limits<float>::max() };
+		glm::vec3 max{ -std::numeric_limits<float>::max() };
+
+		void grow(const glm::vec3& p) { min = glm::min(min, p); max = glm::max(max, p); }
+		void grow(const glm::vec3& a, const glm::vec3& b) { min = glm::min(min, a); max = glm::max(max, b); }
+		float area() const
+		{
+			glm::vec3 e = max - min;
+			return e.x < 0.0f ? 0.0f : 2.0f * (e.x * e.y + e.y * e.z + e.z * e.x);
+		}
+	};
+
+	//entry distance of the ray into the box, infinity when it misses within [0, maxDistance]
+	float ray_box(const glm::vec3& origin, const glm::vec3& invDir, float maxDistance, const glm::vec3& boxMin, const glm::vec3& boxMax)
+	{
+		glm::vec3 t0 = (boxMin - origin) * invDir;
+		glm::vec3 t1 = (boxMax - origin) * invDir;
+		glm::vec3 tNear = glm::min(t0, t1);
+		glm::vec3 tFar = glm::max(t0, t1);
+		float enter = std::max(std::max(tNear.x, tNear.y), std::max(tNear.z, 0.0f));
+		float exit = std::min(std::min(tFar.x, tFar.y), std::min(tFar.z, maxDistance));
+		return enter <= exit ? enter : std::numeric_limits<float>::infinity();
+	}
+}
+
+void Bvh::build(const std::vector<glm::vec3>& boundsMin, const std::vector<glm::vec3>& boundsMax)
+{
+	const uint32_t count = static_cast<uint32_t>(boundsMin.size());
+	_itemMin = boundsMin;
+	_itemMax = boundsMax;
+	_itemOrder.resize(count);
+	_itemLeaf.assign(count, 0);
+	_dirtyLeaves.clear();
+	_nodes.clear();
+	_parents.clear();
+	_subtreeEnd.clear();
+	if (count == 0) {
+		return;
+	}
+	//a binary tree with leaves of at least one item has at most 2n-1 nodes
+	_nodes.reserve(size_t(count) * 2);
+	_parents.reserve(size_t(count) * 2);
+	_subtreeEnd.reserve(size_t(count) * 2);
+
+	std::vector<glm::vec3> centers(count);
+	for (uint32_t i = 0; i < count; i++) {
+		_itemOrder[i] = i;
+		centers[i] = (boundsMin[i] + boundsMax[i]) * 0.5f;
+	}
+	buildNode(0, count, UINT32_MAX, centers);
+}
+
+uint32_t Bvh::buildNode(uint32_t first, uint32_t count, uint32_t parent, std::vector<glm::vec3>& centers)
+{
+	uint32_t index = static_cast<uint32_t>(_nodes.size());
+	_nodes.emplace_back();
+	_parents.push_back(parent);
+	_subtreeEnd.push_back(index + 1);
+
+	Box bounds, centerBounds;
+	for (uint32_t i = first; i < first + count; i++) {
+		uint32_t item = _itemOrder[i];
+		bounds.grow(_itemMin[item], _itemMax[item]);
+		centerBounds.grow(centers[item]);
+	}
+	_nodes[index].boundsMin = bounds.min;
+	_nodes[index].boundsMax = bounds.max;
+
+	//binned SAH: items are bucketed by centroid along each axis and every bin boundary is a split candidate
+	float bestCost = std::numeric_limits<float>::max();
+	int bestAxis = -1;
+	uint32_t bestSplit = 0;
+	if (count > MAX_LEAF_SIZE) {
+		for (int axis = 0; axis < 3; axis++) {
+			float extent = centerBounds.max[axis] - centerBounds.min[axis];
+			if (extent <= 0.0f) {
+				continue;
+			}
+			Box bins[SAH_BINS];
+			uint32_t binCounts[SAH_BINS] = {};
+			float scale = SAH_BINS / extent;
+			for (uint32_t i = first; i < first + count; i++) {
+				uint32_t item = _itemOrder[i];
+				uint32_t bin = std::min(static_cast<uint32_t>((centers[item][axis] - centerBounds.min[axis]) * scale), SAH_BINS - 1);
+				bins[bin].grow(_itemMin[item], _itemMax[item]);
+				binCounts[bin]++;
+			}
+			//sweep from the right to get the area/count of every right side, then from the left
+			float rightArea[SAH_BINS];
+			uint32_t rightCount[SAH_BINS];
+			Box right;
+			uint32_t rightItems = 0;
+			for (uint32_t b = SAH_BINS - 1; b > 0; b--) {
+				right.grow(bins[b].min, bins[b].max);
+				rightItems += binCounts[b];
+				rightArea[b] = right.area();
+				rightCount[b] = rightItems;
+			}
+			Box left;
+			uint32_t leftItems = 0;
+			for (uint32_t b = 1; b < SAH_BINS; b++) {
+				left.grow(bins[b - 1].min, bins[b - 1].max);
+				leftItems += binCounts[b - 1];
+				if (leftItems == 0 || rightCount[b] == 0) {
+					continue;
+				}
+				float cost = left.area() * leftItems + rightArea[b] * rightCount[b];
+				if (cost < bestCost) {
+					bestCost = cost;
+					bestAxis = axis;
+					bestSplit = b;
+				}
+			}
+		}
+	}
+
+	//a leaf is cheaper when splitting does not pay for the extra traversal step
+	float leafCost = bounds.area() * count;
+	if (bestAxis < 0 || TRAVERSAL_COST * bounds.area() + bestCost >= leafCost) {
+		_nodes[index].rightOrFirst = first;
+		_nodes[index].count = count;
+		for (uint32_t i = first; i < first + count; i++) {
+			_itemLeaf[_itemOrder[i]] = index;
+		}
+		return index;
+	}
+
+	float extent = centerBounds.max[bestAxis] - centerBounds.min[bestAxis];
+	float scale = SAH_BINS / extent;
+	float minCenter = centerBounds.min[bestAxis];
+	auto middle = std::partition(_itemOrder.begin() + first, _itemOrder.begin() + first + count, [&](uint32_t item) {
+		return std::min(static_cast<uint32_t>((centers[item][bestAxis] - minCenter) * scale), SAH_BINS - 1) < bestSplit;
+	});
+	uint32_t leftCount = static_cast<uint32_t>(middle - (_itemOrder.begin() + first));
+
+	_nodes[index].count = 0;
+	buildNode(first, leftCount, index, centers);
+	uint32_t rightChild = buildNode(first + leftCount, count - leftCount, index, centers);
+	_nodes[index].rightOrFirst = rightChild;
+	_subtreeEnd[index] = static_cast<uint32_t>(_nodes.size());
+	return index;
+}
+
+void Bvh::updateItem(uint32_t item, const glm::vec3& boundsMin, const glm::vec3& boundsMax)
+{
+	_itemMin[item] = boundsMin;
+	_itemMax[item] = boundsMax;
+	_dirtyLeaves.push_back(_itemLeaf[item]);
+}
+
+void Bvh::fitNode(uint32_t node)
+{
+	Node& n = _nodes[node];
+	if (n.count > 0) {
+		Box box;
+		for (uint32_t i = n.rightOrFirst; i < n.rightOrFirst + n.count; i++) {
+			box.grow(_itemMin[_itemOrder[i]], _itemMax[_itemOrder[i]]);
+		}
+		n.boundsMin = box.min;
+		n.boundsMax = box.max;
+	}
+	else {
+		const Node& left = _nodes[node + 1];
+		const Node& right = _nodes[n.rightOrFirst];
+		n.boundsMin = glm::min(left.boundsMin, right.boundsMin);
+		n.boundsMax = glm::max(left.boundsMax, right.boundsMax);
+	}
+}
+
+void Bvh::refit()
+{
+	for (uint32_t leaf : _dirtyLeaves) {
+		//walk up until a node's bounds do not change, the rest of the path is already correct
+		uint32_t node = leaf;
+		while (node != UINT32_MAX) {
+			glm::vec3 oldMin = _nodes[node].boundsMin;
+			glm::vec3 oldMax = _nodes[node].boundsMax;
+			fitNode(node);
+			if (node != leaf && oldMin == _nodes[node].boundsMin && oldMax == _nodes[node].boundsMax) {
+				break;
+			}
+			node = _parents[node];
+		}
+	}
+	_dirtyLeaves.clear();
+}
+
+void Bvh::refitAll()
+{
+	//children always come after their parent in the depth first order
+	for (size_t node = _nodes.size(); node-- > 0;) {
+		fitNode(static_cast<uint32_t>(node));
+	}
+	_dirtyLeaves.clear();
+}
+
+void Bvh::cullFrustum(const vkcull::Frustum& frustum, std::vector<uint32_t>& outItems) const
+{
+	if (_nodes.empty()) {
+		return;
+	}
+	//each stack entry carries the planes its box still straddles, a subtree inside all six is accepted whole
+	struct Entry {
+		uint32_t node;
+		uint32_t planeMask;
+	};
+	std::vector<Entry> stack;
+	stack.reserve(64);
+	stack.push_back({ 0, 0x3f });
+	while (!stack.empty()) {
+		Entry entry = stack.back();
+		stack.pop_back();
+		const Node& node = _nodes[entry.node];
+		glm::vec3 center = (node.boundsMin + node.boundsMax) * 0.5f;
+		glm::vec3 extent = (node.boundsMax - node.boundsMin) * 0.5f;
+		uint32_t mask = entry.planeMask;
+		bool outside = false;
+		for (uint32_t p = 0; p < 6; p++) {
+			if (!(mask & (1u << p))) {
+				continue;
+			}
+			const glm::vec4& plane = frustum.planes[p];
+			float d = glm::dot(glm::vec3(plane), center) + plane.w;
+			float r = glm::dot(glm::abs(glm::vec3(plane)), extent);
+			if (d + r < 0.0f) {
+				outside = true;
+				break;
+			}
+			if (d - r >= 0.0f) {
+				mask &= ~(1u << p);
+			}
+		}
+		if (outside) {
+			continue;
+		}
+		if (mask == 0) {
+			//fully inside, every item below is visible
+			for (uint32_t n = entry.node; n < _subtreeEnd[entry.node]; n++) {
+				for (uint32_t i = 0; i < _nodes[n].count; i++) {
+					outItems.push_back(_itemOrder[_nodes[n].rightOrFirst + i]);
+				}
+			}
+			continue;
+		}
+		if (node.count > 0) {
+			for (uint32_t i = node.rightOrFirst; i < node.rightOrFirst + node.count; i++) {
+				uint32_t item = _itemOrder[i];
+				glm::vec3 itemCenter = (_itemMin[item] + _itemMax[item]) * 0.5f;
+				glm::vec3 itemExtent = (_itemMax[item] - _itemMin[item]) * 0.5f;
+				bool visible = true;
+				for (uint32_t p = 0; p < 6 && visible; p++) {
+					if (mask & (1u << p)) {
+						const glm::vec4& plane = frustum.planes[p];
+						visible = glm::dot(glm::vec3(plane), itemCenter) + plane.w + glm::dot(glm::abs(glm::vec3(plane)), itemExtent) >= 0.0f;
+					}
+				}
+				if (visible) {
+					outItems.push_back(item);
+				}
+			}
+			continue;
+		}
+		stack.push_back({ node.rightOrFirst, mask });
+		stack.push_back({ entry.node + 1, mask });
+	}
+}
+
+bool Bvh::raycast(const glm::vec3& origin, const glm::vec3& dir, float maxDistance, uint32_t& outItem, float& outDistance) const
+{
+	if (_nodes.empty()) {
+		return false;
+	}
+	//division by zero gives infinities, which the slab test handles
+	glm::vec3 invDir = 1.0f / dir;
+	float best = maxDistance;
+	bool hit = false;
+	std::vector<uint32_t> stack;
+	stack.reserve(64);
+	if (ray_box(origin, invDir, best, _nodes[0].boundsMin, _nodes[0].boundsMax) <= best) {
+		stack.push_back(0);
+	}
+	while (!stack.empty()) {
+		uint32_t index = stack.back();
+		stack.pop_back();
+		const Node& node = _nodes[index];
+		if (node.count > 0) {
+			for (uint32_t i = node.rightOrFirst; i < node.rightOrFirst + node.count; i++) {
+				uint32_t item = _itemOrder[i];
+				float t = ray_box(origin, invDir, best, _itemMin[item], _itemMax[item]);
+				if (t <= best) {
+					best = t;
+					outItem = item;
+					hit = true;
+				}
+			}
+			continue;
+		}
+		//visit the nearer child first so later boxes are rejected against a shorter ray
+		uint32_t leftIndex = index + 1;
+		uint32_t rightIndex = node.rightOrFirst;
+		float leftT = ray_box(origin, invDir, best, _nodes[leftIndex].boundsMin, _nodes[leftIndex].boundsMax);
+		float rightT = ray_box(origin, invDir, best, _nodes[rightIndex].boundsMin, _nodes[rightIndex].boundsMax);
+		if (leftT > rightT) {
+			std::swap(leftT, rightT);
+			std::swap(leftIndex, rightIndex);
+		}
+		if (rightT <= best) {
+			stack.push_back(rightIndex);
+		}
+		if (leftT <= best) {
+			stack.push_back(leftIndex);
+		}
+	}
+	if (hit) {
+		outDistance = best;
+	}
+	return hit;
+}
@@ -0,0 +1,60 @@
+#pragma once
+
+#include <vk_culling.h>
+#include <glm/glm.hpp>
+#include <vector>
+#include <cstdint>
+
+//bounding volume hierarchy over world space item AABBs. nodes live in one depth first array of 32 byte entries: the left
+//child of an interior node directly follows it, so a traversal mostly walks forward through memory. the build splits
+//with a binned surface area heuristic, moving items are handled by refitting the bounds along their leaf-to-root path
+//which keeps the topology, rebuild after large rearrangements
+class Bvh {
+public:
+	struct Node {
+		glm::vec3 boundsMin;
+		//interior: index of the right child, leaf: first entry in the item order
+		uint32_t rightOrFirst;
+		glm::vec3 boundsMax;
+		//items in the leaf, 0 for interior nodes
+		uint32_t count;
+	};
+
+	//items per leaf the build stops at
+	static const uint32_t MAX_LEAF_SIZE = 4;
+
+	void build(const std::vector<glm::vec3>& boundsMin, const std::vector<glm::vec3>& boundsMax);
+
+	//new bounds of one item, applied to the tree by the next refit
+	void updateItem(uint32_t item, const glm::vec3& boundsMin, const glm::vec3& boundsMax);
+
+	//grows/shrinks the nodes above the items updated since the last refit
+	void refit();
+
+	//recomputes every node bottom up, cheaper than refit once more than a few percent of the items moved
+	void refitAll();
+
+	//appends the items whose AABB intersects the frustum, unordered. subtrees fully inside are taken without further tests
+	void cullFrustum(const vkcull::Frustum& frustum, std::vector<uint32_t>& outItems) const;
+
+	//nearest item AABB hit by the ray within maxDistance. dir does not need to be normalized, outDistance is in units of dir
+	bool raycast(const glm::vec3& origin, const glm::vec3& dir, float maxDistance, uint32_t& outItem, float& outDistance) const;
+
+	const std::vector<Node>& nodes() const { return _nodes; }
+	uint32_t itemCount() const { return static_cast<uint32_t>(_itemMin.size()); }
+
+private:
+	uint32_t buildNode(uint32_t first, uint32_t count, uint32_t parent, std::vector<glm::vec3>& centers);
+	void fitNode(uint32_t node);
+
+	std::vector<Node> _nodes;
+	std::vector<uint32_t> _parents;
+	//a subtree is the contiguous node range [node, subtreeEnd[node])
+	std::vector<uint32_t> _subtreeEnd;
+	//item indices in leaf order, leaves reference ranges of it
+	std::vector<uint32_t> _itemOrder;
+	std::vector<uint32_t> _itemLeaf;
+	std::vector<glm::vec3> _itemMin;
+	std::vector<glm::vec3> _itemMax;
+	std::vector<uint32_t> _dirtyLeaves;
+};
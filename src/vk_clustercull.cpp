@@ -0,0 +1,303 @@
+#include <vk_clustercull.h>
+#include <vk_engine.h>
+#include <vk_initializers.h>
+#include <iostream>
+#include <cstring>
+#include <algorithm>
+
+namespace {
+
+	//push constants of meshlet_cull.comp
+	struct CullConstants {
+		glm::vec4 planes[6];
+		uint32_t jobCount;
+		uint32_t groupCount;
+		uint32_t pad[2];
+	};
+
+	//guaranteed minimum of maxComputeWorkGroupCount, larger dispatches continue in y
+	const uint32_t MAX_GROUPS_X = 65535;
+
+	static_assert(sizeof(ClusterCuller::GPUMeshlet) == 64, "GPUMeshlet must match the std430 layout of meshlet_cull.comp");
+	static_assert(sizeof(ClusterCuller::GPUJob) == 96, "GPUJob must match the std430 layout of meshlet_cull.comp");
+}
+
+void ClusterCuller::init(VulkanEngine& engine, VkShaderModule cullShader, uint32_t indexCapacity, uint32_t maxDraws)
+{
+	_engine = &engine;
+	_indexCapacity = indexCapacity;
+	_maxDraws = maxDraws;
+	_frames.resize(engine._framesInFlight);
+	if (cullShader == VK_NULL_HANDLE) {
+		std::cout << "No meshlet cull shader, clusters are culled on the CPU" << std::endl;
+		return;
+	}
+
+	VkDevice device = engine._device;
+	std::vector<VkDescriptorSetLayoutBinding> bindings;
+	for (uint32_t binding = 0; binding < 6; binding++) {
+		bindings.push_back(vkinit::descriptorset_layout_binding(VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, VK_SHADER_STAGE_COMPUTE_BIT, binding));
+	}
+	VkDescriptorSetLayoutCreateInfo layoutInfo = vkinit::descriptorSetLayoutLayout_create_info(bindings);
+	VK_CHECK(vkCreateDescriptorSetLayout(device, &layoutInfo, nullptr, &_setLayout))
+
+	VkPushConstantRange pushConstant{};
+	pushConstant.offset = 0;
+	pushConstant.size = sizeof(CullConstants);
+	pushConstant.stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+
+	VkPipelineLayoutCreateInfo pipelineLayoutInfo = vkinit::pipeline_layout_create_info();
+	pipelineLayoutInfo.setLayoutCount = 1;
+	pipelineLayoutInfo.pSetLayouts = &_setLayout;
+	pipelineLayoutInfo.pushConstantRangeCount = 1;
+	pipelineLayoutInfo.pPushConstantRanges = &pushConstant;
+	VK_CHECK(vkCreatePipelineLayout(device, &pipelineLayoutInfo, nullptr, &_pipelineLayout))
+
+	VkComputePipelineCreateInfo pipelineInfo{};
+	pipelineInfo.sType = VK_STRUCTURE_TYPE_COMPUTE_PIPELINE_CREATE_INFO;
+	pipelineInfo.stage = vkinit::pipeline_shader_stage_create_info(VK_SHADER_STAGE_COMPUTE_BIT, cullShader);
+	pipelineInfo.layout = _pipelineLayout;
+	VK_CHECK(vkCreateComputePipelines(device, VK_NULL_HANDLE, 1, &pipelineInfo, nullptr, &_pipeline))
+
+	const uint32_t frameCount = static_cast<uint32_t>(_frames.size());
+	VkDescriptorPoolSize poolSize = { VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 6 * frameCount };
+	VkDescriptorPoolCreateInfo poolInfo{};
+	poolInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO;
+	poolInfo.maxSets = frameCount;
+	poolInfo.poolSizeCount = 1;
+	poolInfo.pPoolSizes = &poolSize;
+	VK_CHECK(vkCreateDescriptorPool(device, &poolInfo, nullptr, &_descriptorPool))
+}
+
+void ClusterCuller::cleanup()
+{
+	if (_engine == nullptr) {
+		return;
+	}
+	for (Frame& frame : _frames) {
+		destroyBuffer(frame.jobs);
+		destroyBuffer(frame.commands);
+		destroyBuffer(frame.indices);
+	}
+	destroyBuffer(_meshlets);
+	destroyBuffer(_meshletVertices);
+	destroyBuffer(_meshletTriangles);
+	if (_pipeline != VK_NULL_HANDLE) {
+		VkDevice device = _engine->_device;
+		vkDestroyPipeline(device, _pipeline, nullptr);
+		vkDestroyPipelineLayout(device, _pipelineLayout, nullptr);
+		vkDestroyDescriptorSetLayout(device, _setLayout, nullptr);
+		vkDestroyDescriptorPool(device, _descriptorPool, nullptr);
+		_pipeline = VK_NULL_HANDLE;
+	}
+}
+
+void ClusterCuller::createBuffer(VkDeviceSize size, VkBufferUsageFlags usage, VkMemoryPropertyFlags properties, Buffer& out)
+{
+	_engine->createBuffer(size, usage, properties, out.buffer, out.mem);
+}
+
+void ClusterCuller::destroyBuffer(Buffer& buffer)
+{
+	if (buffer.buffer != VK_NULL_HANDLE) {
+		vkDestroyBuffer(_engine->_device, buffer.buffer, nullptr);
+		_engine->_allocator.free(buffer.mem);
+		buffer.buffer = VK_NULL_HANDLE;
+	}
+}
+
+void ClusterCuller::build(const std::vector<Mesh*>& meshes)
+{
+	std::vector<GPUMeshlet> meshlets;
+	std::vector<uint32_t> vertices;
+	std::vector<uint32_t> triangles;
+	for (Mesh* mesh : meshes) {
+		const vkmeshlet::MeshletSet& set = mesh->_meshlets;
+		if (set.empty() || _meshes.count(mesh) != 0) {
+			continue;
+		}
+		_meshes[mesh] = { static_cast<uint32_t>(meshlets.size()), static_cast<uint32_t>(set.meshlets.size()), static_cast<uint32_t>(set.triangleCount() * 3) };
+
+		//offsets become absolute in the merged buffers, triangles are packed into one uint each
+		uint32_t vertexBase = static_cast<uint32_t>(vertices.size());
+		uint32_t triangleBase = static_cast<uint32_t>(triangles.size());
+		for (size_t m = 0; m < set.meshlets.size(); m++) {
+			const vkmeshlet::Meshlet& meshlet = set.meshlets[m];
+			meshlets.push_back({ set.bounds[m], vertexBase + meshlet.vertexOffset, triangleBase + meshlet.triangleOffset,
+				meshlet.vertexCount, meshlet.triangleCount });
+		}
+		vertices.insert(vertices.end(), set.vertices.begin(), set.vertices.end());
+		for (size_t t = 0; t < set.triangleCount(); t++) {
+			const uint8_t* local = &set.triangles[t * 3];
+			triangles.push_back(uint32_t(local[0]) | (uint32_t(local[1]) << 8) | (uint32_t(local[2]) << 16));
+		}
+	}
+	_meshletCount = static_cast<uint32_t>(meshlets.size());
+	if (_meshes.empty()) {
+		return;
+	}
+
+	//the CPU path writes the indices and commands through the mapping, the GPU path only the jobs and command headers
+	const bool gpu = _pipeline != VK_NULL_HANDLE;
+	const VkMemoryPropertyFlags hostVisible = VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT;
+	for (Frame& frame : _frames) {
+		createBuffer(_maxDraws * sizeof(VkDrawIndexedIndirectCommand), VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT,
+			hostVisible, frame.commands);
+		createBuffer(VkDeviceSize(_indexCapacity) * sizeof(uint32_t), VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_INDEX_BUFFER_BIT,
+			gpu ? VkMemoryPropertyFlags(VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT) : hostVisible, frame.indices);
+	}
+	if (!gpu) {
+		return;
+	}
+
+	createBuffer(meshlets.size() * sizeof(GPUMeshlet), VK_BUFFER_USAGE_TRANSFER_DST_BIT | VK_BUFFER_USAGE_STORAGE_BUFFER_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, _meshlets);
+	createBuffer(vertices.size() * sizeof(uint32_t), VK_BUFFER_USAGE_TRANSFER_DST_BIT | VK_BUFFER_USAGE_STORAGE_BUFFER_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, _meshletVertices);
+	createBuffer(triangles.size() * sizeof(uint32_t), VK_BUFFER_USAGE_TRANSFER_DST_BIT | VK_BUFFER_USAGE_STORAGE_BUFFER_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, _meshletTriangles);
+	_engine->_uploadQueue.uploadBuffer(_meshlets.buffer, meshlets.data(), meshlets.size() * sizeof(GPUMeshlet));
+	_engine->_uploadQueue.uploadBuffer(_meshletVertices.buffer, vertices.data(), vertices.size() * sizeof(uint32_t));
+	_engine->_uploadQueue.uploadBuffer(_meshletTriangles.buffer, triangles.data(), triangles.size() * sizeof(uint32_t));
+	_engine->_uploadQueue.flush();
+
+	for (Frame& frame : _frames) {
+		createBuffer(_maxDraws * sizeof(GPUJob), VK_BUFFER_USAGE_STORAGE_BUFFER_BIT, hostVisible, frame.jobs);
+
+		VkDescriptorSetAllocateInfo allocInfo{};
+		allocInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
+		allocInfo.descriptorPool = _descriptorPool;
+		allocInfo.descriptorSetCount = 1;
+		allocInfo.pSetLayouts = &_setLayout;
+		VK_CHECK(vkAllocateDescriptorSets(_engine->_device, &allocInfo, &frame.set))
+
+		VkDescriptorBufferInfo bufferInfos[6] = {
+			{ _meshlets.buffer, 0, VK_WHOLE_SIZE },
+			{ _meshletVertices.buffer, 0, VK_WHOLE_SIZE },
+			{ _meshletTriangles.buffer, 0, VK_WHOLE_SIZE },
+			{ frame.jobs.buffer, 0, VK_WHOLE_SIZE },
+			{ frame.commands.buffer, 0, VK_WHOLE_SIZE },
+			{ frame.indices.buffer, 0, VK_WHOLE_SIZE },
+		};
+		VkWriteDescriptorSet writes[6] = {};
+		for (uint32_t i = 0; i < 6; i++) {
+			writes[i].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+			writes[i].descriptorCount = 1;
+			writes[i].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+			writes[i].dstSet = frame.set;
+			writes[i].dstBinding = i;
+			writes[i].pBufferInfo = &bufferInfos[i];
+		}
+		vkUpdateDescriptorSets(_engine->_device, 6, writes, 0, nullptr);
+	}
+}
+
+void ClusterCuller::beginFrame(uint32_t frame, const vkcull::Frustum& frustum, const glm::vec3& eye, bool coneCulling)
+{
+	_frame = frame;
+	_frustum = frustum;
+	_eye = eye;
+	_coneCulling = coneCulling;
+	_jobs.clear();
+	_groupCount = 0;
+	_indexCursor = 0;
+	_clustersTested = 0;
+	_trianglesTested = 0;
+	_clustersKept = 0;
+	_trianglesKept = 0;
+	_overflows = 0;
+}
+
+uint32_t ClusterCuller::addDraw(const Mesh* mesh, const glm::mat4& transform)
+{
+	auto it = _meshes.find(mesh);
+	if (it == _meshes.end()) {
+		return INVALID_DRAW;
+	}
+	const MeshEntry& entry = it->second;
+	Frame& frame = _frames[_frame];
+	if (_jobs.size() >= _maxDraws || _indexCursor + entry.indexCount > _indexCapacity) {
+		_overflows++;
+		return INVALID_DRAW;
+	}
+
+	uint32_t draw = static_cast<uint32_t>(_jobs.size());
+	vkmeshlet::CullView view = vkmeshlet::make_cull_view(_frustum, transform, _eye, _coneCulling);
+	VkDrawIndexedIndirectCommand& command = static_cast<VkDrawIndexedIndirectCommand*>(frame.commands.mem.mapped)[draw];
+	command.instanceCount = 1;
+	command.firstIndex = _indexCursor;
+	command.vertexOffset = 0;
+	command.firstInstance = 0;
+	_clustersTested += entry.meshletCount;
+	_trianglesTested += entry.indexCount / 3;
+
+	if (_pipeline != VK_NULL_HANDLE) {
+		//the shader appends to indexCount, the range is reserved for every cluster surviving
+		command.indexCount = 0;
+		GPUJob job;
+		job.transform = transform;
+		job.eye = glm::vec4(view.eye, view.coneCulling ? 1.0f : 0.0f);
+		job.maxScale = view.maxScale;
+		job.firstMeshlet = entry.firstMeshlet;
+		job.meshletCount = entry.meshletCount;
+		job.firstGroup = _groupCount;
+		static_cast<GPUJob*>(frame.jobs.mem.mapped)[draw] = job;
+		_jobs.push_back(job);
+		_groupCount += entry.meshletCount;
+		_indexCursor += entry.indexCount;
+		return draw;
+	}
+
+	_scratch.clear();
+	_clustersKept += static_cast<uint32_t>(vkmeshlet::cull_meshlets(mesh->_meshlets, view, _scratch));
+	_trianglesKept += _scratch.size() / 3;
+	if (!_scratch.empty()) {
+		memcpy(static_cast<uint32_t*>(frame.indices.mem.mapped) + _indexCursor, _scratch.data(), _scratch.size() * sizeof(uint32_t));
+	}
+	command.indexCount = static_cast<uint32_t>(_scratch.size());
+	_jobs.push_back({});
+	_indexCursor += command.indexCount;
+	return draw;
+}
+
+void ClusterCuller::recordCull(VkCommandBuffer cmd)
+{
+	if (_pipeline == VK_NULL_HANDLE || _jobs.empty()) {
+		return;
+	}
+	Frame& frame = _frames[_frame];
+	CullConstants constants{};
+	memcpy(constants.planes, _frustum.planes, sizeof(constants.planes));
+	constants.jobCount = static_cast<uint32_t>(_jobs.size());
+	constants.groupCount = _groupCount;
+	vkCmdBindPipeline(cmd, VK_PIPELINE_BIND_POINT_COMPUTE, _pipeline);
+	vkCmdBindDescriptorSets(cmd, VK_PIPELINE_BIND_POINT_COMPUTE, _pipelineLayout, 0, 1, &frame.set, 0, nullptr);
+	vkCmdPushConstants(cmd, _pipelineLayout, VK_SHADER_STAGE_COMPUTE_BIT, 0, sizeof(CullConstants), &constants);
+	//one workgroup per queued meshlet, the shader finds its job by firstGroup
+	const uint32_t groupsX = std::min(_groupCount, MAX_GROUPS_X);
+	vkCmdDispatch(cmd, groupsX, (_groupCount + groupsX - 1) / groupsX, 1);
+
+	VkMemoryBarrier barrier{};
+	barrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+	barrier.srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT;
+	barrier.dstAccessMask = VK_ACCESS_INDIRECT_COMMAND_READ_BIT | VK_ACCESS_INDEX_READ_BIT;
+	vkCmdPipelineBarrier(cmd, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_PIPELINE_STAGE_DRAW_INDIRECT_BIT | VK_PIPELINE_STAGE_VERTEX_INPUT_BIT, 0,
+		1, &barrier, 0, nullptr, 0, nullptr);
+}
+
+void ClusterCuller::recordDraw(VkCommandBuffer cmd, uint32_t draw)
+{
+	vkCmdDrawIndexedIndirect(cmd, _frames[_frame].commands.buffer, draw * sizeof(VkDrawIndexedIndirectCommand), 1, sizeof(VkDrawIndexedIndirectCommand));
+}
+
+ClusterCuller::Stats ClusterCuller::stats() const
+{
+	Stats stats{};
+	stats.meshes = static_cast<uint32_t>(_meshes.size());
+	stats.meshlets = _meshletCount;
+	stats.gpuCulling = _pipeline != VK_NULL_HANDLE;
+	stats.draws = static_cast<uint32_t>(_jobs.size());
+	stats.clustersTested = _clustersTested;
+	stats.trianglesTested = _trianglesTested;
+	stats.clustersKept = _clustersKept;
+	stats.trianglesKept = _trianglesKept;
+	stats.overflows = _overflows;
+	return stats;
+}
@@ -0,0 +1,143 @@
+#pragma once
+
+#include <vk_types.h>
+#include <vk_allocator.h>
+#include <vk_meshlet.h>
+#include <glm/glm.hpp>
+#include <vector>
+#include <unordered_map>
+#include <cstdint>
+
+class VulkanEngine;
+struct Mesh;
+
+//per frame cluster culling of the meshes that have meshlets. every draw of such a mesh gets a range of a per frame
+//index buffer that is filled with the indices of its visible clusters only, and an indirect command whose index count
+//is the size of that compacted list. with shaders/meshlet_cull.comp the clusters are tested and written by one
+//workgroup each on the GPU, in one dispatch over all draws of the frame, without it vkmeshlet::cull_meshlets fills the same buffers on the CPU
+class ClusterCuller {
+public:
+	static const uint32_t INVALID_DRAW = UINT32_MAX;
+	//local_size_x of meshlet_cull.comp, one invocation per triangle of a meshlet
+	static const uint32_t CULL_GROUP_SIZE = 128;
+	static_assert(CULL_GROUP_SIZE >= vkmeshlet::MAX_TRIANGLES, "a workgroup writes one meshlet");
+
+	//std430 layouts of meshlet_cull.comp
+	struct GPUMeshlet {
+		vkmeshlet::MeshletBounds bounds;
+		uint32_t vertexOffset;
+		uint32_t triangleOffset;
+		uint32_t vertexCount;
+		uint32_t triangleCount;
+	};
+
+	struct GPUJob {
+		glm::mat4 transform;
+		//camera in object space, w is 1 when the cone test applies
+		glm::vec4 eye;
+		float maxScale;
+		uint32_t firstMeshlet;
+		uint32_t meshletCount;
+		//workgroup of the frame's single dispatch that tests firstMeshlet, the job's draw command is its own index
+		uint32_t firstGroup;
+	};
+
+	struct Stats {
+		uint32_t meshes;
+		uint32_t meshlets;
+		bool gpuCulling;
+		//last frame
+		uint32_t draws;
+		uint32_t clustersTested;
+		uint64_t trianglesTested;
+		//only known on the CPU path
+		uint32_t clustersKept;
+		uint64_t trianglesKept;
+		//draws left to the regular path because the frame's index space was used up
+		uint32_t overflows;
+	};
+
+	//cullShader is meshlet_cull.comp or VK_NULL_HANDLE for CPU culling, the caller keeps it.
+	//indexCapacity is the index space of one frame, maxDraws the cluster culled draws per frame
+	void init(VulkanEngine& engine, VkShaderModule cullShader, uint32_t indexCapacity, uint32_t maxDraws);
+
+	void cleanup();
+
+	//uploads the meshlets of the meshes, once after they are loaded
+	void build(const std::vector<Mesh*>& meshes);
+
+	bool hasMeshlets(const Mesh* mesh) const { return _meshes.count(mesh) != 0; }
+
+	//camera of the draws added until the next beginFrame, frame selects the buffers
+	void beginFrame(uint32_t frame, const vkcull::Frustum& frustum, const glm::vec3& eye, bool coneCulling);
+
+	//queues the clusters of one object, returns the draw for recordDraw or INVALID_DRAW when the frame is full
+	uint32_t addDraw(const Mesh* mesh, const glm::mat4& transform);
+
+	//the GPU culling of the queued draws, outside of a render pass. nothing to record on the CPU path
+	void recordCull(VkCommandBuffer cmd);
+
+	//index buffer the draws of the current frame read, uint32
+	VkBuffer indexBuffer() const { return _frames[_frame].indices.buffer; }
+
+	//the mesh's vertex buffers and indexBuffer() must be bound
+	void recordDraw(VkCommandBuffer cmd, uint32_t draw);
+
+	Stats stats() const;
+
+private:
+	struct MeshEntry {
+		uint32_t firstMeshlet;
+		uint32_t meshletCount;
+		uint32_t indexCount;
+	};
+
+	struct Buffer {
+		VkBuffer buffer{ VK_NULL_HANDLE };
+		Allocation mem{};
+	};
+
+	struct Frame {
+		Buffer jobs;
+		Buffer commands;
+		Buffer indices;
+		VkDescriptorSet set{ VK_NULL_HANDLE };
+	};
+
+	void createBuffer(VkDeviceSize size, VkBufferUsageFlags usage, VkMemoryPropertyFlags properties, Buffer& out);
+	void destroyBuffer(Buffer& buffer);
+
+	VulkanEngine* _engine{ nullptr };
+	uint32_t _indexCapacity{ 0 };
+	uint32_t _maxDraws{ 0 };
+	VkDescriptorPool _descriptorPool{ VK_NULL_HANDLE };
+	VkDescriptorSetLayout _setLayout{ VK_NULL_HANDLE };
+	VkPipelineLayout _pipelineLayout{ VK_NULL_HANDLE };
+	VkPipeline _pipeline{ VK_NULL_HANDLE };
+
+	//all meshes' meshlets, only uploaded for GPU culling
+	Buffer _meshlets;
+	Buffer _meshletVertices;
+	Buffer _meshletTriangles;
+	std::unordered_map<const Mesh*, MeshEntry> _meshes;
+	uint32_t _meshletCount{ 0 };
+
+	//VulkanEngine::_framesInFlight of them
+	std::vector<Frame> _frames;
+	uint32_t _frame{ 0 };
+	vkcull::Frustum _frustum{};
+	glm::vec3 _eye{ 0.0f };
+	bool _coneCulling{ true };
+	std::vector<GPUJob> _jobs;
+	//meshlets of the queued GPU jobs, the workgroups of recordCull's dispatch
+	uint32_t _groupCount{ 0 };
+	uint32_t _indexCursor{ 0 };
+	//CPU path output of one draw
+	std::vector<uint32_t> _scratch;
+
+	uint32_t _clustersTested{ 0 };
+	uint64_t _trianglesTested{ 0 };
+	uint32_t _clustersKept{ 0 };
+	uint64_t _trianglesKept{ 0 };
+	uint32_t _overflows{ 0 };
+};
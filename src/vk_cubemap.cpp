@@ -2,6 +2,7 @@
 #include <iostream>
 
 #include <vk_initializers.h>
+#include <vk_texture.h>
 
 
 #include <stb_image.h>
@@ -15,6 +16,11 @@ bool vkcubemap::load_image_from_file(VulkanEngine& engine, std::vector<const cha
         std::cout<<"Error image count is not 6"<<std::endl;
     }
 
+    if(vkutil::load_compressed_image(engine,files,true,outImage))
+    {
+        return true;
+    }
+
     for(int i = 0 ; i < 6 ; i++)
     {
         pixels[i] = stbi_load(files[i],&texWidth,&texHeight,&texChannels,STBI_rgb_alpha);
@@ -24,32 +30,6 @@ bool vkcubemap::load_image_from_file(VulkanEngine& engine, std::vector<const cha
 
 	VkFormat image_format = VK_FORMAT_R8G8B8A8_SRGB;
 
-    struct StagingBuffer
-    {
-        /* data */
-        VkBuffer buffer;
-        VkDeviceMemory memory;
-    }stagingBuffer{};
-
-    engine.createBuffer(imageSize*6,VK_BUFFER_USAGE_TRANSFER_SRC_BIT,
-    VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT|VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
-    stagingBuffer.buffer,
-    stagingBuffer.memory);
-
-    for(int i = 0 ; i < 6 ; i++)
-    {
-        void* mapped = nullptr;
-        vkMapMemory(engine._device,stagingBuffer.memory,imageSize*i,imageSize,0,&mapped);
-        memcpy(mapped,pixels[i],imageSize);
-        vkUnmapMemory(engine._device,stagingBuffer.memory);
-
-    }
-
-    for(int i = 0 ; i < 6 ; i++)
-    {
-        stbi_image_free(pixels[i]);
-    }
-
     VkExtent3D imageExtent;
 	imageExtent.width = static_cast<uint32_t>(texWidth);
 	imageExtent.height = static_cast<uint32_t>(texHeight);
@@ -63,15 +43,18 @@ bool vkcubemap::load_image_from_file(VulkanEngine& engine, std::vector<const cha
 
     engine.createImage(dimg_info,VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,newImage._image,newImage._mem);
 
-    transitionImaglayout(engine,newImage._image,image_format,VK_IMAGE_LAYOUT_UNDEFINED,
-    VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL
+    vkutil::transitionImaglayout(engine,newImage._image,image_format,VK_IMAGE_LAYOUT_UNDEFINED,
+    VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,6
     );
-    copyBuffertoImage(engine,stagingBuffer.buffer,newImage._image,imageExtent.width,imageExtent.height);
-    transitionImaglayout(engine,newImage._image,image_format,VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
-    VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL);
+    //every face is copied straight from its decoded pixels into the staging ring
+    for(int i = 0 ; i < 6 ; i++)
+    {
+        engine._uploadQueue.uploadImage(newImage._image,pixels[i],imageSize,imageExtent.width,imageExtent.height,i);
+        stbi_image_free(pixels[i]);
+    }
+    vkutil::transitionImaglayout(engine,newImage._image,image_format,VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+    VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL,6);
 
-    vkDestroyBuffer(engine._device,stagingBuffer.buffer,nullptr);
-    vkFreeMemory(engine._device,stagingBuffer.memory,nullptr);
 
     VkImageViewCreateInfo imageViewInfo{};
     VkImageSubresourceRange range{};
@@ -97,102 +80,11 @@ bool vkcubemap::load_image_from_file(VulkanEngine& engine, std::vector<const cha
 
     outImage = newImage;
 
-    engine._mainDeletionQueue.push_function([=](){
-        vkDestroySampler(engine._device,outImage._sampler,nullptr);
+    engine._mainDeletionQueue.push_function([=,&engine](){
         vkDestroyImageView(engine._device,outImage._view,nullptr);
         vkDestroyImage(engine._device,outImage._image,nullptr);
-		vkFreeMemory(engine._device,outImage._mem,nullptr);
+		engine._allocator.free(outImage._mem);
     });
 
     return true;
 }
-
-void vkcubemap::transitionImaglayout(VulkanEngine &engine,VkImage image,VkFormat format,VkImageLayout oldLayout,VkImageLayout newLayout)
-{
-    VkCommandBuffer commandBuffer = engine.beginSingleCommand();
-
-	VkImageMemoryBarrier barrier{};
-	barrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
-	barrier.oldLayout = oldLayout;
-	barrier.newLayout = newLayout;
-	barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
-	barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
-
-	barrier.image = image;
-	barrier.subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
-	barrier.subresourceRange.baseMipLevel = 0;
-	barrier.subresourceRange.levelCount = 1;
-	barrier.subresourceRange.baseArrayLayer = 0;
-	barrier.subresourceRange.layerCount = 6;
-	barrier.srcAccessMask = 0; // TODO
-	barrier.dstAccessMask = 0;
-
-	VkPipelineStageFlags sourceStage{};
-	VkPipelineStageFlags destinationStage{};
-
-	if (oldLayout == VK_IMAGE_LAYOUT_UNDEFINED && newLayout == VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL) {
-		barrier.srcAccessMask = 0;
-		barrier.dstAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
-
-		sourceStage = VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT;
-		destinationStage = VK_PIPELINE_STAGE_TRANSFER_BIT;
-	}
-	else if (oldLayout == VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL && newLayout == VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL) {
-		barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
-		barrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
-
-		sourceStage = VK_PIPELINE_STAGE_TRANSFER_BIT;
-		destinationStage = VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT;
-	}
-	else {
-		//throw std::invalid_argument("unsupported layout transition!");
-		std::cout << "error" << std::endl;
-	}
-
-	
-	vkCmdPipelineBarrier(
-		commandBuffer,
-		sourceStage, destinationStage,
-		0,
-		0, nullptr,
-		0, nullptr,
-		1, &barrier
-	);
-
-	engine.endSingleCommand(commandBuffer);
-}
-
-void vkcubemap::copyBuffertoImage(VulkanEngine& engine,VkBuffer buffer, VkImage image, uint32_t width, uint32_t height)
- {
-
-    VkCommandBuffer commandBuffer = engine.beginSingleCommand();
-
-	VkBufferImageCopy region{};
-	region.bufferOffset = 0;
-	region.bufferRowLength = 0;
-	region.bufferImageHeight = 0;
-
-	region.imageSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
-	region.imageSubresource.mipLevel = 0;
-	region.imageSubresource.baseArrayLayer = 0;
-	region.imageSubresource.layerCount = 6;
-
-	region.imageOffset = { 0, 0, 0 };
-	region.imageExtent = {
-		width,
-		height,
-		1
-	};
-
-	vkCmdCopyBufferToImage(
-		commandBuffer,
-		buffer,
-		image,
-		VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
-		1,
-		&region
-	);
-
-	engine.endSingleCommand(commandBuffer);
-
- }
\ No newline at end of file
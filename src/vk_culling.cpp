@@ -0,0 +1,170 @@
+#include <vk_culling.h>
+#include <algorithm>
+#include <cmath>
+
+#if defined(__AVX__)
+#define VKCULL_AVX 1
+#include <immintrin.h>
+#elif defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define VKCULL_SSE2 1
+#include <emmintrin.h>
+#endif
+
+vkcull::Frustum vkcull::extract_frustum(const glm::mat4& viewProj)
+{
+	//rows of the matrix, glm is column major
+	glm::vec4 row[4];
+	for (int i = 0; i < 4; i++) {
+		row[i] = glm::vec4(viewProj[0][i], viewProj[1][i], viewProj[2][i], viewProj[3][i]);
+	}
+	Frustum frustum;
+	frustum.planes[0] = row[3] + row[0];
+	frustum.planes[1] = row[3] - row[0];
+	frustum.planes[2] = row[3] + row[1];
+	frustum.planes[3] = row[3] - row[1];
+	//clip space z is 0..w
+	frustum.planes[4] = row[2];
+	frustum.planes[5] = row[3] - row[2];
+	for (glm::vec4& plane : frustum.planes) {
+		float length = glm::length(glm::vec3(plane));
+		if (length > 0.0f) {
+			plane /= length;
+		}
+	}
+	return frustum;
+}
+
+void vkcull::SphereSet::clear()
+{
+	x.clear();
+	y.clear();
+	z.clear();
+	radius.clear();
+}
+
+void vkcull::SphereSet::reserve(size_t count)
+{
+	x.reserve(count);
+	y.reserve(count);
+	z.reserve(count);
+	radius.reserve(count);
+}
+
+void vkcull::SphereSet::push(const glm::vec3& center, float r)
+{
+	x.push_back(center.x);
+	y.push_back(center.y);
+	z.push_back(center.z);
+	radius.push_back(r);
+}
+
+void vkcull::world_sphere(const glm::vec3& boundsMin, const glm::vec3& boundsMax, const glm::mat4& transform, glm::vec3& outCenter, float& outRadius)
+{
+	glm::vec3 center = (boundsMin + boundsMax) * 0.5f;
+	float radius = glm::length(boundsMax - boundsMin) * 0.5f;
+	float scale = std::max(glm::length(glm::vec3(transform[0])), std::max(glm::length(glm::vec3(transform[1])), glm::length(glm::vec3(transform[2]))));
+	outCenter = glm::vec3(transform * glm::vec4(center, 1.0f));
+	outRadius = radius * scale;
+}
+
+void vkcull::world_aabb(const glm::vec3& boundsMin, const glm::vec3& boundsMax, const glm::mat4& transform, glm::vec3& outMin, glm::vec3& outMax)
+{
+	//transformed center plus the extent through the absolute matrix, tight for the box without visiting its corners
+	glm::vec3 center = glm::vec3(transform * glm::vec4((boundsMin + boundsMax) * 0.5f, 1.0f));
+	glm::vec3 extent = (boundsMax - boundsMin) * 0.5f;
+	glm::mat3 absolute(glm::abs(glm::vec3(transform[0])), glm::abs(glm::vec3(transform[1])), glm::abs(glm::vec3(transform[2])));
+	glm::vec3 worldExtent = absolute * extent;
+	outMin = center - worldExtent;
+	outMax = center + worldExtent;
+}
+
+bool vkcull::sphere_visible(const Frustum& frustum, const glm::vec3& center, float radius)
+{
+	//same operation order and NaN handling as the SIMD lanes, so both paths agree exactly
+	for (const glm::vec4& plane : frustum.planes) {
+		float d = (plane.x * center.x + plane.y * center.y) + (plane.z * center.z + plane.w);
+		if (!(d >= -radius)) {
+			return false;
+		}
+	}
+	return true;
+}
+
+size_t vkcull::cull_spheres_scalar(const Frustum& frustum, const SphereSet& spheres, uint32_t* visible)
+{
+	size_t count = 0;
+	for (size_t i = 0; i < spheres.size(); i++) {
+		if (sphere_visible(frustum, glm::vec3(spheres.x[i], spheres.y[i], spheres.z[i]), spheres.radius[i])) {
+			visible[count++] = static_cast<uint32_t>(i);
+		}
+	}
+	return count;
+}
+
+size_t vkcull::cull_spheres(const Frustum& frustum, const SphereSet& spheres, uint32_t* visible)
+{
+	const size_t total = spheres.size();
+	const float* xs = spheres.x.data();
+	const float* ys = spheres.y.data();
+	const float* zs = spheres.z.data();
+	const float* rs = spheres.radius.data();
+	size_t count = 0;
+	size_t i = 0;
+#if defined(VKCULL_AVX)
+	__m256 planes[6][4];
+	for (int p = 0; p < 6; p++) {
+		for (int c = 0; c < 4; c++) {
+			planes[p][c] = _mm256_set1_ps(frustum.planes[p][c]);
+		}
+	}
+	for (; i + 8 <= total; i += 8) {
+		__m256 x = _mm256_loadu_ps(xs + i);
+		__m256 y = _mm256_loadu_ps(ys + i);
+		__m256 z = _mm256_loadu_ps(zs + i);
+		__m256 negRadius = _mm256_sub_ps(_mm256_setzero_ps(), _mm256_loadu_ps(rs + i));
+		__m256 inside = _mm256_castsi256_ps(_mm256_set1_epi32(-1));
+		for (int p = 0; p < 6; p++) {
+			__m256 d = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(planes[p][0], x), _mm256_mul_ps(planes[p][1], y)),
+				_mm256_add_ps(_mm256_mul_ps(planes[p][2], z), planes[p][3]));
+			inside = _mm256_and_ps(inside, _mm256_cmp_ps(d, negRadius, _CMP_GE_OQ));
+		}
+		//compaction: every lane is written, the cursor only advances over visible ones
+		uint32_t bits = static_cast<uint32_t>(_mm256_movemask_ps(inside));
+		for (uint32_t lane = 0; lane < 8; lane++) {
+			visible[count] = static_cast<uint32_t>(i + lane);
+			count += (bits >> lane) & 1;
+		}
+	}
+#elif defined(VKCULL_SSE2)
+	__m128 planes[6][4];
+	for (int p = 0; p < 6; p++) {
+		for (int c = 0; c < 4; c++) {
+			planes[p][c] = _mm_set1_ps(frustum.planes[p][c]);
+		}
+	}
+	for (; i + 4 <= total; i += 4) {
+		__m128 x = _mm_loadu_ps(xs + i);
+		__m128 y = _mm_loadu_ps(ys + i);
+		__m128 z = _mm_loadu_ps(zs + i);
+		__m128 negRadius = _mm_sub_ps(_mm_setzero_ps(), _mm_loadu_ps(rs + i));
+		__m128 inside = _mm_castsi128_ps(_mm_set1_epi32(-1));
+		for (int p = 0; p < 6; p++) {
+			__m128 d = _mm_add_ps(_mm_add_ps(_mm_mul_ps(planes[p][0], x), _mm_mul_ps(planes[p][1], y)),
+				_mm_add_ps(_mm_mul_ps(planes[p][2], z), planes[p][3]));
+			inside = _mm_and_ps(inside, _mm_cmpge_ps(d, negRadius));
+		}
+		//compaction: every lane is written, the cursor only advances over visible ones
+		uint32_t bits = static_cast<uint32_t>(_mm_movemask_ps(inside));
+		for (uint32_t lane = 0; lane < 4; lane++) {
+			visible[count] = static_cast<uint32_t>(i + lane);
+			count += (bits >> lane) & 1;
+		}
+	}
+#endif
+	for (; i < total; i++) {
+		if (sphere_visible(frustum, glm::vec3(xs[i], ys[i], zs[i]), rs[i])) {
+			visible[count++] = static_cast<uint32_t>(i);
+		}
+	}
+	return count;
+}
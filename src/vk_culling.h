@@ -0,0 +1,46 @@
+#pragma once
+
+#include <glm/glm.hpp>
+#include <vector>
+#include <cstdint>
+
+//view frustum culling of bounding spheres. the spheres are kept as separate x/y/z/radius arrays so the test runs on
+//4 (SSE) or 8 (AVX) spheres per iteration against all six planes and compacts the visible indices without branches.
+//nothing here touches the device, the whole pass runs and is benchmarked on the CPU
+namespace vkcull {
+
+	//planes point inwards, a point p is inside when dot(plane.xyz, p) + plane.w >= 0 for all six
+	struct Frustum {
+		glm::vec4 planes[6];
+	};
+
+	//left, right, bottom, top, near, far of a vulkan style (0..1 depth) view projection matrix, normalized
+	Frustum extract_frustum(const glm::mat4& viewProj);
+
+	struct SphereSet {
+		std::vector<float> x;
+		std::vector<float> y;
+		std::vector<float> z;
+		std::vector<float> radius;
+
+		size_t size() const { return x.size(); }
+		void clear();
+		void reserve(size_t count);
+		void push(const glm::vec3& center, float r);
+	};
+
+	//bounding sphere of an object space aabb after transform, the radius grows with the largest axis scale
+	void world_sphere(const glm::vec3& boundsMin, const glm::vec3& boundsMax, const glm::mat4& transform, glm::vec3& outCenter, float& outRadius);
+
+	//aabb enclosing an object space aabb after transform
+	void world_aabb(const glm::vec3& boundsMin, const glm::vec3& boundsMax, const glm::mat4& transform, glm::vec3& outMin, glm::vec3& outMax);
+
+	bool sphere_visible(const Frustum& frustum, const glm::vec3& center, float radius);
+
+	//writes the indices of the spheres intersecting the frustum to visible in ascending order and returns their count.
+	//visible must hold spheres.size() entries
+	size_t cull_spheres(const Frustum& frustum, const SphereSet& spheres, uint32_t* visible);
+
+	//one sphere at a time, the reference the SIMD path is checked against
+	size_t cull_spheres_scalar(const Frustum& frustum, const SphereSet& spheres, uint32_t* visible);
+}
@@ -0,0 +1,200 @@
+#include <vk_depthpyramid.h>
+#include <vk_engine.h>
+#include <vk_initializers.h>
+#include <vk_hiz.h>
+#include <iostream>
+
+namespace {
+
+	//push constants of depth_reduce.comp
+	struct ReduceConstants {
+		uint32_t sourceSize[2];
+		uint32_t size[2];
+	};
+}
+
+void DepthPyramid::init(VulkanEngine& engine, VkShaderModule reduceShader, VkImage depthImage, VkImageView depthView, VkFormat depthFormat,
+	uint32_t width, uint32_t height)
+{
+	_engine = &engine;
+	_depthImage = depthImage;
+	_width = width;
+	_height = height;
+	_levelCount = vkhiz::level_count(width, height);
+	//the formats findDepthFormat picks from
+	if (depthFormat == VK_FORMAT_D32_SFLOAT_S8_UINT || depthFormat == VK_FORMAT_D24_UNORM_S8_UINT) {
+		_depthAspect = VK_IMAGE_ASPECT_DEPTH_BIT | VK_IMAGE_ASPECT_STENCIL_BIT;
+	}
+
+	VkDevice device = engine._device;
+	VkImageCreateInfo imageInfo = vkinit::image_create_info(VK_FORMAT_R32_SFLOAT, VK_IMAGE_USAGE_STORAGE_BIT | VK_IMAGE_USAGE_SAMPLED_BIT,
+		{ (width + 1) / 2, (height + 1) / 2, 1 });
+	imageInfo.mipLevels = _levelCount;
+	engine.createImage(imageInfo, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, _image, _mem);
+
+	VkImageViewCreateInfo viewInfo = vkinit::imageview_begin_info(_image, VK_FORMAT_R32_SFLOAT, VK_IMAGE_ASPECT_COLOR_BIT);
+	viewInfo.subresourceRange.levelCount = _levelCount;
+	_view = engine.createImageView(_image, viewInfo);
+	for (uint32_t level = 0; level < _levelCount; level++) {
+		viewInfo.subresourceRange.baseMipLevel = level;
+		viewInfo.subresourceRange.levelCount = 1;
+		_levelViews.push_back(engine.createImageView(_image, viewInfo));
+	}
+	//only read with texelFetch, the filter does not matter
+	_sampler = engine.createSampler(VK_FILTER_NEAREST);
+
+	VkCommandBuffer cmd = engine.beginSingleCommand();
+	VkImageMemoryBarrier barrier{};
+	barrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+	barrier.oldLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+	barrier.newLayout = VK_IMAGE_LAYOUT_GENERAL;
+	barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+	barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+	barrier.image = _image;
+	barrier.subresourceRange = { VK_IMAGE_ASPECT_COLOR_BIT, 0, _levelCount, 0, 1 };
+	barrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT;
+	vkCmdPipelineBarrier(cmd, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, 0, 0, nullptr, 0, nullptr, 1, &barrier);
+	engine.endSingleCommand(cmd);
+
+	if (reduceShader == VK_NULL_HANDLE) {
+		std::cout << "No depth reduce shader, occlusion culling disabled" << std::endl;
+		return;
+	}
+
+	std::vector<VkDescriptorSetLayoutBinding> bindings = {
+		vkinit::descriptorset_layout_binding(VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, VK_SHADER_STAGE_COMPUTE_BIT, 0),
+		vkinit::descriptorset_layout_binding(VK_DESCRIPTOR_TYPE_STORAGE_IMAGE, VK_SHADER_STAGE_COMPUTE_BIT, 1),
+	};
+	VkDescriptorSetLayoutCreateInfo layoutInfo = vkinit::descriptorSetLayoutLayout_create_info(bindings);
+	VK_CHECK(vkCreateDescriptorSetLayout(device, &layoutInfo, nullptr, &_setLayout))
+
+	VkPushConstantRange pushConstant{};
+	pushConstant.offset = 0;
+	pushConstant.size = sizeof(ReduceConstants);
+	pushConstant.stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+
+	VkPipelineLayoutCreateInfo pipelineLayoutInfo = vkinit::pipeline_layout_create_info();
+	pipelineLayoutInfo.setLayoutCount = 1;
+	pipelineLayoutInfo.pSetLayouts = &_setLayout;
+	pipelineLayoutInfo.pushConstantRangeCount = 1;
+	pipelineLayoutInfo.pPushConstantRanges = &pushConstant;
+	VK_CHECK(vkCreatePipelineLayout(device, &pipelineLayoutInfo, nullptr, &_pipelineLayout))
+
+	VkComputePipelineCreateInfo pipelineInfo{};
+	pipelineInfo.sType = VK_STRUCTURE_TYPE_COMPUTE_PIPELINE_CREATE_INFO;
+	pipelineInfo.stage = vkinit::pipeline_shader_stage_create_info(VK_SHADER_STAGE_COMPUTE_BIT, reduceShader);
+	pipelineInfo.layout = _pipelineLayout;
+	VK_CHECK(vkCreateComputePipelines(device, VK_NULL_HANDLE, 1, &pipelineInfo, nullptr, &_pipeline))
+
+	VkDescriptorPoolSize poolSizes[2] = {
+		{ VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, _levelCount },
+		{ VK_DESCRIPTOR_TYPE_STORAGE_IMAGE, _levelCount },
+	};
+	VkDescriptorPoolCreateInfo poolInfo{};
+	poolInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO;
+	poolInfo.maxSets = _levelCount;
+	poolInfo.poolSizeCount = 2;
+	poolInfo.pPoolSizes = poolSizes;
+	VK_CHECK(vkCreateDescriptorPool(device, &poolInfo, nullptr, &_descriptorPool))
+
+	std::vector<VkDescriptorSetLayout> layouts(_levelCount, _setLayout);
+	_sets.resize(_levelCount);
+	VkDescriptorSetAllocateInfo allocInfo{};
+	allocInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
+	allocInfo.descriptorPool = _descriptorPool;
+	allocInfo.descriptorSetCount = _levelCount;
+	allocInfo.pSetLayouts = layouts.data();
+	VK_CHECK(vkAllocateDescriptorSets(device, &allocInfo, _sets.data()))
+
+	for (uint32_t level = 0; level < _levelCount; level++) {
+		VkDescriptorImageInfo source{ _sampler, level == 0 ? depthView : _levelViews[level - 1],
+			level == 0 ? VK_IMAGE_LAYOUT_DEPTH_STENCIL_READ_ONLY_OPTIMAL : VK_IMAGE_LAYOUT_GENERAL };
+		VkDescriptorImageInfo target{ VK_NULL_HANDLE, _levelViews[level], VK_IMAGE_LAYOUT_GENERAL };
+		VkWriteDescriptorSet writes[2] = {
+			vkinit::write_descriptor_image(VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, _sets[level], &source, 0),
+			vkinit::write_descriptor_image(VK_DESCRIPTOR_TYPE_STORAGE_IMAGE, _sets[level], &target, 1),
+		};
+		vkUpdateDescriptorSets(device, 2, writes, 0, nullptr);
+	}
+	std::cout << "depth pyramid: " << _levelCount << " levels from " << (width + 1) / 2 << "x" << (height + 1) / 2 << std::endl;
+}
+
+void DepthPyramid::cleanup()
+{
+	if (_engine == nullptr) {
+		return;
+	}
+	VkDevice device = _engine->_device;
+	if (_pipeline != VK_NULL_HANDLE) {
+		vkDestroyPipeline(device, _pipeline, nullptr);
+		vkDestroyPipelineLayout(device, _pipelineLayout, nullptr);
+		vkDestroyDescriptorSetLayout(device, _setLayout, nullptr);
+		vkDestroyDescriptorPool(device, _descriptorPool, nullptr);
+		_pipeline = VK_NULL_HANDLE;
+	}
+	for (VkImageView view : _levelViews) {
+		vkDestroyImageView(device, view, nullptr);
+	}
+	_levelViews.clear();
+	if (_image != VK_NULL_HANDLE) {
+		vkDestroyImageView(device, _view, nullptr);
+		vkDestroyImage(device, _image, nullptr);
+		_engine->_allocator.free(_mem);
+		_image = VK_NULL_HANDLE;
+	}
+}
+
+void DepthPyramid::record(VkCommandBuffer cmd)
+{
+	if (_pipeline == VK_NULL_HANDLE) {
+		return;
+	}
+
+	//the depth becomes readable once the render pass is done writing it. the pyramid was last read by the culling
+	VkImageMemoryBarrier barriers[2] = {};
+	for (VkImageMemoryBarrier& barrier : barriers) {
+		barrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+		barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+		barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+	}
+	barriers[0].srcAccessMask = VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT;
+	barriers[0].dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
+	barriers[0].oldLayout = VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL;
+	barriers[0].newLayout = VK_IMAGE_LAYOUT_DEPTH_STENCIL_READ_ONLY_OPTIMAL;
+	barriers[0].image = _depthImage;
+	barriers[0].subresourceRange = { _depthAspect, 0, 1, 0, 1 };
+	barriers[1].srcAccessMask = VK_ACCESS_SHADER_READ_BIT;
+	barriers[1].dstAccessMask = VK_ACCESS_SHADER_WRITE_BIT;
+	barriers[1].oldLayout = VK_IMAGE_LAYOUT_GENERAL;
+	barriers[1].newLayout = VK_IMAGE_LAYOUT_GENERAL;
+	barriers[1].image = _image;
+	barriers[1].subresourceRange = { VK_IMAGE_ASPECT_COLOR_BIT, 0, _levelCount, 0, 1 };
+	vkCmdPipelineBarrier(cmd, VK_PIPELINE_STAGE_EARLY_FRAGMENT_TESTS_BIT | VK_PIPELINE_STAGE_LATE_FRAGMENT_TESTS_BIT | VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+		VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, 0, 0, nullptr, 0, nullptr, 2, barriers);
+
+	vkCmdBindPipeline(cmd, VK_PIPELINE_BIND_POINT_COMPUTE, _pipeline);
+	uint32_t sourceWidth = _width, sourceHeight = _height;
+	for (uint32_t level = 0; level < _levelCount; level++) {
+		ReduceConstants constants{ { sourceWidth, sourceHeight }, { (sourceWidth + 1) / 2, (sourceHeight + 1) / 2 } };
+		vkCmdBindDescriptorSets(cmd, VK_PIPELINE_BIND_POINT_COMPUTE, _pipelineLayout, 0, 1, &_sets[level], 0, nullptr);
+		vkCmdPushConstants(cmd, _pipelineLayout, VK_SHADER_STAGE_COMPUTE_BIT, 0, sizeof(ReduceConstants), &constants);
+		vkCmdDispatch(cmd, (constants.size[0] + REDUCE_GROUP_SIZE - 1) / REDUCE_GROUP_SIZE, (constants.size[1] + REDUCE_GROUP_SIZE - 1) / REDUCE_GROUP_SIZE, 1);
+
+		//the next level reads this one
+		VkImageMemoryBarrier levelBarrier = barriers[1];
+		levelBarrier.srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT;
+		levelBarrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
+		levelBarrier.subresourceRange = { VK_IMAGE_ASPECT_COLOR_BIT, level, 1, 0, 1 };
+		vkCmdPipelineBarrier(cmd, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, 0, 0, nullptr, 0, nullptr, 1, &levelBarrier);
+		sourceWidth = constants.size[0];
+		sourceHeight = constants.size[1];
+	}
+
+	//the second render pass loads the depth again
+	barriers[0].srcAccessMask = 0;
+	barriers[0].dstAccessMask = VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_READ_BIT | VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT;
+	barriers[0].oldLayout = VK_IMAGE_LAYOUT_DEPTH_STENCIL_READ_ONLY_OPTIMAL;
+	barriers[0].newLayout = VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL;
+	vkCmdPipelineBarrier(cmd, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_PIPELINE_STAGE_EARLY_FRAGMENT_TESTS_BIT | VK_PIPELINE_STAGE_LATE_FRAGMENT_TESTS_BIT,
+		0, 0, nullptr, 0, nullptr, 1, &barriers[0]);
+}
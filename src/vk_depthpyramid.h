@@ -0,0 +1,60 @@
+#pragma once
+
+#include <vk_types.h>
+#include <vk_allocator.h>
+#include <vector>
+#include <cstdint>
+
+class VulkanEngine;
+
+//the depth attachment reduced to a vkhiz pyramid on the GPU, one compute dispatch of shaders/depth_reduce.comp per
+//level. the image is R32_SFLOAT with a mip per level and stays in VK_IMAGE_LAYOUT_GENERAL. it is created even without
+//the shader so descriptors can always point at it, ready() tells whether it is ever filled
+class DepthPyramid {
+public:
+	//local_size_x/y of depth_reduce.comp
+	static const uint32_t REDUCE_GROUP_SIZE = 8;
+
+	//reduceShader is depth_reduce.comp or VK_NULL_HANDLE, the caller keeps it. depth is the width x height depth
+	//attachment the pyramid is built from, it needs VK_IMAGE_USAGE_SAMPLED_BIT and a depth only view
+	void init(VulkanEngine& engine, VkShaderModule reduceShader, VkImage depthImage, VkImageView depthView, VkFormat depthFormat,
+		uint32_t width, uint32_t height);
+
+	void cleanup();
+
+	//outside of a render pass, after one that stored the depth and left it in DEPTH_STENCIL_ATTACHMENT_OPTIMAL.
+	//the depth is back in that layout afterwards and the pyramid can be read by compute shaders
+	void record(VkCommandBuffer cmd);
+
+	bool ready() const { return _pipeline != VK_NULL_HANDLE; }
+
+	//all levels, for texelFetch with the level as lod
+	VkImageView view() const { return _view; }
+	VkSampler sampler() const { return _sampler; }
+	//size of the depth buffer, level 0 is half of it
+	uint32_t width() const { return _width; }
+	uint32_t height() const { return _height; }
+	uint32_t levelCount() const { return _levelCount; }
+
+private:
+	VulkanEngine* _engine{ nullptr };
+	VkImage _depthImage{ VK_NULL_HANDLE };
+	VkImageAspectFlags _depthAspect{ VK_IMAGE_ASPECT_DEPTH_BIT };
+	uint32_t _width{ 0 };
+	uint32_t _height{ 0 };
+	uint32_t _levelCount{ 0 };
+
+	VkImage _image{ VK_NULL_HANDLE };
+	Allocation _mem{};
+	VkImageView _view{ VK_NULL_HANDLE };
+	//one single mip view per level, written as storage image and read by the next level
+	std::vector<VkImageView> _levelViews;
+	VkSampler _sampler{ VK_NULL_HANDLE };
+
+	VkDescriptorPool _descriptorPool{ VK_NULL_HANDLE };
+	VkDescriptorSetLayout _setLayout{ VK_NULL_HANDLE };
+	VkPipelineLayout _pipelineLayout{ VK_NULL_HANDLE };
+	VkPipeline _pipeline{ VK_NULL_HANDLE };
+	//set l reads the depth or level l - 1 and writes level l
+	std::vector<VkDescriptorSet> _sets;
+};
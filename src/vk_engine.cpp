@@ -14,19 +14,8 @@
 #include <algorithm>
 constexpr bool bUseValidationLayers = true;
 
-//we want to immediately abort when there is an error. In normal engines this would give an error message to the user, or perform a dump of state.
 using namespace std;
 #define SHADOWMAP_DIM 2048
-#define VK_CHECK(x)                                                 \
-	do                                                              \
-	{                                                               \
-		VkResult err = x;                                           \
-		if (err)                                                    \
-		{                                                           \
-			std::cout <<"Detected Vulkan error: " << err << std::endl; \
-			abort();                                                \
-		}                                                           \
-	} while (0);
 
 
 void VulkanEngine::mouse_callback()
@@ -45,6 +34,8 @@ void VulkanEngine::keyboard_callback()
 
 
 void VulkanEngine::init(){
+	_initStartCounter = SDL_GetPerformanceCounter();
+	_framesInFlight = std::clamp(_framesInFlight, 2u, MAX_FRAMES_IN_FLIGHT);
     if(SDL_Init(SDL_INIT_VIDEO|SDL_INIT_JOYSTICK)<0)
 		std::cout<<"INIT JOYSTICK FAILED"<<std::endl;
 	//SDL_SetRelativeMouseMode(SDL_TRUE);
@@ -72,6 +63,8 @@ void VulkanEngine::init(){
 		}
 	}
 
+	_threadPool.init();
+
 	init_camera();
 
     init_vulkan();
@@ -94,20 +87,22 @@ void VulkanEngine::init(){
 
     init_pipelines();
 
+	//textures are recorded and submitted first so the copies overlap with mesh loading on the CPU
 	load_texture();
+	_uploadQueue.submit();
 
 	load_meshes();
+	_uploadQueue.flush();
+	_uploadQueue.printStats();
 
 	init_scene();
 
 	init_imgui();
 
-	
+	_allocator.printStats();
 
 	//testGLTF.engine = *this;
 
-    buildCommandBuffer();
-
     _isInitialized = true;
 }
 
@@ -118,107 +113,16 @@ void VulkanEngine::cleanup(){
 
         _mainDeletionQueue.flush();
 
+		_samplerCache.cleanup();
+        _allocator.cleanup();
+
         vkDestroySurfaceKHR(_instance,_surface,nullptr);
         vkDestroyDevice(_device,nullptr);
         vkDestroyInstance(_instance,nullptr);
         SDL_DestroyWindow(_window);
         SDL_Quit();
     }
-}
-
-void VulkanEngine::draw(){
-    	//check if window is minimized and skip drawing
-	if (SDL_GetWindowFlags(_window) & SDL_WINDOW_MINIMIZED)
-		return;
-
-	//wait until the gpu has finished rendering the last frame. Timeout of 1 second
-	VK_CHECK(vkWaitForFences(_device, 1, &_renderFence, true, 1000000000));
-	VK_CHECK(vkResetFences(_device, 1, &_renderFence));
-
-	//now that we are sure that the commands finished executing, we can safely reset the command buffer to begin recording again.
-	VK_CHECK(vkResetCommandBuffer(_mainCommandBuffer, 0));
-
-	//request image from the swapchain
-	uint32_t swapchainImageIndex;
-	VK_CHECK(vkAcquireNextImageKHR(_device, _swapchain, 1000000000, _presentSemaphore, VK_NULL_HANDLE, &swapchainImageIndex));
-
-	//naming it cmd for shorter writing
-	VkCommandBuffer cmd = _mainCommandBuffer;
-
-	//begin the command buffer recording. We will use this command buffer exactly once, so we want to let vulkan know that
-	VkCommandBufferBeginInfo cmdBeginInfo = vkinit::command_buffer_begin_info(VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT);
-
-	VK_CHECK(vkBeginCommandBuffer(cmd, &cmdBeginInfo));
-
-	//make a clear-color from frame number. This will flash with a 120 frame period.
-	VkClearValue clearValue;
-	float flash = std::abs(std::sin(_frameNumber / 120.f));
-	clearValue.color = { { 0.0f, 0.0f, flash, 1.0f } };
-
-	//start the main renderpass. 
-	//We will use the clear color from above, and the framebuffer of the index the swapchain gave us
-	VkRenderPassBeginInfo rpInfo = vkinit::renderpass_begin_info(_renderPass, _windowExtent, _framebuffers[swapchainImageIndex]);
-
-	//connect clear values
-	rpInfo.clearValueCount = 1;
-	rpInfo.pClearValues = &clearValue;
-
-	vkCmdBeginRenderPass(cmd, &rpInfo, VK_SUBPASS_CONTENTS_INLINE);
-
-
-	//once we start adding rendering commands, they will go here
-	if (_selectedShader == 0)
-	{
-		vkCmdBindPipeline(cmd, VK_PIPELINE_BIND_POINT_GRAPHICS, _trianglePipeline);
-	}
-	else
-	{
-		vkCmdBindPipeline(cmd, VK_PIPELINE_BIND_POINT_GRAPHICS, _redTrianglePipeline);
-	}
-	vkCmdDraw(cmd, 3, 1, 0, 0);
-
-	//finalize the render pass
-	vkCmdEndRenderPass(cmd);
-	//finalize the command buffer (we can no longer add commands, but it can now be executed)
-	VK_CHECK(vkEndCommandBuffer(cmd));
-
-	//prepare the submission to the queue. 
-	//we want to wait on the _presentSemaphore, as that semaphore is signaled when the swapchain is ready
-	//we will signal the _renderSemaphore, to signal that rendering has finished
-
-	VkSubmitInfo submit = vkinit::submit_info(&cmd);
-	VkPipelineStageFlags waitStage = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT;
-
-	submit.pWaitDstStageMask = &waitStage;
-
-	submit.waitSemaphoreCount = 1;
-	submit.pWaitSemaphores = &_presentSemaphore;
-
-	submit.signalSemaphoreCount = 1;
-	submit.pSignalSemaphores = &_renderSemaphore;
-
-	//submit command buffer to the queue and execute it.
-	// _renderFence will now block until the graphic commands finish execution
-	VK_CHECK(vkQueueSubmit(_graphicsQueue, 1, &submit, _renderFence));
-
-	//prepare present
-	// this will put the image we just rendered to into the visible window.
-	// we want to wait on the _renderSemaphore for that, 
-	// as its necessary that drawing commands have finished before the image is displayed to the user
-	VkPresentInfoKHR presentInfo = vkinit::present_info();
-
-	presentInfo.pSwapchains = &_swapchain;
-	presentInfo.swapchainCount = 1;
-
-	presentInfo.pWaitSemaphores = &_renderSemaphore;
-	presentInfo.waitSemaphoreCount = 1;
-
-	presentInfo.pImageIndices = &swapchainImageIndex;
-
-	VK_CHECK(vkQueuePresentKHR(_graphicsQueue, &presentInfo));
-
-	//increase the number of frames drawn
-	_frameNumber++;
+    _threadPool.cleanup();
 }
 
 void VulkanEngine::run(){
@@ -251,6 +155,10 @@ void VulkanEngine::run(){
 				bQuit = true;
 			}
             if(e.type == SDL_QUIT) bQuit = true;
+			if(e.type == SDL_MOUSEBUTTONDOWN && e.button.button == SDL_BUTTON_LEFT)
+			{
+				_pickedRenderable = pick_renderable(e.button.x, e.button.y);
+			}
 
 			if( e.type == SDL_JOYAXISMOTION )
 			{
@@ -276,10 +184,63 @@ void VulkanEngine::run(){
 
         // //imgui commands
         ImGui::ShowDemoWindow();
+		TextureStreamer::Stats streaming = _textureStreamer.stats();
+		ImGui::Begin("Texture streaming");
+		ImGui::Text("%u/%u textures fully resident, %u uploading", streaming.fullyResident, streaming.textureCount, streaming.pendingUploads);
+		ImGui::Text("resident %.1f MiB (+%.1f MiB uploading) of %.1f MiB budget", streaming.residentBytes / 1048576.0,
+			streaming.pendingBytes / 1048576.0, streaming.budgetBytes / 1048576.0);
+		ImGui::Text("all mips %.1f MiB, streamed %.1f MiB", streaming.fullBytes / 1048576.0, streaming.uploadedBytes / 1048576.0);
+		ImGui::Text("%u loads, %u evictions, %u over budget", streaming.loads, streaming.evictions, streaming.budgetMisses);
+		ImGui::End();
+		ImGui::Begin("Draw queue");
+		ImGui::Text("%u draws, %u state changes", _drawStats.draws, _drawStats.stateChanges());
+		ImGui::Text("binds: %u pipeline, %u descriptor set, %u vertex, %u index", _drawStats.pipelineBinds, _drawStats.descriptorSetBinds,
+			_drawStats.vertexBufferBinds, _drawStats.indexBufferBinds);
+		ImGui::Text("%u push constants, %u instanced draws of %u objects", _drawStats.pushConstants, _drawStats.instancedDraws, _drawStats.instances);
+		ImGui::Checkbox("Parallel recording", &_parallelRecording);
+		ImGui::Text("recorded in %.2f ms, %u secondary command buffers", _drawRecordMs, _recordChunks);
+		ImGui::Checkbox("LOD selection", &_lodSelection);
+		if (_pickedRenderable >= 0) {
+			ImGui::Text("picked renderable %d, LOD %u", _pickedRenderable, _renderables[_pickedRenderable].lod);
+		}
+		else {
+			ImGui::Text("nothing picked");
+		}
+		ImGui::Text("%llu triangles submitted, %llu without LOD", (unsigned long long)_drawStats.triangles,
+			(unsigned long long)_drawStats.fullDetailTriangles);
+		if (_indirectRenderer.ready()) {
+			IndirectRenderer::Stats indirect = _indirectRenderer.stats();
+			ImGui::Checkbox("GPU driven", &_gpuDriven);
+			ImGui::Text("%u objects in %u indirect draws, %u meshes in %.1f KiB", indirect.objects, indirect.groups, indirect.meshes,
+				(indirect.vertexBytes + indirect.indexBytes) / 1024.0);
+			ImGui::Text("%u object updates, %u LOD ranges", indirect.objectUploads, indirect.lodRanges);
+			ImGui::Text("GPU: %llu triangles submitted, %llu without LOD", (unsigned long long)indirect.triangles,
+				(unsigned long long)indirect.fullDetailTriangles);
+			if (_depthPyramid.ready()) {
+				ImGui::Checkbox("Occlusion culling", &_occlusionCulling);
+				ImGui::Text("%u objects occluded, %u drawn in the late phase", indirect.occluded, indirect.disoccluded);
+			}
+		}
+		ClusterCuller::Stats clusters = _clusterCuller.stats();
+		if (clusters.meshes > 0) {
+			ImGui::Checkbox("Meshlet culling", &_meshletCulling);
+			ImGui::Checkbox("Meshlet cone culling", &_meshletConeCulling);
+			ImGui::Text("%u meshes, %u meshlets, culled on the %s", clusters.meshes, clusters.meshlets, clusters.gpuCulling ? "GPU" : "CPU");
+			ImGui::Text("%u draws testing %u clusters of %llu triangles, %u over capacity", clusters.draws, clusters.clustersTested,
+				(unsigned long long)clusters.trianglesTested, clusters.overflows);
+			if (!clusters.gpuCulling) {
+				ImGui::Text("%u clusters with %llu triangles kept", clusters.clustersKept, (unsigned long long)clusters.trianglesKept);
+			}
+		}
+		ImGui::End();
 		ImGui::Render();
         ImDrawData* draw_data = ImGui::GetDrawData();
-		updateUniformBuffer();
-        //updateFrame();
+		//the skybox surrounds the camera, it always wants its top mip
+		_textureStreamer.setView(_camera.Position, _windowExtent.height * 0.5f * std::abs(_shaderData._cameraData.proj[1][1]));
+		uint32_t streamedSkybox = _textureStreamer.find("skybox");
+		if (streamedSkybox != TextureStreamer::INVALID_TEXTURE) {
+			_textureStreamer.requestTexture(streamedSkybox, _camera.Position, 1.0f);
+		}
 		reBuildCommandBuffer(draw_data);
     }
 }
@@ -320,26 +281,77 @@ void VulkanEngine::init_vulkan(){
     vkGetPhysicalDeviceProperties(_chosenGPU,&physicalDevicePops);
 
     std::cout<<physicalDevicePops.deviceName<<std::endl;
+	_minUniformAlignment = std::max<VkDeviceSize>(physicalDevicePops.limits.minUniformBufferOffsetAlignment, 1);
+	_minStorageAlignment = std::max<VkDeviceSize>(physicalDevicePops.limits.minStorageBufferOffsetAlignment, 1);
 
     findQueueIndex();
 
+    std::vector<VkDeviceQueueCreateInfo> queueInfos;
     VkDeviceQueueCreateInfo queueInfo{};
     float queuePriority = 1.0f;
     queueInfo.sType = VK_STRUCTURE_TYPE_DEVICE_QUEUE_CREATE_INFO;
     queueInfo.queueCount = 1;
     queueInfo.pQueuePriorities = &queuePriority;
     queueInfo.queueFamilyIndex = _graphicsQueueFamily;
+    queueInfos.push_back(queueInfo);
+
+    if(_transferQueueFamily != _graphicsQueueFamily)
+    {
+        queueInfo.queueFamilyIndex = _transferQueueFamily;
+        queueInfos.push_back(queueInfo);
+    }
+
+    //only features that are used get enabled
+    VkPhysicalDeviceFeatures supportedFeatures{};
+    vkGetPhysicalDeviceFeatures(_chosenGPU,&supportedFeatures);
+    VkPhysicalDeviceFeatures enabledFeatures{};
+    if(supportedFeatures.samplerAnisotropy)
+    {
+        enabledFeatures.samplerAnisotropy = VK_TRUE;
+        _maxSamplerAnisotropy = physicalDevicePops.limits.maxSamplerAnisotropy;
+    }
+    if(supportedFeatures.textureCompressionBC)
+    {
+        enabledFeatures.textureCompressionBC = VK_TRUE;
+        _supportsBC = true;
+    }
+
+    //the GPU driven path writes its draws, with firstInstance selecting the object, and their count on the GPU
+    VkPhysicalDeviceVulkan12Features enabledFeatures12{};
+    enabledFeatures12.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_VULKAN_1_2_FEATURES;
+    if(physicalDevicePops.apiVersion >= VK_API_VERSION_1_2)
+    {
+        VkPhysicalDeviceVulkan12Features supportedFeatures12{};
+        supportedFeatures12.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_VULKAN_1_2_FEATURES;
+        VkPhysicalDeviceFeatures2 supportedFeatures2{};
+        supportedFeatures2.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_FEATURES_2;
+        supportedFeatures2.pNext = &supportedFeatures12;
+        vkGetPhysicalDeviceFeatures2(_chosenGPU,&supportedFeatures2);
+        if(supportedFeatures12.drawIndirectCount && supportedFeatures.multiDrawIndirect && supportedFeatures.drawIndirectFirstInstance)
+        {
+            enabledFeatures12.drawIndirectCount = VK_TRUE;
+            enabledFeatures.multiDrawIndirect = VK_TRUE;
+            enabledFeatures.drawIndirectFirstInstance = VK_TRUE;
+            _supportsIndirectCount = true;
+        }
+    }
 
     std::vector<const char*> arr = {VK_KHR_SWAPCHAIN_EXTENSION_NAME};
     VkDeviceCreateInfo deviceInfo{};
     deviceInfo.sType = VK_STRUCTURE_TYPE_DEVICE_CREATE_INFO;
-    deviceInfo.queueCreateInfoCount = 1;
-    deviceInfo.pQueueCreateInfos = &queueInfo;
+    deviceInfo.queueCreateInfoCount = queueInfos.size();
+    deviceInfo.pQueueCreateInfos = queueInfos.data();
     deviceInfo.enabledExtensionCount = 1;
     deviceInfo.ppEnabledExtensionNames = arr.data();
+    deviceInfo.pEnabledFeatures = &enabledFeatures;
+    deviceInfo.pNext = _supportsIndirectCount ? &enabledFeatures12 : nullptr;
 
     VK_CHECK(vkCreateDevice(_chosenGPU,&deviceInfo,nullptr,&_device))
     vkGetDeviceQueue(_device,_graphicsQueueFamily,0,&_graphicsQueue);
+    vkGetDeviceQueue(_device,_transferQueueFamily,0,&_transferQueue);
+
+    _allocator.init(_chosenGPU,_device);
+	_samplerCache.init(_device);
 }
 
 void VulkanEngine::init_swapchain(){
@@ -382,15 +394,27 @@ void VulkanEngine::init_swapchain(){
 }
 
 void VulkanEngine::init_default_renderpass(){
+    _renderPass = create_main_renderpass(false, true);
+	_earlyRenderPass = create_main_renderpass(false, false);
+	_lateRenderPass = create_main_renderpass(true, true);
+
+    _mainDeletionQueue.push_function([=](){
+        vkDestroyRenderPass(_device,_renderPass,nullptr);
+		vkDestroyRenderPass(_device,_earlyRenderPass,nullptr);
+		vkDestroyRenderPass(_device,_lateRenderPass,nullptr);
+    });
+}
+
+VkRenderPass VulkanEngine::create_main_renderpass(bool load, bool present){
     VkAttachmentDescription color_attachment{};
     color_attachment.format = _swapchainImageFormat;
-    color_attachment.loadOp = VK_ATTACHMENT_LOAD_OP_CLEAR;
+    color_attachment.loadOp = load ? VK_ATTACHMENT_LOAD_OP_LOAD : VK_ATTACHMENT_LOAD_OP_CLEAR;
     color_attachment.samples = VK_SAMPLE_COUNT_1_BIT;
     color_attachment.storeOp = VK_ATTACHMENT_STORE_OP_STORE;
     color_attachment.stencilLoadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE;
     color_attachment.stencilStoreOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
-    color_attachment.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
-    color_attachment.finalLayout = VK_IMAGE_LAYOUT_PRESENT_SRC_KHR;
+    color_attachment.initialLayout = load ? VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL : VK_IMAGE_LAYOUT_UNDEFINED;
+    color_attachment.finalLayout = present ? VK_IMAGE_LAYOUT_PRESENT_SRC_KHR : VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL;
 
     VkAttachmentReference color_attachment_ref{};
     color_attachment_ref.attachment = 0;
@@ -401,11 +425,11 @@ void VulkanEngine::init_default_renderpass(){
 	depth_attachment.format = _depthStencil.format;
 	depth_attachment.flags = 0;
 	depth_attachment.samples = VK_SAMPLE_COUNT_1_BIT;
-	depth_attachment.loadOp = VK_ATTACHMENT_LOAD_OP_CLEAR;
+	depth_attachment.loadOp = load ? VK_ATTACHMENT_LOAD_OP_LOAD : VK_ATTACHMENT_LOAD_OP_CLEAR;
 	depth_attachment.storeOp = VK_ATTACHMENT_STORE_OP_STORE;
-	depth_attachment.stencilLoadOp = VK_ATTACHMENT_LOAD_OP_CLEAR;
-	depth_attachment.stencilStoreOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
-	depth_attachment.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+	depth_attachment.stencilLoadOp = load ? VK_ATTACHMENT_LOAD_OP_LOAD : VK_ATTACHMENT_LOAD_OP_CLEAR;
+	depth_attachment.stencilStoreOp = present ? VK_ATTACHMENT_STORE_OP_DONT_CARE : VK_ATTACHMENT_STORE_OP_STORE;
+	depth_attachment.initialLayout = load ? VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL : VK_IMAGE_LAYOUT_UNDEFINED;
 	depth_attachment.finalLayout = VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL;
 
 	VkAttachmentReference depth_attachment_ref{};
@@ -418,13 +442,14 @@ void VulkanEngine::init_default_renderpass(){
     subpass.pColorAttachments = &color_attachment_ref;
 	subpass.pDepthStencilAttachment = &depth_attachment_ref;
     
+    //a loading pass also waits for the color writes of the pass before it
     VkSubpassDependency dependency{};
     dependency.srcSubpass = VK_SUBPASS_EXTERNAL;
     dependency.dstSubpass = 0;
     dependency.srcStageMask = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT;
-    dependency.srcAccessMask = 0;
+    dependency.srcAccessMask = load ? VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT : 0;
     dependency.dstStageMask = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT;
-    dependency.dstAccessMask = VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT;
+    dependency.dstAccessMask = VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT | (load ? VK_ACCESS_COLOR_ATTACHMENT_READ_BIT : 0);
 
 	VkSubpassDependency depth_dependency = {};
 	depth_dependency.srcSubpass = VK_SUBPASS_EXTERNAL;
@@ -445,11 +470,9 @@ void VulkanEngine::init_default_renderpass(){
     renderpassInfo.subpassCount = 1;
     renderpassInfo.pSubpasses = &subpass;
 
-    VK_CHECK(vkCreateRenderPass(_device,&renderpassInfo,nullptr,&_renderPass))
-
-    _mainDeletionQueue.push_function([=](){
-        vkDestroyRenderPass(_device,_renderPass,nullptr);
-    });
+	VkRenderPass renderPass;
+    VK_CHECK(vkCreateRenderPass(_device,&renderpassInfo,nullptr,&renderPass))
+	return renderPass;
 }
 
 void VulkanEngine::init_framebuffers(){
@@ -478,65 +501,70 @@ void VulkanEngine::init_commands(){
     VkCommandPoolCreateInfo commandPoolInfo = vkinit::command_pool_create_info(_graphicsQueueFamily,VK_COMMAND_POOL_CREATE_RESET_COMMAND_BUFFER_BIT);
     VK_CHECK(vkCreateCommandPool(_device,&commandPoolInfo,nullptr,&_commandPool))
 
-    VkCommandBufferAllocateInfo cmdAllocInfo = vkinit::command_buffer_allocate_info(_commandPool, 1);
-
-	VK_CHECK(vkAllocateCommandBuffers(_device, &cmdAllocInfo, &_mainCommandBuffer));
+	//the frame pools are reset as a whole once their fence has signaled, their buffers are never reset one by one
+	VkCommandPoolCreateInfo framePoolInfo = vkinit::command_pool_create_info(_graphicsQueueFamily,VK_COMMAND_POOL_CREATE_TRANSIENT_BIT);
+	for(uint32_t i = 0; i < _framesInFlight; i++)
+	{
+		FrameData& frame = _frames[i];
+		VK_CHECK(vkCreateCommandPool(_device,&framePoolInfo,nullptr,&frame.commandPool))
+		VkCommandBufferAllocateInfo cmdAllocInfo = vkinit::command_buffer_allocate_info(frame.commandPool, 1);
+		VK_CHECK(vkAllocateCommandBuffers(_device, &cmdAllocInfo, &frame.commandBuffer));
+		VkCommandBufferAllocateInfo passAllocInfo = vkinit::command_buffer_allocate_info(frame.commandPool, 1, VK_COMMAND_BUFFER_LEVEL_SECONDARY);
+		VK_CHECK(vkAllocateCommandBuffers(_device, &passAllocInfo, &frame.passBuffer));
+
+		//one pool per thread that can take part in the parallel recording
+		frame.recordPools.resize(_threadPool.concurrency());
+		frame.recordBuffers.resize(frame.recordPools.size());
+		for(size_t chunk = 0; chunk < frame.recordPools.size(); chunk++)
+		{
+			VK_CHECK(vkCreateCommandPool(_device,&framePoolInfo,nullptr,&frame.recordPools[chunk]))
+			VkCommandBufferAllocateInfo recordAllocInfo = vkinit::command_buffer_allocate_info(frame.recordPools[chunk], 1, VK_COMMAND_BUFFER_LEVEL_SECONDARY);
+			VK_CHECK(vkAllocateCommandBuffers(_device, &recordAllocInfo, &frame.recordBuffers[chunk]));
+		}
+	}
+	_uploadQueue.init(_device,_allocator,_stagingRingSize,_graphicsQueueFamily,_graphicsQueue,_transferQueueFamily,_transferQueue);
 
-    flightCmdBuffers.resize(_framebuffers.size());
-    for(auto& cmd :flightCmdBuffers)
-    {
-        VK_CHECK(vkAllocateCommandBuffers(_device, &cmdAllocInfo, &cmd));
-    }
 	_mainDeletionQueue.push_function([=]() {
-        vkFreeCommandBuffers(_device,_commandPool,flightCmdBuffers.size(),flightCmdBuffers.data());
-        vkFreeCommandBuffers(_device,_commandPool,1,&_mainCommandBuffer);
+		_uploadQueue.cleanup();
+		for(uint32_t i = 0; i < _framesInFlight; i++)
+		{
+			vkDestroyCommandPool(_device, _frames[i].commandPool, nullptr);
+			for(VkCommandPool pool : _frames[i].recordPools)
+			{
+				vkDestroyCommandPool(_device, pool, nullptr);
+			}
+		}
 		vkDestroyCommandPool(_device, _commandPool, nullptr);
 	});
 }
 
 void VulkanEngine::init_sync_structures(){
+	//signaled, so the first wait on every frame returns at once
     VkFenceCreateInfo fenceCreateInfo = vkinit::fence_create_info(VK_FENCE_CREATE_SIGNALED_BIT);
-
-	VK_CHECK(vkCreateFence(_device, &fenceCreateInfo, nullptr, &_renderFence));
-	_renderFences.resize(2);
-	for(int i = 0; i < 2; i++)
-	{
-		VK_CHECK(vkCreateFence(_device, &fenceCreateInfo, nullptr, &_renderFences[i]));
-		_mainDeletionQueue.push_function([=]() {
-		vkDestroyFence(_device, _renderFences[i], nullptr);
-		});
-	}
-
-	//enqueue the destruction of the fence
-	_mainDeletionQueue.push_function([=]() {
-		vkDestroyFence(_device, _renderFence, nullptr);
-		});
 	VkSemaphoreCreateInfo semaphoreCreateInfo = vkinit::semaphore_create_info();
 
-	VK_CHECK(vkCreateSemaphore(_device, &semaphoreCreateInfo, nullptr, &_presentSemaphore));
-	VK_CHECK(vkCreateSemaphore(_device, &semaphoreCreateInfo, nullptr, &_renderSemaphore));
-	
-	//enqueue the destruction of semaphores
-	_mainDeletionQueue.push_function([=]() {
-		vkDestroySemaphore(_device, _presentSemaphore, nullptr);
-		vkDestroySemaphore(_device, _renderSemaphore, nullptr);
-		});
-
-	_presentSemaphores.resize(2);
-	_renderSemaphores.resize(2);
-
-	for(int i = 0;i < 2;i++)
+	for(uint32_t i = 0; i < _framesInFlight; i++)
 	{
-		VK_CHECK(vkCreateSemaphore(_device, &semaphoreCreateInfo, nullptr, &_presentSemaphores[i]));
-		VK_CHECK(vkCreateSemaphore(_device, &semaphoreCreateInfo, nullptr, &_renderSemaphores[i]));
+		FrameData& frame = _frames[i];
+		VK_CHECK(vkCreateFence(_device, &fenceCreateInfo, nullptr, &frame.renderFence));
+		VK_CHECK(vkCreateSemaphore(_device, &semaphoreCreateInfo, nullptr, &frame.presentSemaphore));
 
 		_mainDeletionQueue.push_function([=]() {
-		vkDestroySemaphore(_device, _presentSemaphores[i], nullptr);
-		vkDestroySemaphore(_device, _renderSemaphores[i], nullptr);
+		vkDestroyFence(_device, _frames[i].renderFence, nullptr);
+		vkDestroySemaphore(_device, _frames[i].presentSemaphore, nullptr);
 		});
 	}
 
-
+	_renderSemaphores.resize(_swapchainImages.size());
+	for (VkSemaphore& semaphore : _renderSemaphores)
+	{
+		VK_CHECK(vkCreateSemaphore(_device, &semaphoreCreateInfo, nullptr, &semaphore));
+	}
+	_mainDeletionQueue.push_function([=]() {
+		for (VkSemaphore semaphore : _renderSemaphores) {
+			vkDestroySemaphore(_device, semaphore, nullptr);
+		}
+	});
 }
 
 void VulkanEngine::findQueueIndex(){
@@ -554,6 +582,20 @@ void VulkanEngine::findQueueIndex(){
         }
     }
 
+    //prefer a transfer-only family (DMA engine) so uploads run next to rendering
+    _transferQueueFamily = _graphicsQueueFamily;
+    for(uint32_t i = 0 ;i<count;i++)
+    {
+        const auto& prop = queueFamilyProperties[i];
+        if((prop.queueFlags & VK_QUEUE_TRANSFER_BIT) &&
+        !(prop.queueFlags & (VK_QUEUE_GRAPHICS_BIT | VK_QUEUE_COMPUTE_BIT)))
+        {
+            _transferQueueFamily = i;
+            break;
+        }
+    }
+    std::cout<<"graphics queue family "<<_graphicsQueueFamily<<", transfer queue family "<<_transferQueueFamily<<std::endl;
+
 }
 
 void VulkanEngine::querySwapchainSupport(){
@@ -575,7 +617,10 @@ void VulkanEngine::querySwapchainSupport(){
         }
     }
     
-    _details.imageCount = 2;
+    //enough images that every frame in flight can hold one while the presentation engine shows another
+    _details.imageCount = std::max(_details.capabilities.minImageCount, _framesInFlight);
+    if(_details.capabilities.maxImageCount > 0)
+        _details.imageCount = std::min(_details.imageCount, _details.capabilities.maxImageCount);
     _details.imageExtent.width = 1024;
     _details.imageExtent.height = 720;
     _details.transform = _details.capabilities.currentTransform;
@@ -609,6 +654,14 @@ void VulkanEngine::init_pipelines()
 		std::cout << "Error when building the mesh vertex shader module" << std::endl;
 	}
 
+	//optional, materials without an instanced pipeline are drawn one object at a time
+	VkShaderModule instancedVertShader = VK_NULL_HANDLE;
+	if (!load_shader_module("../../shaders/default_instanced.vert.spv", &instancedVertShader))
+	{
+		std::cout << "No instanced vertex shader, instancing disabled" << std::endl;
+		instancedVertShader = VK_NULL_HANDLE;
+	}
+
 	VkShaderModule offscreenVertShader;
 	if(!load_shader_module("../../shaders/offscreen.vert.spv", &offscreenVertShader))
 	{
@@ -684,7 +737,7 @@ void VulkanEngine::init_pipelines()
 
 	//build the mesh pipeline
 
-	VertexInputDescription vertexDescription = Vertex::get_vertex_description();
+	VertexInputDescription vertexDescription = Mesh::vertex_description(_vertexFormat);
 
 	//connect the pipeline builder vertex input info to the one we get from Vertex
 	pipelineBuilder._vertexInputInfo.pVertexAttributeDescriptions = vertexDescription.attributes.data();
@@ -719,8 +772,25 @@ void VulkanEngine::init_pipelines()
 	//pipelineBuilder._rasterizer.cullMode = VK_CULL_MODE_BACK_BIT;
 	VkPipeline defaultPipeline =  pipelineBuilder.build_pipeline(_device,_renderPass);
 
+	//same state with the instance buffer at set 2, set 1 stays the texture set so material sets bind unchanged
+	VkPipelineLayout instancedPipLayout = VK_NULL_HANDLE;
+	VkPipeline instancedPipeline = VK_NULL_HANDLE;
+	if (instancedVertShader != VK_NULL_HANDLE) {
+		std::vector<VkDescriptorSetLayout> instancedLayouts = {_descriptorSetLayout,_textureSetLayout,_instanceSetLayout};
+		mesh_pipeline_layout_info.setLayoutCount = instancedLayouts.size();
+		mesh_pipeline_layout_info.pSetLayouts = instancedLayouts.data();
+		VK_CHECK(vkCreatePipelineLayout(_device,&mesh_pipeline_layout_info,nullptr,&instancedPipLayout))
+
+		pipelineBuilder._shaderStages[0] = vkinit::pipeline_shader_stage_create_info(VK_SHADER_STAGE_VERTEX_BIT,instancedVertShader);
+		pipelineBuilder._pipelineLayout = instancedPipLayout;
+		instancedPipeline = pipelineBuilder.build_pipeline(_device,_renderPass);
+		vkDestroyShaderModule(_device, instancedVertShader, nullptr);
+	}
+
 	create_material(meshPipeline, meshPipLayout, "skyboxmesh");
-	create_material(defaultPipeline,defaultPipLayout,"defaultmesh");
+	Material* defaultMaterial = create_material(defaultPipeline,defaultPipLayout,"defaultmesh");
+	defaultMaterial->instancedPipeline = instancedPipeline;
+	defaultMaterial->instancedPipelineLayout = instancedPipLayout;
 
 	vkDestroyShaderModule(_device, meshVertShader, nullptr);
 	vkDestroyShaderModule(_device, colorMeshShader, nullptr);
@@ -741,7 +811,11 @@ void VulkanEngine::init_pipelines()
 		vkDestroyPipeline(_device, defaultPipeline, nullptr);
 
 		vkDestroyPipelineLayout(_device, defaultPipLayout, nullptr);
-		
+
+		if (instancedPipeline != VK_NULL_HANDLE) {
+			vkDestroyPipeline(_device, instancedPipeline, nullptr);
+			vkDestroyPipelineLayout(_device, instancedPipLayout, nullptr);
+		}
 	});
 }
 
@@ -845,90 +919,34 @@ VkPipeline PipelineBuilder::build_pipeline(VkDevice device, VkRenderPass pass)
 	}
 }
 
-void VulkanEngine::buildCommandBuffer()
-{
-    VkCommandBufferBeginInfo cmdBeginInfo = vkinit::command_buffer_begin_info();
-
-    VkClearValue clearValues[2];
-    //float flash = std::abs(std::sin(_frameNumber / 120.f));
-    clearValues[0].color = { { 0.0f, 0.0f, 0.0f, 1.0f } };
-	clearValues[1].depthStencil = { 1.0f , 0};
-    for(int i = 0; i < flightCmdBuffers.size(); i++)
-    {
-        VK_CHECK(vkBeginCommandBuffer(flightCmdBuffers[i], &cmdBeginInfo));
-        //start the main renderpass. 
-        //We will use the clear color from above, and the framebuffer of the index the swapchain gave us
-        VkRenderPassBeginInfo rpInfo = vkinit::renderpass_begin_info(_renderPass, _windowExtent, _framebuffers[i]);
-
-        //connect clear values
-        rpInfo.clearValueCount = 2;
-        rpInfo.pClearValues = clearValues;
-
-        vkCmdBeginRenderPass(flightCmdBuffers[i], &rpInfo, VK_SUBPASS_CONTENTS_INLINE);
-
-
-        //once we start adding rendering commands, they will go here
-        // if (_selectedShader == 0)
-        // {
-        //     vkCmdBindPipeline(flightCmdBuffers[i], VK_PIPELINE_BIND_POINT_GRAPHICS, _trianglePipeline);
-        // }
-        // else
-        // {
-        //     vkCmdBindPipeline(flightCmdBuffers[i], VK_PIPELINE_BIND_POINT_GRAPHICS, _redTrianglePipeline);
-        // }
-        //vkCmdDraw(flightCmdBuffers[i], 3, 1, 0, 0);
-		draw_objects(flightCmdBuffers[i], _renderables.data(), _renderables.size());
-
-        //finalize the render pass
-		//ImGui_ImplVulkan_RenderDrawData(ImGui::GetDrawData(), flightCmdBuffers[i]);
-        vkCmdEndRenderPass(flightCmdBuffers[i]);
-        //finalize the command buffer (we can no longer add commands, but it can now be executed)
-        VK_CHECK(vkEndCommandBuffer(flightCmdBuffers[i]));
-    }
-}
-
-void VulkanEngine::updateFrame()
-{
-	
-	uint32_t currentFrame = _frameNumber % 2;
-    uint32_t nextImage = 0;
-	VK_CHECK(vkWaitForFences(_device,1,&_renderFences[currentFrame],VK_TRUE,UINT64_MAX));
-	
-	VK_CHECK(vkResetFences(_device,1,&_renderFences[currentFrame]));
-    VK_CHECK(vkAcquireNextImageKHR(_device,_swapchain,UINT64_MAX,_presentSemaphores[currentFrame],VK_NULL_HANDLE,&nextImage))
-    VkSubmitInfo submit{};
-    submit.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
-    submit.commandBufferCount = 1;
-    submit.pCommandBuffers = &flightCmdBuffers[currentFrame];
-    submit.waitSemaphoreCount = 1;
-    submit.pWaitSemaphores = &_presentSemaphores[currentFrame];
-    submit.signalSemaphoreCount = 1;
-    submit.pSignalSemaphores = &_renderSemaphores[currentFrame];
-    VK_CHECK(vkQueueSubmit(_graphicsQueue,1,&submit,_renderFences[currentFrame]))
-
-    VkPresentInfoKHR present{};
-    present.sType = VK_STRUCTURE_TYPE_PRESENT_INFO_KHR;
-    present.pImageIndices = &nextImage;
-    present.swapchainCount = 1;
-    present.pSwapchains = &_swapchain;
-    present.waitSemaphoreCount = 1;
-    present.pWaitSemaphores = &_renderSemaphores[currentFrame];
-    VK_CHECK(vkQueuePresentKHR(_graphicsQueue,&present))
-
-	_frameNumber ++;
-   // vkQueueWaitIdle(_graphicsQueue);
-
-}
-
 void VulkanEngine::reBuildCommandBuffer(ImDrawData* draw_data)
 {
-	uint32_t currentFrame = _frameNumber % 2;
+	uint32_t currentFrame = _frameNumber % _framesInFlight;
+	FrameData& frame = _frames[currentFrame];
+	VkCommandBuffer cmd = frame.commandBuffer;
     uint32_t nextImage = 0;
-	VK_CHECK(vkWaitForFences(_device,1,&_renderFences[currentFrame],VK_TRUE,UINT64_MAX));
-	VK_CHECK(vkResetFences(_device,1,&_renderFences[currentFrame]));
-    VK_CHECK(vkAcquireNextImageKHR(_device,_swapchain,UINT64_MAX,_presentSemaphores[currentFrame],VK_NULL_HANDLE,&nextImage))
+	//everything the frame owns is free again once the GPU is done with its last submit
+	VK_CHECK(vkWaitForFences(_device,1,&frame.renderFence,VK_TRUE,UINT64_MAX));
+	_textureStreamer.update();
+	if (_textureStreamer.hasPendingSwaps()) {
+		//the descriptor sets are shared by the frames in flight, the other frames have to be done with them too.
+		//this only stalls on frames where a streamed texture changes
+		VkFence fences[MAX_FRAMES_IN_FLIGHT];
+		for (uint32_t i = 0; i < _framesInFlight; i++) {
+			fences[i] = _frames[i].renderFence;
+		}
+		VK_CHECK(vkWaitForFences(_device,_framesInFlight,fences,VK_TRUE,UINT64_MAX));
+		_textureStreamer.applySwaps();
+	}
+	VK_CHECK(vkResetFences(_device,1,&frame.renderFence));
+	//the swapchain picks the image, it does not have to follow the frame slot
+    VK_CHECK(vkAcquireNextImageKHR(_device,_swapchain,UINT64_MAX,frame.presentSemaphore,VK_NULL_HANDLE,&nextImage))
 
-	vkResetCommandBuffer(flightCmdBuffers[currentFrame], /*VkCommandBufferResetFlagBits*/ 0);
+	VK_CHECK(vkResetCommandPool(_device, frame.commandPool, 0));
+	for (VkCommandPool pool : frame.recordPools) {
+		VK_CHECK(vkResetCommandPool(_device, pool, 0));
+	}
+	updateUniformBuffer(currentFrame);
 	VkCommandBufferBeginInfo cmdBeginInfo = vkinit::command_buffer_begin_info();
 
     VkClearValue clearValues[2];
@@ -936,46 +954,102 @@ void VulkanEngine::reBuildCommandBuffer(ImDrawData* draw_data)
     clearValues[0].color = { { 0.0f, 0.0f, 0.0f, 1.0f } };
 	clearValues[1].depthStencil = { 1.0f , 0};
     
-	VK_CHECK(vkBeginCommandBuffer(flightCmdBuffers[currentFrame], &cmdBeginInfo));
+	VK_CHECK(vkBeginCommandBuffer(cmd, &cmdBeginInfo));
+	bool gpuDriven = _gpuDriven && _indirectRenderer.ready();
+	bool occlusion = gpuDriven && _occlusionCulling && _depthPyramid.ready();
+	if (gpuDriven) {
+		_indirectRenderer.recordCull(cmd, currentFrame, _shaderData._cameraData.viewproj, lod_view(),
+			occlusion ? IndirectRenderer::PHASE_EARLY : IndirectRenderer::PHASE_ALL);
+		//the few renderables the indirect path cannot take (the skybox, meshes with meshlets) are drawn unculled,
+		//the meshlet ones are culled per cluster below
+		_visibleRenderables.clear();
+		vklod::LodView lodView = lod_view();
+		for (uint32_t renderable : _cpuRenderables) {
+			select_lod(_renderables[renderable], lodView);
+			_visibleRenderables.push_back(_renderables[renderable]);
+		}
+	}
+	else {
+		cull_renderables(_shaderData._cameraData.viewproj);
+	}
+	//the cluster culling writes the index buffers the draws read, it has to be done before the render pass
+	prepare_cluster_draws(cmd, currentFrame);
+	uint64_t recordStart = SDL_GetPerformanceCounter();
+	uint32_t draws = prepare_draws(_visibleRenderables.data(), static_cast<int>(_visibleRenderables.size()), _clusterDraws.data());
+	uint32_t chunks = _parallelRecording ? std::min(_threadPool.concurrency(), draws / std::max(_minDrawsPerChunk, 1u)) : 0;
+	bool parallel = chunks >= 2;
 	//start the main renderpass. 
 	//We will use the clear color from above, and the framebuffer of the index the swapchain gave us
-	VkRenderPassBeginInfo rpInfo = vkinit::renderpass_begin_info(_renderPass, _windowExtent, _framebuffers[currentFrame]);
+	VkFramebuffer framebuffer = _framebuffers[nextImage];
+	VkRenderPassBeginInfo rpInfo = vkinit::renderpass_begin_info(occlusion ? _earlyRenderPass : _renderPass, _windowExtent, framebuffer);
 
 	//connect clear values
 	rpInfo.clearValueCount = 2;
 	rpInfo.pClearValues = clearValues;
 
-	vkCmdBeginRenderPass(flightCmdBuffers[currentFrame], &rpInfo, VK_SUBPASS_CONTENTS_INLINE);
-
-
-	//once we start adding rendering commands, they will go here
-	// if (_selectedShader == 0)
-	// {
-	//     vkCmdBindPipeline(flightCmdBuffers[i], VK_PIPELINE_BIND_POINT_GRAPHICS, _trianglePipeline);
-	// }
-	// else
-	// {
-	//     vkCmdBindPipeline(flightCmdBuffers[i], VK_PIPELINE_BIND_POINT_GRAPHICS, _redTrianglePipeline);
-	// }
-	//vkCmdDraw(flightCmdBuffers[i], 3, 1, 0, 0);
-	draw_objects(flightCmdBuffers[currentFrame], _renderables.data(), _renderables.size());
-	ImGui_ImplVulkan_RenderDrawData(draw_data,flightCmdBuffers[currentFrame]);
+	//a pass run from secondary buffers can not take inline commands, the rest of it goes to passBuffer
+	vkCmdBeginRenderPass(cmd, &rpInfo, parallel ? VK_SUBPASS_CONTENTS_SECONDARY_COMMAND_BUFFERS : VK_SUBPASS_CONTENTS_INLINE);
+	VkCommandBuffer passCmd = cmd;
+	_recordChunks = 0;
+	if (parallel) {
+		_recordChunks = record_draws_parallel(_visibleRenderables.data(), chunks, currentFrame, framebuffer);
+		VkCommandBufferInheritanceInfo inheritance = vkinit::command_buffer_inheritance_info(_renderPass, 0, framebuffer);
+		VkCommandBufferBeginInfo passBeginInfo = vkinit::command_buffer_begin_info(
+			VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT | VK_COMMAND_BUFFER_USAGE_RENDER_PASS_CONTINUE_BIT);
+		passBeginInfo.pInheritanceInfo = &inheritance;
+		passCmd = frame.passBuffer;
+		VK_CHECK(vkBeginCommandBuffer(passCmd, &passBeginInfo));
+	}
+	else {
+		_drawStats = {};
+		record_draws(cmd, _visibleRenderables.data(), 0, draws, currentFrame, _drawStats);
+	}
+	_drawRecordMs = float(double(SDL_GetPerformanceCounter() - recordStart) * 1000.0 / double(SDL_GetPerformanceFrequency()));
+	if (gpuDriven) {
+		_indirectRenderer.recordDraw(passCmd, currentFrame,
+			occlusion ? IndirectRenderer::PHASE_EARLY : IndirectRenderer::PHASE_ALL);
+	}
+	//the draw chunks in order, then the main thread's part of the pass
+	auto executeSecondaries = [&]() {
+		VK_CHECK(vkEndCommandBuffer(frame.passBuffer));
+		std::vector<VkCommandBuffer> secondaries(frame.recordBuffers.begin(), frame.recordBuffers.begin() + _recordChunks);
+		secondaries.push_back(frame.passBuffer);
+		vkCmdExecuteCommands(cmd, static_cast<uint32_t>(secondaries.size()), secondaries.data());
+		passCmd = cmd;
+	};
+	if (occlusion) {
+		if (parallel) {
+			executeSecondaries();
+		}
+		//everything drawn so far is the occluder set, the late phase tests every object against its depth
+		vkCmdEndRenderPass(cmd);
+		_depthPyramid.record(cmd);
+		_indirectRenderer.recordCull(cmd, currentFrame, _shaderData._cameraData.viewproj, lod_view(),
+			IndirectRenderer::PHASE_LATE);
+		rpInfo.renderPass = _lateRenderPass;
+		vkCmdBeginRenderPass(cmd, &rpInfo, VK_SUBPASS_CONTENTS_INLINE);
+		_indirectRenderer.recordDraw(cmd, currentFrame, IndirectRenderer::PHASE_LATE);
+	}
+	ImGui_ImplVulkan_RenderDrawData(draw_data,passCmd);
+	if (passCmd != cmd) {
+		executeSecondaries();
+	}
 	//finalize the render pass
-	//ImGui_ImplVulkan_RenderDrawData(ImGui::GetDrawData(), flightCmdBuffers[i]);
-	vkCmdEndRenderPass(flightCmdBuffers[currentFrame]);
+	//ImGui_ImplVulkan_RenderDrawData(ImGui::GetDrawData(), cmd);
+	vkCmdEndRenderPass(cmd);
 	//finalize the command buffer (we can no longer add commands, but it can now be executed)
-	VK_CHECK(vkEndCommandBuffer(flightCmdBuffers[currentFrame]));
+	VK_CHECK(vkEndCommandBuffer(cmd));
     
 
 	VkSubmitInfo submit{};
     submit.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
     submit.commandBufferCount = 1;
-    submit.pCommandBuffers = &flightCmdBuffers[currentFrame];
+    submit.pCommandBuffers = &cmd;
     submit.waitSemaphoreCount = 1;
-    submit.pWaitSemaphores = &_presentSemaphores[currentFrame];
+    submit.pWaitSemaphores = &frame.presentSemaphore;
     submit.signalSemaphoreCount = 1;
-    submit.pSignalSemaphores = &_renderSemaphores[currentFrame];
-    VK_CHECK(vkQueueSubmit(_graphicsQueue,1,&submit,_renderFences[currentFrame]))
+    submit.pSignalSemaphores = &_renderSemaphores[nextImage];
+    VK_CHECK(vkQueueSubmit(_graphicsQueue,1,&submit,frame.renderFence))
 
     VkPresentInfoKHR present{};
     present.sType = VK_STRUCTURE_TYPE_PRESENT_INFO_KHR;
@@ -983,8 +1057,12 @@ void VulkanEngine::reBuildCommandBuffer(ImDrawData* draw_data)
     present.swapchainCount = 1;
     present.pSwapchains = &_swapchain;
     present.waitSemaphoreCount = 1;
-    present.pWaitSemaphores = &_renderSemaphores[currentFrame];
+    present.pWaitSemaphores = &_renderSemaphores[nextImage];
     VK_CHECK(vkQueuePresentKHR(_graphicsQueue,&present))
+	if (_frameNumber == 0) {
+		double seconds = double(SDL_GetPerformanceCounter() - _initStartCounter) / double(SDL_GetPerformanceFrequency());
+		std::cout << "time to first frame: " << seconds * 1000.0 << " ms" << std::endl;
+	}
 	_frameNumber ++;
 
 }
@@ -1020,52 +1098,322 @@ Mesh* VulkanEngine::get_mesh(const std::string& name)
 	}
 }
 
-void VulkanEngine::draw_objects(VkCommandBuffer cmd, RenderObject* first, int count)
+void VulkanEngine::draw_objects(VkCommandBuffer cmd, RenderObject* first, int count, uint32_t frame, const uint32_t* clusterDraws)
 {
-	glm::vec3 camPos = { 0.f,-6.f,-10.f };
-
-	glm::mat4 view = glm::translate(glm::mat4(1.f), camPos);
-	//camera projection
-	glm::mat4 projection = glm::perspective(glm::radians(70.f), 1700.f / 900.f, 0.1f, 200.0f);
-	projection[1][1] *= -1;
+	uint32_t draws = prepare_draws(first, count, clusterDraws);
+	_drawStats = {};
+	record_draws(cmd, first, 0, draws, frame, _drawStats);
+}
 
-	Mesh* lastMesh = nullptr;
-	Material* lastMaterial = nullptr;
+uint32_t VulkanEngine::prepare_draws(RenderObject* first, int count, const uint32_t* clusterDraws)
+{
+	//sort by state so every bind below happens once per change, the background pass keeps the skybox first
+	glm::vec3 eye = glm::vec3(_shaderData._cameraData.viewPos);
+	_renderQueue.clear();
 	for (int i = 0; i < count; i++)
 	{
-		RenderObject& object = first[i];
-
-		//only bind the pipeline if it doesnt match with the already bound one
-		if (object.material != lastMaterial) {
+		const RenderObject& object = first[i];
+		glm::vec3 center = glm::vec3(object.transformMatrix * glm::vec4((object.mesh->_boundsMin + object.mesh->_boundsMax) * 0.5f, 1.0f));
+		uint32_t pass = object.alwaysVisible ? RenderQueue::PASS_BACKGROUND : RenderQueue::PASS_OPAQUE;
+		uint64_t key = RenderQueue::makeKey(pass, _renderQueue.pipelineId(object.material->pipeline), _renderQueue.setId(object.material->textureSet),
+			_renderQueue.meshId(object.mesh), glm::length(center - eye) / _drawDistance);
+		_renderQueue.push(key, static_cast<uint32_t>(i));
+	}
+	_renderQueue.sort();
 
-			vkCmdBindPipeline(cmd, VK_PIPELINE_BIND_POINT_GRAPHICS, object.material->pipeline);
-			lastMaterial = object.material;
+	//the instance ranges are handed out in order here, so the draws can be recorded in any order afterwards
+	_drawBatches.clear();
+	const std::vector<RenderQueue::DrawItem>& items = _renderQueue.items();
+	uint32_t instanceCount = 0;
+	for (size_t i = 0; i < items.size();)
+	{
+		const RenderObject& object = first[items[i].object];
+		Material* material = object.material;
+		Mesh* mesh = object.mesh;
+		//cluster culled draws read their own index range and count, they are never instanced
+		uint32_t clusterDraw = clusterDraws ? clusterDraws[items[i].object] : ClusterCuller::INVALID_DRAW;
+
+		//equal keys above the depth bits are adjacent after the sort, so a run of one mesh and material is contiguous
+		size_t runEnd = i + 1;
+		if (material->instancedPipeline != VK_NULL_HANDLE && clusterDraw == ClusterCuller::INVALID_DRAW) {
+			while (runEnd < items.size() && first[items[runEnd].object].material == material && first[items[runEnd].object].mesh == mesh &&
+				first[items[runEnd].object].lod == object.lod) {
+				runEnd++;
+			}
 		}
+		uint32_t runLength = static_cast<uint32_t>(runEnd - i);
+		bool instanced = material->instancedPipeline != VK_NULL_HANDLE && clusterDraw == ClusterCuller::INVALID_DRAW && runLength >= _minInstanceRun &&
+			instanceCount + runLength <= _maxInstances;
+		if (!instanced) {
+			runLength = 1;
+		}
+		_drawBatches.push_back({ static_cast<uint32_t>(i), runLength, instanced ? instanceCount : 0, clusterDraw, instanced });
+		if (instanced) {
+			instanceCount += runLength;
+		}
+		i += runLength;
+	}
+	return static_cast<uint32_t>(_drawBatches.size());
+}
 
+void VulkanEngine::record_draws(VkCommandBuffer cmd, RenderObject* first, uint32_t begin, uint32_t end, uint32_t frame, RenderQueue::Stats& stats)
+{
+	const std::vector<RenderQueue::DrawItem>& items = _renderQueue.items();
+	const FrameData& frameData = _frames[frame];
+	GPUInstanceData* instanceData = reinterpret_cast<GPUInstanceData*>(static_cast<char*>(_instanceBuffer.mem.mapped) + frameData.instanceOffset);
 
-		glm::mat4 model = object.transformMatrix;
-		//final render matrix, that we are calculating on the cpu
-		glm::mat4 mesh_matrix = model;
+	Mesh* lastMesh = nullptr;
+	VkBuffer lastIndexBuffer = VK_NULL_HANDLE;
+	VkPipeline lastPipeline = VK_NULL_HANDLE;
+	VkPipelineLayout lastLayout = VK_NULL_HANDLE;
+	VkDescriptorSet lastTextureSet = VK_NULL_HANDLE;
+	bool instanceSetBound = false;
+	for (uint32_t b = begin; b < end; b++)
+	{
+		const DrawBatch& batch = _drawBatches[b];
+		RenderObject& object = first[items[batch.item].object];
+		Material* material = object.material;
+		Mesh* mesh = object.mesh;
+		uint32_t clusterDraw = batch.clusterDraw;
+		bool instanced = batch.instanced;
+		VkPipeline pipeline = instanced ? material->instancedPipeline : material->pipeline;
+		VkPipelineLayout layout = instanced ? material->instancedPipelineLayout : material->pipelineLayout;
 
-		MeshPushConstants constants;
-		constants.render_matrix = mesh_matrix;
-		constants.objectColor = glm::vec4(object.mesh->objectColor,1.0f);
+		//only bind the pipeline if it doesnt match with the already bound one
+		if (pipeline != lastPipeline) {
+			vkCmdBindPipeline(cmd, VK_PIPELINE_BIND_POINT_GRAPHICS, pipeline);
+			lastPipeline = pipeline;
+			stats.pipelineBinds++;
+		}
+		//sets stay bound across pipelines of the same layout
+		if (layout != lastLayout) {
+			vkCmdBindDescriptorSets(cmd, VK_PIPELINE_BIND_POINT_GRAPHICS, layout, 0, 1, &frameData.uboSet, 0, nullptr);
+			lastLayout = layout;
+			lastTextureSet = VK_NULL_HANDLE;
+			instanceSetBound = false;
+			stats.descriptorSetBinds++;
+		}
+		if (material->textureSet != VK_NULL_HANDLE && material->textureSet != lastTextureSet) {
+			vkCmdBindDescriptorSets(cmd, VK_PIPELINE_BIND_POINT_GRAPHICS, layout, 1, 1, &material->textureSet, 0, nullptr);
+			lastTextureSet = material->textureSet;
+			stats.descriptorSetBinds++;
+		}
+		if (instanced && !instanceSetBound) {
+			vkCmdBindDescriptorSets(cmd, VK_PIPELINE_BIND_POINT_GRAPHICS, layout, 2, 1, &frameData.instanceSet, 0, nullptr);
+			instanceSetBound = true;
+			stats.descriptorSetBinds++;
+		}
 
-		//upload the mesh to the gpu via pushconstants
-		vkCmdPushConstants(cmd, object.material->pipelineLayout, VK_SHADER_STAGE_VERTEX_BIT, 0, sizeof(MeshPushConstants), &constants);
-		vkCmdBindDescriptorSets(cmd,VK_PIPELINE_BIND_POINT_GRAPHICS,object.material->pipelineLayout,0,1,&_uboSet,0,nullptr);
-		if(object.material->textureSet!=VK_NULL_HANDLE)
-		vkCmdBindDescriptorSets(cmd,VK_PIPELINE_BIND_POINT_GRAPHICS,object.material->pipelineLayout,1,1,&object.material->textureSet,0,nullptr);
 		//only bind the mesh if its a different one from last bind
-		if (object.mesh != lastMesh) {
+		if (mesh != lastMesh) {
 			//bind the mesh vertex buffer with offset 0
-			VkDeviceSize offset = 0;
-			vkCmdBindVertexBuffers(cmd, 0, 1, &object.mesh->_vertexBuffer.buffer, &offset);
-			lastMesh = object.mesh;
+			VkDeviceSize offsets[2] = { 0, 0 };
+			VkBuffer buffers[2] = { mesh->_vertexBuffer.buffer, _constantVertexBuffer.buffer };
+			vkCmdBindVertexBuffers(cmd, 0, mesh->_format == VertexFormat::Compact ? 2 : 1, buffers, offsets);
+			stats.vertexBufferBinds++;
+			lastMesh = mesh;
 		}
+		VkBuffer indexBuffer = clusterDraw != ClusterCuller::INVALID_DRAW ? _clusterCuller.indexBuffer() : mesh->_indexBuffer.buffer;
+		if (mesh->indexed() && indexBuffer != lastIndexBuffer) {
+			vkCmdBindIndexBuffer(cmd, indexBuffer, 0, clusterDraw != ClusterCuller::INVALID_DRAW ? VK_INDEX_TYPE_UINT32 : mesh->_indexType);
+			lastIndexBuffer = indexBuffer;
+			stats.indexBufferBinds++;
+		}
+
+		if (instanced) {
+			//the shader indexes with gl_InstanceIndex, which includes firstInstance
+			for (uint32_t j = 0; j < batch.count; j++) {
+				const RenderObject& instance = first[items[batch.item + j].object];
+				GPUInstanceData& data = instanceData[batch.firstInstance + j];
+				data.render_matrix = instance.transformMatrix * mesh->dequantize_matrix();
+				data.objectColor = glm::vec4(mesh->objectColor, 1.0f);
+			}
+			stats.instancedDraws++;
+			stats.instances += batch.count;
+		}
+		else {
+			glm::mat4 model = object.transformMatrix;
+			//final render matrix, that we are calculating on the cpu. compact meshes fold the position dequantization in
+			glm::mat4 mesh_matrix = model * mesh->dequantize_matrix();
+
+			MeshPushConstants constants;
+			constants.render_matrix = mesh_matrix;
+			constants.objectColor = glm::vec4(mesh->objectColor,1.0f);
+
+			//upload the mesh to the gpu via pushconstants
+			vkCmdPushConstants(cmd, layout, VK_SHADER_STAGE_VERTEX_BIT, 0, sizeof(MeshPushConstants), &constants);
+			stats.pushConstants++;
+		}
+
 		//we can now draw
-		vkCmdDraw(cmd, object.mesh->_vertices.size(), 1, 0, 0);
+		uint32_t drawInstances = batch.count;
+		vklod::LodRange range = mesh->lod(object.lod);
+		if (clusterDraw != ClusterCuller::INVALID_DRAW)
+			_clusterCuller.recordDraw(cmd, clusterDraw);
+		else if (mesh->indexed())
+			vkCmdDrawIndexed(cmd, range.indexCount, drawInstances, range.firstIndex, 0, batch.firstInstance);
+		else
+			vkCmdDraw(cmd, mesh->vertex_count(), drawInstances, 0, batch.firstInstance);
+		stats.draws++;
+		//cluster culled draws are counted at full detail, their kept triangles are only known on the GPU
+		uint64_t fullTriangles = (mesh->indexed() ? mesh->index_count() : mesh->vertex_count()) / 3;
+		stats.fullDetailTriangles += fullTriangles * drawInstances;
+		stats.triangles += (mesh->indexed() && clusterDraw == ClusterCuller::INVALID_DRAW ? range.indexCount / 3 : fullTriangles) * drawInstances;
+	}
+}
+
+uint32_t VulkanEngine::record_draws_parallel(RenderObject* first, uint32_t chunks, uint32_t frame, VkFramebuffer framebuffer)
+{
+	FrameData& frameData = _frames[frame];
+	chunks = std::min(chunks, static_cast<uint32_t>(frameData.recordBuffers.size()));
+	const uint32_t draws = static_cast<uint32_t>(_drawBatches.size());
+	//a secondary buffer starts without any state, every chunk binds what its first draw needs
+	std::vector<RenderQueue::Stats> chunkStats(chunks, RenderQueue::Stats{});
+	_drawStats = {};
+	_threadPool.parallel_for(chunks, [&](uint32_t chunk) {
+		VkCommandBuffer cmd = frameData.recordBuffers[chunk];
+		VkCommandBufferInheritanceInfo inheritance = vkinit::command_buffer_inheritance_info(_renderPass, 0, framebuffer);
+		VkCommandBufferBeginInfo beginInfo = vkinit::command_buffer_begin_info(
+			VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT | VK_COMMAND_BUFFER_USAGE_RENDER_PASS_CONTINUE_BIT);
+		beginInfo.pInheritanceInfo = &inheritance;
+		VK_CHECK(vkBeginCommandBuffer(cmd, &beginInfo));
+		record_draws(cmd, first, uint64_t(draws) * chunk / chunks, uint64_t(draws) * (chunk + 1) / chunks, frame, chunkStats[chunk]);
+		VK_CHECK(vkEndCommandBuffer(cmd));
+	});
+	for (const RenderQueue::Stats& stats : chunkStats) {
+		_drawStats.add(stats);
+	}
+	return chunks;
+}
+
+void VulkanEngine::prepare_cluster_draws(VkCommandBuffer cmd, uint32_t frame)
+{
+	_clusterDraws.assign(_visibleRenderables.size(), ClusterCuller::INVALID_DRAW);
+	_clusterCuller.beginFrame(frame, vkcull::extract_frustum(_shaderData._cameraData.viewproj), glm::vec3(_shaderData._cameraData.viewPos),
+		_meshletConeCulling);
+	if (!_meshletCulling) {
+		return;
+	}
+	for (size_t i = 0; i < _visibleRenderables.size(); i++) {
+		const RenderObject& object = _visibleRenderables[i];
+		//distant objects draw a coarser LOD instead, the clusters only cover full detail
+		if (!object.alwaysVisible && object.lod == 0 && _clusterCuller.hasMeshlets(object.mesh)) {
+			_clusterDraws[i] = _clusterCuller.addDraw(object.mesh, object.transformMatrix);
+		}
 	}
+	_clusterCuller.recordCull(cmd);
+}
+
+void VulkanEngine::build_scene_bvh()
+{
+	std::vector<glm::vec3> boundsMin, boundsMax;
+	_bvhRenderables.clear();
+	_renderableItems.assign(_renderables.size(), UINT32_MAX);
+	for (uint32_t i = 0; i < _renderables.size(); i++) {
+		const RenderObject& object = _renderables[i];
+		if (object.alwaysVisible) {
+			continue;
+		}
+		glm::vec3 worldMin, worldMax;
+		vkcull::world_aabb(object.mesh->_boundsMin, object.mesh->_boundsMax, object.transformMatrix, worldMin, worldMax);
+		_renderableItems[i] = static_cast<uint32_t>(_bvhRenderables.size());
+		_bvhRenderables.push_back(i);
+		boundsMin.push_back(worldMin);
+		boundsMax.push_back(worldMax);
+	}
+	_sceneBvh.build(boundsMin, boundsMax);
+}
+
+void VulkanEngine::set_transform(uint32_t renderable, const glm::mat4& transform)
+{
+	RenderObject& object = _renderables[renderable];
+	object.transformMatrix = transform;
+	if (_renderableItems[renderable] != UINT32_MAX) {
+		glm::vec3 worldMin, worldMax;
+		vkcull::world_aabb(object.mesh->_boundsMin, object.mesh->_boundsMax, transform, worldMin, worldMax);
+		_sceneBvh.updateItem(_renderableItems[renderable], worldMin, worldMax);
+	}
+	if (_renderableObjects[renderable] != IndirectRenderer::INVALID_OBJECT) {
+		_indirectRenderer.updateObject(_renderableObjects[renderable], transform);
+	}
+}
+
+void VulkanEngine::cull_renderables(const glm::mat4& viewProj)
+{
+	_sceneBvh.refit();
+	_cullVisible.clear();
+	_sceneBvh.cullFrustum(vkcull::extract_frustum(viewProj), _cullVisible);
+	//back to renderable indices, sorted because the draw order is the _renderables order
+	for (uint32_t& item : _cullVisible) {
+		item = _bvhRenderables[item];
+	}
+	std::sort(_cullVisible.begin(), _cullVisible.end());
+
+	_visibleRenderables.clear();
+	vklod::LodView lodView = lod_view();
+	size_t next = 0;
+	for (uint32_t i = 0; i < _renderables.size(); i++) {
+		if (_renderables[i].alwaysVisible) {
+			_visibleRenderables.push_back(_renderables[i]);
+		}
+		else if (next < _cullVisible.size() && _cullVisible[next] == i) {
+			select_lod(_renderables[i], lodView);
+			_visibleRenderables.push_back(_renderables[i]);
+			next++;
+		}
+	}
+}
+
+vklod::LodView VulkanEngine::lod_view() const
+{
+	return vklod::make_lod_view(glm::vec3(_shaderData._cameraData.viewPos), _shaderData._cameraData.proj, float(_windowExtent.height),
+		_lodSelection ? _lodPixelError : 0.0f, _lodHysteresis);
+}
+
+void VulkanEngine::select_lod(RenderObject& object, const vklod::LodView& view)
+{
+	const Mesh* mesh = object.mesh;
+	if (mesh->_lods.empty() || object.alwaysVisible) {
+		object.lod = 0;
+		return;
+	}
+	glm::vec3 center;
+	float radius;
+	vkcull::world_sphere(mesh->_boundsMin, mesh->_boundsMax, object.transformMatrix, center, radius);
+	const glm::mat4& m = object.transformMatrix;
+	float scale = std::max(glm::length(glm::vec3(m[0])), std::max(glm::length(glm::vec3(m[1])), glm::length(glm::vec3(m[2]))));
+	object.lod = vklod::select_lod(view, mesh->_lods.data(), mesh->lod_count(), center, radius, scale, object.lod);
+}
+
+void VulkanEngine::cull_shadow_casters(const glm::mat4& lightViewProj, std::vector<RenderObject>& outCasters)
+{
+	_sceneBvh.refit();
+	_cullVisible.clear();
+	_sceneBvh.cullFrustum(vkcull::extract_frustum(lightViewProj), _cullVisible);
+	outCasters.clear();
+	for (uint32_t item : _cullVisible) {
+		outCasters.push_back(_renderables[_bvhRenderables[item]]);
+	}
+}
+
+int VulkanEngine::pick_renderable(int x, int y)
+{
+	//unproject the pixel at the near and far plane, the projection already flips y so window and NDC y agree
+	glm::mat4 inverseViewProj = glm::inverse(_shaderData._cameraData.viewproj);
+	float ndcX = 2.0f * (x + 0.5f) / _windowExtent.width - 1.0f;
+	float ndcY = 2.0f * (y + 0.5f) / _windowExtent.height - 1.0f;
+	glm::vec4 nearPoint = inverseViewProj * glm::vec4(ndcX, ndcY, 0.0f, 1.0f);
+	glm::vec4 farPoint = inverseViewProj * glm::vec4(ndcX, ndcY, 1.0f, 1.0f);
+	glm::vec3 origin = glm::vec3(nearPoint) / nearPoint.w;
+	glm::vec3 direction = glm::vec3(farPoint) / farPoint.w - origin;
+
+	_sceneBvh.refit();
+	uint32_t item;
+	float distance;
+	if (!_sceneBvh.raycast(origin, direction, 1.0f, item, distance)) {
+		return -1;
+	}
+	return static_cast<int>(_bvhRenderables[item]);
 }
 
 void VulkanEngine::init_scene()
@@ -1080,6 +1428,7 @@ void VulkanEngine::init_scene()
 	skybox.mesh = get_mesh("cube");
 	skybox.material = get_material("skyboxmesh");
 	skybox.transformMatrix = glm::mat4{ 2.0f };
+	skybox.alwaysVisible = true;
 
 	RenderObject floor;
 	floor.mesh = get_mesh("cube");
@@ -1090,6 +1439,62 @@ void VulkanEngine::init_scene()
 	_renderables.push_back(skybox);
 	_renderables.push_back(monkey);
 	_renderables.push_back(floor);
+	build_scene_bvh();
+
+	VkShaderModule reduceShader = VK_NULL_HANDLE;
+	if (!load_shader_module("../../shaders/depth_reduce.comp.spv", &reduceShader)) {
+		reduceShader = VK_NULL_HANDLE;
+	}
+	_depthPyramid.init(*this, reduceShader, _depthStencil.image, _depthStencil.view, _depthStencil.format, _details.imageExtent.width,
+		_details.imageExtent.height);
+	if (reduceShader != VK_NULL_HANDLE) {
+		vkDestroyShaderModule(_device, reduceShader, nullptr);
+	}
+	_mainDeletionQueue.push_function([=]() {
+		_depthPyramid.cleanup();
+	});
+
+	VkShaderModule cullShader = VK_NULL_HANDLE;
+	if (_supportsIndirectCount && !load_shader_module("../../shaders/indirect_cull.comp.spv", &cullShader)) {
+		cullShader = VK_NULL_HANDLE;
+	}
+	bool indirect = _indirectRenderer.init(*this, cullShader, _depthPyramid);
+	if (cullShader != VK_NULL_HANDLE) {
+		vkDestroyShaderModule(_device, cullShader, nullptr);
+	}
+	if (indirect) {
+		_indirectRenderer.build(_renderables, _renderableObjects);
+	}
+	else {
+		_renderableObjects.assign(_renderables.size(), IndirectRenderer::INVALID_OBJECT);
+	}
+	_mainDeletionQueue.push_function([=]() {
+		_indirectRenderer.cleanup();
+	});
+
+	VkShaderModule meshletShader = VK_NULL_HANDLE;
+	if (!load_shader_module("../../shaders/meshlet_cull.comp.spv", &meshletShader)) {
+		meshletShader = VK_NULL_HANDLE;
+	}
+	_clusterCuller.init(*this, meshletShader, _clusterIndexCapacity, _maxClusterDraws);
+	if (meshletShader != VK_NULL_HANDLE) {
+		vkDestroyShaderModule(_device, meshletShader, nullptr);
+	}
+	std::vector<Mesh*> meshletMeshes;
+	for (auto& mesh : _meshes) {
+		if (!mesh.second._meshlets.empty()) {
+			meshletMeshes.push_back(&mesh.second);
+		}
+	}
+	_clusterCuller.build(meshletMeshes);
+	_mainDeletionQueue.push_function([=]() {
+		_clusterCuller.cleanup();
+	});
+	for (uint32_t i = 0; i < _renderables.size(); i++) {
+		if (_renderableObjects[i] == IndirectRenderer::INVALID_OBJECT) {
+			_cpuRenderables.push_back(i);
+		}
+	}
 
 	// for (int x = -20; x <= 20; x++) {
 	// 	for (int y = -20; y <= 20; y++) {
@@ -1121,14 +1526,37 @@ void VulkanEngine::init_scene()
 
 	vkAllocateDescriptorSets(_device, &allocInfo, &texturedMat->textureSet);
 
-	VkWriteDescriptorSet texture1 = vkinit::write_descriptor_image(
-		VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, texturedMat->textureSet, &_loadedTextures["skybox"].descriptor, 0);
-	
-	vkUpdateDescriptorSets(_device,1,&texture1,0,nullptr);
+	uint32_t streamedSkybox = _textureStreamer.find("skybox");
+	if (streamedSkybox != TextureStreamer::INVALID_TEXTURE) {
+		//rewritten by the streamer whenever the skybox residency changes
+		_textureStreamer.bindDescriptor(streamedSkybox, texturedMat->textureSet, 0);
+	}
+	else {
+		VkWriteDescriptorSet texture1 = vkinit::write_descriptor_image(
+			VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, texturedMat->textureSet, &_loadedTextures["skybox"].descriptor, 0);
+
+		vkUpdateDescriptorSets(_device,1,&texture1,0,nullptr);
+	}
 }
 
 void VulkanEngine::load_meshes()
 {
+	//compact vertices read their color from here, the OBJ meshes are loaded with a black vertex color
+	glm::vec4 constantColor{ 0.0f };
+	createBuffer(
+		sizeof(constantColor),
+		VK_BUFFER_USAGE_TRANSFER_DST_BIT | VK_BUFFER_USAGE_VERTEX_BUFFER_BIT,
+		VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
+		_constantVertexBuffer.buffer,
+		_constantVertexBuffer.memory
+	);
+	_uploadQueue.uploadBuffer(_constantVertexBuffer.buffer,&constantColor,sizeof(constantColor));
+	VertexBuffer constantBuffer = _constantVertexBuffer;
+	_mainDeletionQueue.push_function([=](){
+		vkDestroyBuffer(_device,constantBuffer.buffer,nullptr);
+		_allocator.free(constantBuffer.memory);
+	});
+
     Mesh triMesh{};
 	//make the array 3 vertices long
 	triMesh._vertices.resize(3);
@@ -1142,16 +1570,18 @@ void VulkanEngine::load_meshes()
 	triMesh._vertices[0].color = { 0.f,1.f, 0.0f }; //pure green
 	triMesh._vertices[1].color = { 0.f,1.f, 0.0f }; //pure green
 	triMesh._vertices[2].color = { 0.f,1.f, 0.0f }; //pure green
+	triMesh.compute_bounds();
 	//we dont care about the vertex normals
+	//the vertex color is only kept with VertexFormat::Full, compact meshes read the constant color buffer
 
 	//load the monkey
 	Mesh cubeMesh{};
-	cubeMesh.load_from_obj("../../assets/cube.obj");
+	cubeMesh.load_cached("../../assets/cube.obj", &_threadPool, _vertexFormat);
 	Mesh lostEmpire{};
-	lostEmpire.load_from_obj("../../assets/lost_empire.obj");
+	lostEmpire.load_cached("../../assets/lost_empire.obj", &_threadPool, _vertexFormat);
 	Mesh monkeyMesh{};
 	
-	monkeyMesh.load_from_obj("../../assets/monkey_smooth.obj");
+	monkeyMesh.load_cached("../../assets/monkey_smooth.obj", &_threadPool, _vertexFormat);
 
 	//alloc buffer
 	upload_mesh(triMesh);
@@ -1179,25 +1609,28 @@ void VulkanEngine::upload_mesh(Mesh& mesh)
 	// //this buffer is going to be used as a Vertex Buffer
 	// bufferInfo.usage = VK_BUFFER_USAGE_VERTEX_BUFFER_BIT;
 
-    size_t vertexBufferSize = mesh._vertices.size()*sizeof(Vertex);
+    //cooked meshes were optimized when they were cooked, this catches meshes built in memory
+    mesh.optimize();
+    mesh.build_lods();
+
+    //every mesh has to match the layout the pipelines were built with
+    if(_vertexFormat == VertexFormat::Compact)
+    {
+        mesh.compact(&_threadPool);
+    }
 
-    struct StagingBuffer
+    //large meshes are split into clusters that are culled on their own every frame
+    if(mesh.indexed() && mesh.index_count()/3 >= _meshletMinTriangles)
     {
-        /* data */
-        VkBuffer buffer;
-        VkDeviceMemory memory;
-    }stagingBuffer{};
+        mesh.build_meshlets();
+    }
+
+    size_t vertexBufferSize = mesh.vertex_count()*Mesh::vertex_stride(mesh._format);
 
-	if(mesh._vertices.empty())
+	if(mesh.vertex_count() == 0)
 	{
 		std::cout<<"empty";
 	}
-    createBuffer(vertexBufferSize,
-    VK_BUFFER_USAGE_TRANSFER_SRC_BIT,
-    VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
-    stagingBuffer.buffer,
-    stagingBuffer.memory,
-    mesh._vertices.data());
 
     createBuffer(
         vertexBufferSize,
@@ -1207,14 +1640,61 @@ void VulkanEngine::upload_mesh(Mesh& mesh)
         mesh._vertexBuffer.memory
     );
 
-    copyBuffer(stagingBuffer.buffer,mesh._vertexBuffer.buffer,vertexBufferSize);
+    //cooked meshes hand the mapped file contents straight to the staging ring
+    _uploadQueue.uploadBuffer(mesh._vertexBuffer.buffer,mesh.vertex_data(),vertexBufferSize);
+
+    VertexBuffer vertexBuffer = mesh._vertexBuffer;
+    _mainDeletionQueue.push_function([=](){
+        vkDestroyBuffer(_device,vertexBuffer.buffer,nullptr);
+        _allocator.free(vertexBuffer.memory);
+    }
+    );
+
+    if(!mesh.indexed())
+    {
+        return;
+    }
+
+    //narrow to 16 bit indices when possible, the ring copies the data so the temporary can go right away.
+    //cooked indices are stored narrowed already, with the LOD indices right behind them
+    std::vector<uint16_t> shortIndices;
+    std::vector<uint32_t> longIndices;
+    const void* indexData = mesh.index_data();
+    size_t indexCount = mesh.index_count() + mesh.lod_index_count();
+    size_t indexBufferSize = indexCount*(mesh._indexType == VK_INDEX_TYPE_UINT16 ? sizeof(uint16_t) : sizeof(uint32_t));
+    if(!mesh._cookedFile)
+    {
+        mesh._indexType = Mesh::index_type_for(mesh.vertex_count());
+        indexBufferSize = indexCount*sizeof(uint32_t);
+        if(mesh._indexType == VK_INDEX_TYPE_UINT16)
+        {
+            shortIndices.assign(mesh._indices.begin(),mesh._indices.end());
+            shortIndices.insert(shortIndices.end(),mesh._lodIndices.begin(),mesh._lodIndices.end());
+            indexData = shortIndices.data();
+            indexBufferSize = shortIndices.size()*sizeof(uint16_t);
+        }
+        else if(!mesh._lodIndices.empty())
+        {
+            longIndices.assign(mesh._indices.begin(),mesh._indices.end());
+            longIndices.insert(longIndices.end(),mesh._lodIndices.begin(),mesh._lodIndices.end());
+            indexData = longIndices.data();
+        }
+    }
+
+    createBuffer(
+        indexBufferSize,
+        VK_BUFFER_USAGE_TRANSFER_DST_BIT | VK_BUFFER_USAGE_INDEX_BUFFER_BIT,
+        VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
+        mesh._indexBuffer.buffer,
+        mesh._indexBuffer.memory
+    );
 
-    vkFreeMemory(_device,stagingBuffer.memory,nullptr);
-    vkDestroyBuffer(_device,stagingBuffer.buffer,nullptr);
+    _uploadQueue.uploadBuffer(mesh._indexBuffer.buffer,indexData,indexBufferSize);
 
+    VertexBuffer indexBuffer = mesh._indexBuffer;
     _mainDeletionQueue.push_function([=](){
-        vkFreeMemory(_device,mesh._vertexBuffer.memory,nullptr);
-        vkDestroyBuffer(_device,mesh._vertexBuffer.buffer,nullptr);
+        vkDestroyBuffer(_device,indexBuffer.buffer,nullptr);
+        _allocator.free(indexBuffer.memory);
     }
     );
 
@@ -1246,8 +1726,14 @@ void VulkanEngine::endSingleCommand(VkCommandBuffer cmdBuffer)
     submit.commandBufferCount = 1;
     submit.pCommandBuffers = &cmdBuffer;
     submit.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
-    vkQueueSubmit(_graphicsQueue,1,&submit,VK_NULL_HANDLE);
-    vkDeviceWaitIdle(_device);
+
+    //wait on this submission only instead of draining the whole device
+    VkFenceCreateInfo fenceInfo = vkinit::fence_create_info();
+    VkFence fence;
+    VK_CHECK(vkCreateFence(_device,&fenceInfo,nullptr,&fence))
+    VK_CHECK(vkQueueSubmit(_graphicsQueue,1,&submit,fence))
+    VK_CHECK(vkWaitForFences(_device,1,&fence,VK_TRUE,UINT64_MAX))
+    vkDestroyFence(_device,fence,nullptr);
     vkFreeCommandBuffers(_device,_commandPool,1,&cmdBuffer);
 };
 
@@ -1256,8 +1742,9 @@ void VulkanEngine::createBuffer(
     VkBufferUsageFlags usage,
     VkMemoryPropertyFlags properties,
     VkBuffer& buffer,
-    VkDeviceMemory& memory,
-    void* data/* = nullptr*/)
+    Allocation& memory,
+    void* data/* = nullptr*/,
+    bool transient/* = false*/)
     {
         VkBufferCreateInfo createInfo{};
         createInfo.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
@@ -1266,50 +1753,31 @@ void VulkanEngine::createBuffer(
         createInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
         VK_CHECK(vkCreateBuffer(_device,&createInfo,nullptr,&buffer))
 
-        VkMemoryAllocateInfo allocInfo{};
-        allocInfo.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
         VkMemoryRequirements memRequirements{};
         vkGetBufferMemoryRequirements(_device,buffer,&memRequirements);
-        auto typeFilter = memRequirements.memoryTypeBits;
-        allocInfo.memoryTypeIndex = findMemoryType(typeFilter,properties);
-        allocInfo.allocationSize = memRequirements.size;
 
-        VK_CHECK(vkAllocateMemory(_device,&allocInfo,nullptr,&memory))
-        VK_CHECK(vkBindBufferMemory(_device,buffer,memory,0))
-        void* mapped = nullptr;
+        if(!_allocator.allocate(memRequirements,properties,memory,transient))
+        {
+            throw std::runtime_error("failed to allocate buffer memory!");
+        }
+        VK_CHECK(vkBindBufferMemory(_device,buffer,memory.memory,memory.offset))
 
-        if(data != nullptr)
+        //host visible blocks stay persistently mapped by the allocator
+        if(data != nullptr && memory.mapped != nullptr)
         {
-            vkMapMemory(_device,memory,0,size,0,&mapped);
-            memcpy(mapped,data,size);
-            vkUnmapMemory(_device,memory);
+            memcpy(memory.mapped,data,size);
         }
 };
 
 int VulkanEngine::findMemoryType(int typeFilter,VkMemoryPropertyFlags properties)
 {
-        VkPhysicalDeviceMemoryProperties memProperties{};
-        vkGetPhysicalDeviceMemoryProperties(_chosenGPU,&memProperties);
-
-        for(uint32_t i = 0; i < memProperties.memoryTypeCount;i++)
-        {
-            if(typeFilter & ( 1 << i ) && (memProperties.memoryTypes[i].propertyFlags & properties) == properties)
-            return i ;
-        }
-
-        return 0;
+        uint32_t memoryType = _allocator.findMemoryType(typeFilter,properties);
+        return memoryType == UINT32_MAX ? 0 : memoryType;
 }
 
  void VulkanEngine::copyBuffer(VkBuffer srcBuffer,VkBuffer dstBuffer,VkDeviceSize size)
 {
-        VkCommandBuffer cmd = beginSingleCommand();
-		VkBufferCopy bufferCopy{};
-		bufferCopy.size = size;
-		bufferCopy.dstOffset = 0;
-		bufferCopy.srcOffset = 0;
-
-		vkCmdCopyBuffer(cmd,srcBuffer,dstBuffer,1,&bufferCopy);
-		endSingleCommand(cmd);
+		_uploadQueue.copyBuffer(srcBuffer,dstBuffer,size);
 }
 
 void VulkanEngine::createImage(
@@ -1320,7 +1788,7 @@ void VulkanEngine::createImage(
 		VkImageUsageFlags usage,
 		VkMemoryPropertyFlags properties,
 		VkImage& image,
-		VkDeviceMemory& imageMemory
+		Allocation& imageMemory
 	)
 {
     VkImageCreateInfo imageInfo{};
@@ -1338,26 +1806,13 @@ void VulkanEngine::createImage(
 	imageInfo.samples = VK_SAMPLE_COUNT_1_BIT;
 	imageInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
 
-	if (vkCreateImage(_device, &imageInfo, nullptr, &image) != VK_SUCCESS) {
-		throw std::runtime_error("failed to create image!");
-	}
-
-	VkMemoryRequirements memRequirements;
-	vkGetImageMemoryRequirements(_device, image, &memRequirements);
-
-	VkMemoryAllocateInfo allocInfo{};
-	allocInfo.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
-	allocInfo.allocationSize = memRequirements.size;
-	allocInfo.memoryTypeIndex = findMemoryType(memRequirements.memoryTypeBits, properties);
-
-	VK_CHECK(vkAllocateMemory(_device,&allocInfo,nullptr,&imageMemory))
-	VK_CHECK(vkBindImageMemory(_device,image,imageMemory,0))
+	createImage(imageInfo, properties, image, imageMemory);
 }
 
 void VulkanEngine::createImage(VkImageCreateInfo imageInfo,
 		VkMemoryPropertyFlags properties,
 		VkImage& image,
-		VkDeviceMemory& imageMemory)
+		Allocation& imageMemory)
 {
 	if (vkCreateImage(_device, &imageInfo, nullptr, &image) != VK_SUCCESS) {
 		throw std::runtime_error("failed to create image!");
@@ -1366,13 +1821,10 @@ void VulkanEngine::createImage(VkImageCreateInfo imageInfo,
 	VkMemoryRequirements memRequirements;
 	vkGetImageMemoryRequirements(_device, image, &memRequirements);
 
-	VkMemoryAllocateInfo allocInfo{};
-	allocInfo.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
-	allocInfo.allocationSize = memRequirements.size;
-	allocInfo.memoryTypeIndex = findMemoryType(memRequirements.memoryTypeBits, properties);
-
-	VK_CHECK(vkAllocateMemory(_device,&allocInfo,nullptr,&imageMemory))
-	VK_CHECK(vkBindImageMemory(_device,image,imageMemory,0))
+	if (!_allocator.allocate(memRequirements, properties, imageMemory)) {
+		throw std::runtime_error("failed to allocate image memory!");
+	}
+	VK_CHECK(vkBindImageMemory(_device,image,imageMemory.memory,imageMemory.offset))
 }
 
 VkFormat VulkanEngine::findSupportedFormat(const std::vector<VkFormat>& candidates, VkImageTiling tiling, VkFormatFeatureFlags features)
@@ -1399,7 +1851,7 @@ VkFormat VulkanEngine::findDepthFormat()
 	return findSupportedFormat(
 		{ VK_FORMAT_D32_SFLOAT, VK_FORMAT_D32_SFLOAT_S8_UINT, VK_FORMAT_D24_UNORM_S8_UINT },
 		VK_IMAGE_TILING_OPTIMAL,
-		VK_FORMAT_FEATURE_DEPTH_STENCIL_ATTACHMENT_BIT
+		VK_FORMAT_FEATURE_DEPTH_STENCIL_ATTACHMENT_BIT | VK_FORMAT_FEATURE_SAMPLED_IMAGE_BIT
 	);
 }
 
@@ -1412,7 +1864,8 @@ void VulkanEngine::createDepthStencil()
 		_details.imageExtent.height,
 		format,
 		VK_IMAGE_TILING_OPTIMAL,
-		VK_IMAGE_USAGE_DEPTH_STENCIL_ATTACHMENT_BIT,
+		//sampled by the depth pyramid build
+		VK_IMAGE_USAGE_DEPTH_STENCIL_ATTACHMENT_BIT | VK_IMAGE_USAGE_SAMPLED_BIT,
 		VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
 		_depthStencil.image,
 		_depthStencil.mem
@@ -1420,9 +1873,9 @@ void VulkanEngine::createDepthStencil()
 	_depthStencil.view = createImageView(_depthStencil.image, format, VK_IMAGE_ASPECT_DEPTH_BIT);
 
     _mainDeletionQueue.push_function([=](){
-        vkFreeMemory(_device,_depthStencil.mem,nullptr);
         vkDestroyImageView(_device,_depthStencil.view,nullptr);
         vkDestroyImage(_device,_depthStencil.image,nullptr);
+        _allocator.free(_depthStencil.mem);
     });
 }
 
@@ -1458,15 +1911,17 @@ void VulkanEngine::init_descriptors()
 {
 	createUniformBuffer();
 
+	//plus a camera and an instance set per frame in flight
 	std::vector<VkDescriptorPoolSize> sizes = 
 	{
-		{VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER, 10},
-		{VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER,10}
+		{VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER, 10 + MAX_FRAMES_IN_FLIGHT},
+		{VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER,10},
+		{VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 10 + MAX_FRAMES_IN_FLIGHT}
 	};
 
 	VkDescriptorPoolCreateInfo poolInfo{};
 	poolInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO;
-	poolInfo.maxSets = 10;
+	poolInfo.maxSets = 10 + 2 * MAX_FRAMES_IN_FLIGHT;
 	poolInfo.poolSizeCount = (uint32_t)sizes.size();
 	poolInfo.pPoolSizes = sizes.data();
 
@@ -1500,21 +1955,32 @@ void VulkanEngine::init_descriptors()
 	descriptorLayoutInfo.bindingCount = texbindings.size();
 	VK_CHECK(vkCreateDescriptorSetLayout(_device,&descriptorLayoutInfo,nullptr,&_textureSetLayout))
 
+	VkDescriptorSetLayoutBinding instanceBind =
+	vkinit::descriptorset_layout_binding(VK_DESCRIPTOR_TYPE_STORAGE_BUFFER,VK_SHADER_STAGE_VERTEX_BIT,0);
+	descriptorLayoutInfo.pBindings = &instanceBind;
+	descriptorLayoutInfo.bindingCount = 1;
+	VK_CHECK(vkCreateDescriptorSetLayout(_device,&descriptorLayoutInfo,nullptr,&_instanceSetLayout))
+	createInstanceBuffers();
+
+	for (uint32_t i = 0; i < _framesInFlight; i++)
 	{
+		FrameData& frame = _frames[i];
 		VkDescriptorSetAllocateInfo allocInfo{};
 		allocInfo.descriptorPool = _descriptorPool;
 		allocInfo.descriptorSetCount = 1;
 		allocInfo.pSetLayouts = &_descriptorSetLayout;
 		allocInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
 
-		VK_CHECK(vkAllocateDescriptorSets(_device,&allocInfo,&_uboSet))
+		VK_CHECK(vkAllocateDescriptorSets(_device,&allocInfo,&frame.uboSet))
 
+		VkDescriptorBufferInfo bufferInfo = _shaderData._cameraBuffer.descriptor;
+		bufferInfo.offset = frame.cameraOffset;
 		VkWriteDescriptorSet writer{};
 		writer.descriptorCount = 1;
 		writer.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
 		writer.dstBinding = 0;
-		writer.dstSet = _uboSet;
-		writer.pBufferInfo = &_shaderData._cameraBuffer.descriptor;
+		writer.dstSet = frame.uboSet;
+		writer.pBufferInfo = &bufferInfo;
 		writer.descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
 		vkUpdateDescriptorSets(_device,1,&writer,0,nullptr);
 	}
@@ -1565,6 +2031,7 @@ void VulkanEngine::init_descriptors()
 	_mainDeletionQueue.push_function([=](){
 		vkDestroyDescriptorSetLayout(_device,_descriptorSetLayout,nullptr);
 		vkDestroyDescriptorSetLayout(_device,_textureSetLayout,nullptr);
+		vkDestroyDescriptorSetLayout(_device,_instanceSetLayout,nullptr);
 		vkDestroyDescriptorSetLayout(_device,shadowMapDescriptorLayout,nullptr);
 		vkDestroyDescriptorPool(_device,_descriptorPool,nullptr);
 	});
@@ -1574,7 +2041,12 @@ void VulkanEngine::init_descriptors()
 void VulkanEngine::createUniformBuffer()
 {
 	uint32_t size = sizeof(_shaderData._cameraData);
-	createBuffer(size,VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT,
+	//one slice per frame in flight, so the CPU never writes the data a frame still in flight reads
+	VkDeviceSize stride = (size + _minUniformAlignment - 1) / _minUniformAlignment * _minUniformAlignment;
+	for (uint32_t i = 0; i < _framesInFlight; i++) {
+		_frames[i].cameraOffset = i * stride;
+	}
+	createBuffer(stride * _framesInFlight,VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT,
 	VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
 	_shaderData._cameraBuffer.buffer,
 	_shaderData._cameraBuffer.mem);
@@ -1584,11 +2056,11 @@ void VulkanEngine::createUniformBuffer()
 	_shaderData._cameraBuffer.descriptor.offset = 0;
 	_shaderData._cameraBuffer.descriptor.range = size;
 
-	VK_CHECK(vkMapMemory(_device,_shaderData._cameraBuffer.mem,0,size,0,&_shaderData._cameraBuffer.mapped))
+	_shaderData._cameraBuffer.mapped = _shaderData._cameraBuffer.mem.mapped;
 
 	_mainDeletionQueue.push_function([=](){
-		vkFreeMemory(_device,_shaderData._cameraBuffer.mem,nullptr);
 		vkDestroyBuffer(_device,_shaderData._cameraBuffer.buffer,nullptr);
+		_allocator.free(_shaderData._cameraBuffer.mem);
 	});
 
 	{
@@ -1601,7 +2073,7 @@ void VulkanEngine::createUniformBuffer()
 		shadowMapUniformBuffers.sceneDescriptor.buffer = shadowMapUniformBuffers.scene;
 		shadowMapUniformBuffers.sceneDescriptor.offset = 0;
 		shadowMapUniformBuffers.sceneDescriptor.range = sizeof(uboVSscene);
-		VK_CHECK(vkMapMemory(_device,shadowMapUniformBuffers.sceneMem,0,size,0,&shadowMapUniformBuffers.sceneMapped))
+		shadowMapUniformBuffers.sceneMapped = shadowMapUniformBuffers.sceneMem.mapped;
 	}
 
 	{
@@ -1614,20 +2086,57 @@ void VulkanEngine::createUniformBuffer()
 		shadowMapUniformBuffers.offscreenDescriptor.buffer = shadowMapUniformBuffers.offscreen;
 		shadowMapUniformBuffers.offscreenDescriptor.offset = 0;
 		shadowMapUniformBuffers.offscreenDescriptor.range = sizeof(uboOffscreenVS);
-		VK_CHECK(vkMapMemory(_device,shadowMapUniformBuffers.offscreenMem,0,size,0,&shadowMapUniformBuffers.offscreenMapped))
+		shadowMapUniformBuffers.offscreenMapped = shadowMapUniformBuffers.offscreenMem.mapped;
 	}
 
 
 	_mainDeletionQueue.push_function([=](){
-		vkFreeMemory(_device,shadowMapUniformBuffers.sceneMem,nullptr);
 		vkDestroyBuffer(_device,shadowMapUniformBuffers.scene,nullptr);
+		_allocator.free(shadowMapUniformBuffers.sceneMem);
 
-		vkFreeMemory(_device,shadowMapUniformBuffers.offscreenMem,nullptr);
 		vkDestroyBuffer(_device,shadowMapUniformBuffers.offscreen,nullptr);
+		_allocator.free(shadowMapUniformBuffers.offscreenMem);
+	});
+}
+
+void VulkanEngine::createInstanceBuffers()
+{
+	VkDeviceSize size = sizeof(GPUInstanceData) * _maxInstances;
+	VkDeviceSize stride = (size + _minStorageAlignment - 1) / _minStorageAlignment * _minStorageAlignment;
+	createBuffer(stride * _framesInFlight,VK_BUFFER_USAGE_STORAGE_BUFFER_BIT,
+	VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
+	_instanceBuffer.buffer,
+	_instanceBuffer.mem);
+
+	for (uint32_t i = 0; i < _framesInFlight; i++) {
+		FrameData& frame = _frames[i];
+		frame.instanceOffset = i * stride;
+
+		VkDescriptorSetAllocateInfo allocInfo{};
+		allocInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
+		allocInfo.descriptorPool = _descriptorPool;
+		allocInfo.descriptorSetCount = 1;
+		allocInfo.pSetLayouts = &_instanceSetLayout;
+		VK_CHECK(vkAllocateDescriptorSets(_device,&allocInfo,&frame.instanceSet))
+
+		VkDescriptorBufferInfo bufferInfo{ _instanceBuffer.buffer, frame.instanceOffset, size };
+		VkWriteDescriptorSet writer{};
+		writer.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+		writer.descriptorCount = 1;
+		writer.descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+		writer.dstBinding = 0;
+		writer.dstSet = frame.instanceSet;
+		writer.pBufferInfo = &bufferInfo;
+		vkUpdateDescriptorSets(_device,1,&writer,0,nullptr);
+	}
+
+	_mainDeletionQueue.push_function([=](){
+		vkDestroyBuffer(_device,_instanceBuffer.buffer,nullptr);
+		_allocator.free(_instanceBuffer.mem);
 	});
 }
 
-void VulkanEngine::updateUniformBuffer()
+void VulkanEngine::updateUniformBuffer(uint32_t frame)
 {
 	// glm::vec3 camPos = { 0.f,-6.f,-10.f };
 
@@ -1642,7 +2151,7 @@ void VulkanEngine::updateUniformBuffer()
 	 _shaderData._cameraData.viewPos = glm::vec4(_camera.Position,1.0f);
 	 _shaderData._cameraData.viewproj = _shaderData._cameraData.proj *_shaderData._cameraData.view;
 
-	memcpy(_shaderData._cameraBuffer.mapped,&_shaderData._cameraData,sizeof(_shaderData._cameraData));
+	memcpy(static_cast<char*>(_shaderData._cameraBuffer.mapped) + _frames[frame].cameraOffset,&_shaderData._cameraData,sizeof(_shaderData._cameraData));
 }
 
 void VulkanEngine::init_camera()
@@ -1677,9 +2186,7 @@ VkSampler VulkanEngine::createSampler()
 	createInfo.mipLodBias = 0.0f;
 	createInfo.minLod = 0.0f;
 	createInfo.maxLod = 0.0f;
-	VkSampler sampler{};
-	VK_CHECK(vkCreateSampler(_device, &createInfo, nullptr, &sampler));
-	return sampler;
+	return _samplerCache.getSampler(createInfo);
 }
 
 VkSampler VulkanEngine::createSampler(VkFilter filter)
@@ -1702,16 +2209,44 @@ VkSampler VulkanEngine::createSampler(VkFilter filter)
 	createInfo.mipLodBias = 0.0f;
 	createInfo.minLod = 0.0f;
 	createInfo.maxLod = 0.0f;
-	VkSampler sampler{};
-	VK_CHECK(vkCreateSampler(_device, &createInfo, nullptr, &sampler));
-	return sampler;
+	return _samplerCache.getSampler(createInfo);
+}
+
+VkSampler VulkanEngine::createTextureSampler()
+{
+	VkSamplerCreateInfo createInfo{};
+	createInfo.sType = VK_STRUCTURE_TYPE_SAMPLER_CREATE_INFO;
+	float anisotropy = std::min(_textureAnisotropy, _maxSamplerAnisotropy);
+	createInfo.anisotropyEnable = anisotropy > 1.0f ? VK_TRUE : VK_FALSE;
+	createInfo.maxAnisotropy = anisotropy > 1.0f ? anisotropy : 1.0f;
+	createInfo.addressModeU = VK_SAMPLER_ADDRESS_MODE_REPEAT;
+	createInfo.addressModeV = VK_SAMPLER_ADDRESS_MODE_REPEAT;
+	createInfo.addressModeW = VK_SAMPLER_ADDRESS_MODE_REPEAT;
+
+	createInfo.magFilter = VK_FILTER_LINEAR;
+	createInfo.minFilter = VK_FILTER_LINEAR;
+	createInfo.borderColor = VK_BORDER_COLOR_FLOAT_OPAQUE_BLACK;
+	createInfo.unnormalizedCoordinates = VK_FALSE;
+	createInfo.compareEnable = VK_FALSE;
+	createInfo.compareOp = VK_COMPARE_OP_ALWAYS;
+
+	createInfo.mipmapMode = VK_SAMPLER_MIPMAP_MODE_LINEAR;
+	createInfo.mipLodBias = 0.0f;
+	createInfo.minLod = 0.0f;
+	//the view limits the mips, so the sampler does not depend on the texture
+	createInfo.maxLod = VK_LOD_CLAMP_NONE;
+	return _samplerCache.getSampler(createInfo);
 }
 
 void VulkanEngine::load_texture()
 {
-	AllocatedImage lostEmpire;
-	vkutil::load_image_from_file(*this, "../../assets/lost_empire-RGBA.png", lostEmpire);
+	_textureStreamer.init(*this, _textureBudget, _textureStreamBytesPerFrame);
+	_mainDeletionQueue.push_function([=]() {
+		_textureStreamer.printStats();
+		_textureStreamer.cleanup();
+	});
 
+	const char* lostEmpireFile = "../../assets/lost_empire-RGBA.png";
 	std::vector<const char*> files ={
 		"../../assets/skybox_right.jpg",
 		"../../assets/skybox_left.jpg",
@@ -1720,11 +2255,17 @@ void VulkanEngine::load_texture()
 		"../../assets/skybox_front.jpg",
 		"../../assets/skybox_back.jpg"
 	};
-	AllocatedImage skybox;
-	vkcubemap::load_image_from_file(*this,files,skybox);
-
-	_loadedTextures["lostEmpire"] = lostEmpire;
-	_loadedTextures["skybox"] = skybox;
+	//streamed textures live in _textureStreamer, the rest is fully resident in _loadedTextures
+	if (!_textureStreaming || _textureStreamer.addTexture("lostEmpire", { lostEmpireFile }, false) == TextureStreamer::INVALID_TEXTURE) {
+		AllocatedImage lostEmpire;
+		vkutil::load_image_from_file(*this, lostEmpireFile, lostEmpire);
+		_loadedTextures["lostEmpire"] = lostEmpire;
+	}
+	if (!_textureStreaming || _textureStreamer.addTexture("skybox", files, true) == TextureStreamer::INVALID_TEXTURE) {
+		AllocatedImage skybox;
+		vkcubemap::load_image_from_file(*this,files,skybox);
+		_loadedTextures["skybox"] = skybox;
+	}
 }
 
 
@@ -1903,9 +2444,8 @@ void VulkanEngine::prepareOffscreenFramebuffer()
 
 	_mainDeletionQueue.push_function([=]() {
 		vkDestroyImageView(_device,offscreenPass.depth.view,nullptr);
-		vkFreeMemory(_device,offscreenPass.depth.mem,nullptr);
 		vkDestroyImage(_device,offscreenPass.depth.image,nullptr);
+		_allocator.free(offscreenPass.depth.mem);
 		vkDestroyFramebuffer(_device,offscreenPass.frameBuffer,nullptr);
-		vkDestroySampler(_device,offscreenPass.depthSampler,nullptr);
 	});
 }
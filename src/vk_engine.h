@@ -9,6 +9,17 @@
 #include <glm/glm.hpp>
 #include <glm/gtx/transform.hpp>
 #include <vk_camera.h>
+#include <vk_allocator.h>
+#include <vk_upload.h>
+#include <vk_threadpool.h>
+#include <vk_samplercache.h>
+#include <vk_texturestream.h>
+#include <vk_culling.h>
+#include <vk_bvh.h>
+#include <vk_renderqueue.h>
+#include <vk_indirect.h>
+#include <vk_clustercull.h>
+#include <vk_depthpyramid.h>
 
 #include <imgui.h>
 #include <backends/imgui_impl_vulkan.h>
@@ -55,6 +66,10 @@ struct Material {
 	VkDescriptorSet textureSet{VK_NULL_HANDLE};
 	VkPipeline pipeline;
 	VkPipelineLayout pipelineLayout;
+	//variant reading GPUInstanceData[gl_InstanceIndex] from set 2 instead of the push constants,
+	//VK_NULL_HANDLE when the material is only drawn one object at a time
+	VkPipeline instancedPipeline{VK_NULL_HANDLE};
+	VkPipelineLayout instancedPipelineLayout{VK_NULL_HANDLE};
 };
 
 struct RenderObject {
@@ -62,6 +77,10 @@ struct RenderObject {
 	Material* material;
 
 	glm::mat4 transformMatrix;
+	//camera relative objects such as the skybox are never culled
+	bool alwaysVisible{ false };
+	//range of mesh->_lods drawn, kept between frames for the hysteresis
+	uint32_t lod{ 0 };
 };
 
 struct MeshPushConstants {
@@ -69,6 +88,51 @@ struct MeshPushConstants {
 	glm::mat4 render_matrix;
 };
 
+//one element of the per frame instance storage buffer, std430:
+//layout(std430, set = 2, binding = 0) readonly buffer Instances { InstanceData instances[]; };
+//the instanced vertex shader uses instances[gl_InstanceIndex] where default.vert uses the push constants
+struct GPUInstanceData {
+	glm::mat4 render_matrix;
+	glm::vec4 objectColor;
+};
+
+//host visible instance storage shared by the frames in flight, each frame owns _maxInstances at its FrameData::instanceOffset
+struct InstanceBuffer {
+	VkBuffer buffer;
+	Allocation mem;
+};
+
+//one draw of draw_objects: sorted items [item, item + count) of one mesh and material, instanced from firstInstance,
+//or a single object drawn with push constants or through its cluster culled draw
+struct DrawBatch {
+	uint32_t item;
+	uint32_t count;
+	uint32_t firstInstance;
+	uint32_t clusterDraw;
+	bool instanced;
+};
+
+//everything one frame in flight records or writes, reused only after its renderFence has signaled
+struct FrameData {
+	//reset as a whole at the start of the frame
+	VkCommandPool commandPool{ VK_NULL_HANDLE };
+	VkCommandBuffer commandBuffer{ VK_NULL_HANDLE };
+	VkFence renderFence{ VK_NULL_HANDLE };
+	//signaled by the swapchain image acquire, waited on by the submit
+	VkSemaphore presentSemaphore{ VK_NULL_HANDLE };
+	//this frame's slice of the camera buffer and the set 0 pointing at it
+	VkDeviceSize cameraOffset{ 0 };
+	VkDescriptorSet uboSet{ VK_NULL_HANDLE };
+	//this frame's slice of _instanceBuffer and the set 2 pointing at it
+	VkDeviceSize instanceOffset{ 0 };
+	VkDescriptorSet instanceSet{ VK_NULL_HANDLE };
+	//parallel draw recording: chunk i records recordBuffers[i] from recordPools[i], so no pool is used by two threads.
+	//passBuffer takes what the main thread records into the same render pass
+	std::vector<VkCommandPool> recordPools;
+	std::vector<VkCommandBuffer> recordBuffers;
+	VkCommandBuffer passBuffer{ VK_NULL_HANDLE };
+};
+
 struct ShaderData
 {
 	struct GPUCameraData{
@@ -78,10 +142,11 @@ struct ShaderData
 		glm::vec4 viewPos;
 	}_cameraData;
 
+	//one GPUCameraData slice per frame in flight, at FrameData::cameraOffset
 	struct UBOBuffer
 	{
 		VkBuffer buffer;
-		VkDeviceMemory mem;
+		Allocation mem;
 		VkDescriptorBufferInfo descriptor{};
 		void* mapped = nullptr;
 	}_cameraBuffer;
@@ -93,6 +158,8 @@ public:
 
     bool _isInitialized{false};
     int _frameNumber {0};
+	//SDL performance counter at the start of init, for the time to first frame
+	uint64_t _initStartCounter{ 0 };
 	int _selectedShader{ 1 };
 
 	VkExtent2D _windowExtent{ 1024 , 720 };
@@ -104,20 +171,24 @@ public:
 	VkPhysicalDevice _chosenGPU;
 	VkDevice _device;
 
-	VkSemaphore _presentSemaphore, _renderSemaphore;
-	std::vector<VkSemaphore> _presentSemaphores;
-	std::vector<VkSemaphore>_renderSemaphores;
-	VkFence _renderFence;
-	std::vector<VkFence> _renderFences;
+	//frames the CPU may record ahead of the GPU, 2 or 3. frame _frameNumber % _framesInFlight is the one being recorded
+	uint32_t _framesInFlight{ 2 };
+	FrameData _frames[MAX_FRAMES_IN_FLIGHT];
 
 	VkQueue _graphicsQueue;
 	uint32_t _graphicsQueueFamily;
+	//same as the graphics family when the device has no dedicated transfer family
+	VkQueue _transferQueue;
+	uint32_t _transferQueueFamily;
 
+	//single time commands, the frames record from their own pools
 	VkCommandPool _commandPool;
-	VkCommandBuffer _mainCommandBuffer;
-	std::vector<VkCommandBuffer> flightCmdBuffers;
 	
 	VkRenderPass _renderPass;
+	//the frame split around the depth pyramid build of occlusion culling: the early pass clears and keeps the attachments,
+	//the late one loads and presents them. both are compatible with _renderPass, its pipelines and framebuffers
+	VkRenderPass _earlyRenderPass;
+	VkRenderPass _lateRenderPass;
 
 	VkSurfaceKHR _surface;
 	VkSwapchainKHR _swapchain;
@@ -137,6 +208,10 @@ public:
 	std::vector<VkFramebuffer> _framebuffers;
 	std::vector<VkImage> _swapchainImages;
 	std::vector<VkImageView> _swapchainImageViews;
+	//one per swapchain image, signaled by the submit and waited on by the present of that image. a frame slot can come
+	//back around before the presentation engine is done with the semaphore it signaled, the next acquire of the image
+	//cannot
+	std::vector<VkSemaphore> _renderSemaphores;
 
 	VkPipelineLayout _trianglePipelineLayout;
 	VkPipeline _trianglePipeline;
@@ -147,7 +222,12 @@ public:
 	VkDescriptorPool _descriptorPool;
 	VkDescriptorSetLayout _descriptorSetLayout;
 	VkDescriptorSetLayout _textureSetLayout;
-	VkDescriptorSet _uboSet;
+	VkDescriptorSetLayout _instanceSetLayout;
+	//rewritten by draw_objects
+	InstanceBuffer _instanceBuffer;
+	uint32_t _maxInstances{ 16384 };
+	//runs of one mesh and material shorter than this keep their per object draws
+	uint32_t _minInstanceRun{ 2 };
 
 	AllocatedImage _texture;
 
@@ -156,7 +236,7 @@ public:
 	// Framebuffer for offscreen rendering
 	struct FrameBufferAttachment {
 		VkImage image;
-		VkDeviceMemory mem;
+		Allocation mem;
 		VkImageView view;
 	};
 	struct OffscreenPass {
@@ -174,12 +254,12 @@ public:
 
 	struct {
 		VkBuffer scene;
-		VkDeviceMemory sceneMem;
+		Allocation sceneMem;
 		VkDescriptorBufferInfo sceneDescriptor{};
 		void* sceneMapped = nullptr;
 
 		VkBuffer offscreen;
-		VkDeviceMemory offscreenMem;
+		Allocation offscreenMem;
 		VkDescriptorBufferInfo offscreenDescriptor{};
 		void* offscreenMapped = nullptr;
 
@@ -213,14 +293,36 @@ public:
 	//shuts down the engine
 	void cleanup();
 
-	//draw loop
-	void draw();
-
 	//run main loop
 	void run();
 
 	//default array of renderable objects
 	std::vector<RenderObject> _renderables;
+	//the renderables that survived frustum culling this frame, in _renderables order
+	std::vector<RenderObject> _visibleRenderables;
+	//world bounds of the renderables that can be culled, item i is renderable _bvhRenderables[i]
+	Bvh _sceneBvh;
+	std::vector<uint32_t> _bvhRenderables;
+	//renderable -> bvh item, UINT32_MAX for always visible ones
+	std::vector<uint32_t> _renderableItems;
+	//scratch of the bvh queries
+	std::vector<uint32_t> _cullVisible;
+	//renderable under the last left click, -1 when it hit nothing
+	int _pickedRenderable{ -1 };
+	//draws of the frame sorted by state, and the binds the last draw_objects recorded
+	RenderQueue _renderQueue;
+	RenderQueue::Stats _drawStats{};
+	//draws of the sorted queue, from prepare_draws
+	std::vector<DrawBatch> _drawBatches;
+	//with at least two chunks of _minDrawsPerChunk draws, the main pass records them on the thread pool into secondary
+	//command buffers, one chunk per thread at most
+	bool _parallelRecording{ true };
+	uint32_t _minDrawsPerChunk{ 256 };
+	//chunks of the last frame, 0 when it was recorded inline, and the CPU time of its draw recording
+	uint32_t _recordChunks{ 0 };
+	float _drawRecordMs{ 0.0f };
+	//far plane of the projection, normalizes the depth in the sort keys
+	float _drawDistance{ 200.0f };
 
 	std::unordered_map<std::string, Material> _materials;
 	std::unordered_map<std::string, Mesh> _meshes;
@@ -228,25 +330,95 @@ public:
 
 	struct {
 		VkImage image;
-		VkDeviceMemory mem;
+		Allocation mem;
 		VkImageView view;
 		VkFormat format;
 	} _depthStencil;
 
 	Camera _camera;
 
+	MemoryAllocator _allocator;
+
+	//every VkSampler comes from here, see createSampler
+	SamplerCache _samplerCache;
+
+	//batched copies/layout transitions for resource loading
+	UploadQueue _uploadQueue;
+	//size of the persistently mapped staging ring used by _uploadQueue
+	VkDeviceSize _stagingRingSize{ 32ull * 1024 * 1024 };
+
+	//worker threads for asset parsing/preprocessing
+	ThreadPool _threadPool;
+
+	//loaded textures get a full mip chain
+	bool _textureMipmaps{ true };
+	//requested texture sampler anisotropy, 1 disables it. clamped to _maxSamplerAnisotropy
+	float _textureAnisotropy{ 8.0f };
+	//device limit, 0 when samplerAnisotropy is not supported
+	float _maxSamplerAnisotropy{ 0.0f };
+	//device limits the per frame slices of shared buffers are aligned to
+	VkDeviceSize _minUniformAlignment{ 256 };
+	VkDeviceSize _minStorageAlignment{ 256 };
+	//file textures are cooked to BC1/BC3 once and loaded from the cache after that
+	bool _textureCompression{ true };
+	//textureCompressionBC is supported and enabled
+	bool _supportsBC{ false };
+	//drawIndirectCount, multiDrawIndirect and drawIndirectFirstInstance are supported and enabled
+	bool _supportsIndirectCount{ false };
+	//renderables with an instanced material are culled and drawn by the GPU when the device supports it
+	bool _gpuDriven{ true };
+	IndirectRenderer _indirectRenderer;
+	//renderable -> indirect object, IndirectRenderer::INVALID_OBJECT for the ones drawn by draw_objects
+	std::vector<uint32_t> _renderableObjects;
+	//renderables left to the CPU path while the GPU driven one is active
+	std::vector<uint32_t> _cpuRenderables;
+	//the GPU driven path draws last frame's visible objects first, reduces their depth to _depthPyramid and then draws
+	//the objects that turn out visible against it. the CPU path draws before the pyramid is built, as occluders
+	bool _occlusionCulling{ true };
+	DepthPyramid _depthPyramid;
+	//meshes with a LOD chain draw the coarsest range whose error projects to at most _lodPixelError pixels. a coarser
+	//range has to get under (1 - _lodHysteresis) of that before it is switched to, so objects near a boundary do not pop
+	bool _lodSelection{ true };
+	float _lodPixelError{ 1.0f };
+	float _lodHysteresis{ 0.25f };
+	//meshes with at least this many triangles get meshlets at upload, their draws only keep the visible clusters
+	uint32_t _meshletMinTriangles{ 4096 };
+	bool _meshletCulling{ true };
+	bool _meshletConeCulling{ true };
+	ClusterCuller _clusterCuller;
+	//index space of the cluster culled draws of one frame, and how many of them a frame takes
+	uint32_t _clusterIndexCapacity{ 4u * 1024 * 1024 };
+	uint32_t _maxClusterDraws{ 1024 };
+	//_visibleRenderables -> cluster draw of the frame, ClusterCuller::INVALID_DRAW for the regular ones
+	std::vector<uint32_t> _clusterDraws;
+	//cooked textures start with their mip tail and stream the larger mips by camera distance
+	bool _textureStreaming{ true };
+	TextureStreamer _textureStreamer;
+	//device memory the streamed textures may settle on
+	VkDeviceSize _textureBudget{ 256ull * 1024 * 1024 };
+	//upload size after which no more streaming loads are issued in a frame
+	VkDeviceSize _textureStreamBytesPerFrame{ 8ull * 1024 * 1024 };
+
+	//layout every mesh is uploaded with, the mesh pipelines are built for it
+	VertexFormat _vertexFormat{ VertexFormat::Compact };
+	//source of the stride 0 color binding of compact vertices
+	VertexBuffer _constantVertexBuffer;
+
+	//transient buffers (staging) are bump allocated and should be released soon after use
 	void createBuffer(
 		VkDeviceSize size,
 		VkBufferUsageFlags usage,
 		VkMemoryPropertyFlags properties,
 		VkBuffer& buffer,
-		VkDeviceMemory& memory,
-		void* data = nullptr
+		Allocation& memory,
+		void* data = nullptr,
+		bool transient = false
 	);
 
 	GLTFLoader testGLTF;
 	int findMemoryType(int typeFilter,VkMemoryPropertyFlags properties);
 
+	//records into _uploadQueue, the copy has finished once the queue is flushed or its ticket completes
 	void copyBuffer(VkBuffer srcBuffer,VkBuffer dstBuffer,VkDeviceSize size);
 
 	void createImage(
@@ -257,14 +429,14 @@ public:
 		VkImageUsageFlags usage,
 		VkMemoryPropertyFlags properties,
 		VkImage& image,
-		VkDeviceMemory& imageMemory
+		Allocation& imageMemory
 	);
 
 		void createImage(
 		VkImageCreateInfo imageInfo,
 		VkMemoryPropertyFlags properties,
 		VkImage& image,
-		VkDeviceMemory& imageMemory
+		Allocation& imageMemory
 	);
 
 	VkImageView createImageView(VkImage image, VkFormat format, VkImageAspectFlagBits aspect);
@@ -274,8 +446,11 @@ public:
 
 	void endSingleCommand(VkCommandBuffer cmdBuffer);
 
+	//samplers are shared through _samplerCache, never destroy the returned handles
 	VkSampler createSampler();
 	VkSampler createSampler(VkFilter filter);
+	//trilinear over every mip of the view, anisotropic when enabled. one sampler serves all textures
+	VkSampler createTextureSampler();
 
 private:
 
@@ -289,6 +464,10 @@ private:
 
 	void init_default_renderpass();
 
+	//the main pass over a swapchain image and _depthStencil. load keeps what an earlier pass of the frame rendered
+	//instead of clearing it, present leaves the image ready for presentation instead of for another pass
+	VkRenderPass create_main_renderpass(bool load, bool present);
+
 	void init_framebuffers();
 
 	void init_commands();
@@ -304,12 +483,9 @@ private:
 	//loads a shader module from a spir-v file. Returns false if it errors
 	bool load_shader_module(const char* filePath, VkShaderModule* outShaderModule);
 
-	void buildCommandBuffer();
-
+	//waits for the next frame in flight, records and submits it and presents the acquired swapchain image
 	void reBuildCommandBuffer(ImDrawData* draw_data);
 
-	void updateFrame();
-
 	void init_camera();
 
 	//functions
@@ -323,8 +499,45 @@ private:
 	//returns nullptr if it cant be found
 	Mesh* get_mesh(const std::string& name);
 
-	//our draw function
-	void draw_objects(VkCommandBuffer cmd, RenderObject* first, int count);
+	//our draw function, records the objects in sort key order binding state only when it changes.
+	//runs sharing mesh and material are drawn instanced from frame's slice of _instanceBuffer. clusterDraws maps the objects
+	//to their cluster culled draws, from prepare_cluster_draws
+	void draw_objects(VkCommandBuffer cmd, RenderObject* first, int count, uint32_t frame, const uint32_t* clusterDraws = nullptr);
+
+	//sorts the objects and groups them into _drawBatches without recording anything, returns the number of draws
+	uint32_t prepare_draws(RenderObject* first, int count, const uint32_t* clusterDraws);
+
+	//records _drawBatches [begin, end) of the objects given to prepare_draws, binding all the state they use. writes their
+	//instances to frame's slice of _instanceBuffer and counts the commands in stats
+	void record_draws(VkCommandBuffer cmd, RenderObject* first, uint32_t begin, uint32_t end, uint32_t frame, RenderQueue::Stats& stats);
+
+	//records chunks of _drawBatches into frame's recordBuffers on the thread pool, for a render pass compatible with
+	//_renderPass begun with VK_SUBPASS_CONTENTS_SECONDARY_COMMAND_BUFFERS. returns the number of buffers recorded
+	uint32_t record_draws_parallel(RenderObject* first, uint32_t chunks, uint32_t frame, VkFramebuffer framebuffer);
+
+	//queues the visible renderables with meshlets for cluster culling and records the culling, outside of a render pass.
+	//fills _clusterDraws
+	void prepare_cluster_draws(VkCommandBuffer cmd, uint32_t frame);
+
+	//builds _sceneBvh over the world bounds of _renderables, call after adding or removing renderables
+	void build_scene_bvh();
+
+	//moves a renderable, its bounds are refit in the bvh before the next query
+	void set_transform(uint32_t renderable, const glm::mat4& transform);
+
+	//fills _visibleRenderables with the renderables whose world bounds intersect the frustum of viewProj
+	void cull_renderables(const glm::mat4& viewProj);
+
+	//camera values of the LOD selection, errorScale 0 while _lodSelection is off
+	vklod::LodView lod_view() const;
+	//updates object.lod for the current camera
+	void select_lod(RenderObject& object, const vklod::LodView& view);
+
+	//the renderables inside the light frustum, for the shadow pass rendered with uboOffscreenVS.depthMVP
+	void cull_shadow_casters(const glm::mat4& lightViewProj, std::vector<RenderObject>& outCasters);
+
+	//renderable under the window pixel, by world bounds. -1 when nothing is hit
+	int pick_renderable(int x, int y);
 
 	void init_scene();
 
@@ -348,7 +561,10 @@ private:
 
 	void createUniformBuffer();
 
-	void updateUniformBuffer();
+	void createInstanceBuffers();
+
+	//updates the camera data and writes it to the slice of frame
+	void updateUniformBuffer(uint32_t frame);
 
 	void mouse_callback();
 	void keyboard_callback();
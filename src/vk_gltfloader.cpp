@@ -3,41 +3,156 @@
 #include <vk_gltfloader.h>
 #include <vk_texture.h>
 #include <vk_engine.h>
+#include <vk_meshopt.h>
+#include <vk_meshcache.h>
+#include <stb_image.h>
+#include <chrono>
+#include <mutex>
+#include <condition_variable>
+#include <deque>
 
-void GLTFLoader::loadNode(VulkanEngine& engine,const tinygltf::Node& inputNode, const tinygltf::Model& input, Node* parent, uint32_t nodeIndex, std::vector<uint32_t>& indexBuffer, std::vector<Vertex>& vertexBuffer)
+namespace {
+
+	//element pointer and byte stride of an accessor inside its glTF buffer
+	struct AccessorView {
+		const unsigned char* data{ nullptr };
+		size_t stride{ 0 };
+		size_t count{ 0 };
+		int componentType{ -1 };
+
+		bool valid(int type) const { return data != nullptr && componentType == type; }
+	};
+
+	//false unless the accessor is of type (TINYGLTF_TYPE_*) and every element lies inside its buffer view and buffer
+	bool accessor_view(const tinygltf::Model& input, int accessorIndex, int type, AccessorView& outView)
+	{
+		if (accessorIndex < 0 || accessorIndex >= static_cast<int>(input.accessors.size())) {
+			return false;
+		}
+		const tinygltf::Accessor& accessor = input.accessors[accessorIndex];
+		if (accessor.type != type || accessor.bufferView < 0 || accessor.bufferView >= static_cast<int>(input.bufferViews.size())) {
+			return false;
+		}
+		const tinygltf::BufferView& view = input.bufferViews[accessor.bufferView];
+		if (view.buffer < 0 || view.buffer >= static_cast<int>(input.buffers.size())) {
+			return false;
+		}
+		const std::vector<unsigned char>& buffer = input.buffers[view.buffer].data;
+		int componentSize = tinygltf::GetComponentSizeInBytes(static_cast<uint32_t>(accessor.componentType));
+		int components = tinygltf::GetNumComponentsInType(static_cast<uint32_t>(accessor.type));
+		if (componentSize <= 0 || components <= 0 || view.byteOffset > buffer.size() || view.byteLength > buffer.size() - view.byteOffset) {
+			return false;
+		}
+		//the view's byteStride when the attributes are interleaved, the packed element size otherwise
+		int stride = accessor.ByteStride(view);
+		size_t elementSize = size_t(componentSize) * size_t(components);
+		if (stride <= 0 || accessor.byteOffset > view.byteLength) {
+			return false;
+		}
+		//the last element ends at byteOffset + (count - 1) * stride + elementSize, written so it cannot overflow
+		size_t available = view.byteLength - accessor.byteOffset;
+		if (accessor.count > 0 && (elementSize > available || accessor.count - 1 > (available - elementSize) / size_t(stride))) {
+			return false;
+		}
+		size_t offset = view.byteOffset + accessor.byteOffset;
+		outView.data = buffer.data() + offset;
+		outView.stride = static_cast<size_t>(stride);
+		outView.count = accessor.count;
+		outView.componentType = accessor.componentType;
+		return true;
+	}
+
+	//copies count elements of size bytes between strided arrays, a single memcpy when both sides are tightly packed
+	void copy_strided(void* dst, size_t dstStride, const unsigned char* src, size_t srcStride, size_t count, size_t size)
+	{
+		char* out = static_cast<char*>(dst);
+		if (dstStride == size && srcStride == size) {
+			memcpy(out, src, count * size);
+			return;
+		}
+		for (size_t i = 0; i < count; i++) {
+			memcpy(out + i * dstStride, src + i * srcStride, size);
+		}
+	}
+
+	//image callback that keeps the encoded bytes, GLTFLoader::loadImages decodes them on the thread pool
+	bool keep_encoded_image(tinygltf::Image* image, const int /*imageIndex*/, std::string* /*error*/, std::string* /*warning*/,
+		int /*requestedWidth*/, int /*requestedHeight*/, const unsigned char* bytes, int size, void* /*userData*/)
+	{
+		image->image.assign(bytes, bytes + size);
+		image->width = -1;
+		image->height = -1;
+		image->component = 0;
+		return true;
+	}
+
+	//false for -1 and for indices past the end of items, glTF references are plain ints from the file
+	template<typename T>
+	bool valid_index(int index, const std::vector<T>& items)
+	{
+		return index >= 0 && index < static_cast<int>(items.size());
+	}
+
+	//vertex and index totals of a node subtree, instanced meshes are counted once per instance like loadNode appends them.
+	//only sizes the reservation, invalid references count nothing and are rejected by loadNode and accessor_view
+	void count_geometry(const tinygltf::Model& input, int nodeIndex, size_t& vertexCount, size_t& indexCount)
+	{
+		if (!valid_index(nodeIndex, input.nodes)) {
+			return;
+		}
+		const tinygltf::Node& node = input.nodes[nodeIndex];
+		if (valid_index(node.mesh, input.meshes)) {
+			for (const tinygltf::Primitive& primitive : input.meshes[node.mesh].primitives) {
+				auto position = primitive.attributes.find("POSITION");
+				size_t vertices = position != primitive.attributes.end() && valid_index(position->second, input.accessors)
+					? input.accessors[position->second].count : 0;
+				vertexCount += vertices;
+				indexCount += valid_index(primitive.indices, input.accessors) ? input.accessors[primitive.indices].count : vertices;
+			}
+		}
+		for (int child : node.children) {
+			count_geometry(input, child, vertexCount, indexCount);
+		}
+	}
+}
+
+void GLTFLoader::loadNode(VulkanEngine& engine,const tinygltf::Node& inputNode, const tinygltf::Model& input, int32_t parent, uint32_t nodeIndex, std::vector<uint32_t>& indexBuffer, std::vector<Vertex>& vertexBuffer)
 {
-	Node* node = new Node{};
-	node->matrix = glm::mat4(1.0f);
-	node->index = nodeIndex;
-	node->parent = parent;
+	uint32_t node = scene.size();
+	scene.parent.push_back(parent);
+	scene.subtreeEnd.push_back(node + 1);
+	scene.gltfIndex.push_back(nodeIndex);
+	scene.translation.push_back(glm::vec3(0.0f));
+	scene.rotation.push_back(glm::quat(1.0f, 0.0f, 0.0f, 0.0f));
+	scene.scale.push_back(glm::vec3(1.0f));
+	scene.matrix.push_back(glm::mat4(1.0f));
+	scene.world.push_back(glm::mat4(1.0f));
+	scene.dirty.push_back(1);
+	scene.meshes.emplace_back();
+	scene.dirtyCount++;
 
 	// Get the local node matrix
 	// It's either made up from translation, rotation, scale or a 4x4 matrix
 	if (inputNode.translation.size() == 3) {
-		node->matrix = glm::translate(node->matrix, glm::vec3(glm::make_vec3(inputNode.translation.data())));
+		scene.translation[node] = glm::vec3(glm::make_vec3(inputNode.translation.data()));
 	}
 	if (inputNode.rotation.size() == 4) {
-		glm::quat q = glm::make_quat(inputNode.rotation.data());
-		node->matrix *= glm::mat4(q);
+		scene.rotation[node] = glm::quat(glm::make_quat(inputNode.rotation.data()));
 	}
 	if (inputNode.scale.size() == 3) {
-		node->matrix = glm::scale(node->matrix, glm::vec3(glm::make_vec3(inputNode.scale.data())));
+		scene.scale[node] = glm::vec3(glm::make_vec3(inputNode.scale.data()));
 	}
 	if (inputNode.matrix.size() == 16) {
-		node->matrix = glm::make_mat4x4(inputNode.matrix.data());
+		scene.matrix[node] = glm::make_mat4x4(inputNode.matrix.data());
 	};
 
-	// Load node's children
-	if (inputNode.children.size() > 0) {
-		for (size_t i = 0; i < inputNode.children.size(); i++) {
-			loadNode(engine,input.nodes[inputNode.children[i]], input, node, inputNode.children[i], indexBuffer, vertexBuffer);
-		}
-	}
-
 	// If the node contains mesh data, we load vertices and indices from the buffers
 	// In glTF this is done via accessors and buffer views
-	if (inputNode.mesh > -1) {
-		const tinygltf::Mesh mesh = input.meshes[inputNode.mesh];
+	if (inputNode.mesh > -1 && !valid_index(inputNode.mesh, input.meshes)) {
+		std::cout << "glTF node " << nodeIndex << " references missing mesh " << inputNode.mesh << ", skipped" << std::endl;
+	}
+	else if (inputNode.mesh > -1) {
+		const tinygltf::Mesh& mesh = input.meshes[inputNode.mesh];
 		// Iterate through all primitives of this node's mesh
 		for (size_t i = 0; i < mesh.primitives.size(); i++) {
 			const tinygltf::Primitive& glTFPrimitive = mesh.primitives[i];
@@ -46,135 +161,441 @@ void GLTFLoader::loadNode(VulkanEngine& engine,const tinygltf::Node& inputNode,
 			uint32_t indexCount = 0;
 			// Vertices
 			{
-				const float* positionBuffer = nullptr;
-				const float* normalsBuffer = nullptr;
-				const float* texCoordsBuffer = nullptr;
-				const float* tangentsBuffer = nullptr;
-				size_t vertexCount = 0;
-
-				// Get buffer data for vertex positions
-				if (glTFPrimitive.attributes.find("POSITION") != glTFPrimitive.attributes.end()) {
-					const tinygltf::Accessor& accessor = input.accessors[glTFPrimitive.attributes.find("POSITION")->second];
-					const tinygltf::BufferView& view = input.bufferViews[accessor.bufferView];
-					positionBuffer = reinterpret_cast<const float*>(&(input.buffers[view.buffer].data[accessor.byteOffset + view.byteOffset]));
-					vertexCount = accessor.count;
+				//one pass over the attribute map instead of a find per attribute and use
+				AccessorView positions, normals, texCoords, tangents;
+				for (const auto& attribute : glTFPrimitive.attributes) {
+					if (attribute.first == "POSITION") {
+						accessor_view(input, attribute.second, TINYGLTF_TYPE_VEC3, positions);
+					}
+					else if (attribute.first == "NORMAL") {
+						accessor_view(input, attribute.second, TINYGLTF_TYPE_VEC3, normals);
+					}
+					// glTF supports multiple sets, we only load the first one
+					else if (attribute.first == "TEXCOORD_0") {
+						accessor_view(input, attribute.second, TINYGLTF_TYPE_VEC2, texCoords);
+					}
+					else if (attribute.first == "TANGENT") {
+						accessor_view(input, attribute.second, TINYGLTF_TYPE_VEC4, tangents);
+					}
 				}
-				// Get buffer data for vertex normals
-				if (glTFPrimitive.attributes.find("NORMAL") != glTFPrimitive.attributes.end()) {
-					const tinygltf::Accessor& accessor = input.accessors[glTFPrimitive.attributes.find("NORMAL")->second];
-					const tinygltf::BufferView& view = input.bufferViews[accessor.bufferView];
-					normalsBuffer = reinterpret_cast<const float*>(&(input.buffers[view.buffer].data[accessor.byteOffset + view.byteOffset]));
+				if (!positions.valid(TINYGLTF_COMPONENT_TYPE_FLOAT)) {
+					std::cerr << "Primitive without float positions skipped" << std::endl;
+					continue;
 				}
-				// Get buffer data for vertex texture coordinates
-				// glTF supports multiple sets, we only load the first one
-				if (glTFPrimitive.attributes.find("TEXCOORD_0") != glTFPrimitive.attributes.end()) {
-					const tinygltf::Accessor& accessor = input.accessors[glTFPrimitive.attributes.find("TEXCOORD_0")->second];
-					const tinygltf::BufferView& view = input.bufferViews[accessor.bufferView];
-					texCoordsBuffer = reinterpret_cast<const float*>(&(input.buffers[view.buffer].data[accessor.byteOffset + view.byteOffset]));
+				const size_t vertexCount = positions.count;
+
+				// Append data to model's vertex buffer, attribute by attribute straight from the glTF buffers
+				vertexBuffer.resize(vertexStart + vertexCount);
+				Vertex* vert = vertexBuffer.data() + vertexStart;
+				copy_strided(&vert->pos, sizeof(Vertex), positions.data, positions.stride, vertexCount, sizeof(glm::vec3));
+				if (normals.valid(TINYGLTF_COMPONENT_TYPE_FLOAT)) {
+					copy_strided(&vert->normal, sizeof(Vertex), normals.data, normals.stride, std::min(vertexCount, normals.count), sizeof(glm::vec3));
 				}
-				if (glTFPrimitive.attributes.find("TANGENT") != glTFPrimitive.attributes.end()) {
-					const tinygltf::Accessor& accessor = input.accessors[glTFPrimitive.attributes.find("TANGENT")->second];
-					const tinygltf::BufferView& view = input.bufferViews[accessor.bufferView];
-					tangentsBuffer = reinterpret_cast<const float*>(&(input.buffers[view.buffer].data[accessor.byteOffset + view.byteOffset]));
+				if (texCoords.valid(TINYGLTF_COMPONENT_TYPE_FLOAT)) {
+					copy_strided(&vert->uv, sizeof(Vertex), texCoords.data, texCoords.stride, std::min(vertexCount, texCoords.count), sizeof(glm::vec2));
+				}
+				if (tangents.valid(TINYGLTF_COMPONENT_TYPE_FLOAT)) {
+					copy_strided(&vert->tangent, sizeof(Vertex), tangents.data, tangents.stride, std::min(vertexCount, tangents.count), sizeof(glm::vec4));
 				}
-
-
-				// Append data to model's vertex buffer
 				for (size_t v = 0; v < vertexCount; v++) {
-					Vertex vert{};
-					vert.pos = glm::vec4(glm::make_vec3(&positionBuffer[v * 3]), 1.0f);
-					vert.normal = glm::normalize(glm::vec3(normalsBuffer ? glm::make_vec3(&normalsBuffer[v * 3]) : glm::vec3(0.0f)));
-					vert.uv = texCoordsBuffer ? glm::make_vec2(&texCoordsBuffer[v * 2]) : glm::vec3(0.0f);
-					vert.color = glm::vec3(1.0f);
-					vert.tangent = tangentsBuffer ? glm::vec4(glm::make_vec4(&tangentsBuffer[v * 4])) : glm::vec4(0.0f);
-					vertexBuffer.push_back(vert);
+					if (glm::dot(vert[v].normal, vert[v].normal) > 0.0f) {
+						vert[v].normal = glm::normalize(vert[v].normal);
+					}
+					vert[v].color = glm::vec3(1.0f);
 				}
 			}
 			// Indices
 			{
-				const tinygltf::Accessor& accessor = input.accessors[glTFPrimitive.indices];
-				const tinygltf::BufferView& bufferView = input.bufferViews[accessor.bufferView];
-				const tinygltf::Buffer& buffer = input.buffers[bufferView.buffer];
-
-				indexCount += static_cast<uint32_t>(accessor.count);
-
-				// glTF supports different component types of indices
-				switch (accessor.componentType) {
-				case TINYGLTF_PARAMETER_TYPE_UNSIGNED_INT: {
-					const uint32_t* buf = reinterpret_cast<const uint32_t*>(&buffer.data[accessor.byteOffset + bufferView.byteOffset]);
-					for (size_t index = 0; index < accessor.count; index++) {
-						indexBuffer.push_back(buf[index] + vertexStart);
+				const uint32_t vertexCount = static_cast<uint32_t>(vertexBuffer.size()) - vertexStart;
+				AccessorView view;
+				if (glTFPrimitive.indices < 0) {
+					//non indexed primitive, draw the vertices in order
+					indexCount = vertexCount;
+					indexBuffer.resize(firstIndex + indexCount);
+					for (uint32_t index = 0; index < indexCount; index++) {
+						indexBuffer[firstIndex + index] = vertexStart + index;
 					}
-					break;
 				}
-				case TINYGLTF_PARAMETER_TYPE_UNSIGNED_SHORT: {
-					const uint16_t* buf = reinterpret_cast<const uint16_t*>(&buffer.data[accessor.byteOffset + bufferView.byteOffset]);
-					for (size_t index = 0; index < accessor.count; index++) {
-						indexBuffer.push_back(buf[index] + vertexStart);
+				else if (accessor_view(input, glTFPrimitive.indices, TINYGLTF_TYPE_SCALAR, view)) {
+					indexCount = static_cast<uint32_t>(view.count);
+					indexBuffer.resize(firstIndex + indexCount);
+					uint32_t* dst = indexBuffer.data() + firstIndex;
+
+					// glTF supports different component types of indices
+					switch (view.componentType) {
+					case TINYGLTF_PARAMETER_TYPE_UNSIGNED_INT:
+						//tightly packed 32 bit indices are one memcpy, then rebased onto the merged vertex buffer
+						copy_strided(dst, sizeof(uint32_t), view.data, view.stride, indexCount, sizeof(uint32_t));
+						if (vertexStart != 0) {
+							for (uint32_t index = 0; index < indexCount; index++) {
+								dst[index] += vertexStart;
+							}
+						}
+						break;
+					case TINYGLTF_PARAMETER_TYPE_UNSIGNED_SHORT:
+						for (uint32_t index = 0; index < indexCount; index++) {
+							uint16_t value;
+							memcpy(&value, view.data + index * view.stride, sizeof(value));
+							dst[index] = value + vertexStart;
+						}
+						break;
+					case TINYGLTF_PARAMETER_TYPE_UNSIGNED_BYTE:
+						for (uint32_t index = 0; index < indexCount; index++) {
+							dst[index] = view.data[index * view.stride] + vertexStart;
+						}
+						break;
+					default:
+						std::cerr << "Index component type " << view.componentType << " not supported!" << std::endl;
+						indexBuffer.resize(firstIndex);
+						vertexBuffer.resize(vertexStart);
+						continue;
 					}
-					break;
-				}
-				case TINYGLTF_PARAMETER_TYPE_UNSIGNED_BYTE: {
-					const uint8_t* buf = reinterpret_cast<const uint8_t*>(&buffer.data[accessor.byteOffset + bufferView.byteOffset]);
-					for (size_t index = 0; index < accessor.count; index++) {
-						indexBuffer.push_back(buf[index] + vertexStart);
+					//the optimizer and the draws trust every index to name a vertex of the primitive
+					bool inRange = true;
+					for (uint32_t index = 0; index < indexCount && inRange; index++) {
+						inRange = dst[index] >= vertexStart && dst[index] - vertexStart < vertexCount;
+					}
+					if (!inRange) {
+						std::cerr << "Primitive index past its " << vertexCount << " vertices, skipped" << std::endl;
+						indexBuffer.resize(firstIndex);
+						vertexBuffer.resize(vertexStart);
+						continue;
 					}
-					break;
 				}
-				default:
-					std::cerr << "Index component type " << accessor.componentType << " not supported!" << std::endl;
-					return;
+				else {
+					std::cerr << "Primitive index accessor not readable, skipped" << std::endl;
+					vertexBuffer.resize(vertexStart);
+					continue;
 				}
 			}
 			Primitive primitive{};
 			primitive.firstIndex = firstIndex;
 			primitive.indexCount = indexCount;
 			primitive.materialIndex = glTFPrimitive.material;
-			node->mesh.primitives.push_back(primitive);
+			//POSITION min/max are required by the spec, exporters still get them wrong or drop them now and then
+			const tinygltf::Accessor& positionAccessor = input.accessors[glTFPrimitive.attributes.find("POSITION")->second];
+			if (positionAccessor.minValues.size() == 3 && positionAccessor.maxValues.size() == 3) {
+				primitive.boundsMin = glm::vec3(glm::make_vec3(positionAccessor.minValues.data()));
+				primitive.boundsMax = glm::vec3(glm::make_vec3(positionAccessor.maxValues.data()));
+			}
+			else if (vertexBuffer.size() > vertexStart) {
+				primitive.boundsMin = primitive.boundsMax = vertexBuffer[vertexStart].pos;
+				for (size_t v = vertexStart; v < vertexBuffer.size(); v++) {
+					primitive.boundsMin = glm::min(primitive.boundsMin, vertexBuffer[v].pos);
+					primitive.boundsMax = glm::max(primitive.boundsMax, vertexBuffer[v].pos);
+				}
+			}
+			scene.meshes[node].primitives.push_back(primitive);
+			geometryRanges.push_back({ vertexStart, static_cast<uint32_t>(vertexBuffer.size()) - vertexStart, firstIndex, indexCount });
+		}
+	}
+
+	// Load node's children right behind it, which keeps the subtree contiguous
+	for (size_t i = 0; i < inputNode.children.size(); i++) {
+		if (!valid_index(inputNode.children[i], input.nodes)) {
+			continue;
+		}
+		loadNode(engine,input.nodes[inputNode.children[i]], input, static_cast<int32_t>(node), inputNode.children[i], indexBuffer, vertexBuffer);
+	}
+	scene.subtreeEnd[node] = scene.size();
+}
+
+void GLTFLoader::setTranslation(uint32_t node, const glm::vec3& translation)
+{
+	scene.translation[node] = translation;
+	markDirty(node);
+}
+
+void GLTFLoader::setRotation(uint32_t node, const glm::quat& rotation)
+{
+	scene.rotation[node] = rotation;
+	markDirty(node);
+}
+
+void GLTFLoader::setScale(uint32_t node, const glm::vec3& scale)
+{
+	scene.scale[node] = scale;
+	markDirty(node);
+}
+
+void GLTFLoader::markDirty(uint32_t node)
+{
+	if (!scene.dirty[node]) {
+		scene.dirty[node] = 1;
+		scene.dirtyCount++;
+	}
+}
+
+void GLTFLoader::updateWorldMatrices()
+{
+	if (scene.dirtyCount == 0) {
+		return;
+	}
+	//parents precede children, so one forward pass sees every parent world matrix already updated.
+	//a dirty node drags its whole subtree along, clean subtrees are only touched by the flag check
+	uint32_t dirtyUntil = 0;
+	for (uint32_t node = 0; node < scene.size(); node++) {
+		if (!scene.dirty[node] && node >= dirtyUntil) {
+			continue;
+		}
+		glm::mat4 local = scene.localMatrix(node);
+		scene.world[node] = scene.parent[node] >= 0 ? scene.world[scene.parent[node]] * local : local;
+		scene.dirty[node] = 0;
+		dirtyUntil = std::max(dirtyUntil, scene.subtreeEnd[node]);
+	}
+	scene.dirtyCount = 0;
+}
+
+void GLTFLoader::optimizeGeometry(const std::string& filename, std::vector<uint32_t>& indexBuffer, std::vector<Vertex>& vertexBuffer)
+{
+	//the key covers exactly what the optimizer sees, so any change to the asset or the loader invalidates it
+	uint64_t inputHash = vkcook::hash_bytes(vertexBuffer.data(), vertexBuffer.size() * sizeof(Vertex)) * 31 +
+		vkcook::hash_bytes(indexBuffer.data(), indexBuffer.size() * sizeof(uint32_t));
+	std::string cachePath = filename + ".meshopt";
+	if (vkcook::load_geometry(cachePath.c_str(), inputHash, vertexBuffer.data(), sizeof(Vertex), vertexBuffer.size(), indexBuffer.data(), indexBuffer.size())) {
+		std::cout << filename << ": loaded optimized geometry" << std::endl;
+		return;
+	}
+
+	vkmeshopt::CacheStats before = vkmeshopt::analyze_vertex_cache(indexBuffer.data(), indexBuffer.size(), vertexBuffer.size());
+	for (const GeometryRange& range : geometryRanges) {
+		if (range.indexCount < 6 || range.vertexCount == 0) {
+			continue;
+		}
+		//the optimizer works on primitive local indices
+		uint32_t* indices = indexBuffer.data() + range.firstIndex;
+		for (uint32_t i = 0; i < range.indexCount; i++) {
+			indices[i] -= range.firstVertex;
+		}
+		Vertex* vertices = vertexBuffer.data() + range.firstVertex;
+		vkmeshopt::optimize_vertex_cache(indices, range.indexCount, range.vertexCount);
+		vkmeshopt::optimize_overdraw(indices, range.indexCount, &vertices[0].pos, sizeof(Vertex), range.vertexCount);
+		//unreferenced vertices end up at the back of the range and stay there unused
+		vkmeshopt::optimize_vertex_fetch(vertices, sizeof(Vertex), range.vertexCount, indices, range.indexCount);
+		for (uint32_t i = 0; i < range.indexCount; i++) {
+			indices[i] += range.firstVertex;
 		}
 	}
+	vkmeshopt::CacheStats after = vkmeshopt::analyze_vertex_cache(indexBuffer.data(), indexBuffer.size(), vertexBuffer.size());
+	std::cout << filename << ": optimized " << geometryRanges.size() << " primitives, ACMR " << before.acmr << " -> " << after.acmr
+		<< ", ATVR " << before.atvr << " -> " << after.atvr << std::endl;
 
-	if (parent) {
-		parent->children.push_back(node);
+	vkcook::write_geometry(cachePath.c_str(), inputHash, vertexBuffer.data(), sizeof(Vertex), vertexBuffer.size(), indexBuffer.data(), indexBuffer.size());
+}
+
+void GLTFLoader::buildLods(const std::string& filename, std::vector<uint32_t>& indexBuffer, const std::vector<Vertex>& vertexBuffer)
+{
+	uint64_t inputHash = vkcook::hash_bytes(vertexBuffer.data(), vertexBuffer.size() * sizeof(Vertex)) * 31 +
+		vkcook::hash_bytes(indexBuffer.data(), indexBuffer.size() * sizeof(uint32_t));
+	std::string cachePath = filename + ".lods";
+	std::vector<uint32_t> lodIndices;
+	std::vector<uint32_t> rangeCounts;
+	lodRanges.clear();
+	if (vkcook::load_lods(cachePath.c_str(), inputHash, lodIndices, lodRanges, rangeCounts) && rangeCounts.size() == geometryRanges.size()) {
+		std::cout << filename << ": loaded LOD chains" << std::endl;
+	}
+	else {
+		lodIndices.clear();
+		lodRanges.clear();
+		rangeCounts.clear();
+		const uint32_t lodIndexBase = static_cast<uint32_t>(indexBuffer.size());
+		std::vector<uint32_t> local;
+		for (const GeometryRange& range : geometryRanges) {
+			size_t firstRange = lodRanges.size();
+			//small primitives cost the same at any distance
+			if (range.indexCount < 3 * 256 || range.vertexCount == 0) {
+				lodRanges.push_back({ range.firstIndex, range.indexCount, 0.0f });
+			}
+			else {
+				//the simplifier works on primitive local indices like the optimizer
+				local.assign(indexBuffer.begin() + range.firstIndex, indexBuffer.begin() + range.firstIndex + range.indexCount);
+				for (uint32_t& index : local) {
+					index -= range.firstVertex;
+				}
+				size_t firstLodIndex = lodIndices.size();
+				vklod::build_lod_chain(local.data(), local.size(), range.firstIndex, &vertexBuffer[range.firstVertex].pos, sizeof(Vertex),
+					range.vertexCount, lodIndexBase, lodIndices, lodRanges);
+				for (size_t i = firstLodIndex; i < lodIndices.size(); i++) {
+					lodIndices[i] += range.firstVertex;
+				}
+			}
+			rangeCounts.push_back(static_cast<uint32_t>(lodRanges.size() - firstRange));
+		}
+		std::cout << filename << ": " << lodRanges.size() - geometryRanges.size() << " LOD ranges with " << lodIndices.size() / 3
+			<< " triangles for " << indexBuffer.size() / 3 << " full detail ones" << std::endl;
+		vkcook::write_lods(cachePath.c_str(), inputHash, lodIndices, lodRanges, rangeCounts);
+	}
+	indexBuffer.insert(indexBuffer.end(), lodIndices.begin(), lodIndices.end());
+
+	//primitives were added in the same order as their geometry ranges
+	uint32_t rangeIndex = 0;
+	uint32_t firstLod = 0;
+	for (uint32_t node = 0; node < scene.size(); node++) {
+		for (Primitive& primitive : scene.meshes[node].primitives) {
+			primitive.firstLod = firstLod;
+			primitive.lodCount = rangeCounts[rangeIndex];
+			primitive.lod = 0;
+			firstLod += rangeCounts[rangeIndex++];
+		}
+	}
+}
+
+VertexInputDescription GLTFLoader::get_vertex_description(VertexFormat format)
+{
+	VertexInputDescription description;
+	const bool compact = format == VertexFormat::Compact;
+
+	VkVertexInputBindingDescription mainBinding = {};
+	mainBinding.binding = 0;
+	mainBinding.stride = compact ? sizeof(CompactVertex) : sizeof(Vertex);
+	mainBinding.inputRate = VK_VERTEX_INPUT_RATE_VERTEX;
+	description.bindings.push_back(mainBinding);
+
+	if (compact) {
+		VkVertexInputBindingDescription colorBinding = {};
+		colorBinding.binding = 1;
+		colorBinding.stride = 0;
+		colorBinding.inputRate = VK_VERTEX_INPUT_RATE_VERTEX;
+		description.bindings.push_back(colorBinding);
+	}
+
+	auto attribute = [&](uint32_t location, uint32_t binding, VkFormat vkFormat, uint32_t offset) {
+		VkVertexInputAttributeDescription desc = {};
+		desc.location = location;
+		desc.binding = binding;
+		desc.format = vkFormat;
+		desc.offset = offset;
+		description.attributes.push_back(desc);
+	};
+
+	if (compact) {
+		attribute(0, 0, VK_FORMAT_R16G16B16A16_SNORM, offsetof(CompactVertex, pos));
+		attribute(1, 0, VK_FORMAT_R8G8B8A8_SNORM, offsetof(CompactVertex, normal));
+		attribute(2, 0, VK_FORMAT_R16G16_SFLOAT, offsetof(CompactVertex, uv));
+		attribute(3, 1, VK_FORMAT_R32G32B32_SFLOAT, 0);
+		attribute(4, 0, VK_FORMAT_R8G8B8A8_SNORM, offsetof(CompactVertex, tangent));
 	}
 	else {
-		nodes.push_back(node);
+		attribute(0, 0, VK_FORMAT_R32G32B32_SFLOAT, offsetof(Vertex, pos));
+		attribute(1, 0, VK_FORMAT_R32G32B32_SFLOAT, offsetof(Vertex, normal));
+		attribute(2, 0, VK_FORMAT_R32G32_SFLOAT, offsetof(Vertex, uv));
+		attribute(3, 0, VK_FORMAT_R32G32B32_SFLOAT, offsetof(Vertex, color));
+		attribute(4, 0, VK_FORMAT_R32G32B32A32_SFLOAT, offsetof(Vertex, tangent));
 	}
+	return description;
 }
 
 void GLTFLoader::loadImages(VulkanEngine& engine,tinygltf::Model& input)
 {
-	images.resize(input.images.size()); //do 
-	for (size_t i = 0; i < input.images.size(); i++) {
-		tinygltf::Image& glTFImage = input.images[i];
-		// Get the image data from the glTF loader
-		unsigned char* buffer = nullptr;
-		VkDeviceSize bufferSize = 0;
-		bool deleteBuffer = false;
-		// We convert RGB-only images to RGBA, as most devices don't support RGB-formats in Vulkan
-		if (glTFImage.component == 3) {
-			bufferSize = glTFImage.width * glTFImage.height * 4;
-			buffer = new unsigned char[bufferSize];
-			unsigned char* rgba = buffer;
-			unsigned char* rgb = &glTFImage.image[0];
-			for (size_t i = 0; i < glTFImage.width * glTFImage.height; ++i) {
-				memcpy(rgba, rgb, sizeof(unsigned char) * 3);
-				rgba += 4;
-				rgb += 3;
+	auto start = std::chrono::high_resolution_clock::now();
+	const uint32_t imageCount = static_cast<uint32_t>(input.images.size());
+	images.resize(imageCount);
+	std::vector<DecodedImage> decoded(imageCount);
+
+	//decode + rgb expansion runs on the workers, finished images are uploaded here in completion order
+	//so recording/staging image N overlaps decoding N+1. the upload queue is only touched by this thread
+	std::mutex readyMutex;
+	std::condition_variable readyCondition;
+	std::deque<uint32_t> ready;
+	for (uint32_t i = 0; i < imageCount; i++) {
+		engine._threadPool.enqueue([&, i]() {
+			decodeImage(input.images[i], decoded[i]);
+			{
+				std::lock_guard<std::mutex> lock(readyMutex);
+				ready.push_back(i);
 			}
-			deleteBuffer = true;
+			readyCondition.notify_one();
+		});
+	}
+
+	for (uint32_t uploaded = 0; uploaded < imageCount; uploaded++) {
+		uint32_t i;
+		{
+			std::unique_lock<std::mutex> lock(readyMutex);
+			readyCondition.wait(lock, [&]() { return !ready.empty(); });
+			i = ready.front();
+			ready.pop_front();
+		}
+		DecodedImage& image = decoded[i];
+		if (image.pixels == nullptr) {
+			//keep the material's image index valid with a white texel
+			std::cout << "Failed to decode glTF image " << i << " " << input.images[i].uri << std::endl;
+			static uint8_t white[4] = { 255, 255, 255, 255 };
+			vkutil::load_image_from_buffer(engine, white, sizeof(white), 1, 1, images[i].texture);
 		}
 		else {
-			std::cout << " rgba";
-			buffer = &glTFImage.image[0];
-			bufferSize = glTFImage.image.size();
+			// Load texture from image buffer
+			vkutil::load_image_from_buffer(engine, image.pixels, image.size, image.width, image.height, images[i].texture);
 		}
-		// Load texture from image buffer
-		vkutil::load_image_from_buffer(engine,buffer,bufferSize,glTFImage.width,glTFImage.height,images[i].texture);
+		//the pixels are in the staging ring now
+		image.release();
+		//start the copies while the remaining images decode
+		engine._uploadQueue.submit();
+	}
+
+	std::cout << imageCount << " glTF images decoded and uploaded in "
+		<< std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - start).count() << " ms" << std::endl;
+}
 
-		if (deleteBuffer) {
-			delete[] buffer;
+void GLTFLoader::DecodedImage::release()
+{
+	if (decoded) {
+		stbi_image_free(decoded);
+		decoded = nullptr;
+	}
+	expanded = std::vector<uint8_t>();
+	pixels = nullptr;
+}
+
+void GLTFLoader::decodeImage(tinygltf::Image& glTFImage, DecodedImage& outImage)
+{
+	if (glTFImage.component > 0) {
+		//already decoded by tinygltf
+		outImage.width = glTFImage.width;
+		outImage.height = glTFImage.height;
+		outImage.size = size_t(glTFImage.width) * glTFImage.height * 4;
+		if (glTFImage.component == 4) {
+			outImage.pixels = glTFImage.image.data();
+			return;
 		}
+		if (glTFImage.component == 3) {
+			outImage.expanded.resize(outImage.size);
+			vkutil::expand_rgb_to_rgba(glTFImage.image.data(), outImage.expanded.data(), size_t(glTFImage.width) * glTFImage.height);
+			outImage.pixels = outImage.expanded.data();
+			glTFImage.image.clear();
+			glTFImage.image.shrink_to_fit();
+		}
+		return;
+	}
+
+	//the deferred loader left the encoded file in image
+	const int encodedSize = static_cast<int>(glTFImage.image.size());
+	int width = 0, height = 0, components = 0;
+	if (!stbi_info_from_memory(glTFImage.image.data(), encodedSize, &width, &height, &components)) {
+		return;
+	}
+	//rgb is decoded as is and expanded with the simd path, grey/grey-alpha are expanded by stb
+	int requested = components == 3 ? 3 : 4;
+	stbi_uc* pixels = stbi_load_from_memory(glTFImage.image.data(), encodedSize, &width, &height, &components, requested);
+	glTFImage.image.clear();
+	glTFImage.image.shrink_to_fit();
+	if (!pixels) {
+		return;
+	}
+	glTFImage.width = width;
+	glTFImage.height = height;
+	outImage.width = width;
+	outImage.height = height;
+	outImage.size = size_t(width) * height * 4;
+	if (requested == 3) {
+		outImage.expanded.resize(outImage.size);
+		vkutil::expand_rgb_to_rgba(pixels, outImage.expanded.data(), size_t(width) * height);
+		outImage.pixels = outImage.expanded.data();
+		stbi_image_free(pixels);
+	}
+	else {
+		outImage.pixels = pixels;
+		outImage.decoded = pixels;
 	}
 }
 
@@ -217,58 +638,112 @@ void GLTFLoader::loadMaterials(VulkanEngine& engine,tinygltf::Model& input)
 	}
 }
 
-void GLTFLoader::drawNode(VulkanEngine& engine,VkCommandBuffer commandBuffer, VkPipelineLayout pipelineLayout, GLTFLoader::Node* node)
+void GLTFLoader::draw(VkCommandBuffer commandBuffer, VkPipelineLayout pipelineLayout, const vkcull::Frustum* frustum,
+	const vklod::LodView* lodView)
 {
-	if (node->mesh.primitives.size() > 0) {
-		//Pass the node's matrix via push constants
-		//Traverse the node hierarchy to the top-most parent to get the final matrix of the current node
-		glm::mat4 nodeMatrix = node->matrix;
-		GLTFLoader::Node* currentParent = node->parent;
-		while (currentParent) {
-			nodeMatrix = currentParent->matrix * nodeMatrix;
-			currentParent = currentParent->parent;
+	VkDeviceSize offsets[2] = { 0, 0 };
+	VkBuffer buffers[2] = { vertices.verticesBuffer, constantColorBuffer };
+	vkCmdBindVertexBuffers(commandBuffer, 0, vertexFormat == VertexFormat::Compact ? 2 : 1, buffers, offsets);
+	vkCmdBindIndexBuffer(commandBuffer, indices.buffer, 0, VK_INDEX_TYPE_UINT32);
+	updateWorldMatrices();
+	//compact positions are dequantized by the node matrix
+	glm::mat4 dequantize = vertexFormat == VertexFormat::Compact ? vkvertex::dequantize_matrix(quantization) : glm::mat4(1.0f);
+	if (frustum) {
+		//primitive bounds are in the space of the node matrix, before dequantization
+		cullSpheres.clear();
+		cullPrimitives.clear();
+		for (uint32_t node = 0; node < scene.size(); node++) {
+			const std::vector<Primitive>& primitives = scene.meshes[node].primitives;
+			for (uint32_t i = 0; i < primitives.size(); i++) {
+				if (primitives[i].indexCount == 0) {
+					continue;
+				}
+				glm::vec3 center;
+				float radius;
+				vkcull::world_sphere(primitives[i].boundsMin, primitives[i].boundsMax, scene.world[node], center, radius);
+				cullSpheres.push(center, radius);
+				cullPrimitives.push_back({ node, i });
+			}
+		}
+		visiblePrimitives.resize(cullSpheres.size());
+		visiblePrimitives.resize(vkcull::cull_spheres(*frustum, cullSpheres, visiblePrimitives.data()));
+		//visible primitives keep the node order, so the node matrix is pushed once per run of primitives
+		uint32_t lastNode = UINT32_MAX;
+		for (uint32_t visible : visiblePrimitives) {
+			uint32_t node = cullPrimitives[visible].first;
+			Primitive& primitive = scene.meshes[node].primitives[cullPrimitives[visible].second];
+			if (node != lastNode) {
+				glm::mat4 nodeMatrix = scene.world[node] * dequantize;
+				vkCmdPushConstants(commandBuffer, pipelineLayout, VK_SHADER_STAGE_VERTEX_BIT, 0, sizeof(glm::mat4), &nodeMatrix);
+				lastNode = node;
+			}
+			const vklod::LodRange& range = selectLod(primitive, node, lodView);
+			vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, pipelineLayout, 1, 1, &materials[primitive.materialIndex].matDescriptorSet, 0, nullptr);
+			vkCmdDrawIndexed(commandBuffer, range.indexCount, 1, range.firstIndex, 0, 0);
 		}
+		return;
+	}
+	for (uint32_t node = 0; node < scene.size(); node++) {
+		const Mesh& mesh = scene.meshes[node];
+		if (mesh.primitives.empty()) {
+			continue;
+		}
+		glm::mat4 nodeMatrix = scene.world[node] * dequantize;
 		//Pass the final matrix to the vertex shader using push constants
 		vkCmdPushConstants(commandBuffer, pipelineLayout, VK_SHADER_STAGE_VERTEX_BIT, 0, sizeof(glm::mat4), &nodeMatrix);
-		//vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, pipelineLayout, 2, 1, &hmwks[node->index].descriptorSet, 0, nullptr);
-		for (GLTFLoader::Primitive& primitive : node->mesh.primitives) {
+		for (Primitive& primitive : scene.meshes[node].primitives) {
 			if (primitive.indexCount > 0) {
-				// Get the texture index for this primitive
-				//VulkanglTFModel::Texture texture = textures[materials[primitive.materialIndex].baseColorTextureIndex];
-				//VulkanglTFModel::Texture texture = textures[materials[primitive.materialIndex].normalTextureIndex];
-				//VulkanglTFModel::Texture colorTexture = textures[materials[primitive.materialIndex].baseColorTextureIndex];
+				const vklod::LodRange& range = selectLod(primitive, node, lodView);
 				// Bind the descriptor for the current primitive's texture
 				vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, pipelineLayout, 1, 1, &materials[primitive.materialIndex].matDescriptorSet, 0, nullptr);
-				//vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, pipelineLayout, 2, 1, &hmwks[node->index].descriptorSet, 0, nullptr);
-				//vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, pipelineLayout, 1, 1, &images[colorTexture.imageIndex].descriptorSet, 0, nullptr);
-				vkCmdDrawIndexed(commandBuffer, primitive.indexCount, 1, primitive.firstIndex, 0, 0);
+				vkCmdDrawIndexed(commandBuffer, range.indexCount, 1, range.firstIndex, 0, 0);
 			}
 		}
 	}
-	for (auto& child : node->children) {
-		drawNode(engine,commandBuffer, pipelineLayout, child);
+}
+
+const vklod::LodRange& GLTFLoader::selectLod(Primitive& primitive, uint32_t node, const vklod::LodView* lodView)
+{
+	if (lodView != nullptr && primitive.lodCount > 1) {
+		glm::vec3 center;
+		float radius;
+		vkcull::world_sphere(primitive.boundsMin, primitive.boundsMax, scene.world[node], center, radius);
+		const glm::mat4& world = scene.world[node];
+		float scale = std::max(glm::length(glm::vec3(world[0])), std::max(glm::length(glm::vec3(world[1])), glm::length(glm::vec3(world[2]))));
+		primitive.lod = vklod::select_lod(*lodView, &lodRanges[primitive.firstLod], primitive.lodCount, center, radius, scale, primitive.lod);
+	}
+	else {
+		primitive.lod = 0;
 	}
+	return lodRanges[primitive.firstLod + std::min(primitive.lod, primitive.lodCount - 1)];
 }
 
-void GLTFLoader::draw(VulkanEngine& engine,VkCommandBuffer commandBuffer, VkPipelineLayout pipelineLayout)
+bool GLTFLoader::loadModel(const std::string& filename, tinygltf::Model& model)
 {
-	VkDeviceSize offsets[1] = { 0 };
-	vkCmdBindVertexBuffers(commandBuffer, 0, 1, &vertices.verticesBuffer, offsets);
-	vkCmdBindIndexBuffer(commandBuffer, indices.buffer, 0, VK_INDEX_TYPE_UINT32);
-	// Render all nodes at top-level
-	for (auto& node : nodes) {
-		drawNode(engine,commandBuffer, pipelineLayout, node);
+	tinygltf::TinyGLTF gltfContext;
+	std::string error, warning;
+
+	gltfContext.SetImageLoader(keep_encoded_image, nullptr);
+	//.glb keeps the json and the buffers in one file, the buffers are read without the base64 detour of embedded .gltf
+	bool binary = filename.size() >= 4 && (filename.compare(filename.size() - 4, 4, ".glb") == 0 || filename.compare(filename.size() - 4, 4, ".GLB") == 0);
+	bool fileLoaded = binary ? gltfContext.LoadBinaryFromFile(&model, &error, &warning, filename)
+		: gltfContext.LoadASCIIFromFile(&model, &error, &warning, filename);
+	if (!warning.empty()) {
+		std::cout << filename << ": " << warning << std::endl;
+	}
+	if (!error.empty()) {
+		std::cerr << filename << ": " << error << std::endl;
 	}
+	return fileLoaded;
 }
 
 void GLTFLoader::loadgltfFile(VulkanEngine& engine,std::string filename)
 {
     tinygltf::Model glTFInput;
-	tinygltf::TinyGLTF gltfContext;
-
-	std::string error, warning;
 
-	bool fileLoaded = gltfContext.LoadASCIIFromFile(&glTFInput, &error, &warning, filename);
+	auto start = std::chrono::high_resolution_clock::now();
+	bool fileLoaded = loadModel(filename, glTFInput);
+	auto parsed = std::chrono::high_resolution_clock::now();
 
 	std::vector<uint32_t> indexBuffer;
 	std::vector<Vertex> vertexBuffer;
@@ -279,11 +754,35 @@ void GLTFLoader::loadgltfFile(VulkanEngine& engine,std::string filename)
 		loadTextures(engine,glTFInput);
 		loadMaterials(engine,glTFInput);
 
-		const tinygltf::Scene& scene = glTFInput.scenes[0];
-		for (size_t i = 0; i < scene.nodes.size(); i++) {
-			const tinygltf::Node node = glTFInput.nodes[scene.nodes[i]];
-			loadNode(engine,node, glTFInput, nullptr, scene.nodes[i], indexBuffer, vertexBuffer);
+		auto geometryStart = std::chrono::high_resolution_clock::now();
+		geometryRanges.clear();
+		scene = SceneGraph{};
+		int sceneIndex = valid_index(glTFInput.defaultScene, glTFInput.scenes) ? glTFInput.defaultScene : 0;
+		static const tinygltf::Scene emptyScene;
+		const tinygltf::Scene& gltfScene = valid_index(sceneIndex, glTFInput.scenes) ? glTFInput.scenes[sceneIndex] : emptyScene;
+		//size the merged arrays once, loadNode then only resizes within the reserved capacity
+		size_t totalVertices = 0;
+		size_t totalIndices = 0;
+		for (int root : gltfScene.nodes) {
+			count_geometry(glTFInput, root, totalVertices, totalIndices);
 		}
+		vertexBuffer.reserve(totalVertices);
+		indexBuffer.reserve(totalIndices);
+		for (size_t i = 0; i < gltfScene.nodes.size(); i++) {
+			if (!valid_index(gltfScene.nodes[i], glTFInput.nodes)) {
+				std::cout << "glTF scene references missing node " << gltfScene.nodes[i] << ", skipped" << std::endl;
+				continue;
+			}
+			const tinygltf::Node node = glTFInput.nodes[gltfScene.nodes[i]];
+			loadNode(engine,node, glTFInput, -1, gltfScene.nodes[i], indexBuffer, vertexBuffer);
+		}
+		auto assembled = std::chrono::high_resolution_clock::now();
+		std::cout << filename << ": parsed in " << std::chrono::duration<double, std::milli>(parsed - start).count() << " ms, "
+			<< vertexBuffer.size() << " vertices and " << indexBuffer.size() << " indices assembled in "
+			<< std::chrono::duration<double, std::milli>(assembled - geometryStart).count() << " ms" << std::endl;
+		optimizeGeometry(filename, indexBuffer, vertexBuffer);
+		buildLods(filename, indexBuffer, vertexBuffer);
+		updateWorldMatrices();
 	}
 	else {
 		std::cout << "Could not open the glTF file.\n\nThe file is part of the additional asset pack.\n\nRun \"download_assets.py\" in the repository root to download the latest version.";
@@ -291,31 +790,48 @@ void GLTFLoader::loadgltfFile(VulkanEngine& engine,std::string filename)
 	}
 
 	size_t vertexBufferSize = vertexBuffer.size() * sizeof(Vertex);
-	size_t indexBufferSize = indexBuffer.size() * sizeof(uint32_t);
-	indices.count = static_cast<uint32_t>(indexBuffer.size());
+	const void* vertexData = vertexBuffer.data();
+	std::vector<CompactVertex> compactBuffer;
+	if (vertexFormat == VertexFormat::Compact && !vertexBuffer.empty()) {
+		glm::vec3 boundsMin = vertexBuffer[0].pos;
+		glm::vec3 boundsMax = vertexBuffer[0].pos;
+		for (const Vertex& vert : vertexBuffer) {
+			boundsMin = glm::min(boundsMin, vert.pos);
+			boundsMax = glm::max(boundsMax, vert.pos);
+		}
+		quantization = vkvertex::quantization_for(boundsMin, boundsMax);
 
-	struct StagingBuffer {
-		VkBuffer buffer;
-		VkDeviceMemory memory;
-	} vertexStaging, indexStaging;
+		compactBuffer.resize(vertexBuffer.size());
+		const size_t count = vertexBuffer.size();
+		vkvertex::encode_positions(&vertexBuffer[0].pos, sizeof(Vertex), count, quantization, compactBuffer[0].pos, sizeof(CompactVertex));
+		vkvertex::encode_snorm8(&vertexBuffer[0].normal, sizeof(Vertex), count, 3, compactBuffer[0].normal, sizeof(CompactVertex));
+		//tangent is the last member, so its 4 floats are exactly in bounds
+		vkvertex::encode_snorm8(&vertexBuffer[0].tangent, sizeof(Vertex), count, 4, compactBuffer[0].tangent, sizeof(CompactVertex));
+		vkvertex::encode_half2(&vertexBuffer[0].uv, sizeof(Vertex), count, compactBuffer[0].uv, sizeof(CompactVertex));
 
+		std::cout << filename << ": " << count << " vertices, " << vertexBufferSize / 1024 << " KiB -> "
+			<< count * sizeof(CompactVertex) / 1024 << " KiB compact" << std::endl;
+		vertexBufferSize = count * sizeof(CompactVertex);
+		vertexData = compactBuffer.data();
 
-	engine.createBuffer(
-		vertexBufferSize,
-		VK_BUFFER_USAGE_TRANSFER_SRC_BIT,
-		VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
-		vertexStaging.buffer,
-		vertexStaging.memory,
-		vertexBuffer.data()
-	);
-	engine.createBuffer(
-		indexBufferSize,
-		VK_BUFFER_USAGE_TRANSFER_SRC_BIT,
-		VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
-		indexStaging.buffer,
-		indexStaging.memory,
-		indexBuffer.data()
-	);
+		glm::vec4 white{ 1.0f };
+		engine.createBuffer(
+			sizeof(white),
+			VK_BUFFER_USAGE_VERTEX_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+			VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
+			constantColorBuffer,
+			constantColorMemory
+		);
+		engine._uploadQueue.uploadBuffer(constantColorBuffer, &white, sizeof(white));
+		VkBuffer colorBuffer = constantColorBuffer;
+		Allocation colorMemory = constantColorMemory;
+		engine._mainDeletionQueue.push_function([=, &engine]() {
+			vkDestroyBuffer(engine._device, colorBuffer, nullptr);
+			engine._allocator.free(colorMemory);
+		});
+	}
+	size_t indexBufferSize = indexBuffer.size() * sizeof(uint32_t);
+	indices.count = static_cast<uint32_t>(indexBuffer.size());
 
 	engine.createBuffer(
 		vertexBufferSize,
@@ -332,11 +848,6 @@ void GLTFLoader::loadgltfFile(VulkanEngine& engine,std::string filename)
 		indices.memory
 	);
 
-	engine.copyBuffer(vertexStaging.buffer, vertices.verticesBuffer, vertexBufferSize);
-	engine.copyBuffer(indexStaging.buffer, indices.buffer, indexBufferSize);
-
-	vkDestroyBuffer(engine._device, vertexStaging.buffer, nullptr);
-	vkFreeMemory(engine._device, vertexStaging.memory, nullptr);
-	vkDestroyBuffer(engine._device, indexStaging.buffer, nullptr);
-	vkFreeMemory(engine._device, indexStaging.memory, nullptr);
+	engine._uploadQueue.uploadBuffer(vertices.verticesBuffer, vertexData, vertexBufferSize);
+	engine._uploadQueue.uploadBuffer(indices.buffer, indexBuffer.data(), indexBufferSize);
 }
@@ -1,6 +1,10 @@
 #pragma once
 #include <tiny_gltf.h>
 #include <vk_types.h>
+#include <vk_mesh.h>
+#include <vk_vertexformat.h>
+#include <vk_culling.h>
+#include <vk_lod.h>
 
 
 #include <glm/glm.hpp>
@@ -19,54 +23,97 @@ class GLTFLoader
 		glm::vec4 tangent;
 	};
 
+	//VertexFormat::Compact, 20 bytes instead of 60. color is always 1 so it comes from a stride 0 binding
+	struct CompactVertex {
+		//snorm16 relative to the model quantization, w unused
+		int16_t pos[4];
+		//snorm8, w unused
+		int8_t normal[4];
+		//snorm8 with the handedness in w
+		int8_t tangent[4];
+		//half floats
+		uint16_t uv[2];
+	};
+
+	static VertexInputDescription get_vertex_description(VertexFormat format);
+
+	//set before loadgltfFile
+	VertexFormat vertexFormat{ VertexFormat::Full };
+	//positions of compact vertices are relative to the bounds of the whole model
+	vkvertex::Quantization quantization;
+	//vec4(1) for the color binding of compact vertices
+	VkBuffer constantColorBuffer{ VK_NULL_HANDLE };
+	Allocation constantColorMemory;
+
 	struct Vertices
 	{
 		VkBuffer verticesBuffer;
-		VkDeviceMemory verticesMemory;
+		Allocation verticesMemory;
 	}vertices;
 
 	struct {
 		int count;
 		VkBuffer buffer;
-		VkDeviceMemory memory;
+		Allocation memory;
 	} indices;
 
 	struct Primitive {
 		uint32_t firstIndex;
 		uint32_t indexCount;
 		int32_t materialIndex;
+		//object space positions, from the accessor min/max when the file has them
+		glm::vec3 boundsMin;
+		glm::vec3 boundsMax;
+		//ranges in lodRanges, the first one is firstIndex/indexCount
+		uint32_t firstLod;
+		uint32_t lodCount;
+		//range drawn last frame, the primitives belong to one node so this is per node
+		uint32_t lod;
 	};
 
 	struct Mesh {
 		std::vector<Primitive> primitives;
 	};
-	struct Node {
-		Node* parent;
-		std::vector<Node*> children;
-		Mesh mesh;
-		glm::mat4 matrix;
-		bool hasAnimation = false;
-		uint32_t            index;
-		glm::vec3           translation{};
-		glm::vec3           scale{ 1.0f };
-		glm::quat           rotation{};
-		glm::mat4 getLocalMatrix()
-		{
-			return glm::translate(glm::mat4(1.0f), translation) * glm::mat4(rotation) * glm::scale(glm::mat4(1.0f), scale) * matrix;
-			//return matrix;
-		}
-		glm::mat4 getAnimationMatrix()
+
+	//vertex/index ranges of each primitive in the merged buffers, the optimizer works on them one by one
+	struct GeometryRange {
+		uint32_t firstVertex;
+		uint32_t vertexCount;
+		uint32_t firstIndex;
+		uint32_t indexCount;
+	};
+	std::vector<GeometryRange> geometryRanges;
+	//LOD chains of all primitives, their coarser indices are stored behind the primitives' in the index buffer
+	std::vector<vklod::LodRange> lodRanges;
+	//scene graph flattened in preorder: a parent always comes before its children and every subtree is the
+	//contiguous range [node, subtreeEnd[node]). world matrices are refreshed in one forward pass over dirty subtrees
+	struct SceneGraph {
+		std::vector<int32_t> parent;
+		std::vector<uint32_t> subtreeEnd;
+		std::vector<uint32_t> gltfIndex;
+		std::vector<glm::vec3> translation;
+		std::vector<glm::quat> rotation;
+		std::vector<glm::vec3> scale;
+		//the glTF matrix property, identity when the node uses TRS
+		std::vector<glm::mat4> matrix;
+		std::vector<glm::mat4> world;
+		std::vector<uint8_t> dirty;
+		std::vector<Mesh> meshes;
+		uint32_t dirtyCount{ 0 };
+
+		uint32_t size() const { return static_cast<uint32_t>(parent.size()); }
+		glm::mat4 localMatrix(uint32_t node) const
 		{
-			return glm::translate(glm::mat4(1.0f), translation) * glm::mat4(rotation) * glm::scale(glm::mat4(1.0f), scale);
-			//return matrix;
+			return glm::translate(glm::mat4(1.0f), translation[node]) * glm::mat4(rotation[node]) * glm::scale(glm::mat4(1.0f), scale[node]) * matrix[node];
 		}
+	} scene;
 
-		~Node() {
-			for (auto& child : children) {
-				delete child;
-			}
-		}
-	};
+	//setters mark the node so its subtree is refreshed by the next updateWorldMatrices
+	void setTranslation(uint32_t node, const glm::vec3& translation);
+	void setRotation(uint32_t node, const glm::quat& rotation);
+	void setScale(uint32_t node, const glm::vec3& scale);
+	void markDirty(uint32_t node);
+	void updateWorldMatrices();
 
 	struct Material {
 		glm::vec4 baseColorFactor = glm::vec4(1.0f);
@@ -89,21 +136,50 @@ class GLTFLoader
 
 	std::vector<Image> images;
 	std::vector<Texture> textures;
-	std::vector<Node*> nodes;
 	std::vector<Material> materials;
    
+	//appends the node and its subtree to scene in preorder
 	void loadNode(
         VulkanEngine& engine,
 		const tinygltf::Node& inputNode,
 		const tinygltf::Model& input,
-		GLTFLoader::Node* parent, uint32_t nodeIndex,
+		int32_t parent, uint32_t nodeIndex,
 		std::vector<uint32_t>& indexBuffer,
 		std::vector<Vertex>& vertexBuffer
 	);
+	//vertex cache/fetch optimizes every primitive, the result is cached in <filename>.meshopt keyed by the input geometry
+	void optimizeGeometry(const std::string& filename, std::vector<uint32_t>& indexBuffer, std::vector<Vertex>& vertexBuffer);
+	//simplifies every large primitive into a LOD chain appended to indexBuffer, cached in <filename>.lods keyed by the
+	//optimized geometry
+	void buildLods(const std::string& filename, std::vector<uint32_t>& indexBuffer, const std::vector<Vertex>& vertexBuffer);
+	//rgba8 pixels of one image, owned by either the stb allocation or expanded
+	struct DecodedImage {
+		const uint8_t* pixels{ nullptr };
+		size_t size{ 0 };
+		int width{ 0 };
+		int height{ 0 };
+		unsigned char* decoded{ nullptr };
+		std::vector<uint8_t> expanded;
+
+		void release();
+	};
+	//decodes on the engine thread pool and uploads in batches as images finish
 	void loadImages(VulkanEngine& engine,tinygltf::Model& input);
+	//thread safe, leaves outImage.pixels null when the image cannot be decoded
+	static void decodeImage(tinygltf::Image& glTFImage, DecodedImage& outImage);
 	void loadTextures(VulkanEngine& engine,tinygltf::Model& input);
 	void loadMaterials(VulkanEngine& engine,tinygltf::Model& input);
-	void drawNode(VulkanEngine& engine,VkCommandBuffer commandBuffer, VkPipelineLayout pipelineLayout, GLTFLoader::Node* node);
-	void draw(VulkanEngine& engine,VkCommandBuffer commandBuffer, VkPipelineLayout pipelineLayout);
+	//with a frustum only the primitives whose world bounds intersect it are drawn, with a LOD view every primitive draws
+	//the range it selects
+	void draw(VkCommandBuffer commandBuffer, VkPipelineLayout pipelineLayout, const vkcull::Frustum* frustum = nullptr,
+		const vklod::LodView* lodView = nullptr);
+	//updates primitive.lod for the camera and returns the range to draw, full detail without a view
+	const vklod::LodRange& selectLod(Primitive& primitive, uint32_t node, const vklod::LodView* lodView);
+	//per draw culling scratch: world spheres and (node, primitive) of every primitive, then the visible ones
+	vkcull::SphereSet cullSpheres;
+	std::vector<std::pair<uint32_t, uint32_t>> cullPrimitives;
+	std::vector<uint32_t> visiblePrimitives;
     void loadgltfFile(VulkanEngine& engine,std::string filename);
+	//parses filename with the images left encoded for decodeImage
+	static bool loadModel(const std::string& filename, tinygltf::Model& model);
 };
\ No newline at end of file
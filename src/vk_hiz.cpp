@@ -0,0 +1,106 @@
+#include <vk_hiz.h>
+#include <algorithm>
+#include <cmath>
+
+uint32_t vkhiz::level_count(uint32_t width, uint32_t height)
+{
+	uint32_t levels = 1;
+	width = (width + 1) / 2;
+	height = (height + 1) / 2;
+	while (width > 1 || height > 1) {
+		width = (width + 1) / 2;
+		height = (height + 1) / 2;
+		levels++;
+	}
+	return levels;
+}
+
+void vkhiz::build_pyramid(const float* depth, uint32_t width, uint32_t height, Pyramid& out)
+{
+	out.width = width;
+	out.height = height;
+	out.levels.clear();
+	uint32_t levels = level_count(width, height);
+	size_t texels = 0;
+	uint32_t levelWidth = width, levelHeight = height;
+	for (uint32_t level = 0; level < levels; level++) {
+		levelWidth = (levelWidth + 1) / 2;
+		levelHeight = (levelHeight + 1) / 2;
+		out.levels.push_back({ levelWidth, levelHeight, texels });
+		texels += size_t(levelWidth) * levelHeight;
+	}
+	out.texels.resize(texels);
+
+	//same reduction as depth_reduce.comp: the last row/column of an odd source is read twice
+	const float* source = depth;
+	uint32_t sourceWidth = width, sourceHeight = height;
+	for (uint32_t level = 0; level < levels; level++) {
+		const Level& target = out.levels[level];
+		float* dst = &out.texels[target.offset];
+		for (uint32_t y = 0; y < target.height; y++) {
+			uint32_t y0 = y * 2, y1 = std::min(y * 2 + 1, sourceHeight - 1);
+			for (uint32_t x = 0; x < target.width; x++) {
+				uint32_t x0 = x * 2, x1 = std::min(x * 2 + 1, sourceWidth - 1);
+				dst[size_t(y) * target.width + x] = std::max(std::max(source[size_t(y0) * sourceWidth + x0], source[size_t(y0) * sourceWidth + x1]),
+					std::max(source[size_t(y1) * sourceWidth + x0], source[size_t(y1) * sourceWidth + x1]));
+			}
+		}
+		source = dst;
+		sourceWidth = target.width;
+		sourceHeight = target.height;
+	}
+}
+
+bool vkhiz::project_box(const glm::mat4& viewProj, const glm::vec3& boundsMin, const glm::vec3& boundsMax, uint32_t width, uint32_t height,
+	ScreenRect& out)
+{
+	glm::vec2 lo(1e30f), hi(-1e30f);
+	float nearest = 1.0f;
+	for (int i = 0; i < 8; i++) {
+		glm::vec3 corner((i & 1) ? boundsMax.x : boundsMin.x, (i & 2) ? boundsMax.y : boundsMin.y, (i & 4) ? boundsMax.z : boundsMin.z);
+		glm::vec4 clip = viewProj * glm::vec4(corner, 1.0f);
+		//vulkan clips at z = 0, whatever the projection maps the near plane to
+		if (clip.w <= 0.0f || clip.z < 0.0f) {
+			return false;
+		}
+		glm::vec3 ndc = glm::vec3(clip) / clip.w;
+		lo = glm::min(lo, glm::vec2(ndc));
+		hi = glm::max(hi, glm::vec2(ndc));
+		nearest = std::min(nearest, ndc.z);
+	}
+	//the projection flips y, so NDC y and window y agree
+	glm::vec2 size = glm::vec2(width, height);
+	glm::vec2 p0 = glm::floor((lo * 0.5f + 0.5f) * size);
+	glm::vec2 p1 = glm::floor((hi * 0.5f + 0.5f) * size);
+	out.x0 = int32_t(glm::clamp(p0.x, 0.0f, size.x - 1.0f));
+	out.y0 = int32_t(glm::clamp(p0.y, 0.0f, size.y - 1.0f));
+	out.x1 = int32_t(glm::clamp(p1.x, 0.0f, size.x - 1.0f));
+	out.y1 = int32_t(glm::clamp(p1.y, 0.0f, size.y - 1.0f));
+	out.depth = nearest;
+	return true;
+}
+
+uint32_t vkhiz::select_level(const Pyramid& pyramid, const ScreenRect& rect)
+{
+	uint32_t level = 0;
+	const uint32_t levels = static_cast<uint32_t>(pyramid.levels.size());
+	while (level + 1 < levels && ((rect.x1 >> (level + 1)) - (rect.x0 >> (level + 1)) > 1 || (rect.y1 >> (level + 1)) - (rect.y0 >> (level + 1)) > 1)) {
+		level++;
+	}
+	return level;
+}
+
+bool vkhiz::box_occluded(const Pyramid& pyramid, const glm::mat4& viewProj, const glm::vec3& boundsMin, const glm::vec3& boundsMax)
+{
+	ScreenRect rect;
+	if (pyramid.levels.empty() || !project_box(viewProj, boundsMin, boundsMax, pyramid.width, pyramid.height, rect)) {
+		return false;
+	}
+	uint32_t level = select_level(pyramid, rect);
+	uint32_t shift = level + 1;
+	uint32_t tx0 = uint32_t(rect.x0) >> shift, ty0 = uint32_t(rect.y0) >> shift;
+	uint32_t tx1 = uint32_t(rect.x1) >> shift, ty1 = uint32_t(rect.y1) >> shift;
+	float farthest = std::max(std::max(pyramid.texel(level, tx0, ty0), pyramid.texel(level, tx1, ty0)),
+		std::max(pyramid.texel(level, tx0, ty1), pyramid.texel(level, tx1, ty1)));
+	return rect.depth > farthest;
+}
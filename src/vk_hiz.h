@@ -0,0 +1,53 @@
+#pragma once
+
+#include <glm/glm.hpp>
+#include <vector>
+#include <cstdint>
+
+//hierarchical depth for occlusion culling, the CPU reference of DepthPyramid and the test in indirect_cull.comp.
+//level 0 has half the size of the depth buffer, rounded up, and every level halves the one before down to 1x1.
+//a texel keeps the farthest depth of the 2x2 texels below it, so texel (x, y) of level l covers exactly the depth
+//pixels (x << (l + 1), y << (l + 1)) to ((x + 1) << (l + 1)) - 1, clamped to the buffer. depth is 0 at the near plane
+namespace vkhiz {
+
+	struct Level {
+		uint32_t width;
+		uint32_t height;
+		//first texel of the level in Pyramid::texels
+		size_t offset;
+	};
+
+	struct Pyramid {
+		//size of the depth buffer the pyramid was built from
+		uint32_t width{ 0 };
+		uint32_t height{ 0 };
+		std::vector<Level> levels;
+		std::vector<float> texels;
+
+		float texel(uint32_t level, uint32_t x, uint32_t y) const { return texels[levels[level].offset + size_t(y) * levels[level].width + x]; }
+	};
+
+	//levels of the pyramid of a width x height depth buffer, at least 1
+	uint32_t level_count(uint32_t width, uint32_t height);
+
+	//depth is width x height, row major
+	void build_pyramid(const float* depth, uint32_t width, uint32_t height, Pyramid& out);
+
+	//pixels and nearest depth a world box covers on screen
+	struct ScreenRect {
+		//inclusive pixel range, clamped to the screen
+		int32_t x0, y0, x1, y1;
+		float depth;
+	};
+
+	//false when part of the box is in front of the near plane, it has to be treated as visible then
+	bool project_box(const glm::mat4& viewProj, const glm::vec3& boundsMin, const glm::vec3& boundsMax, uint32_t width, uint32_t height,
+		ScreenRect& out);
+
+	//finest level at which the rect touches at most 2x2 texels
+	uint32_t select_level(const Pyramid& pyramid, const ScreenRect& rect);
+
+	//true when everything of the box is behind the depth the pyramid holds over its screen rect. conservative: a box
+	//that is visible in the depth buffer is never reported occluded
+	bool box_occluded(const Pyramid& pyramid, const glm::mat4& viewProj, const glm::vec3& boundsMin, const glm::vec3& boundsMax);
+}
@@ -0,0 +1,452 @@
+#include <vk_indirect.h>
+#include <vk_engine.h>
+#include <vk_initializers.h>
+#include <vk_depthpyramid.h>
+#include <iostream>
+#include <cstring>
+#include <algorithm>
+
+namespace {
+
+	//push constants of indirect_cull.comp
+	struct CullConstants {
+		glm::vec4 planes[6];
+		//camera position, w is the LOD error scale
+		glm::vec4 lodEye;
+		uint32_t objectCount;
+		float lodHysteresis;
+		uint32_t phase;
+		uint32_t groupCount;
+	};
+
+	static_assert(sizeof(CullConstants) <= 128, "push constants beyond the guaranteed 128 bytes");
+
+	static_assert(sizeof(IndirectRenderer::GPUCullObject) == 48, "GPUCullObject must match the std430 layout of indirect_cull.comp");
+	static_assert(sizeof(IndirectRenderer::GPUCullView) == 80, "GPUCullView must match the std430 layout of indirect_cull.comp");
+
+	//triangles submitted, at full detail, occluded and disoccluded objects
+	const uint32_t COUNTER_COUNT = 4;
+}
+
+bool IndirectRenderer::init(VulkanEngine& engine, VkShaderModule cullShader, const DepthPyramid& depthPyramid)
+{
+	_engine = &engine;
+	_depthPyramid = &depthPyramid;
+	_frames.resize(engine._framesInFlight);
+	if (!engine._supportsIndirectCount || cullShader == VK_NULL_HANDLE) {
+		std::cout << "No drawIndirectCount or indirect cull shader, GPU driven rendering disabled" << std::endl;
+		return false;
+	}
+
+	VkDevice device = engine._device;
+	std::vector<VkDescriptorSetLayoutBinding> bindings = {
+		vkinit::descriptorset_layout_binding(VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, VK_SHADER_STAGE_COMPUTE_BIT, 0),
+		vkinit::descriptorset_layout_binding(VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, VK_SHADER_STAGE_COMPUTE_BIT, 1),
+		vkinit::descriptorset_layout_binding(VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, VK_SHADER_STAGE_COMPUTE_BIT, 2),
+		vkinit::descriptorset_layout_binding(VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, VK_SHADER_STAGE_COMPUTE_BIT, 3),
+		vkinit::descriptorset_layout_binding(VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, VK_SHADER_STAGE_COMPUTE_BIT, 4),
+		vkinit::descriptorset_layout_binding(VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, VK_SHADER_STAGE_COMPUTE_BIT, 5),
+		vkinit::descriptorset_layout_binding(VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, VK_SHADER_STAGE_COMPUTE_BIT, 6),
+		vkinit::descriptorset_layout_binding(VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, VK_SHADER_STAGE_COMPUTE_BIT, 7),
+		vkinit::descriptorset_layout_binding(VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, VK_SHADER_STAGE_COMPUTE_BIT, 8),
+	};
+	VkDescriptorSetLayoutCreateInfo layoutInfo = vkinit::descriptorSetLayoutLayout_create_info(bindings);
+	VK_CHECK(vkCreateDescriptorSetLayout(device, &layoutInfo, nullptr, &_cullSetLayout))
+
+	VkPushConstantRange pushConstant{};
+	pushConstant.offset = 0;
+	pushConstant.size = sizeof(CullConstants);
+	pushConstant.stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+
+	VkPipelineLayoutCreateInfo pipelineLayoutInfo = vkinit::pipeline_layout_create_info();
+	pipelineLayoutInfo.setLayoutCount = 1;
+	pipelineLayoutInfo.pSetLayouts = &_cullSetLayout;
+	pipelineLayoutInfo.pushConstantRangeCount = 1;
+	pipelineLayoutInfo.pPushConstantRanges = &pushConstant;
+	VK_CHECK(vkCreatePipelineLayout(device, &pipelineLayoutInfo, nullptr, &_cullLayout))
+
+	VkComputePipelineCreateInfo pipelineInfo{};
+	pipelineInfo.sType = VK_STRUCTURE_TYPE_COMPUTE_PIPELINE_CREATE_INFO;
+	pipelineInfo.stage = vkinit::pipeline_shader_stage_create_info(VK_SHADER_STAGE_COMPUTE_BIT, cullShader);
+	pipelineInfo.layout = _cullLayout;
+	VK_CHECK(vkCreateComputePipelines(device, VK_NULL_HANDLE, 1, &pipelineInfo, nullptr, &_cullPipeline))
+
+	//per frame: the cull set with eight buffers and the depth pyramid, the instance set with one buffer
+	const uint32_t frameCount = static_cast<uint32_t>(_frames.size());
+	VkDescriptorPoolSize poolSizes[2] = {
+		{ VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 9 * frameCount },
+		{ VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, frameCount },
+	};
+	VkDescriptorPoolCreateInfo poolInfo{};
+	poolInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO;
+	poolInfo.maxSets = 2 * frameCount;
+	poolInfo.poolSizeCount = 2;
+	poolInfo.pPoolSizes = poolSizes;
+	VK_CHECK(vkCreateDescriptorPool(device, &poolInfo, nullptr, &_descriptorPool))
+	return true;
+}
+
+void IndirectRenderer::cleanup()
+{
+	if (_engine == nullptr) {
+		return;
+	}
+	VkDevice device = _engine->_device;
+	for (Frame& frame : _frames) {
+		destroyBuffer(frame.instances);
+		destroyBuffer(frame.cullObjects);
+		destroyBuffer(frame.commands);
+		destroyBuffer(frame.counts);
+		destroyBuffer(frame.cullView);
+		destroyBuffer(frame.counters);
+	}
+	destroyBuffer(_vertices);
+	destroyBuffer(_indices);
+	destroyBuffer(_lodRanges);
+	destroyBuffer(_lodState);
+	destroyBuffer(_visibility);
+	if (_cullPipeline != VK_NULL_HANDLE) {
+		vkDestroyPipeline(device, _cullPipeline, nullptr);
+		vkDestroyPipelineLayout(device, _cullLayout, nullptr);
+		vkDestroyDescriptorSetLayout(device, _cullSetLayout, nullptr);
+		vkDestroyDescriptorPool(device, _descriptorPool, nullptr);
+		_cullPipeline = VK_NULL_HANDLE;
+	}
+}
+
+void IndirectRenderer::createBuffer(VkDeviceSize size, VkBufferUsageFlags usage, VkMemoryPropertyFlags properties, Buffer& out)
+{
+	_engine->createBuffer(size, usage, properties, out.buffer, out.mem);
+}
+
+void IndirectRenderer::destroyBuffer(Buffer& buffer)
+{
+	if (buffer.buffer != VK_NULL_HANDLE) {
+		vkDestroyBuffer(_engine->_device, buffer.buffer, nullptr);
+		_engine->_allocator.free(buffer.mem);
+		buffer.buffer = VK_NULL_HANDLE;
+	}
+}
+
+const IndirectRenderer::MeshRange& IndirectRenderer::addMesh(Mesh* mesh, std::vector<uint8_t>& vertices, std::vector<uint32_t>& indices)
+{
+	auto it = _meshes.find(mesh);
+	if (it != _meshes.end()) {
+		return it->second;
+	}
+
+	const size_t stride = Mesh::vertex_stride(mesh->_format);
+	const size_t vertexCount = mesh->vertex_count();
+	MeshRange range;
+	range.vertexOffset = static_cast<int32_t>(vertices.size() / stride);
+	range.firstIndex = static_cast<uint32_t>(indices.size());
+	const uint8_t* vertexData = static_cast<const uint8_t*>(mesh->vertex_data());
+	vertices.insert(vertices.end(), vertexData, vertexData + vertexCount * stride);
+
+	//one index type for every draw: cooked uint16 indices are widened, unindexed meshes get a sequential list.
+	//the LOD indices follow the full detail ones as in the mesh's own index buffer, so the ranges only need rebasing
+	if (!mesh->indexed()) {
+		for (uint32_t i = 0; i < vertexCount; i++) {
+			indices.push_back(i);
+		}
+		range.indexCount = static_cast<uint32_t>(vertexCount);
+	}
+	else if (mesh->_cookedFile && mesh->_indexType == VK_INDEX_TYPE_UINT16) {
+		const uint16_t* shortIndices = static_cast<const uint16_t*>(mesh->index_data());
+		indices.insert(indices.end(), shortIndices, shortIndices + mesh->index_count() + mesh->lod_index_count());
+		range.indexCount = static_cast<uint32_t>(mesh->index_count());
+	}
+	else {
+		const uint32_t* longIndices = static_cast<const uint32_t*>(mesh->index_data());
+		indices.insert(indices.end(), longIndices, longIndices + mesh->index_count());
+		const uint32_t* lodIndices = static_cast<const uint32_t*>(mesh->lod_index_data());
+		indices.insert(indices.end(), lodIndices, lodIndices + mesh->lod_index_count());
+		range.indexCount = static_cast<uint32_t>(mesh->index_count());
+	}
+	range.lodOffset = static_cast<uint32_t>(_lods.size());
+	range.lodCount = mesh->indexed() ? mesh->lod_count() : 1;
+	for (uint32_t level = 0; level < range.lodCount; level++) {
+		vklod::LodRange lod = mesh->indexed() ? mesh->lod(level) : vklod::LodRange{ 0, range.indexCount, 0.0f };
+		lod.firstIndex += range.firstIndex;
+		_lods.push_back(lod);
+	}
+
+	return _meshes.emplace(mesh, range).first->second;
+}
+
+void IndirectRenderer::build(const std::vector<RenderObject>& renderables, std::vector<uint32_t>& outObjects)
+{
+	outObjects.assign(renderables.size(), INVALID_OBJECT);
+	if (_cullPipeline == VK_NULL_HANDLE) {
+		return;
+	}
+
+	//group by material so every group is one contiguous command range drawn with one pipeline
+	std::vector<std::vector<uint32_t>> groupRenderables;
+	for (uint32_t i = 0; i < renderables.size(); i++) {
+		const RenderObject& object = renderables[i];
+		//meshes with meshlets stay on the CPU path, their draws are cluster culled there
+		if (object.alwaysVisible || object.material->instancedPipeline == VK_NULL_HANDLE || object.mesh->vertex_count() == 0 ||
+			object.mesh->_format != _engine->_vertexFormat || !object.mesh->_meshlets.empty()) {
+			continue;
+		}
+		size_t group = 0;
+		while (group < _groups.size() && _groups[group].material != object.material) {
+			group++;
+		}
+		if (group == _groups.size()) {
+			_groups.push_back({ object.material, 0, 0 });
+			groupRenderables.emplace_back();
+		}
+		groupRenderables[group].push_back(i);
+	}
+
+	std::vector<uint8_t> vertices;
+	std::vector<uint32_t> indices;
+	for (uint32_t group = 0; group < _groups.size(); group++) {
+		_groups[group].commandBase = static_cast<uint32_t>(_cullObjects.size());
+		_groups[group].objectCount = static_cast<uint32_t>(groupRenderables[group].size());
+		for (uint32_t renderable : groupRenderables[group]) {
+			const RenderObject& object = renderables[renderable];
+			const MeshRange& range = addMesh(object.mesh, vertices, indices);
+
+			GPUCullObject cullObject{};
+			cullObject.indexCount = range.indexCount;
+			cullObject.firstIndex = range.firstIndex;
+			cullObject.vertexOffset = range.vertexOffset;
+			cullObject.group = group;
+			cullObject.commandBase = _groups[group].commandBase;
+			cullObject.lodOffset = range.lodOffset;
+			cullObject.lodCount = range.lodCount;
+
+			outObjects[renderable] = static_cast<uint32_t>(_cullObjects.size());
+			_cullObjects.push_back(cullObject);
+			_transforms.push_back(object.transformMatrix);
+			_objectMeshes.push_back(object.mesh);
+		}
+	}
+	if (_cullObjects.empty()) {
+		return;
+	}
+
+	_vertexBytes = vertices.size();
+	_indexBytes = indices.size() * sizeof(uint32_t);
+	createBuffer(_vertexBytes, VK_BUFFER_USAGE_TRANSFER_DST_BIT | VK_BUFFER_USAGE_VERTEX_BUFFER_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, _vertices);
+	createBuffer(_indexBytes, VK_BUFFER_USAGE_TRANSFER_DST_BIT | VK_BUFFER_USAGE_INDEX_BUFFER_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, _indices);
+	_engine->_uploadQueue.uploadBuffer(_vertices.buffer, vertices.data(), _vertexBytes);
+	_engine->_uploadQueue.uploadBuffer(_indices.buffer, indices.data(), _indexBytes);
+	const VkDeviceSize objectCount = _cullObjects.size();
+	createBuffer(_lods.size() * sizeof(vklod::LodRange), VK_BUFFER_USAGE_TRANSFER_DST_BIT | VK_BUFFER_USAGE_STORAGE_BUFFER_BIT,
+		VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, _lodRanges);
+	_engine->_uploadQueue.uploadBuffer(_lodRanges.buffer, _lods.data(), _lods.size() * sizeof(vklod::LodRange));
+	//every object starts at full detail
+	std::vector<uint32_t> lodState(objectCount, 0);
+	createBuffer(objectCount * sizeof(uint32_t), VK_BUFFER_USAGE_TRANSFER_DST_BIT | VK_BUFFER_USAGE_STORAGE_BUFFER_BIT,
+		VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, _lodState);
+	_engine->_uploadQueue.uploadBuffer(_lodState.buffer, lodState.data(), lodState.size() * sizeof(uint32_t));
+	//and hidden, the first late phase draws whatever it finds visible
+	createBuffer(objectCount * sizeof(uint32_t), VK_BUFFER_USAGE_TRANSFER_DST_BIT | VK_BUFFER_USAGE_STORAGE_BUFFER_BIT,
+		VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, _visibility);
+	_engine->_uploadQueue.uploadBuffer(_visibility.buffer, lodState.data(), lodState.size() * sizeof(uint32_t));
+	_engine->_uploadQueue.flush();
+
+	const VkMemoryPropertyFlags hostVisible = VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT;
+	for (Frame& frame : _frames) {
+		createBuffer(objectCount * sizeof(GPUInstanceData), VK_BUFFER_USAGE_STORAGE_BUFFER_BIT, hostVisible, frame.instances);
+		createBuffer(objectCount * sizeof(GPUCullObject), VK_BUFFER_USAGE_STORAGE_BUFFER_BIT, hostVisible, frame.cullObjects);
+		createBuffer(2 * objectCount * sizeof(VkDrawIndexedIndirectCommand), VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT,
+			VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, frame.commands);
+		createBuffer(2 * _groups.size() * sizeof(uint32_t), VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+			VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, frame.counts);
+		createBuffer(sizeof(GPUCullView), VK_BUFFER_USAGE_STORAGE_BUFFER_BIT, hostVisible, frame.cullView);
+		createBuffer(COUNTER_COUNT * sizeof(uint32_t), VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT, hostVisible, frame.counters);
+		memset(frame.counters.mem.mapped, 0, COUNTER_COUNT * sizeof(uint32_t));
+
+		VkDescriptorSetLayout layouts[2] = { _cullSetLayout, _engine->_instanceSetLayout };
+		VkDescriptorSet sets[2];
+		VkDescriptorSetAllocateInfo allocInfo{};
+		allocInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
+		allocInfo.descriptorPool = _descriptorPool;
+		allocInfo.descriptorSetCount = 2;
+		allocInfo.pSetLayouts = layouts;
+		VK_CHECK(vkAllocateDescriptorSets(_engine->_device, &allocInfo, sets))
+		frame.cullSet = sets[0];
+		frame.instanceSet = sets[1];
+
+		VkDescriptorBufferInfo bufferInfos[9] = {
+			{ frame.cullObjects.buffer, 0, VK_WHOLE_SIZE },
+			{ frame.commands.buffer, 0, VK_WHOLE_SIZE },
+			{ frame.counts.buffer, 0, VK_WHOLE_SIZE },
+			{ _lodRanges.buffer, 0, VK_WHOLE_SIZE },
+			{ _lodState.buffer, 0, VK_WHOLE_SIZE },
+			{ frame.counters.buffer, 0, VK_WHOLE_SIZE },
+			{ _visibility.buffer, 0, VK_WHOLE_SIZE },
+			{ frame.cullView.buffer, 0, VK_WHOLE_SIZE },
+			{ frame.instances.buffer, 0, VK_WHOLE_SIZE },
+		};
+		VkWriteDescriptorSet writes[10] = {};
+		for (uint32_t i = 0; i < 9; i++) {
+			writes[i].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+			writes[i].descriptorCount = 1;
+			writes[i].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+			writes[i].dstSet = i < 8 ? frame.cullSet : frame.instanceSet;
+			writes[i].dstBinding = i < 8 ? i : 0;
+			writes[i].pBufferInfo = &bufferInfos[i];
+		}
+		//written even when the pyramid is never built, the late phase only runs when it is
+		VkDescriptorImageInfo pyramidInfo{ _depthPyramid->sampler(), _depthPyramid->view(), VK_IMAGE_LAYOUT_GENERAL };
+		writes[9] = vkinit::write_descriptor_image(VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, frame.cullSet, &pyramidInfo, 8);
+		vkUpdateDescriptorSets(_engine->_device, 10, writes, 0, nullptr);
+	}
+
+	_dirtyFrames.assign(_cullObjects.size(), 0);
+	for (uint32_t object = 0; object < _cullObjects.size(); object++) {
+		updateObject(object, _transforms[object]);
+	}
+	std::cout << "indirect renderer: " << _cullObjects.size() << " objects in " << _groups.size() << " draws, " << _meshes.size()
+		<< " meshes, " << (_vertexBytes + _indexBytes) / 1024 << " KiB of geometry" << std::endl;
+}
+
+void IndirectRenderer::updateObject(uint32_t object, const glm::mat4& transform)
+{
+	_transforms[object] = transform;
+	const Mesh* mesh = _objectMeshes[object];
+	glm::vec3 center;
+	float radius;
+	vkcull::world_sphere(mesh->_boundsMin, mesh->_boundsMax, transform, center, radius);
+	_cullObjects[object].sphere = glm::vec4(center, radius);
+	_cullObjects[object].scale = std::max(glm::length(glm::vec3(transform[0])),
+		std::max(glm::length(glm::vec3(transform[1])), glm::length(glm::vec3(transform[2]))));
+
+	if (_dirtyFrames[object] == 0) {
+		_dirty.push_back(object);
+	}
+	_dirtyFrames[object] = static_cast<uint8_t>((1 << _frames.size()) - 1);
+}
+
+void IndirectRenderer::flushObjects(uint32_t frame)
+{
+	Frame& target = _frames[frame];
+	GPUInstanceData* instances = static_cast<GPUInstanceData*>(target.instances.mem.mapped);
+	GPUCullObject* cullObjects = static_cast<GPUCullObject*>(target.cullObjects.mem.mapped);
+	const uint8_t bit = static_cast<uint8_t>(1 << frame);
+
+	_objectUploads = 0;
+	size_t kept = 0;
+	for (uint32_t object : _dirty) {
+		if (_dirtyFrames[object] & bit) {
+			const Mesh* mesh = _objectMeshes[object];
+			instances[object].render_matrix = _transforms[object] * mesh->dequantize_matrix();
+			instances[object].objectColor = glm::vec4(mesh->objectColor, 1.0f);
+			cullObjects[object] = _cullObjects[object];
+			_dirtyFrames[object] &= ~bit;
+			_objectUploads++;
+		}
+		if (_dirtyFrames[object] != 0) {
+			_dirty[kept++] = object;
+		}
+	}
+	_dirty.resize(kept);
+}
+
+void IndirectRenderer::recordCull(VkCommandBuffer cmd, uint32_t frame, const glm::mat4& viewProj, const vklod::LodView& lodView, uint32_t phase)
+{
+	Frame& target = _frames[frame];
+	VkMemoryBarrier barrier{};
+	barrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+	if (phase != PHASE_LATE) {
+		flushObjects(frame);
+
+		//the frame's fence has been waited on, so the counters of its last cull passes are final
+		const uint32_t* counters = static_cast<const uint32_t*>(target.counters.mem.mapped);
+		_triangles = counters[0];
+		_fullDetailTriangles = counters[1];
+		_occluded = counters[2];
+		_disoccluded = counters[3];
+
+		GPUCullView* view = static_cast<GPUCullView*>(target.cullView.mem.mapped);
+		view->viewProj = viewProj;
+		view->width = _depthPyramid->width();
+		view->height = _depthPyramid->height();
+		view->levels = _depthPyramid->levelCount();
+
+		vkCmdFillBuffer(cmd, target.counts.buffer, 0, VK_WHOLE_SIZE, 0);
+		vkCmdFillBuffer(cmd, target.counters.buffer, 0, VK_WHOLE_SIZE, 0);
+		//the LOD state and visibility were last written by the other frame's cull passes
+		barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT | VK_ACCESS_SHADER_WRITE_BIT;
+		barrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT;
+		vkCmdPipelineBarrier(cmd, VK_PIPELINE_STAGE_TRANSFER_BIT | VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, 0,
+			1, &barrier, 0, nullptr, 0, nullptr);
+	}
+	else {
+		//the early phase of this frame wrote the LOD state and the counts the late phase adds to
+		barrier.srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT;
+		barrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT;
+		vkCmdPipelineBarrier(cmd, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, 0, 1, &barrier, 0, nullptr, 0, nullptr);
+	}
+
+	CullConstants constants{};
+	vkcull::Frustum frustum = vkcull::extract_frustum(viewProj);
+	memcpy(constants.planes, frustum.planes, sizeof(constants.planes));
+	constants.lodEye = glm::vec4(lodView.eye, lodView.errorScale);
+	constants.objectCount = static_cast<uint32_t>(_cullObjects.size());
+	constants.lodHysteresis = lodView.hysteresis;
+	constants.phase = phase;
+	constants.groupCount = static_cast<uint32_t>(_groups.size());
+	vkCmdBindPipeline(cmd, VK_PIPELINE_BIND_POINT_COMPUTE, _cullPipeline);
+	vkCmdBindDescriptorSets(cmd, VK_PIPELINE_BIND_POINT_COMPUTE, _cullLayout, 0, 1, &target.cullSet, 0, nullptr);
+	vkCmdPushConstants(cmd, _cullLayout, VK_SHADER_STAGE_COMPUTE_BIT, 0, sizeof(CullConstants), &constants);
+	vkCmdDispatch(cmd, (constants.objectCount + CULL_GROUP_SIZE - 1) / CULL_GROUP_SIZE, 1, 1);
+
+	//the commands and counts are read as indirect parameters
+	barrier.srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT;
+	barrier.dstAccessMask = VK_ACCESS_INDIRECT_COMMAND_READ_BIT;
+	vkCmdPipelineBarrier(cmd, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_PIPELINE_STAGE_DRAW_INDIRECT_BIT, 0, 1, &barrier, 0, nullptr, 0, nullptr);
+	//the counters are read on the CPU once the fence of the frame signals
+	barrier.dstAccessMask = VK_ACCESS_HOST_READ_BIT;
+	vkCmdPipelineBarrier(cmd, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_PIPELINE_STAGE_HOST_BIT, 0, 1, &barrier, 0, nullptr, 0, nullptr);
+}
+
+void IndirectRenderer::recordDraw(VkCommandBuffer cmd, uint32_t frame, uint32_t phase)
+{
+	Frame& target = _frames[frame];
+	//the late phase appends to the second half of the commands and counts
+	const uint32_t commandOffset = phase == PHASE_LATE ? static_cast<uint32_t>(_cullObjects.size()) : 0;
+	const uint32_t countOffset = phase == PHASE_LATE ? static_cast<uint32_t>(_groups.size()) : 0;
+
+	VkDeviceSize offsets[2] = { 0, 0 };
+	VkBuffer buffers[2] = { _vertices.buffer, _engine->_constantVertexBuffer.buffer };
+	vkCmdBindVertexBuffers(cmd, 0, _engine->_vertexFormat == VertexFormat::Compact ? 2 : 1, buffers, offsets);
+	vkCmdBindIndexBuffer(cmd, _indices.buffer, 0, VK_INDEX_TYPE_UINT32);
+
+	for (uint32_t group = 0; group < _groups.size(); group++) {
+		const Group& draw = _groups[group];
+		Material* material = draw.material;
+		VkPipelineLayout layout = material->instancedPipelineLayout;
+		vkCmdBindPipeline(cmd, VK_PIPELINE_BIND_POINT_GRAPHICS, material->instancedPipeline);
+		vkCmdBindDescriptorSets(cmd, VK_PIPELINE_BIND_POINT_GRAPHICS, layout, 0, 1, &_engine->_frames[frame].uboSet, 0, nullptr);
+		if (material->textureSet != VK_NULL_HANDLE) {
+			vkCmdBindDescriptorSets(cmd, VK_PIPELINE_BIND_POINT_GRAPHICS, layout, 1, 1, &material->textureSet, 0, nullptr);
+		}
+		vkCmdBindDescriptorSets(cmd, VK_PIPELINE_BIND_POINT_GRAPHICS, layout, 2, 1, &target.instanceSet, 0, nullptr);
+		vkCmdDrawIndexedIndirectCount(cmd, target.commands.buffer, (commandOffset + draw.commandBase) * sizeof(VkDrawIndexedIndirectCommand),
+			target.counts.buffer, (countOffset + group) * sizeof(uint32_t), draw.objectCount, sizeof(VkDrawIndexedIndirectCommand));
+	}
+}
+
+IndirectRenderer::Stats IndirectRenderer::stats() const
+{
+	Stats stats{};
+	stats.objects = static_cast<uint32_t>(_cullObjects.size());
+	stats.groups = static_cast<uint32_t>(_groups.size());
+	stats.meshes = static_cast<uint32_t>(_meshes.size());
+	stats.vertexBytes = _vertexBytes;
+	stats.indexBytes = _indexBytes;
+	stats.objectUploads = _objectUploads;
+	stats.lodRanges = static_cast<uint32_t>(_lods.size());
+	stats.triangles = _triangles;
+	stats.fullDetailTriangles = _fullDetailTriangles;
+	stats.occluded = _occluded;
+	stats.disoccluded = _disoccluded;
+	return stats;
+}
@@ -0,0 +1,185 @@
+#pragma once
+
+#include <vk_types.h>
+#include <vk_allocator.h>
+#include <vk_culling.h>
+#include <vk_lod.h>
+#include <glm/glm.hpp>
+#include <vector>
+#include <unordered_map>
+#include <cstdint>
+
+class VulkanEngine;
+class DepthPyramid;
+struct RenderObject;
+struct Mesh;
+struct Material;
+
+//GPU driven path for the renderables whose material has an instanced pipeline. their meshes are merged into one
+//vertex and one uint32 index buffer, per object data lives in storage buffers and a compute pass culls every object
+//against the frustum, appending a VkDrawIndexedIndirectCommand per visible object to the range of its material.
+//the render pass then issues one vkCmdDrawIndexedIndirectCount per material, so the CPU cost of a frame only depends
+//on the number of materials and on the objects moved since the last frame, not on the size of the scene. the cull pass
+//also picks every object's LOD range, keeping the choice of the last frame in a buffer for the hysteresis.
+//with occlusion culling a frame is culled in two phases: the early one draws the objects that were visible last frame,
+//their depth is reduced to the DepthPyramid and the late one tests every object against it, drawing the ones that
+//became visible and remembering the result for the next frame.
+//needs drawIndirectCount (Vulkan 1.2), multiDrawIndirect, drawIndirectFirstInstance and shaders/indirect_cull.comp.spv
+class IndirectRenderer {
+public:
+	static const uint32_t INVALID_OBJECT = UINT32_MAX;
+	//local_size_x of indirect_cull.comp
+	static const uint32_t CULL_GROUP_SIZE = 64;
+	//recordCull phases: one pass without occlusion culling, or the two passes around the depth pyramid build
+	static const uint32_t PHASE_ALL = 0;
+	static const uint32_t PHASE_EARLY = 1;
+	static const uint32_t PHASE_LATE = 2;
+
+	//std430 element of the cull input, one per object
+	struct GPUCullObject {
+		//world space bounding sphere, w is the radius
+		glm::vec4 sphere;
+		uint32_t indexCount;
+		uint32_t firstIndex;
+		int32_t vertexOffset;
+		//material group, selects the draw count slot
+		uint32_t group;
+		//first command of the group
+		uint32_t commandBase;
+		//the mesh's ranges in the LOD buffer, at least the full detail one
+		uint32_t lodOffset;
+		uint32_t lodCount;
+		//largest axis scale of the transform, for the LOD error
+		float scale;
+	};
+
+	//std430 camera of the occlusion test, one per frame
+	struct GPUCullView {
+		glm::mat4 viewProj;
+		//depth buffer size and pyramid levels
+		uint32_t width;
+		uint32_t height;
+		uint32_t levels;
+		uint32_t pad;
+	};
+
+	struct Stats {
+		uint32_t objects;
+		//indirect draw calls per frame, one per material
+		uint32_t groups;
+		uint32_t meshes;
+		VkDeviceSize vertexBytes;
+		VkDeviceSize indexBytes;
+		//object entries written to the frame's buffers last frame
+		uint32_t objectUploads;
+		uint32_t lodRanges;
+		//counted by the cull pass of the last frame recorded in the same frame slot
+		uint64_t triangles;
+		uint64_t fullDetailTriangles;
+		//frustum visible objects the late phase found occluded, and the ones it drew because they became visible
+		uint32_t occluded;
+		uint32_t disoccluded;
+	};
+
+	//cullShader is indirect_cull.comp, the caller keeps it. false when the device lacks the features or there is no
+	//shader, the caller then keeps drawing on the CPU. depthPyramid has to be initialized, it is read by the late phase
+	bool init(VulkanEngine& engine, VkShaderModule cullShader, const DepthPyramid& depthPyramid);
+
+	void cleanup();
+
+	//takes the renderables that can be drawn indirectly and uploads their meshes and object data, once after init.
+	//outObjects gets the object of every renderable, INVALID_OBJECT for the ones left to the CPU path
+	void build(const std::vector<RenderObject>& renderables, std::vector<uint32_t>& outObjects);
+
+	//new transform of an object, written to each frame's buffers the next time that frame is recorded
+	void updateObject(uint32_t object, const glm::mat4& transform);
+
+	//dispatches the culling and LOD selection, must be recorded outside of a render pass. PHASE_ALL and PHASE_EARLY
+	//start the frame and reset its draw counts, PHASE_LATE follows PHASE_EARLY once the depth pyramid is built
+	void recordCull(VkCommandBuffer cmd, uint32_t frame, const glm::mat4& viewProj, const vklod::LodView& lodView, uint32_t phase = PHASE_ALL);
+
+	//the indirect draws of a phase, inside a render pass after recordCull of the same frame and phase
+	void recordDraw(VkCommandBuffer cmd, uint32_t frame, uint32_t phase = PHASE_ALL);
+
+	bool ready() const { return _cullPipeline != VK_NULL_HANDLE && !_cullObjects.empty(); }
+
+	Stats stats() const;
+
+private:
+	struct MeshRange {
+		uint32_t indexCount;
+		uint32_t firstIndex;
+		int32_t vertexOffset;
+		uint32_t lodOffset;
+		uint32_t lodCount;
+	};
+
+	struct Group {
+		Material* material;
+		uint32_t commandBase;
+		uint32_t objectCount;
+	};
+
+	struct Buffer {
+		VkBuffer buffer{ VK_NULL_HANDLE };
+		Allocation mem{};
+	};
+
+	//one per frame in flight, the CPU writes the object data of a frame while the others render
+	struct Frame {
+		Buffer instances;
+		Buffer cullObjects;
+		//a command range and a count per group for each of the early (or only) and the late phase
+		Buffer commands;
+		Buffer counts;
+		//GPUCullView, host visible
+		Buffer cullView;
+		//triangles submitted and at full detail, occluded and disoccluded objects, host visible
+		Buffer counters;
+		VkDescriptorSet cullSet{ VK_NULL_HANDLE };
+		VkDescriptorSet instanceSet{ VK_NULL_HANDLE };
+	};
+
+	void createBuffer(VkDeviceSize size, VkBufferUsageFlags usage, VkMemoryPropertyFlags properties, Buffer& out);
+	void destroyBuffer(Buffer& buffer);
+	//vertex/index ranges of mesh in the megabuffers, appended on first use
+	const MeshRange& addMesh(Mesh* mesh, std::vector<uint8_t>& vertices, std::vector<uint32_t>& indices);
+	void flushObjects(uint32_t frame);
+
+	VulkanEngine* _engine{ nullptr };
+	VkDescriptorPool _descriptorPool{ VK_NULL_HANDLE };
+	VkDescriptorSetLayout _cullSetLayout{ VK_NULL_HANDLE };
+	VkPipelineLayout _cullLayout{ VK_NULL_HANDLE };
+	VkPipeline _cullPipeline{ VK_NULL_HANDLE };
+
+	Buffer _vertices;
+	Buffer _indices;
+	//every mesh's LOD ranges, rebased into _indices
+	std::vector<vklod::LodRange> _lods;
+	Buffer _lodRanges;
+	//LOD chosen for every object last frame, written by the cull pass of one frame and read by the next
+	Buffer _lodState;
+	//1 for the objects the last late phase found visible
+	Buffer _visibility;
+	const DepthPyramid* _depthPyramid{ nullptr };
+	VkDeviceSize _vertexBytes{ 0 };
+	VkDeviceSize _indexBytes{ 0 };
+	std::unordered_map<Mesh*, MeshRange> _meshes;
+
+	std::vector<Group> _groups;
+	//CPU copies of the object data, the frames are brought up to date from these
+	std::vector<glm::mat4> _transforms;
+	std::vector<Mesh*> _objectMeshes;
+	std::vector<GPUCullObject> _cullObjects;
+	//bit f set: frame f still has to receive the object
+	std::vector<uint8_t> _dirtyFrames;
+	std::vector<uint32_t> _dirty;
+	uint32_t _objectUploads{ 0 };
+	uint64_t _triangles{ 0 };
+	uint64_t _fullDetailTriangles{ 0 };
+	uint32_t _occluded{ 0 };
+	uint32_t _disoccluded{ 0 };
+
+	//VulkanEngine::_framesInFlight of them
+	std::vector<Frame> _frames;
+};
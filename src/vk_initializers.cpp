@@ -6,6 +6,7 @@ VkCommandPoolCreateInfo vkinit::command_pool_create_info(uint32_t queueFamilyInd
 	info.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO;
 	info.pNext = nullptr;
 
+	info.queueFamilyIndex = queueFamilyIndex;
 	info.flags = flags;
 	return info;
 }
@@ -33,6 +34,18 @@ VkCommandBufferBeginInfo vkinit::command_buffer_begin_info(VkCommandBufferUsageF
 	return info;
 }
 
+VkCommandBufferInheritanceInfo vkinit::command_buffer_inheritance_info(VkRenderPass renderPass, uint32_t subpass /*= 0*/, VkFramebuffer framebuffer /*= VK_NULL_HANDLE*/)
+{
+	VkCommandBufferInheritanceInfo info = {};
+	info.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_INHERITANCE_INFO;
+	info.pNext = nullptr;
+
+	info.renderPass = renderPass;
+	info.subpass = subpass;
+	info.framebuffer = framebuffer;
+	return info;
+}
+
 VkFramebufferCreateInfo vkinit::framebuffer_create_info(VkRenderPass renderPass, VkExtent2D extent)
 {
 	VkFramebufferCreateInfo info = {};
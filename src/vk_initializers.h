@@ -10,6 +10,9 @@ namespace vkinit {
 
 	VkCommandBufferBeginInfo command_buffer_begin_info(VkCommandBufferUsageFlags flags = 0);
 
+	//for secondary command buffers executed inside subpass of renderPass, framebuffer may be VK_NULL_HANDLE
+	VkCommandBufferInheritanceInfo command_buffer_inheritance_info(VkRenderPass renderPass, uint32_t subpass = 0, VkFramebuffer framebuffer = VK_NULL_HANDLE);
+
 	VkFramebufferCreateInfo framebuffer_create_info(VkRenderPass renderPass, VkExtent2D extent);
 
 	VkFenceCreateInfo fence_create_info(VkFenceCreateFlags flags = 0);
@@ -0,0 +1,62 @@
+#include <vk_lod.h>
+#include <vk_meshopt.h>
+#include <algorithm>
+#include <cmath>
+#include <cfloat>
+
+void vklod::build_lod_chain(const uint32_t* indices, size_t indexCount, uint32_t firstIndex, const void* positions, size_t positionStride,
+	size_t vertexCount, uint32_t lodIndexBase, std::vector<uint32_t>& outIndices, std::vector<LodRange>& outLods, uint32_t maxLods)
+{
+	outLods.push_back({ firstIndex, static_cast<uint32_t>(indexCount), 0.0f });
+
+	//every level is simplified from the one before, its error adds up along the chain
+	std::vector<uint32_t> source(indices, indices + indexCount);
+	std::vector<uint32_t> simplified(indexCount);
+	float error = 0.0f;
+	for (uint32_t level = 1; level < maxLods; level++) {
+		size_t target = source.size() / 2;
+		target -= target % 3;
+		if (target < 3 * 32) {
+			break;
+		}
+		float levelError = 0.0f;
+		size_t count = vkmeshopt::simplify(source.data(), source.size(), positions, positionStride, vertexCount, target, FLT_MAX,
+			simplified.data(), levelError);
+		//a level that is hardly smaller than the one before only costs memory
+		if (count == 0 || count > source.size() * 3 / 4) {
+			break;
+		}
+		vkmeshopt::optimize_vertex_cache(simplified.data(), count, vertexCount);
+		error += levelError;
+		outLods.push_back({ lodIndexBase + static_cast<uint32_t>(outIndices.size()), static_cast<uint32_t>(count), error });
+		outIndices.insert(outIndices.end(), simplified.begin(), simplified.begin() + count);
+		source.assign(simplified.begin(), simplified.begin() + count);
+	}
+}
+
+vklod::LodView vklod::make_lod_view(const glm::vec3& eye, const glm::mat4& projection, float viewportHeight, float pixelError, float hysteresis)
+{
+	LodView view;
+	view.eye = eye;
+	//proj[1][1] is 1 / tan(fovy / 2), negative for the flipped vulkan projection
+	view.errorScale = pixelError > 0.0f ? viewportHeight * 0.5f * std::abs(projection[1][1]) / pixelError : 0.0f;
+	view.hysteresis = hysteresis;
+	return view;
+}
+
+uint32_t vklod::select_lod(const LodView& view, const LodRange* lods, uint32_t lodCount, const glm::vec3& center, float radius, float scale,
+	uint32_t current)
+{
+	if (lodCount <= 1 || view.errorScale <= 0.0f) {
+		return 0;
+	}
+	float distance = std::max(glm::length(center - view.eye) - radius, 1e-3f);
+	float pixelsPerError = scale * view.errorScale / distance;
+	for (uint32_t level = lodCount - 1; level > 0; level--) {
+		float limit = level > current ? 1.0f - view.hysteresis : 1.0f;
+		if (lods[level].error * pixelsPerError <= limit) {
+			return level;
+		}
+	}
+	return 0;
+}
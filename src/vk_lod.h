@@ -0,0 +1,43 @@
+#pragma once
+
+#include <glm/glm.hpp>
+#include <vector>
+#include <cstdint>
+
+//discrete levels of detail as index ranges over one vertex buffer. the chain is built once by quadric simplification,
+//every frame an object picks the coarsest range whose object space error projects to less than a pixel threshold
+namespace vklod {
+
+	//full detail plus up to 4 coarser ranges
+	const uint32_t MAX_LODS = 5;
+
+	//std430 friendly
+	struct LodRange {
+		uint32_t firstIndex;
+		uint32_t indexCount;
+		//object space deviation from the full detail mesh, 0 for the first range
+		float error;
+	};
+
+	//appends the coarser ranges of an indexed triangle list to outIndices, each about half the triangles of the one
+	//before. outLods gets the full range {firstIndex, indexCount} followed by the coarser ones, which start at
+	//lodIndexBase + their offset in outIndices. the chain ends early when simplification stops paying off
+	void build_lod_chain(const uint32_t* indices, size_t indexCount, uint32_t firstIndex, const void* positions, size_t positionStride,
+		size_t vertexCount, uint32_t lodIndexBase, std::vector<uint32_t>& outIndices, std::vector<LodRange>& outLods, uint32_t maxLods = MAX_LODS);
+
+	//the camera values LOD selection needs
+	struct LodView {
+		glm::vec3 eye;
+		//pixels covered by an error of 1 at distance 1, divided by the allowed error in pixels. 0 selects full detail
+		float errorScale;
+		//a coarser range has to stay under this fraction of the threshold before it replaces the current one
+		float hysteresis;
+	};
+
+	LodView make_lod_view(const glm::vec3& eye, const glm::mat4& projection, float viewportHeight, float pixelError, float hysteresis);
+
+	//coarsest range whose projected error is within the threshold. center/radius are the world bounding sphere, the
+	//error is measured from its near side; scale is the largest axis scale of the object. current is last frame's choice
+	uint32_t select_lod(const LodView& view, const LodRange* lods, uint32_t lodCount, const glm::vec3& center, float radius, float scale,
+		uint32_t current);
+}
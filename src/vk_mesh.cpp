@@ -1,6 +1,39 @@
 #include <vk_mesh.h>
 #include <tiny_obj_loader.h>
+#include <vk_threadpool.h>
+#include <vk_meshcache.h>
+#include <vk_meshopt.h>
+#include <vk_meshlet.h>
 #include <iostream>
+#include <fstream>
+#include <unordered_map>
+#include <cmath>
+#include <glm/common.hpp>
+
+//vertices are deduplicated on their exact bit pattern, Vertex is tightly packed floats so there is no padding to hash
+static_assert(sizeof(Vertex) == 11 * sizeof(float), "Vertex must stay free of padding for hashing");
+static_assert(sizeof(CompactVertex) == 16, "CompactVertex must stay tightly packed");
+
+struct VertexHash {
+	size_t operator()(const Vertex& v) const
+	{
+		//FNV-1a over the raw bytes
+		const unsigned char* bytes = reinterpret_cast<const unsigned char*>(&v);
+		uint64_t hash = 14695981039346656037ull;
+		for (size_t i = 0; i < sizeof(Vertex); i++) {
+			hash ^= bytes[i];
+			hash *= 1099511628211ull;
+		}
+		return static_cast<size_t>(hash);
+	}
+};
+
+struct VertexEqual {
+	bool operator()(const Vertex& a, const Vertex& b) const
+	{
+		return memcmp(&a, &b, sizeof(Vertex)) == 0;
+	}
+};
 
 VertexInputDescription Vertex::get_vertex_description()
 {
@@ -48,7 +81,93 @@ VertexInputDescription Vertex::get_vertex_description()
 	return description;
 }
 
-bool Mesh::load_from_obj(const char* filename)
+VertexInputDescription CompactVertex::get_vertex_description()
+{
+	VertexInputDescription description;
+
+	VkVertexInputBindingDescription mainBinding = {};
+	mainBinding.binding = 0;
+	mainBinding.stride = sizeof(CompactVertex);
+	mainBinding.inputRate = VK_VERTEX_INPUT_RATE_VERTEX;
+
+	//stride 0 makes every vertex read the same color, so it is stored once instead of per vertex
+	VkVertexInputBindingDescription colorBinding = {};
+	colorBinding.binding = 1;
+	colorBinding.stride = 0;
+	colorBinding.inputRate = VK_VERTEX_INPUT_RATE_VERTEX;
+
+	description.bindings.push_back(mainBinding);
+	description.bindings.push_back(colorBinding);
+
+	//the normalized formats are expanded to floats on fetch, the shaders still see vec3/vec2
+	VkVertexInputAttributeDescription positionAttribute = {};
+	positionAttribute.binding = 0;
+	positionAttribute.location = 0;
+	positionAttribute.format = VK_FORMAT_R16G16B16A16_SNORM;
+	positionAttribute.offset = offsetof(CompactVertex, position);
+
+	VkVertexInputAttributeDescription normalAttribute = {};
+	normalAttribute.binding = 0;
+	normalAttribute.location = 1;
+	normalAttribute.format = VK_FORMAT_R8G8B8A8_SNORM;
+	normalAttribute.offset = offsetof(CompactVertex, normal);
+
+	VkVertexInputAttributeDescription colorAttribute = {};
+	colorAttribute.binding = 1;
+	colorAttribute.location = 2;
+	colorAttribute.format = VK_FORMAT_R32G32B32_SFLOAT;
+	colorAttribute.offset = 0;
+
+	VkVertexInputAttributeDescription uvAttribute = {};
+	uvAttribute.binding = 0;
+	uvAttribute.location = 3;
+	uvAttribute.format = VK_FORMAT_R16G16_SFLOAT;
+	uvAttribute.offset = offsetof(CompactVertex, uv);
+
+	description.attributes.push_back(positionAttribute);
+	description.attributes.push_back(normalAttribute);
+	description.attributes.push_back(colorAttribute);
+	description.attributes.push_back(uvAttribute);
+	return description;
+}
+
+VertexInputDescription Mesh::vertex_description(VertexFormat format)
+{
+	return format == VertexFormat::Compact ? CompactVertex::get_vertex_description() : Vertex::get_vertex_description();
+}
+
+const void* Mesh::vertex_data() const
+{
+	if (_cookedFile) {
+		return _cookedVertices;
+	}
+	return _format == VertexFormat::Compact ? static_cast<const void*>(_compactVertices.data()) : static_cast<const void*>(_vertices.data());
+}
+
+size_t Mesh::vertex_count() const
+{
+	if (_cookedFile) {
+		return _cookedVertexCount;
+	}
+	return _format == VertexFormat::Compact ? _compactVertices.size() : _vertices.size();
+}
+
+//face corner of an OBJ file with zero based attribute indices, -1 when the attribute is absent
+struct ObjCorner {
+	int v;
+	int vn;
+	int vt;
+};
+
+//raw attribute arrays and triangle corners in file order
+struct ObjData {
+	std::vector<tinyobj::real_t> positions;
+	std::vector<tinyobj::real_t> normals;
+	std::vector<tinyobj::real_t> texcoords;
+	std::vector<ObjCorner> corners;
+};
+
+static bool parse_obj_tinyobj(const char* filename, ObjData& out)
 {
 	//attrib will contain the vertex arrays of the file
 	tinyobj::attrib_t attrib;
@@ -75,6 +194,12 @@ bool Mesh::load_from_obj(const char* filename)
 		return false;
 	}
 
+	size_t cornerCount = 0;
+	for (size_t s = 0; s < shapes.size(); s++) {
+		cornerCount += shapes[s].mesh.num_face_vertices.size() * 3;
+	}
+	out.corners.reserve(cornerCount);
+
 	// Loop over shapes
 	for (size_t s = 0; s < shapes.size(); s++) {
 		// Loop over faces(polygon)
@@ -88,41 +213,700 @@ bool Mesh::load_from_obj(const char* filename)
 			for (size_t v = 0; v < fv; v++) {
 				// access to vertex
 				tinyobj::index_t idx = shapes[s].mesh.indices[index_offset + v];
-				//vertex position
-				tinyobj::real_t vx = attrib.vertices[3 * idx.vertex_index + 0];
-				tinyobj::real_t vy = attrib.vertices[3 * idx.vertex_index + 1];
-				tinyobj::real_t vz = attrib.vertices[3 * idx.vertex_index + 2];
-				//vertex normal
-				tinyobj::real_t nx = attrib.normals[3 * idx.normal_index + 0];
-				tinyobj::real_t ny = attrib.normals[3 * idx.normal_index + 1];
-				tinyobj::real_t nz = attrib.normals[3 * idx.normal_index + 2];
+				out.corners.push_back({ idx.vertex_index, idx.normal_index, idx.texcoord_index });
+			}
+			index_offset += fv;
+		}
+	}
+
+	out.positions.swap(attrib.vertices);
+	out.normals.swap(attrib.normals);
+	out.texcoords.swap(attrib.texcoords);
+	return true;
+}
+
+//the parallel parser below mirrors tinyobj's number and index parsing exactly so both paths give bit identical meshes
+static inline bool obj_is_space(char c) { return c == ' ' || c == '\t'; }
+static inline bool obj_is_digit(char c) { return static_cast<unsigned int>(c - '0') < 10u; }
 
-				//uv
-				tinyobj::real_t ux = attrib.texcoords[2 * idx.texcoord_index + 0];
-				tinyobj::real_t uy = attrib.texcoords[2 * idx.texcoord_index + 1];
+//same grammar and arithmetic as tinyobj tryParseDouble
+static bool obj_parse_double(const char* s, const char* s_end, double* result)
+{
+	if (s >= s_end) {
+		return false;
+	}
 
-				//copy it into our vertex
-				Vertex new_vert;
-				new_vert.position.x = vx;
-				new_vert.position.y = vy;
-				new_vert.position.z = vz;
+	double mantissa = 0.0;
+	int exponent = 0;
+	char sign = '+';
+	char exp_sign = '+';
+	const char* curr = s;
+	int read = 0;
+	bool end_not_reached = false;
+	bool leading_decimal_dots = false;
 
-				new_vert.normal.x = nx;
-				new_vert.normal.y = ny;
-				new_vert.normal.z = nz;
+	if (*curr == '+' || *curr == '-') {
+		sign = *curr;
+		curr++;
+		if ((curr != s_end) && (*curr == '.')) {
+			leading_decimal_dots = true;
+		}
+	}
+	else if (obj_is_digit(*curr)) {
+	}
+	else if (*curr == '.') {
+		leading_decimal_dots = true;
+	}
+	else {
+		return false;
+	}
 
-				new_vert.uv.x = ux;
-				new_vert.uv.y = 1-uy;
+	end_not_reached = (curr != s_end);
+	if (!leading_decimal_dots) {
+		while (end_not_reached && obj_is_digit(*curr)) {
+			mantissa *= 10;
+			mantissa += static_cast<int>(*curr - 0x30);
+			curr++;
+			read++;
+			end_not_reached = (curr != s_end);
+		}
+		if (read == 0) {
+			return false;
+		}
+	}
 
-				//we are setting the vertex color as the vertex normal. This is just for display purposes
-				new_vert.color = this->objectColor;
+	if (end_not_reached) {
+		bool readExponent = false;
+		if (*curr == '.') {
+			curr++;
+			read = 1;
+			end_not_reached = (curr != s_end);
+			while (end_not_reached && obj_is_digit(*curr)) {
+				static const double pow_lut[] = {
+					1.0, 0.1, 0.01, 0.001, 0.0001, 0.00001, 0.000001, 0.0000001,
+				};
+				const int lut_entries = sizeof pow_lut / sizeof pow_lut[0];
+				mantissa += static_cast<int>(*curr - 0x30) *
+					(read < lut_entries ? pow_lut[read] : std::pow(10.0, -read));
+				read++;
+				curr++;
+				end_not_reached = (curr != s_end);
+			}
+			readExponent = end_not_reached;
+		}
+		else if (*curr == 'e' || *curr == 'E') {
+			readExponent = true;
+		}
 
+		if (readExponent && (*curr == 'e' || *curr == 'E')) {
+			curr++;
+			end_not_reached = (curr != s_end);
+			if (end_not_reached && (*curr == '+' || *curr == '-')) {
+				exp_sign = *curr;
+				curr++;
+			}
+			else if (obj_is_digit(*curr)) {
+			}
+			else {
+				return false;
+			}
 
-				_vertices.push_back(new_vert);
+			read = 0;
+			end_not_reached = (curr != s_end);
+			while (end_not_reached && obj_is_digit(*curr)) {
+				exponent *= 10;
+				exponent += static_cast<int>(*curr - 0x30);
+				curr++;
+				read++;
+				end_not_reached = (curr != s_end);
 			}
-			index_offset += fv;
+			exponent *= (exp_sign == '+' ? 1 : -1);
+			if (read == 0) {
+				return false;
+			}
+		}
+	}
+
+	*result = (sign == '+' ? 1 : -1) *
+		(exponent ? std::ldexp(mantissa * std::pow(5.0, exponent), exponent) : mantissa);
+	return true;
+}
+
+static tinyobj::real_t obj_parse_real(const char*& token, const char* lineEnd, double defaultValue = 0.0)
+{
+	while (token < lineEnd && obj_is_space(*token)) token++;
+	const char* end = token;
+	while (end < lineEnd && !obj_is_space(*end)) end++;
+	double val = defaultValue;
+	obj_parse_double(token, end, &val);
+	token = end;
+	return static_cast<tinyobj::real_t>(val);
+}
+
+//atoi on a line that is not zero terminated
+static int obj_parse_int(const char* p, const char* lineEnd)
+{
+	while (p < lineEnd && (obj_is_space(*p) || *p == '\v' || *p == '\f')) p++;
+	bool negative = false;
+	if (p < lineEnd && (*p == '+' || *p == '-')) {
+		negative = *p == '-';
+		p++;
+	}
+	int value = 0;
+	while (p < lineEnd && obj_is_digit(*p)) {
+		value = value * 10 + (*p - '0');
+		p++;
+	}
+	return negative ? -value : value;
+}
+
+//tinyobj fixIndex, relative indices count back from the attributes parsed so far
+static inline bool obj_fix_index(int idx, size_t n, int* ret)
+{
+	if (idx > 0) {
+		*ret = idx - 1;
+		return true;
+	}
+	if (idx == 0) {
+		return false;
+	}
+	*ret = static_cast<int>(n) + idx;
+	return true;
+}
+
+static inline void obj_skip_index(const char*& token, const char* lineEnd)
+{
+	while (token < lineEnd && *token != '/' && !obj_is_space(*token)) token++;
+}
+
+//tinyobj parseTriple: i, i/j, i//k, i/j/k
+static bool obj_parse_triple(const char*& token, const char* lineEnd, size_t vsize, size_t vnsize, size_t vtsize, ObjCorner& out)
+{
+	out = { -1, -1, -1 };
+	if (!obj_fix_index(obj_parse_int(token, lineEnd), vsize, &out.v)) {
+		return false;
+	}
+	obj_skip_index(token, lineEnd);
+	if (token >= lineEnd || *token != '/') {
+		return true;
+	}
+	token++;
+
+	if (token < lineEnd && *token == '/') {
+		token++;
+		if (!obj_fix_index(obj_parse_int(token, lineEnd), vnsize, &out.vn)) {
+			return false;
+		}
+		obj_skip_index(token, lineEnd);
+		return true;
+	}
+
+	if (!obj_fix_index(obj_parse_int(token, lineEnd), vtsize, &out.vt)) {
+		return false;
+	}
+	obj_skip_index(token, lineEnd);
+	if (token >= lineEnd || *token != '/') {
+		return true;
+	}
+	token++;
+	if (!obj_fix_index(obj_parse_int(token, lineEnd), vnsize, &out.vn)) {
+		return false;
+	}
+	obj_skip_index(token, lineEnd);
+	return true;
+}
+
+enum ObjLine { OBJ_OTHER, OBJ_V, OBJ_VN, OBJ_VT, OBJ_F, OBJ_UNSUPPORTED };
+
+//calls func(type, token, lineEnd) for every line of [begin,end), token points past the keyword
+template<typename F>
+static void obj_for_each_line(const char* begin, const char* end, F&& func)
+{
+	const char* p = begin;
+	while (p < end) {
+		const char* lineEnd = p;
+		//tinyobj splits on \n, \r\n and \r, the empty lines this produces are skipped anyway
+		while (lineEnd < end && *lineEnd != '\n' && *lineEnd != '\r') lineEnd++;
+
+		const char* token = p;
+		while (token < lineEnd && obj_is_space(*token)) token++;
+
+		if (token < lineEnd && *token != '#') {
+			bool space1 = token + 1 < lineEnd && obj_is_space(token[1]);
+			bool space2 = token + 2 < lineEnd && obj_is_space(token[2]);
+			if (token[0] == 'v' && space1) func(OBJ_V, token + 2, lineEnd);
+			else if (token[0] == 'v' && token + 1 < lineEnd && token[1] == 'n' && space2) func(OBJ_VN, token + 3, lineEnd);
+			else if (token[0] == 'v' && token + 1 < lineEnd && token[1] == 't' && space2) func(OBJ_VT, token + 3, lineEnd);
+			else if (token[0] == 'f' && space1) func(OBJ_F, token + 2, lineEnd);
+			//lines and points can fail to parse in tinyobj, leave those files to it
+			else if ((token[0] == 'l' || token[0] == 'p') && space1) func(OBJ_UNSUPPORTED, token, lineEnd);
+		}
+		p = lineEnd + 1;
+	}
+}
+
+struct ObjChunk {
+	const char* begin;
+	const char* end;
+	size_t positions{ 0 };
+	size_t normals{ 0 };
+	size_t texcoords{ 0 };
+	size_t faces{ 0 };
+	size_t writtenFaces{ 0 };
+	bool unsupported{ false };
+};
+
+//returns false when the file uses something only tinyobj handles (polygons, lines, bad indices), the caller falls back then
+static bool parse_obj_parallel(const char* filename, ThreadPool& pool, ObjData& out)
+{
+	std::ifstream file(filename, std::ios::binary | std::ios::ate);
+	if (!file.is_open()) {
+		return false;
+	}
+	size_t size = static_cast<size_t>(file.tellg());
+	std::string text(size, '\0');
+	file.seekg(0);
+	file.read(&text[0], size);
+
+	const char* data = text.data();
+	const char* end = data + size;
+
+	//line aligned chunks, a few per thread so uneven chunks balance out
+	const size_t minChunk = 256 * 1024;
+	uint32_t chunkCount = static_cast<uint32_t>(std::max<size_t>(1, std::min<size_t>(size / minChunk, pool.concurrency() * 4)));
+	std::vector<ObjChunk> chunks(chunkCount);
+	const char* cursor = data;
+	for (uint32_t i = 0; i < chunkCount; i++) {
+		chunks[i].begin = cursor;
+		const char* split = i + 1 == chunkCount ? end : std::max(cursor, data + size / chunkCount * (i + 1));
+		while (split < end && *split != '\n' && *split != '\r') split++;
+		chunks[i].end = split;
+		cursor = split;
+	}
+
+	//pass 1: count attributes and faces per chunk
+	pool.parallel_for(chunkCount, [&](uint32_t c) {
+		ObjChunk& chunk = chunks[c];
+		obj_for_each_line(chunk.begin, chunk.end, [&](ObjLine type, const char*, const char*) {
+			switch (type) {
+			case OBJ_V: chunk.positions++; break;
+			case OBJ_VN: chunk.normals++; break;
+			case OBJ_VT: chunk.texcoords++; break;
+			case OBJ_F: chunk.faces++; break;
+			case OBJ_UNSUPPORTED: chunk.unsupported = true; break;
+			default: break;
+			}
+		});
+	});
+
+	//prefix sums give every chunk its slot in the pre-sized output, and the base for relative indices
+	std::vector<size_t> positionBase(chunkCount), normalBase(chunkCount), texcoordBase(chunkCount), faceBase(chunkCount);
+	size_t positionCount = 0, normalCount = 0, texcoordCount = 0, faceCount = 0;
+	for (uint32_t c = 0; c < chunkCount; c++) {
+		if (chunks[c].unsupported) {
+			return false;
+		}
+		positionBase[c] = positionCount;
+		normalBase[c] = normalCount;
+		texcoordBase[c] = texcoordCount;
+		faceBase[c] = faceCount;
+		positionCount += chunks[c].positions;
+		normalCount += chunks[c].normals;
+		texcoordCount += chunks[c].texcoords;
+		faceCount += chunks[c].faces;
+	}
+
+	out.positions.resize(positionCount * 3);
+	out.normals.resize(normalCount * 3);
+	out.texcoords.resize(texcoordCount * 2);
+	out.corners.resize(faceCount * 3);
+
+	//pass 2: parse straight into the final arrays
+	pool.parallel_for(chunkCount, [&](uint32_t c) {
+		ObjChunk& chunk = chunks[c];
+		size_t v = positionBase[c], vn = normalBase[c], vt = texcoordBase[c];
+		ObjCorner* faces = out.corners.data() + faceBase[c] * 3;
+
+		obj_for_each_line(chunk.begin, chunk.end, [&](ObjLine type, const char* token, const char* lineEnd) {
+			if (chunk.unsupported) {
+				return;
+			}
+			switch (type) {
+			case OBJ_V: {
+				tinyobj::real_t* dst = out.positions.data() + v * 3;
+				dst[0] = obj_parse_real(token, lineEnd);
+				dst[1] = obj_parse_real(token, lineEnd);
+				dst[2] = obj_parse_real(token, lineEnd);
+				v++;
+				break;
+			}
+			case OBJ_VN: {
+				tinyobj::real_t* dst = out.normals.data() + vn * 3;
+				dst[0] = obj_parse_real(token, lineEnd);
+				dst[1] = obj_parse_real(token, lineEnd);
+				dst[2] = obj_parse_real(token, lineEnd);
+				vn++;
+				break;
+			}
+			case OBJ_VT: {
+				tinyobj::real_t* dst = out.texcoords.data() + vt * 2;
+				dst[0] = obj_parse_real(token, lineEnd);
+				dst[1] = obj_parse_real(token, lineEnd);
+				vt++;
+				break;
+			}
+			case OBJ_F: {
+				while (token < lineEnd && obj_is_space(*token)) token++;
+				ObjCorner corners[3];
+				int count = 0;
+				while (token < lineEnd) {
+					ObjCorner corner;
+					if (count == 3 || !obj_parse_triple(token, lineEnd, v, vn, vt, corner)) {
+						//polygon or broken index
+						chunk.unsupported = true;
+						return;
+					}
+					corners[count++] = corner;
+					while (token < lineEnd && obj_is_space(*token)) token++;
+				}
+				//tinyobj drops faces with less than 3 corners
+				if (count == 3) {
+					ObjCorner* dst = faces + chunk.writtenFaces * 3;
+					dst[0] = corners[0];
+					dst[1] = corners[1];
+					dst[2] = corners[2];
+					chunk.writtenFaces++;
+				}
+				break;
+			}
+			default:
+				break;
+			}
+		});
+	});
+
+	//close the gaps left by dropped faces
+	size_t writtenFaces = 0;
+	for (uint32_t c = 0; c < chunkCount; c++) {
+		if (chunks[c].unsupported) {
+			return false;
+		}
+		if (writtenFaces != faceBase[c]) {
+			memmove(out.corners.data() + writtenFaces * 3, out.corners.data() + faceBase[c] * 3, chunks[c].writtenFaces * 3 * sizeof(ObjCorner));
 		}
+		writtenFaces += chunks[c].writtenFaces;
+	}
+	out.corners.resize(writtenFaces * 3);
+	return true;
+}
+
+static Vertex obj_make_vertex(const ObjData& obj, const ObjCorner& corner, const glm::vec3& color)
+{
+	Vertex new_vert{};
+	//vertex position
+	if (corner.v >= 0 && size_t(corner.v) * 3 + 2 < obj.positions.size()) {
+		new_vert.position.x = obj.positions[3 * corner.v + 0];
+		new_vert.position.y = obj.positions[3 * corner.v + 1];
+		new_vert.position.z = obj.positions[3 * corner.v + 2];
+	}
+	//vertex normal
+	if (corner.vn >= 0 && size_t(corner.vn) * 3 + 2 < obj.normals.size()) {
+		new_vert.normal.x = obj.normals[3 * corner.vn + 0];
+		new_vert.normal.y = obj.normals[3 * corner.vn + 1];
+		new_vert.normal.z = obj.normals[3 * corner.vn + 2];
+	}
+	//uv
+	if (corner.vt >= 0 && size_t(corner.vt) * 2 + 1 < obj.texcoords.size()) {
+		new_vert.uv.x = obj.texcoords[2 * corner.vt + 0];
+		new_vert.uv.y = 1 - obj.texcoords[2 * corner.vt + 1];
+	}
+	else {
+		new_vert.uv.y = 1;
+	}
+
+	//we are setting the vertex color as the vertex normal. This is just for display purposes
+	new_vert.color = color;
+	return new_vert;
+}
+
+typedef std::unordered_map<Vertex, uint32_t, VertexHash, VertexEqual> VertexTable;
+
+//builds the deduplicated vertex/index arrays. the parallel version dedups ranges locally and merges them in order,
+//which hands out indices in the same first-occurrence order as the serial loop
+static void obj_build_indexed(Mesh& mesh, const ObjData& obj, ThreadPool* pool)
+{
+	const size_t cornerCount = obj.corners.size();
+	mesh._vertices.clear();
+	mesh._indices.resize(cornerCount);
+
+	if (pool == nullptr || pool->concurrency() == 1) {
+		VertexTable uniqueVertices;
+		uniqueVertices.reserve(cornerCount / 2);
+		for (size_t i = 0; i < cornerCount; i++) {
+			Vertex new_vert = obj_make_vertex(obj, obj.corners[i], mesh.objectColor);
+			//reuse the index of an identical vertex seen before
+			auto it = uniqueVertices.find(new_vert);
+			if (it == uniqueVertices.end()) {
+				it = uniqueVertices.emplace(new_vert, static_cast<uint32_t>(mesh._vertices.size())).first;
+				mesh._vertices.push_back(new_vert);
+			}
+			mesh._indices[i] = it->second;
+		}
+		return;
+	}
+
+	struct Range {
+		size_t begin;
+		size_t end;
+		std::vector<Vertex> unique;
+		std::vector<uint32_t> remap;
+	};
+	uint32_t rangeCount = static_cast<uint32_t>(std::max<size_t>(1, std::min<size_t>(cornerCount / 4096, pool->concurrency() * 4)));
+	std::vector<Range> ranges(rangeCount);
+	for (uint32_t r = 0; r < rangeCount; r++) {
+		ranges[r].begin = cornerCount * r / rangeCount;
+		ranges[r].end = cornerCount * (r + 1) / rangeCount;
+	}
+
+	//local dedup, mesh._indices temporarily holds range local indices
+	pool->parallel_for(rangeCount, [&](uint32_t r) {
+		Range& range = ranges[r];
+		VertexTable local;
+		local.reserve((range.end - range.begin) / 2);
+		for (size_t i = range.begin; i < range.end; i++) {
+			Vertex new_vert = obj_make_vertex(obj, obj.corners[i], mesh.objectColor);
+			auto it = local.find(new_vert);
+			if (it == local.end()) {
+				it = local.emplace(new_vert, static_cast<uint32_t>(range.unique.size())).first;
+				range.unique.push_back(new_vert);
+			}
+			mesh._indices[i] = it->second;
+		}
+	});
+
+	size_t uniqueTotal = 0;
+	for (auto& range : ranges) {
+		uniqueTotal += range.unique.size();
+	}
+	VertexTable global;
+	global.reserve(uniqueTotal);
+	mesh._vertices.reserve(uniqueTotal);
+	for (auto& range : ranges) {
+		range.remap.resize(range.unique.size());
+		for (size_t u = 0; u < range.unique.size(); u++) {
+			auto it = global.find(range.unique[u]);
+			if (it == global.end()) {
+				it = global.emplace(range.unique[u], static_cast<uint32_t>(mesh._vertices.size())).first;
+				mesh._vertices.push_back(range.unique[u]);
+			}
+			range.remap[u] = it->second;
+		}
+	}
+
+	pool->parallel_for(rangeCount, [&](uint32_t r) {
+		Range& range = ranges[r];
+		for (size_t i = range.begin; i < range.end; i++) {
+			mesh._indices[i] = range.remap[mesh._indices[i]];
+		}
+	});
+}
+
+bool Mesh::load_from_obj(const char* filename, ThreadPool* pool)
+{
+	ObjData obj;
+	bool parsed = false;
+	if (pool != nullptr && pool->concurrency() > 1) {
+		parsed = parse_obj_parallel(filename, *pool, obj);
+		if (!parsed) {
+			obj = ObjData{};
+		}
+	}
+	if (!parsed && !parse_obj_tinyobj(filename, obj)) {
+		return false;
+	}
+
+	obj_build_indexed(*this, obj, pool);
+	compute_bounds();
+
+	size_t indexSize = index_type_for(_vertices.size()) == VK_INDEX_TYPE_UINT16 ? sizeof(uint16_t) : sizeof(uint32_t);
+	size_t expandedBytes = _indices.size() * sizeof(Vertex);
+	size_t indexedBytes = _vertices.size() * sizeof(Vertex) + _indices.size() * indexSize;
+	std::cout << filename << ": " << _indices.size() << " corners -> " << _vertices.size() << " unique vertices ("
+		<< (_vertices.empty() ? 0.0f : float(_indices.size()) / float(_vertices.size())) << "x), "
+		<< expandedBytes / 1024 << " KiB -> " << indexedBytes / 1024 << " KiB, saved "
+		<< (expandedBytes - std::min(expandedBytes, indexedBytes)) / 1024 << " KiB" << std::endl;
+
+	return true;
+}
+
+bool Mesh::load_cached(const char* filename, ThreadPool* pool, VertexFormat format)
+{
+	std::string path = vkcook::cooked_path(filename);
+	if (vkcook::load(path.c_str(), filename, *this, format)) {
+		std::cout << filename << ": loaded cooked mesh, " << _cookedVertexCount << " vertices, " << _cookedIndexCount << " indices" << std::endl;
+		return true;
+	}
+
+	if (!load_from_obj(filename, pool)) {
+		return false;
+	}
+	optimize(true);
+	build_lods();
+	if (format == VertexFormat::Compact) {
+		compact(pool);
 	}
 
+	SourceStamp stamp;
+	if (vkcook::stamp_source(filename, stamp) && vkcook::hash_file(filename, stamp.hash) && vkcook::write(path.c_str(), *this, stamp)) {
+		std::cout << filename << ": cooked to " << path << std::endl;
+	}
 	return true;
-}
\ No newline at end of file
+}
+
+void Mesh::compute_bounds()
+{
+	//compact meshes keep the bounds they were quantized with
+	if (_format != VertexFormat::Full || _cookedFile) {
+		return;
+	}
+	const Vertex* vertices = _vertices.data();
+	size_t count = _vertices.size();
+	if (count == 0) {
+		_boundsMin = _boundsMax = glm::vec3(0.0f);
+		return;
+	}
+	_boundsMin = _boundsMax = vertices[0].position;
+	for (size_t i = 1; i < count; i++) {
+		_boundsMin = glm::min(_boundsMin, vertices[i].position);
+		_boundsMax = glm::max(_boundsMax, vertices[i].position);
+	}
+}
+
+void Mesh::compact(ThreadPool* pool)
+{
+	if (_format == VertexFormat::Compact || _cookedFile) {
+		return;
+	}
+	compute_bounds();
+	vkvertex::Quantization quantization = vkvertex::quantization_for(_boundsMin, _boundsMax);
+
+	const size_t count = _vertices.size();
+	_compactVertices.resize(count);
+
+	//fixed size blocks so the encode can be spread over the pool
+	const size_t blockSize = 16384;
+	uint32_t blocks = static_cast<uint32_t>((count + blockSize - 1) / blockSize);
+	auto encode = [&](uint32_t block) {
+		size_t first = block * blockSize;
+		size_t n = std::min(blockSize, count - first);
+		const Vertex* src = _vertices.data() + first;
+		CompactVertex* dst = _compactVertices.data() + first;
+		vkvertex::encode_positions(&src->position, sizeof(Vertex), n, quantization, dst->position, sizeof(CompactVertex));
+		vkvertex::encode_snorm8(&src->normal, sizeof(Vertex), n, 3, dst->normal, sizeof(CompactVertex));
+		vkvertex::encode_half2(&src->uv, sizeof(Vertex), n, dst->uv, sizeof(CompactVertex));
+	};
+	if (pool != nullptr) {
+		pool->parallel_for(blocks, encode);
+	}
+	else {
+		for (uint32_t block = 0; block < blocks; block++) {
+			encode(block);
+		}
+	}
+
+	_format = VertexFormat::Compact;
+	std::vector<Vertex>().swap(_vertices);
+}
+
+glm::mat4 Mesh::dequantize_matrix() const
+{
+	if (_format != VertexFormat::Compact) {
+		return glm::mat4(1.0f);
+	}
+	return vkvertex::dequantize_matrix(vkvertex::quantization_for(_boundsMin, _boundsMax));
+}
+
+void Mesh::build_meshlets()
+{
+	if (!indexed()) {
+		return;
+	}
+	const size_t vertexCount = vertex_count();
+
+	//the bounds are built from mesh space float positions, compact ones are decoded first
+	std::vector<glm::vec3> decoded;
+	const void* positions = vertex_data();
+	size_t positionStride = sizeof(Vertex);
+	if (_format == VertexFormat::Compact) {
+		glm::mat4 dequantize = dequantize_matrix();
+		const CompactVertex* vertices = static_cast<const CompactVertex*>(vertex_data());
+		decoded.resize(vertexCount);
+		for (size_t i = 0; i < vertexCount; i++) {
+			glm::vec3 snorm = glm::max(glm::vec3(vertices[i].position[0], vertices[i].position[1], vertices[i].position[2]) / 32767.0f, glm::vec3(-1.0f));
+			decoded[i] = glm::vec3(dequantize * glm::vec4(snorm, 1.0f));
+		}
+		positions = decoded.data();
+		positionStride = sizeof(glm::vec3);
+	}
+
+	std::vector<uint32_t> wideIndices;
+	const uint32_t* indices = static_cast<const uint32_t*>(index_data());
+	if (_cookedFile && _indexType == VK_INDEX_TYPE_UINT16) {
+		const uint16_t* shortIndices = static_cast<const uint16_t*>(index_data());
+		wideIndices.assign(shortIndices, shortIndices + index_count());
+		indices = wideIndices.data();
+	}
+
+	vkmeshlet::build_meshlets(indices, index_count(), positions, positionStride, vertexCount, _meshlets);
+	std::cout << "meshlets: " << _meshlets.meshlets.size() << " clusters for " << index_count() / 3 << " triangles, "
+		<< float(_meshlets.vertices.size()) / std::max<size_t>(_meshlets.meshlets.size(), 1) << " vertices each" << std::endl;
+}
+
+void Mesh::build_lods()
+{
+	//small meshes cost the same at any distance
+	if (!_lods.empty() || _cookedFile || _format != VertexFormat::Full || _indices.size() < 3 * 256) {
+		return;
+	}
+	_lodIndices.clear();
+	vklod::build_lod_chain(_indices.data(), _indices.size(), 0, &_vertices[0].position, sizeof(Vertex), _vertices.size(),
+		static_cast<uint32_t>(_indices.size()), _lodIndices, _lods);
+	if (_lods.size() < 2) {
+		_lods.clear();
+		return;
+	}
+	std::cout << "lods:";
+	for (const vklod::LodRange& range : _lods) {
+		std::cout << " " << range.indexCount / 3 << " (" << range.error << ")";
+	}
+	std::cout << " triangles (error)" << std::endl;
+}
+
+vklod::LodRange Mesh::lod(uint32_t level) const
+{
+	if (_lods.empty()) {
+		return { 0, static_cast<uint32_t>(index_count()), 0.0f };
+	}
+	return _lods[std::min<size_t>(level, _lods.size() - 1)];
+}
+
+void Mesh::optimize(bool overdraw)
+{
+	//LOD ranges index the current vertex order
+	if (_optimized || _cookedFile || _format != VertexFormat::Full || _indices.size() < 6 || !_lods.empty()) {
+		return;
+	}
+
+	vkmeshopt::CacheStats before = vkmeshopt::analyze_vertex_cache(_indices.data(), _indices.size(), _vertices.size());
+
+	vkmeshopt::optimize_vertex_cache(_indices.data(), _indices.size(), _vertices.size());
+	if (overdraw) {
+		vkmeshopt::optimize_overdraw(_indices.data(), _indices.size(), &_vertices[0].position, sizeof(Vertex), _vertices.size());
+	}
+	size_t vertexCount = vkmeshopt::optimize_vertex_fetch(_vertices.data(), sizeof(Vertex), _vertices.size(), _indices.data(), _indices.size());
+	_vertices.resize(vertexCount);
+
+	vkmeshopt::CacheStats after = vkmeshopt::analyze_vertex_cache(_indices.data(), _indices.size(), _vertices.size());
+	std::cout << "mesh optimize: ACMR " << before.acmr << " -> " << after.acmr << ", ATVR " << before.atvr << " -> " << after.atvr << std::endl;
+	_optimized = true;
+}
@@ -2,8 +2,13 @@
 
 #include <vk_types.h>
 #include <vector>
+#include <memory>
 #include <glm/vec3.hpp>
 #include <glm/vec2.hpp>
+#include <glm/mat4x4.hpp>
+#include <vk_vertexformat.h>
+#include <vk_meshlet.h>
+#include <vk_lod.h>
 struct VertexInputDescription {
 	std::vector<VkVertexInputBindingDescription> bindings;
 	std::vector<VkVertexInputAttributeDescription> attributes;
@@ -21,18 +26,103 @@ struct Vertex {
 	static VertexInputDescription get_vertex_description();
 }; 
 
+//VertexFormat::Compact. color is not stored, it comes from a second binding with stride 0
+struct CompactVertex {
+	//snorm16 relative to the mesh quantization, w unused
+	int16_t position[4];
+	//snorm8, w unused
+	int8_t normal[4];
+	//half floats
+	uint16_t uv[2];
+	static VertexInputDescription get_vertex_description();
+};
+
 struct VertexBuffer
 {
     /* data */
     VkBuffer buffer;
-    VkDeviceMemory memory;
+    Allocation memory;
 };
 
 
+class ThreadPool;
+class MappedFile;
+
 struct Mesh {
 	std::vector<Vertex> _vertices;
+	//filled instead of _vertices once the mesh is compacted
+	std::vector<CompactVertex> _compactVertices;
+	VertexFormat _format{ VertexFormat::Full };
+	//empty for meshes drawn without an index buffer
+	std::vector<uint32_t> _indices;
 
 	VertexBuffer _vertexBuffer;
+	VertexBuffer _indexBuffer;
+	//uint16 indices are used on the GPU when every vertex fits
+	VkIndexType _indexType{ VK_INDEX_TYPE_UINT32 };
 	glm::vec3 objectColor = glm::vec3(0.0f);
-	bool load_from_obj(const char* filename);
+	glm::vec3 _boundsMin = glm::vec3(0.0f);
+	glm::vec3 _boundsMax = glm::vec3(0.0f);
+
+	//set for meshes loaded from a cooked cache, the vertex/index data then lives in the mapped file instead of the vectors
+	std::shared_ptr<MappedFile> _cookedFile;
+	//in _format
+	const void* _cookedVertices{ nullptr };
+	//already in _indexType
+	const void* _cookedIndices{ nullptr };
+	uint32_t _cookedVertexCount{ 0 };
+	uint32_t _cookedIndexCount{ 0 };
+	//the coarser LOD indices, right behind _cookedIndices in the file
+	const void* _cookedLodIndices{ nullptr };
+	uint32_t _cookedLodIndexCount{ 0 };
+
+	//with a pool the file is parsed and assembled on all threads, the result is identical to the single threaded path
+	bool load_from_obj(const char* filename, ThreadPool* pool = nullptr);
+
+	//maps <filename>.cooked when it is up to date, otherwise parses the OBJ and writes the cache for the next run
+	bool load_cached(const char* filename, ThreadPool* pool = nullptr, VertexFormat format = VertexFormat::Full);
+
+	void compute_bounds();
+
+	//reorders triangles for the post-transform cache (optionally clustered for less overdraw) and vertices for fetch
+	//locality, prints ACMR/ATVR before and after. only for uncooked full format meshes, cooked ones are stored optimized
+	void optimize(bool overdraw = false);
+	bool _optimized{ false };
+
+	//encodes _vertices into _compactVertices and releases them, positions are quantized against the bounds
+	void compact(ThreadPool* pool = nullptr);
+
+	//identity for full vertices, otherwise maps the quantized positions back into mesh space
+	glm::mat4 dequantize_matrix() const;
+
+	//index ranges from full detail to coarsest, empty when the mesh has no LODs. the first range is index_data(), the
+	//coarser ones follow it in the index buffer
+	std::vector<vklod::LodRange> _lods;
+	//indices of the coarser ranges, uint32 like _indices
+	std::vector<uint32_t> _lodIndices;
+	//simplifies the mesh into _lods, before compaction. cooked meshes bring their LODs along
+	void build_lods();
+	uint32_t lod_count() const { return _lods.empty() ? 1 : static_cast<uint32_t>(_lods.size()); }
+	vklod::LodRange lod(uint32_t level) const;
+
+	//clusters for culling below the draw level, empty unless build_meshlets was called on an indexed mesh
+	vkmeshlet::MeshletSet _meshlets;
+	//splits the index buffer into meshlets with their bounds and cones, for any format and cooked meshes
+	void build_meshlets();
+
+	static VertexInputDescription vertex_description(VertexFormat format);
+	static size_t vertex_stride(VertexFormat format) { return format == VertexFormat::Compact ? sizeof(CompactVertex) : sizeof(Vertex); }
+
+	//in _format
+	const void* vertex_data() const;
+	size_t vertex_count() const;
+	//uint32 for meshes built in memory, _indexType for cooked ones
+	const void* index_data() const { return _cookedFile ? _cookedIndices : _indices.data(); }
+	size_t index_count() const { return _cookedFile ? _cookedIndexCount : _indices.size(); }
+	//the coarser LOD ranges, in the same type as index_data()
+	const void* lod_index_data() const { return _cookedFile ? _cookedLodIndices : _lodIndices.data(); }
+	size_t lod_index_count() const { return _cookedFile ? _cookedLodIndexCount : _lodIndices.size(); }
+
+	bool indexed() const { return index_count() != 0; }
+	static VkIndexType index_type_for(size_t vertexCount) { return vertexCount <= 65536 ? VK_INDEX_TYPE_UINT16 : VK_INDEX_TYPE_UINT32; }
 };
\ No newline at end of file
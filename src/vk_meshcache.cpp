@@ -0,0 +1,458 @@
+#include <vk_meshcache.h>
+#include <vk_mesh.h>
+#include <iostream>
+#include <fstream>
+#include <filesystem>
+#include <vector>
+#include <cstring>
+#include <cstdio>
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+bool MappedFile::open(const char* path)
+{
+	close();
+#ifdef _WIN32
+	HANDLE file = CreateFileA(path, GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+	if (file == INVALID_HANDLE_VALUE) {
+		return false;
+	}
+	LARGE_INTEGER size;
+	if (!GetFileSizeEx(file, &size) || size.QuadPart == 0) {
+		CloseHandle(file);
+		return false;
+	}
+	HANDLE mapping = CreateFileMappingA(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+	if (mapping == nullptr) {
+		CloseHandle(file);
+		return false;
+	}
+	void* view = MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+	if (view == nullptr) {
+		CloseHandle(mapping);
+		CloseHandle(file);
+		return false;
+	}
+	_file = file;
+	_mapping = mapping;
+	_data = static_cast<const char*>(view);
+	_size = static_cast<size_t>(size.QuadPart);
+#else
+	int fd = ::open(path, O_RDONLY);
+	if (fd < 0) {
+		return false;
+	}
+	struct stat st;
+	if (fstat(fd, &st) != 0 || st.st_size == 0) {
+		::close(fd);
+		return false;
+	}
+	void* view = mmap(nullptr, static_cast<size_t>(st.st_size), PROT_READ, MAP_PRIVATE, fd, 0);
+	//the mapping keeps its own reference to the file
+	::close(fd);
+	if (view == MAP_FAILED) {
+		return false;
+	}
+	_data = static_cast<const char*>(view);
+	_size = static_cast<size_t>(st.st_size);
+#endif
+	return true;
+}
+
+void MappedFile::close()
+{
+	if (_data == nullptr) {
+		return;
+	}
+#ifdef _WIN32
+	UnmapViewOfFile(_data);
+	CloseHandle(_mapping);
+	CloseHandle(_file);
+	_mapping = nullptr;
+	_file = nullptr;
+#else
+	munmap(const_cast<char*>(_data), _size);
+#endif
+	_data = nullptr;
+	_size = 0;
+}
+
+namespace {
+
+	const uint64_t DATA_ALIGNMENT = 16;
+
+	uint64_t align_up(uint64_t value, uint64_t alignment)
+	{
+		return (value + alignment - 1) & ~(alignment - 1);
+	}
+
+	std::vector<vkcook::Attribute> current_layout(VertexFormat format, uint32_t& outStride)
+	{
+		VertexInputDescription description = Mesh::vertex_description(format);
+		outStride = description.bindings.empty() ? 0 : description.bindings[0].stride;
+
+		//only the attributes stored in the blob, i.e. binding 0
+		std::vector<vkcook::Attribute> layout;
+		for (auto& attribute : description.attributes) {
+			if (attribute.binding == 0) {
+				layout.push_back({ attribute.location, static_cast<uint32_t>(attribute.format), attribute.offset });
+			}
+		}
+		return layout;
+	}
+
+	bool rewrite_header(const char* path, const vkcook::Header& header)
+	{
+		std::fstream file(path, std::ios::binary | std::ios::in | std::ios::out);
+		if (!file.is_open()) {
+			return false;
+		}
+		file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+		return file.good();
+	}
+}
+
+bool vkcook::write_atomic(const char* path, const std::vector<char>& blob)
+{
+	std::string temp = std::string(path) + ".tmp";
+	{
+		std::ofstream file(temp, std::ios::binary | std::ios::trunc);
+		if (!file.is_open()) {
+			std::cout << "failed to write cache " << temp << std::endl;
+			return false;
+		}
+		file.write(blob.data(), blob.size());
+		if (!file.good()) {
+			std::cout << "failed to write cache " << temp << std::endl;
+			return false;
+		}
+	}
+	std::remove(path);
+	if (std::rename(temp.c_str(), path) != 0) {
+		std::cout << "failed to write cache " << path << std::endl;
+		std::remove(temp.c_str());
+		return false;
+	}
+	return true;
+}
+
+std::string vkcook::cooked_path(const char* source)
+{
+	return std::string(source) + ".cooked";
+}
+
+bool vkcook::stamp_source(const char* source, SourceStamp& outStamp)
+{
+	std::error_code ec;
+	uint64_t size = std::filesystem::file_size(source, ec);
+	if (ec) {
+		return false;
+	}
+	auto time = std::filesystem::last_write_time(source, ec);
+	if (ec) {
+		return false;
+	}
+	outStamp.size = size;
+	outStamp.mtime = static_cast<int64_t>(time.time_since_epoch().count());
+	return true;
+}
+
+uint64_t vkcook::hash_bytes(const void* data, size_t size)
+{
+	//FNV-1a folded over 8 byte words, the tail byte by byte
+	const unsigned char* bytes = static_cast<const unsigned char*>(data);
+	uint64_t hash = 14695981039346656037ull;
+	size_t i = 0;
+	for (; i + 8 <= size; i += 8) {
+		uint64_t word;
+		memcpy(&word, bytes + i, sizeof(word));
+		hash ^= word;
+		hash *= 1099511628211ull;
+		hash ^= hash >> 29;
+	}
+	for (; i < size; i++) {
+		hash ^= bytes[i];
+		hash *= 1099511628211ull;
+	}
+	return hash;
+}
+
+bool vkcook::hash_file(const char* path, uint64_t& outHash)
+{
+	MappedFile file;
+	if (!file.open(path)) {
+		return false;
+	}
+	outHash = hash_bytes(file.data(), file.size());
+	return true;
+}
+
+bool vkcook::write(const char* path, const Mesh& mesh, const SourceStamp& stamp)
+{
+	uint32_t stride;
+	std::vector<Attribute> layout = current_layout(mesh._format, stride);
+
+	const size_t vertexCount = mesh.vertex_count();
+	const size_t indexCount = mesh.index_count();
+	const size_t lodIndexCount = mesh.lod_index_count();
+
+	//store indices in the type the GPU buffer will use so loading never converts
+	VkIndexType indexType = Mesh::index_type_for(vertexCount);
+	std::vector<uint16_t> shortIndices;
+	const void* indexData = mesh.index_data();
+	const void* lodIndexData = mesh.lod_index_data();
+	size_t indexSize = sizeof(uint32_t);
+	if (mesh._cookedFile) {
+		indexType = mesh._indexType;
+		indexSize = indexType == VK_INDEX_TYPE_UINT16 ? sizeof(uint16_t) : sizeof(uint32_t);
+	}
+	else if (indexType == VK_INDEX_TYPE_UINT16) {
+		shortIndices.assign(mesh._indices.begin(), mesh._indices.end());
+		shortIndices.insert(shortIndices.end(), mesh._lodIndices.begin(), mesh._lodIndices.end());
+		indexData = shortIndices.data();
+		lodIndexData = shortIndices.data() + indexCount;
+		indexSize = sizeof(uint16_t);
+	}
+
+	Header header = {};
+	header.magic = MAGIC;
+	header.version = VERSION;
+	header.sourceSize = stamp.size;
+	header.sourceTime = stamp.mtime;
+	header.sourceHash = stamp.hash;
+	header.vertexFormat = static_cast<uint32_t>(mesh._format);
+	header.vertexStride = stride;
+	header.attributeCount = static_cast<uint32_t>(layout.size());
+	header.vertexCount = static_cast<uint32_t>(vertexCount);
+	header.indexCount = static_cast<uint32_t>(indexCount);
+	header.indexType = static_cast<uint32_t>(indexType);
+	for (int i = 0; i < 3; i++) {
+		header.boundsMin[i] = mesh._boundsMin[i];
+		header.boundsMax[i] = mesh._boundsMax[i];
+	}
+	header.vertexOffset = align_up(sizeof(Header) + layout.size() * sizeof(Attribute), DATA_ALIGNMENT);
+	header.indexOffset = align_up(header.vertexOffset + vertexCount * stride, DATA_ALIGNMENT);
+	//a mesh without LODs still stores its full range, so load can require one
+	std::vector<vklod::LodRange> lods = mesh._lods;
+	if (lods.empty()) {
+		lods.push_back({ 0, static_cast<uint32_t>(indexCount), 0.0f });
+	}
+	header.lodCount = static_cast<uint32_t>(lods.size());
+	header.lodIndexCount = static_cast<uint32_t>(lodIndexCount);
+	header.lodOffset = align_up(header.indexOffset + (indexCount + lodIndexCount) * indexSize, DATA_ALIGNMENT);
+	header.fileSize = header.lodOffset + lods.size() * sizeof(vklod::LodRange);
+
+	std::vector<char> blob(header.fileSize, 0);
+	memcpy(blob.data(), &header, sizeof(header));
+	if (!layout.empty()) {
+		memcpy(blob.data() + sizeof(header), layout.data(), layout.size() * sizeof(Attribute));
+	}
+	if (vertexCount > 0) {
+		memcpy(blob.data() + header.vertexOffset, mesh.vertex_data(), vertexCount * stride);
+	}
+	if (indexCount > 0) {
+		memcpy(blob.data() + header.indexOffset, indexData, indexCount * indexSize);
+	}
+	if (lodIndexCount > 0) {
+		memcpy(blob.data() + header.indexOffset + indexCount * indexSize, lodIndexData, lodIndexCount * indexSize);
+	}
+	memcpy(blob.data() + header.lodOffset, lods.data(), lods.size() * sizeof(vklod::LodRange));
+
+	return write_atomic(path, blob);
+}
+
+bool vkcook::load(const char* path, const char* source, Mesh& mesh, VertexFormat format)
+{
+	auto file = std::make_shared<MappedFile>();
+	if (!file->open(path) || file->size() < sizeof(Header)) {
+		return false;
+	}
+
+	Header header;
+	memcpy(&header, file->data(), sizeof(header));
+	if (header.magic != MAGIC || header.version != VERSION || header.fileSize != file->size()) {
+		return false;
+	}
+
+	if (header.vertexFormat != static_cast<uint32_t>(format)) {
+		return false;
+	}
+	uint32_t stride;
+	std::vector<Attribute> layout = current_layout(format, stride);
+	if (header.vertexStride != stride || header.attributeCount != layout.size() ||
+		sizeof(Header) + layout.size() * sizeof(Attribute) > file->size() ||
+		memcmp(file->data() + sizeof(Header), layout.data(), layout.size() * sizeof(Attribute)) != 0) {
+		return false;
+	}
+
+	//the indices and LOD ranges go to the GPU as they are, anything they could read out of range rejects the file
+	if (header.indexType != VK_INDEX_TYPE_UINT16 && header.indexType != VK_INDEX_TYPE_UINT32) {
+		return false;
+	}
+	size_t indexSize = header.indexType == VK_INDEX_TYPE_UINT16 ? sizeof(uint16_t) : sizeof(uint32_t);
+	if (header.lodCount < 1 || header.vertexOffset % DATA_ALIGNMENT != 0 || header.indexOffset % DATA_ALIGNMENT != 0 ||
+		header.vertexOffset + uint64_t(header.vertexCount) * stride > header.indexOffset ||
+		header.indexOffset + (uint64_t(header.indexCount) + header.lodIndexCount) * indexSize > header.lodOffset ||
+		header.lodOffset % DATA_ALIGNMENT != 0 || header.lodOffset + uint64_t(header.lodCount) * sizeof(vklod::LodRange) > header.fileSize) {
+		return false;
+	}
+	std::vector<vklod::LodRange> lods(header.lodCount);
+	memcpy(lods.data(), file->data() + header.lodOffset, header.lodCount * sizeof(vklod::LodRange));
+	const uint64_t totalIndexCount = uint64_t(header.indexCount) + header.lodIndexCount;
+	for (const vklod::LodRange& range : lods) {
+		if (uint64_t(range.firstIndex) + range.indexCount > totalIndexCount) {
+			return false;
+		}
+	}
+
+	//a source without a stamp (cache shipped alone) is accepted as is
+	SourceStamp stamp;
+	if (source != nullptr && stamp_source(source, stamp) &&
+		(stamp.size != header.sourceSize || stamp.mtime != header.sourceTime)) {
+		//the file was touched, only the content decides
+		if (!hash_file(source, stamp.hash) || stamp.hash != header.sourceHash) {
+			return false;
+		}
+		header.sourceSize = stamp.size;
+		header.sourceTime = stamp.mtime;
+		file->close();
+		if (!rewrite_header(path, header) || !file->open(path)) {
+			return false;
+		}
+	}
+
+	mesh._vertices.clear();
+	mesh._compactVertices.clear();
+	mesh._indices.clear();
+	mesh._format = format;
+	mesh._optimized = true;
+	mesh._cookedFile = file;
+	mesh._cookedVertices = file->data() + header.vertexOffset;
+	mesh._cookedIndices = file->data() + header.indexOffset;
+	mesh._cookedVertexCount = header.vertexCount;
+	mesh._cookedIndexCount = header.indexCount;
+	mesh._cookedLodIndices = file->data() + header.indexOffset + header.indexCount * indexSize;
+	mesh._cookedLodIndexCount = header.lodIndexCount;
+	//a lone full range is a mesh without LODs, as build_lods leaves it
+	if (lods.size() < 2) {
+		lods.clear();
+	}
+	mesh._lods = std::move(lods);
+	mesh._lodIndices.clear();
+	mesh._indexType = static_cast<VkIndexType>(header.indexType);
+	mesh._boundsMin = glm::vec3(header.boundsMin[0], header.boundsMin[1], header.boundsMin[2]);
+	mesh._boundsMax = glm::vec3(header.boundsMax[0], header.boundsMax[1], header.boundsMax[2]);
+	return true;
+}
+
+bool vkcook::write_geometry(const char* path, uint64_t inputHash, const void* vertices, size_t vertexStride, size_t vertexCount, const uint32_t* indices, size_t indexCount)
+{
+	GeometryHeader header = {};
+	header.magic = GEOMETRY_MAGIC;
+	header.version = GEOMETRY_VERSION;
+	header.inputHash = inputHash;
+	header.vertexStride = static_cast<uint32_t>(vertexStride);
+	header.vertexCount = static_cast<uint32_t>(vertexCount);
+	header.indexCount = static_cast<uint32_t>(indexCount);
+
+	size_t vertexBytes = vertexStride * vertexCount;
+	std::vector<char> blob(sizeof(header) + vertexBytes + indexCount * sizeof(uint32_t));
+	memcpy(blob.data(), &header, sizeof(header));
+	if (vertexBytes > 0) {
+		memcpy(blob.data() + sizeof(header), vertices, vertexBytes);
+	}
+	if (indexCount > 0) {
+		memcpy(blob.data() + sizeof(header) + vertexBytes, indices, indexCount * sizeof(uint32_t));
+	}
+	return write_atomic(path, blob);
+}
+
+bool vkcook::load_geometry(const char* path, uint64_t inputHash, void* vertices, size_t vertexStride, size_t vertexCount, uint32_t* indices, size_t indexCount)
+{
+	MappedFile file;
+	if (!file.open(path) || file.size() < sizeof(GeometryHeader)) {
+		return false;
+	}
+	GeometryHeader header;
+	memcpy(&header, file.data(), sizeof(header));
+	size_t vertexBytes = vertexStride * vertexCount;
+	if (header.magic != GEOMETRY_MAGIC || header.version != GEOMETRY_VERSION || header.inputHash != inputHash ||
+		header.vertexStride != vertexStride || header.vertexCount != vertexCount || header.indexCount != indexCount ||
+		file.size() != sizeof(header) + vertexBytes + indexCount * sizeof(uint32_t)) {
+		return false;
+	}
+	if (vertexBytes > 0) {
+		memcpy(vertices, file.data() + sizeof(header), vertexBytes);
+	}
+	if (indexCount > 0) {
+		memcpy(indices, file.data() + sizeof(header) + vertexBytes, indexCount * sizeof(uint32_t));
+	}
+	return true;
+}
+
+bool vkcook::write_lods(const char* path, uint64_t inputHash, const std::vector<uint32_t>& indices, const std::vector<vklod::LodRange>& ranges,
+	const std::vector<uint32_t>& rangeCounts)
+{
+	LodHeader header = {};
+	header.magic = LOD_MAGIC;
+	header.version = LOD_VERSION;
+	header.inputHash = inputHash;
+	header.indexCount = static_cast<uint32_t>(indices.size());
+	header.rangeCount = static_cast<uint32_t>(ranges.size());
+	header.primitiveCount = static_cast<uint32_t>(rangeCounts.size());
+
+	size_t indexBytes = indices.size() * sizeof(uint32_t);
+	size_t rangeBytes = ranges.size() * sizeof(vklod::LodRange);
+	std::vector<char> blob(sizeof(header) + indexBytes + rangeBytes + rangeCounts.size() * sizeof(uint32_t));
+	memcpy(blob.data(), &header, sizeof(header));
+	if (indexBytes > 0) {
+		memcpy(blob.data() + sizeof(header), indices.data(), indexBytes);
+	}
+	if (rangeBytes > 0) {
+		memcpy(blob.data() + sizeof(header) + indexBytes, ranges.data(), rangeBytes);
+	}
+	if (!rangeCounts.empty()) {
+		memcpy(blob.data() + sizeof(header) + indexBytes + rangeBytes, rangeCounts.data(), rangeCounts.size() * sizeof(uint32_t));
+	}
+	return write_atomic(path, blob);
+}
+
+bool vkcook::load_lods(const char* path, uint64_t inputHash, std::vector<uint32_t>& outIndices, std::vector<vklod::LodRange>& outRanges,
+	std::vector<uint32_t>& outRangeCounts)
+{
+	MappedFile file;
+	if (!file.open(path) || file.size() < sizeof(LodHeader)) {
+		return false;
+	}
+	LodHeader header;
+	memcpy(&header, file.data(), sizeof(header));
+	size_t indexBytes = size_t(header.indexCount) * sizeof(uint32_t);
+	size_t rangeBytes = size_t(header.rangeCount) * sizeof(vklod::LodRange);
+	if (header.magic != LOD_MAGIC || header.version != LOD_VERSION || header.inputHash != inputHash ||
+		file.size() != sizeof(header) + indexBytes + rangeBytes + size_t(header.primitiveCount) * sizeof(uint32_t)) {
+		return false;
+	}
+	const char* data = file.data() + sizeof(header);
+	outIndices.resize(header.indexCount);
+	outRanges.resize(header.rangeCount);
+	outRangeCounts.resize(header.primitiveCount);
+	if (indexBytes > 0) {
+		memcpy(outIndices.data(), data, indexBytes);
+	}
+	if (rangeBytes > 0) {
+		memcpy(outRanges.data(), data + indexBytes, rangeBytes);
+	}
+	if (header.primitiveCount > 0) {
+		memcpy(outRangeCounts.data(), data + indexBytes + rangeBytes, header.primitiveCount * sizeof(uint32_t));
+	}
+	return true;
+}
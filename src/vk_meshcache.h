@@ -0,0 +1,143 @@
+#pragma once
+
+#include <vk_types.h>
+#include <vk_vertexformat.h>
+#include <vk_lod.h>
+#include <string>
+#include <memory>
+#include <vector>
+
+struct Mesh;
+class ThreadPool;
+
+//read only memory mapping of a whole file
+class MappedFile {
+public:
+	MappedFile() = default;
+	~MappedFile() { close(); }
+	MappedFile(const MappedFile&) = delete;
+	MappedFile& operator=(const MappedFile&) = delete;
+
+	bool open(const char* path);
+	void close();
+
+	const char* data() const { return _data; }
+	size_t size() const { return _size; }
+
+private:
+	const char* _data{ nullptr };
+	size_t _size{ 0 };
+#ifdef _WIN32
+	void* _file{ nullptr };
+	void* _mapping{ nullptr };
+#endif
+};
+
+//identifies the source a cooked mesh was built from
+struct SourceStamp {
+	uint64_t size{ 0 };
+	int64_t mtime{ 0 };
+	//0 until computed, hashing needs a full read of the source
+	uint64_t hash{ 0 };
+};
+
+//cooked meshes are a versioned binary dump of the final vertex/index arrays written next to the source as <source>.cooked:
+//header, vertex layout, vertex data, index data already narrowed to the GPU index type followed by the coarser LOD
+//indices, the LOD table and the bounds.
+//they are mapped on load and the vertex/index pointers go straight to the staging upload.
+namespace vkcook {
+
+	const uint32_t MAGIC = 0x434d4b56; //"VKMC"
+	//3: cooked meshes are stored vertex cache/fetch optimized
+	//4: LOD chain
+	//5: the LOD table always holds at least the full detail range
+	const uint32_t VERSION = 5;
+
+	struct Header {
+		uint32_t magic;
+		uint32_t version;
+		uint64_t sourceSize;
+		int64_t sourceTime;
+		uint64_t sourceHash;
+		//vertex layout, checked against Mesh::vertex_description
+		uint32_t vertexFormat;
+		uint32_t vertexStride;
+		uint32_t attributeCount;
+		uint32_t vertexCount;
+		uint32_t indexCount;
+		uint32_t indexType;
+		float boundsMin[3];
+		float boundsMax[3];
+		uint64_t vertexOffset;
+		uint64_t indexOffset;
+		//vklod::LodRange entries, 1 (the full detail range) without LODs
+		uint32_t lodCount;
+		//coarser LOD indices after the indexCount full detail ones
+		uint32_t lodIndexCount;
+		uint64_t lodOffset;
+		uint64_t fileSize;
+	};
+
+	struct Attribute {
+		uint32_t location;
+		uint32_t format;
+		uint32_t offset;
+	};
+
+	//optimized geometry of formats that are not cooked as a whole (glTF): the final vertex and index arrays,
+	//keyed by a hash of the arrays before optimization
+	const uint32_t GEOMETRY_MAGIC = 0x4f474b56; //"VKGO"
+	const uint32_t GEOMETRY_VERSION = 1;
+
+	struct GeometryHeader {
+		uint32_t magic;
+		uint32_t version;
+		uint64_t inputHash;
+		uint32_t vertexStride;
+		uint32_t vertexCount;
+		uint32_t indexCount;
+		uint32_t padding;
+	};
+
+	//LOD chains of formats that are not cooked as a whole (glTF), keyed by a hash of the optimized geometry: the coarser
+	//indices, the ranges of every primitive in order and how many ranges each primitive has
+	const uint32_t LOD_MAGIC = 0x444c4b56; //"VKLD"
+	const uint32_t LOD_VERSION = 1;
+
+	struct LodHeader {
+		uint32_t magic;
+		uint32_t version;
+		uint64_t inputHash;
+		uint32_t indexCount;
+		uint32_t rangeCount;
+		uint32_t primitiveCount;
+		uint32_t padding;
+	};
+
+	std::string cooked_path(const char* source);
+
+	//size and mtime only, cheap
+	bool stamp_source(const char* source, SourceStamp& outStamp);
+	uint64_t hash_bytes(const void* data, size_t size);
+	bool hash_file(const char* path, uint64_t& outHash);
+
+	//writes to a temporary and renames it, so a crash never leaves a half written cache behind
+	bool write_atomic(const char* path, const std::vector<char>& blob);
+
+	bool write(const char* path, const Mesh& mesh, const SourceStamp& stamp);
+
+	//maps a cooked file and points mesh at its data. a size/mtime mismatch falls back to comparing the source hash,
+	//a cache cooked for another vertex format is rejected
+	bool load(const char* path, const char* source, Mesh& mesh, VertexFormat format);
+
+	bool write_geometry(const char* path, uint64_t inputHash, const void* vertices, size_t vertexStride, size_t vertexCount, const uint32_t* indices, size_t indexCount);
+
+	//copies the cached arrays over the caller's when hash, stride and counts match
+	bool load_geometry(const char* path, uint64_t inputHash, void* vertices, size_t vertexStride, size_t vertexCount, uint32_t* indices, size_t indexCount);
+
+	bool write_lods(const char* path, uint64_t inputHash, const std::vector<uint32_t>& indices, const std::vector<vklod::LodRange>& ranges,
+		const std::vector<uint32_t>& rangeCounts);
+
+	bool load_lods(const char* path, uint64_t inputHash, std::vector<uint32_t>& outIndices, std::vector<vklod::LodRange>& outRanges,
+		std::vector<uint32_t>& outRangeCounts);
+}
@@ -0,0 +1,173 @@
+#include <vk_meshlet.h>
+#include <algorithm>
+#include <cmath>
+
+namespace {
+
+	const glm::vec3& position_at(const void* positions, size_t positionStride, uint32_t index)
+	{
+		return *reinterpret_cast<const glm::vec3*>(static_cast<const uint8_t*>(positions) + size_t(index) * positionStride);
+	}
+
+	//sphere around the bounds center, not the tightest but cheap and stable
+	void compute_bounds(const vkmeshlet::MeshletSet& set, const vkmeshlet::Meshlet& meshlet, const void* positions, size_t positionStride,
+		vkmeshlet::MeshletBounds& out)
+	{
+		glm::vec3 boundsMin(INFINITY), boundsMax(-INFINITY);
+		for (uint32_t i = 0; i < meshlet.vertexCount; i++) {
+			const glm::vec3& p = position_at(positions, positionStride, set.vertices[meshlet.vertexOffset + i]);
+			boundsMin = glm::min(boundsMin, p);
+			boundsMax = glm::max(boundsMax, p);
+		}
+		out.center = (boundsMin + boundsMax) * 0.5f;
+		out.radius = 0.0f;
+		for (uint32_t i = 0; i < meshlet.vertexCount; i++) {
+			const glm::vec3& p = position_at(positions, positionStride, set.vertices[meshlet.vertexOffset + i]);
+			out.radius = std::max(out.radius, glm::length(p - out.center));
+		}
+
+		//cone around the average normal, degenerate triangles do not constrain it
+		std::vector<glm::vec3> normals;
+		std::vector<glm::vec3> corners;
+		normals.reserve(meshlet.triangleCount);
+		corners.reserve(meshlet.triangleCount);
+		glm::vec3 axis(0.0f);
+		for (uint32_t t = 0; t < meshlet.triangleCount; t++) {
+			const uint8_t* local = &set.triangles[(meshlet.triangleOffset + t) * 3];
+			const glm::vec3& a = position_at(positions, positionStride, set.vertices[meshlet.vertexOffset + local[0]]);
+			const glm::vec3& b = position_at(positions, positionStride, set.vertices[meshlet.vertexOffset + local[1]]);
+			const glm::vec3& c = position_at(positions, positionStride, set.vertices[meshlet.vertexOffset + local[2]]);
+			glm::vec3 normal = glm::cross(b - a, c - a);
+			float length = glm::length(normal);
+			if (length <= 0.0f) {
+				continue;
+			}
+			normal /= length;
+			normals.push_back(normal);
+			corners.push_back(a);
+			axis += normal;
+		}
+
+		out.coneAxis = glm::vec3(0.0f, 0.0f, 1.0f);
+		out.coneApex = out.center;
+		out.coneCutoff = vkmeshlet::NO_CONE;
+		out.pad = 0.0f;
+		float axisLength = glm::length(axis);
+		if (normals.empty() || axisLength < 1e-6f) {
+			return;
+		}
+		axis /= axisLength;
+		float minDot = 1.0f;
+		for (const glm::vec3& normal : normals) {
+			minDot = std::min(minDot, glm::dot(axis, normal));
+		}
+		//a spread of 90 degrees or more leaves no view direction that sees only back faces
+		if (minDot <= 0.01f) {
+			return;
+		}
+
+		//apex: the point on the axis behind every triangle plane, so the test holds for the whole triangle not just its normal
+		float maxT = 0.0f;
+		for (size_t i = 0; i < normals.size(); i++) {
+			float t = glm::dot(out.center - corners[i], normals[i]) / glm::dot(axis, normals[i]);
+			maxT = std::max(maxT, t);
+		}
+		out.coneAxis = axis;
+		out.coneApex = out.center - axis * maxT;
+		out.coneCutoff = std::sqrt(1.0f - minDot * minDot);
+	}
+}
+
+void vkmeshlet::build_meshlets(const uint32_t* indices, size_t indexCount, const void* positions, size_t positionStride, size_t vertexCount,
+	MeshletSet& out, uint32_t maxVertices, uint32_t maxTriangles)
+{
+	out = MeshletSet();
+	maxVertices = std::min(maxVertices, 256u);
+
+	//slot of a vertex in the current meshlet, valid while its stamp is the current meshlet's
+	std::vector<uint8_t> slots(vertexCount, 0);
+	std::vector<uint32_t> stamps(vertexCount, UINT32_MAX);
+	Meshlet current = { 0, 0, 0, 0 };
+	uint32_t meshletIndex = 0;
+
+	auto flush = [&]() {
+		if (current.triangleCount == 0) {
+			return;
+		}
+		out.meshlets.push_back(current);
+		current = { static_cast<uint32_t>(out.vertices.size()), static_cast<uint32_t>(out.triangles.size() / 3), 0, 0 };
+		meshletIndex++;
+	};
+
+	for (size_t i = 0; i + 2 < indexCount; i += 3) {
+		const uint32_t* triangle = indices + i;
+		uint32_t newVertices = 0;
+		for (int corner = 0; corner < 3; corner++) {
+			uint32_t v = triangle[corner];
+			bool repeated = (corner > 0 && triangle[0] == v) || (corner > 1 && triangle[1] == v);
+			newVertices += stamps[v] != meshletIndex && !repeated ? 1 : 0;
+		}
+		if (current.vertexCount + newVertices > maxVertices || current.triangleCount + 1 > maxTriangles) {
+			flush();
+		}
+		for (int corner = 0; corner < 3; corner++) {
+			uint32_t v = triangle[corner];
+			if (stamps[v] != meshletIndex) {
+				stamps[v] = meshletIndex;
+				slots[v] = static_cast<uint8_t>(current.vertexCount++);
+				out.vertices.push_back(v);
+			}
+			out.triangles.push_back(slots[v]);
+		}
+		current.triangleCount++;
+	}
+	flush();
+
+	out.bounds.resize(out.meshlets.size());
+	for (size_t m = 0; m < out.meshlets.size(); m++) {
+		compute_bounds(out, out.meshlets[m], positions, positionStride, out.bounds[m]);
+	}
+}
+
+vkmeshlet::CullView vkmeshlet::make_cull_view(const vkcull::Frustum& frustum, const glm::mat4& transform, const glm::vec3& eye, bool coneCulling)
+{
+	CullView view;
+	view.frustum = frustum;
+	view.transform = transform;
+	float scaleX = glm::length(glm::vec3(transform[0]));
+	float scaleY = glm::length(glm::vec3(transform[1]));
+	float scaleZ = glm::length(glm::vec3(transform[2]));
+	view.maxScale = std::max(scaleX, std::max(scaleY, scaleZ));
+	float minScale = std::min(scaleX, std::min(scaleY, scaleZ));
+	view.eye = glm::vec3(glm::inverse(transform) * glm::vec4(eye, 1.0f));
+	//mirrored transforms flip which side of a triangle faces the camera
+	view.coneCulling = coneCulling && minScale > view.maxScale * 0.999f && glm::determinant(glm::mat3(transform)) > 0.0f;
+	return view;
+}
+
+bool vkmeshlet::meshlet_visible(const CullView& view, const MeshletBounds& bounds)
+{
+	if (view.coneCulling && glm::dot(glm::normalize(bounds.coneApex - view.eye), bounds.coneAxis) >= bounds.coneCutoff) {
+		return false;
+	}
+	glm::vec3 center = glm::vec3(view.transform * glm::vec4(bounds.center, 1.0f));
+	return vkcull::sphere_visible(view.frustum, center, bounds.radius * view.maxScale);
+}
+
+size_t vkmeshlet::cull_meshlets(const MeshletSet& set, const CullView& view, std::vector<uint32_t>& outIndices)
+{
+	size_t kept = 0;
+	for (size_t m = 0; m < set.meshlets.size(); m++) {
+		if (!meshlet_visible(view, set.bounds[m])) {
+			continue;
+		}
+		const Meshlet& meshlet = set.meshlets[m];
+		const uint8_t* local = &set.triangles[size_t(meshlet.triangleOffset) * 3];
+		const uint32_t* vertices = &set.vertices[meshlet.vertexOffset];
+		for (uint32_t i = 0; i < meshlet.triangleCount * 3; i++) {
+			outIndices.push_back(vertices[local[i]]);
+		}
+		kept++;
+	}
+	return kept;
+}
@@ -0,0 +1,74 @@
+#pragma once
+
+#include <vk_culling.h>
+#include <glm/glm.hpp>
+#include <vector>
+#include <cstdint>
+
+//splits indexed triangle lists into small clusters that are culled on their own. every cluster keeps a bounding sphere
+//for frustum tests and a normal cone: when the camera lies inside the cone's back side, every triangle of the cluster
+//faces away and the whole cluster can be skipped
+namespace vkmeshlet {
+
+	const uint32_t MAX_VERTICES = 64;
+	const uint32_t MAX_TRIANGLES = 124;
+	//coneCutoff of clusters whose normals spread too far for a cone test
+	const float NO_CONE = 2.0f;
+
+	struct Meshlet {
+		//first entry in MeshletSet::vertices
+		uint32_t vertexOffset;
+		//first triangle in MeshletSet::triangles, 3 local indices each
+		uint32_t triangleOffset;
+		uint32_t vertexCount;
+		uint32_t triangleCount;
+	};
+
+	//std430 friendly, object space
+	struct MeshletBounds {
+		glm::vec3 center;
+		float radius;
+		glm::vec3 coneApex;
+		//sin of the normal spread, the cluster is backfacing when dot(normalize(coneApex - eye), coneAxis) >= coneCutoff
+		float coneCutoff;
+		glm::vec3 coneAxis;
+		float pad;
+	};
+
+	struct MeshletSet {
+		std::vector<Meshlet> meshlets;
+		std::vector<MeshletBounds> bounds;
+		//mesh vertex indices referenced by the meshlets
+		std::vector<uint32_t> vertices;
+		//meshlet local vertex indices, 3 per triangle
+		std::vector<uint8_t> triangles;
+
+		bool empty() const { return meshlets.empty(); }
+		size_t triangleCount() const { return triangles.size() / 3; }
+	};
+
+	//greedy in index order, so a cache optimized index buffer gives compact clusters. positions are 3 floats every
+	//positionStride bytes
+	void build_meshlets(const uint32_t* indices, size_t indexCount, const void* positions, size_t positionStride, size_t vertexCount,
+		MeshletSet& out, uint32_t maxVertices = MAX_VERTICES, uint32_t maxTriangles = MAX_TRIANGLES);
+
+	//per object values the cluster tests need
+	struct CullView {
+		vkcull::Frustum frustum;
+		glm::mat4 transform;
+		//largest axis scale of transform, grows the spheres
+		float maxScale;
+		//camera in object space
+		glm::vec3 eye;
+		//off for non-uniformly scaled objects, the cone angles do not survive the transform
+		bool coneCulling;
+	};
+
+	CullView make_cull_view(const vkcull::Frustum& frustum, const glm::mat4& transform, const glm::vec3& eye, bool coneCulling = true);
+
+	bool meshlet_visible(const CullView& view, const MeshletBounds& bounds);
+
+	//CPU reference of shaders/meshlet_cull.comp: appends the mesh indices of the visible clusters to outIndices,
+	//returns the number of clusters kept
+	size_t cull_meshlets(const MeshletSet& set, const CullView& view, std::vector<uint32_t>& outIndices);
+}
@@ -0,0 +1,541 @@
+#include <vk_meshopt.h>
+#include <glm/glm.hpp>
+#include <algorithm>
+#include <cstring>
+#include <cmath>
+
+vkmeshopt::CacheStats vkmeshopt::analyze_vertex_cache(const uint32_t* indices, size_t indexCount, size_t vertexCount, uint32_t cacheSize)
+{
+	CacheStats stats;
+	if (indexCount < 3) {
+		return stats;
+	}
+
+	//a vertex is in the FIFO while fewer than cacheSize misses happened since it was loaded
+	std::vector<uint64_t> loadedAt(vertexCount, 0);
+	std::vector<bool> used(vertexCount, false);
+	uint64_t misses = 0;
+	size_t unique = 0;
+	for (size_t i = 0; i < indexCount; i++) {
+		uint32_t v = indices[i];
+		if (!used[v]) {
+			used[v] = true;
+			unique++;
+		}
+		if (loadedAt[v] == 0 || misses - loadedAt[v] >= cacheSize) {
+			misses++;
+			loadedAt[v] = misses;
+		}
+	}
+
+	stats.acmr = float(misses) / float(indexCount / 3);
+	stats.atvr = unique > 0 ? float(misses) / float(unique) : 0.0f;
+	return stats;
+}
+
+namespace {
+
+	const uint32_t CACHE_SIZE = 32;
+
+	//score tables from Forsyth's "Linear-Speed Vertex Cache Optimisation"
+	struct ScoreTables {
+		float cache[CACHE_SIZE];
+		float valence[32];
+
+		ScoreTables()
+		{
+			const float lastTriScore = 0.75f;
+			const float decayPower = 1.5f;
+			for (uint32_t i = 0; i < CACHE_SIZE; i++) {
+				if (i < 3) {
+					//the last triangle's vertices get a fixed score so the next triangle does not just reuse them
+					cache[i] = lastTriScore;
+				}
+				else {
+					float scaler = 1.0f - float(i - 3) / float(CACHE_SIZE - 3);
+					cache[i] = std::pow(scaler, decayPower);
+				}
+			}
+			for (uint32_t i = 0; i < 32; i++) {
+				//vertices with few triangles left are finished first so they do not get stranded
+				valence[i] = i == 0 ? 0.0f : 2.0f * std::pow(float(i), -0.5f);
+			}
+		}
+	};
+
+	const ScoreTables& score_tables()
+	{
+		static ScoreTables tables;
+		return tables;
+	}
+
+	inline float vertex_score(int cachePosition, uint32_t remaining)
+	{
+		if (remaining == 0) {
+			return -1.0f;
+		}
+		const ScoreTables& tables = score_tables();
+		float score = cachePosition >= 0 ? tables.cache[cachePosition] : 0.0f;
+		return score + (remaining < 32 ? tables.valence[remaining] : 2.0f * std::pow(float(remaining), -0.5f));
+	}
+}
+
+void vkmeshopt::optimize_vertex_cache(uint32_t* indices, size_t indexCount, size_t vertexCount)
+{
+	const size_t triangleCount = indexCount / 3;
+	if (triangleCount < 2) {
+		return;
+	}
+
+	//vertex -> triangles adjacency in one flat array
+	std::vector<uint32_t> triangleOffsets(vertexCount + 1, 0);
+	for (size_t i = 0; i < triangleCount * 3; i++) {
+		triangleOffsets[indices[i] + 1]++;
+	}
+	for (size_t v = 0; v < vertexCount; v++) {
+		triangleOffsets[v + 1] += triangleOffsets[v];
+	}
+	std::vector<uint32_t> remaining(vertexCount);
+	for (size_t v = 0; v < vertexCount; v++) {
+		remaining[v] = triangleOffsets[v + 1] - triangleOffsets[v];
+	}
+	std::vector<uint32_t> adjacency(triangleCount * 3);
+	{
+		std::vector<uint32_t> fill(triangleOffsets.begin(), triangleOffsets.end() - 1);
+		for (size_t t = 0; t < triangleCount; t++) {
+			for (int k = 0; k < 3; k++) {
+				adjacency[fill[indices[t * 3 + k]]++] = static_cast<uint32_t>(t);
+			}
+		}
+	}
+
+	std::vector<float> vertexScores(vertexCount);
+	for (size_t v = 0; v < vertexCount; v++) {
+		vertexScores[v] = vertex_score(-1, remaining[v]);
+	}
+	std::vector<float> triangleScores(triangleCount);
+	for (size_t t = 0; t < triangleCount; t++) {
+		triangleScores[t] = vertexScores[indices[t * 3]] + vertexScores[indices[t * 3 + 1]] + vertexScores[indices[t * 3 + 2]];
+	}
+
+	std::vector<bool> emitted(triangleCount, false);
+	std::vector<uint32_t> output;
+	output.reserve(triangleCount * 3);
+
+	//LRU cache, 3 extra slots hold the vertices pushed out by the triangle just added
+	uint32_t cache[CACHE_SIZE + 3];
+	uint32_t cacheCount = 0;
+
+	size_t scanCursor = 0;
+	int64_t bestTriangle = -1;
+
+	for (size_t emittedCount = 0; emittedCount < triangleCount; emittedCount++) {
+		if (bestTriangle < 0) {
+			//nothing left around the cache, continue with the next unemitted triangle in input order.
+			//a global best-score search here would be quadratic on meshes made of many small islands
+			while (emitted[scanCursor]) {
+				scanCursor++;
+			}
+			bestTriangle = static_cast<int64_t>(scanCursor);
+		}
+
+		uint32_t tri = static_cast<uint32_t>(bestTriangle);
+		emitted[tri] = true;
+		uint32_t triVertices[3] = { indices[tri * 3], indices[tri * 3 + 1], indices[tri * 3 + 2] };
+		output.insert(output.end(), triVertices, triVertices + 3);
+
+		//the triangle's vertices move to the front of the LRU
+		uint32_t newCache[CACHE_SIZE + 3];
+		uint32_t newCount = 0;
+		for (int k = 0; k < 3; k++) {
+			uint32_t v = triVertices[k];
+			bool duplicate = false;
+			for (uint32_t j = 0; j < newCount; j++) {
+				duplicate |= newCache[j] == v;
+			}
+			if (!duplicate) {
+				newCache[newCount++] = v;
+			}
+
+			//drop the emitted triangle from the vertex's remaining list
+			uint32_t begin = triangleOffsets[v];
+			uint32_t end = begin + remaining[v];
+			for (uint32_t j = begin; j < end; j++) {
+				if (adjacency[j] == tri) {
+					adjacency[j] = adjacency[end - 1];
+					remaining[v]--;
+					break;
+				}
+			}
+		}
+		for (uint32_t j = 0; j < cacheCount; j++) {
+			uint32_t v = cache[j];
+			if (v != triVertices[0] && v != triVertices[1] && v != triVertices[2]) {
+				newCache[newCount++] = v;
+			}
+		}
+
+		//rescore everything that was or is in the cache and the triangles that use it
+		for (uint32_t j = 0; j < newCount; j++) {
+			uint32_t v = newCache[j];
+			int position = j < CACHE_SIZE ? static_cast<int>(j) : -1;
+			float score = vertex_score(position, remaining[v]);
+			float delta = score - vertexScores[v];
+			vertexScores[v] = score;
+			for (uint32_t a = triangleOffsets[v]; a < triangleOffsets[v] + remaining[v]; a++) {
+				triangleScores[adjacency[a]] += delta;
+			}
+		}
+
+		cacheCount = std::min(newCount, CACHE_SIZE);
+		memcpy(cache, newCache, cacheCount * sizeof(uint32_t));
+
+		//next triangle: the best one touching the cache
+		bestTriangle = -1;
+		float bestScore = -1e30f;
+		for (uint32_t j = 0; j < cacheCount; j++) {
+			uint32_t v = cache[j];
+			for (uint32_t a = triangleOffsets[v]; a < triangleOffsets[v] + remaining[v]; a++) {
+				uint32_t t = adjacency[a];
+				if (triangleScores[t] > bestScore) {
+					bestScore = triangleScores[t];
+					bestTriangle = t;
+				}
+			}
+		}
+	}
+
+	//a trailing partial triangle is kept as is
+	memcpy(indices, output.data(), output.size() * sizeof(uint32_t));
+}
+
+void vkmeshopt::optimize_overdraw(uint32_t* indices, size_t indexCount, const void* positions, size_t positionStride, size_t vertexCount)
+{
+	const size_t triangleCount = indexCount / 3;
+	if (triangleCount < 2) {
+		return;
+	}
+	auto position = [&](uint32_t v) {
+		glm::vec3 p;
+		memcpy(&p, static_cast<const char*>(positions) + v * positionStride, sizeof(p));
+		return p;
+	};
+
+	//clusters break where a triangle misses the cache on all three vertices, so reordering them keeps the locality inside
+	std::vector<size_t> clusterStarts;
+	{
+		const uint32_t cacheSize = 16;
+		std::vector<uint64_t> loadedAt(vertexCount, 0);
+		uint64_t misses = 0;
+		for (size_t t = 0; t < triangleCount; t++) {
+			int triMisses = 0;
+			for (int k = 0; k < 3; k++) {
+				uint32_t v = indices[t * 3 + k];
+				if (loadedAt[v] == 0 || misses - loadedAt[v] >= cacheSize) {
+					misses++;
+					loadedAt[v] = misses;
+					triMisses++;
+				}
+			}
+			if (t == 0 || triMisses == 3) {
+				clusterStarts.push_back(t);
+			}
+		}
+	}
+	clusterStarts.push_back(triangleCount);
+	const size_t clusterCount = clusterStarts.size() - 1;
+	if (clusterCount < 2) {
+		return;
+	}
+
+	//area weighted centroid and normal per cluster
+	std::vector<glm::vec3> clusterCentroid(clusterCount, glm::vec3(0.0f));
+	std::vector<glm::vec3> clusterNormal(clusterCount, glm::vec3(0.0f));
+	glm::vec3 meshCentroid(0.0f);
+	float meshArea = 0.0f;
+	for (size_t c = 0; c < clusterCount; c++) {
+		float area = 0.0f;
+		for (size_t t = clusterStarts[c]; t < clusterStarts[c + 1]; t++) {
+			glm::vec3 a = position(indices[t * 3]);
+			glm::vec3 b = position(indices[t * 3 + 1]);
+			glm::vec3 d = position(indices[t * 3 + 2]);
+			glm::vec3 n = glm::cross(b - a, d - a);
+			float triArea = glm::length(n);
+			clusterCentroid[c] += (a + b + d) * (triArea / 3.0f);
+			clusterNormal[c] += n;
+			area += triArea;
+		}
+		meshCentroid += clusterCentroid[c];
+		meshArea += area;
+		clusterCentroid[c] = area > 0.0f ? clusterCentroid[c] / area : position(indices[clusterStarts[c] * 3]);
+		float length = glm::length(clusterNormal[c]);
+		clusterNormal[c] = length > 0.0f ? clusterNormal[c] / length : glm::vec3(0.0f);
+	}
+	if (meshArea > 0.0f) {
+		meshCentroid /= meshArea;
+	}
+
+	//clusters far out along their own normal are likely occluders, draw them first
+	std::vector<float> sortKey(clusterCount);
+	std::vector<uint32_t> order(clusterCount);
+	for (size_t c = 0; c < clusterCount; c++) {
+		sortKey[c] = glm::dot(clusterCentroid[c] - meshCentroid, clusterNormal[c]);
+		order[c] = static_cast<uint32_t>(c);
+	}
+	std::stable_sort(order.begin(), order.end(), [&](uint32_t a, uint32_t b) { return sortKey[a] > sortKey[b]; });
+
+	std::vector<uint32_t> output;
+	output.reserve(triangleCount * 3);
+	for (uint32_t c : order) {
+		output.insert(output.end(), indices + clusterStarts[c] * 3, indices + clusterStarts[c + 1] * 3);
+	}
+	memcpy(indices, output.data(), output.size() * sizeof(uint32_t));
+}
+
+size_t vkmeshopt::optimize_vertex_fetch(void* vertices, size_t vertexStride, size_t vertexCount, uint32_t* indices, size_t indexCount)
+{
+	const uint32_t unused = UINT32_MAX;
+	std::vector<uint32_t> remap(vertexCount, unused);
+	uint32_t next = 0;
+	for (size_t i = 0; i < indexCount; i++) {
+		uint32_t& target = remap[indices[i]];
+		if (target == unused) {
+			target = next++;
+		}
+		indices[i] = target;
+	}
+
+	std::vector<char> reordered(size_t(next) * vertexStride);
+	const char* src = static_cast<const char*>(vertices);
+	for (size_t v = 0; v < vertexCount; v++) {
+		if (remap[v] != unused) {
+			memcpy(reordered.data() + size_t(remap[v]) * vertexStride, src + v * vertexStride, vertexStride);
+		}
+	}
+	memcpy(vertices, reordered.data(), reordered.size());
+	return next;
+}
+
+namespace {
+
+	//symmetric 4x4 plane quadric, area weighted
+	struct Quadric {
+		double a00, a11, a22, a01, a02, a12;
+		double b0, b1, b2;
+		double c;
+		double weight;
+
+		void add_plane(const glm::dvec3& n, double d, double w)
+		{
+			a00 += w * n.x * n.x; a11 += w * n.y * n.y; a22 += w * n.z * n.z;
+			a01 += w * n.x * n.y; a02 += w * n.x * n.z; a12 += w * n.y * n.z;
+			b0 += w * n.x * d; b1 += w * n.y * d; b2 += w * n.z * d;
+			c += w * d * d;
+			weight += w;
+		}
+
+		void add(const Quadric& q)
+		{
+			a00 += q.a00; a11 += q.a11; a22 += q.a22; a01 += q.a01; a02 += q.a02; a12 += q.a12;
+			b0 += q.b0; b1 += q.b1; b2 += q.b2;
+			c += q.c;
+			weight += q.weight;
+		}
+
+		//weighted sum of squared distances to the planes
+		double evaluate(const glm::dvec3& p) const
+		{
+			return a00 * p.x * p.x + a11 * p.y * p.y + a22 * p.z * p.z + 2.0 * (a01 * p.x * p.y + a02 * p.x * p.z + a12 * p.y * p.z)
+				+ 2.0 * (b0 * p.x + b1 * p.y + b2 * p.z) + c;
+		}
+	};
+
+	struct Collapse {
+		uint32_t from;
+		uint32_t to;
+		float error;
+	};
+}
+
+size_t vkmeshopt::simplify(const uint32_t* indices, size_t indexCount, const void* positions, size_t positionStride, size_t vertexCount,
+	size_t targetIndexCount, float maxError, uint32_t* outIndices, float& outError)
+{
+	outError = 0.0f;
+	indexCount -= indexCount % 3;
+	memcpy(outIndices, indices, indexCount * sizeof(uint32_t));
+	if (indexCount <= targetIndexCount || vertexCount == 0) {
+		return indexCount;
+	}
+	auto position = [&](uint32_t v) {
+		return glm::dvec3(*reinterpret_cast<const glm::vec3*>(static_cast<const uint8_t*>(positions) + size_t(v) * positionStride));
+	};
+
+	//vertices sharing a position are welded for the topology, and kept in place when there are several of them
+	std::vector<uint32_t> weld(vertexCount);
+	std::vector<uint8_t> locked(vertexCount, 0);
+	{
+		std::vector<uint32_t> order(vertexCount);
+		for (uint32_t v = 0; v < vertexCount; v++) {
+			order[v] = v;
+		}
+		auto key = [&](uint32_t v) {
+			return *reinterpret_cast<const glm::vec3*>(static_cast<const uint8_t*>(positions) + size_t(v) * positionStride);
+		};
+		std::sort(order.begin(), order.end(), [&](uint32_t a, uint32_t b) {
+			glm::vec3 pa = key(a), pb = key(b);
+			return pa.x != pb.x ? pa.x < pb.x : pa.y != pb.y ? pa.y < pb.y : pa.z != pb.z ? pa.z < pb.z : a < b;
+		});
+		for (size_t i = 0; i < vertexCount;) {
+			size_t end = i + 1;
+			while (end < vertexCount && key(order[end]) == key(order[i])) {
+				end++;
+			}
+			for (size_t j = i; j < end; j++) {
+				weld[order[j]] = order[i];
+				locked[order[j]] = end - i > 1 ? 1 : 0;
+			}
+			i = end;
+		}
+	}
+
+	//an edge used in one direction only lies on an open border
+	{
+		std::vector<uint64_t> edges;
+		edges.reserve(indexCount);
+		for (size_t i = 0; i < indexCount; i += 3) {
+			for (int e = 0; e < 3; e++) {
+				uint32_t a = weld[indices[i + e]], b = weld[indices[i + (e + 1) % 3]];
+				edges.push_back(uint64_t(a) << 32 | b);
+			}
+		}
+		std::vector<uint64_t> sorted = edges;
+		std::sort(sorted.begin(), sorted.end());
+		for (size_t i = 0; i < indexCount; i += 3) {
+			for (int e = 0; e < 3; e++) {
+				uint32_t a = weld[indices[i + e]], b = weld[indices[i + (e + 1) % 3]];
+				if (!std::binary_search(sorted.begin(), sorted.end(), uint64_t(b) << 32 | a)) {
+					locked[indices[i + e]] = 1;
+					locked[indices[i + (e + 1) % 3]] = 1;
+				}
+			}
+		}
+	}
+
+	std::vector<Quadric> quadrics(vertexCount, Quadric{});
+	for (size_t i = 0; i < indexCount; i += 3) {
+		glm::dvec3 p0 = position(indices[i]), p1 = position(indices[i + 1]), p2 = position(indices[i + 2]);
+		glm::dvec3 normal = glm::cross(p1 - p0, p2 - p0);
+		double area = glm::length(normal);
+		if (area <= 0.0) {
+			continue;
+		}
+		normal /= area;
+		for (int corner = 0; corner < 3; corner++) {
+			quadrics[indices[i + corner]].add_plane(normal, -glm::dot(normal, p0), area * 0.5);
+		}
+	}
+
+	//passes of independent collapses: a collapse touches its own triangles only, so the cost and flip tests of one pass
+	//stay valid while it runs
+	size_t count = indexCount;
+	std::vector<uint32_t> collapsed(vertexCount);
+	std::vector<uint8_t> touched(vertexCount);
+	std::vector<uint32_t> adjacencyOffsets(vertexCount + 1);
+	std::vector<uint32_t> adjacency;
+	std::vector<Collapse> collapses;
+	while (count > targetIndexCount) {
+		collapses.clear();
+		for (size_t i = 0; i < count; i += 3) {
+			for (int e = 0; e < 3; e++) {
+				uint32_t a = outIndices[i + e], b = outIndices[i + (e + 1) % 3];
+				Quadric q = quadrics[a];
+				q.add(quadrics[b]);
+				double norm = std::max(q.weight, 1e-12);
+				if (!locked[a]) {
+					collapses.push_back({ a, b, float(std::sqrt(std::max(q.evaluate(position(b)), 0.0) / norm)) });
+				}
+				if (!locked[b]) {
+					collapses.push_back({ b, a, float(std::sqrt(std::max(q.evaluate(position(a)), 0.0) / norm)) });
+				}
+			}
+		}
+		if (collapses.empty()) {
+			break;
+		}
+		std::sort(collapses.begin(), collapses.end(), [](const Collapse& a, const Collapse& b) { return a.error < b.error; });
+
+		std::fill(adjacencyOffsets.begin(), adjacencyOffsets.end(), 0);
+		for (size_t i = 0; i < count; i++) {
+			adjacencyOffsets[outIndices[i] + 1]++;
+		}
+		for (size_t v = 0; v < vertexCount; v++) {
+			adjacencyOffsets[v + 1] += adjacencyOffsets[v];
+		}
+		adjacency.resize(count);
+		{
+			std::vector<uint32_t> cursor(adjacencyOffsets.begin(), adjacencyOffsets.end() - 1);
+			for (size_t i = 0; i < count; i++) {
+				adjacency[cursor[outIndices[i]]++] = static_cast<uint32_t>(i / 3);
+			}
+		}
+
+		for (uint32_t v = 0; v < vertexCount; v++) {
+			collapsed[v] = v;
+		}
+		std::fill(touched.begin(), touched.end(), 0);
+		//a collapse removes about two triangles, one pass goes at most half way so the later collapses see fresh costs
+		size_t goal = std::max<size_t>((count - targetIndexCount) / 6 / 2, 1);
+		size_t done = 0;
+		for (const Collapse& collapse : collapses) {
+			if (collapse.error > maxError || done >= goal) {
+				break;
+			}
+			if (touched[collapse.from] || touched[collapse.to]) {
+				continue;
+			}
+			//no triangle that survives may flip or become a sliver
+			bool valid = true;
+			glm::dvec3 target = position(collapse.to);
+			for (uint32_t a = adjacencyOffsets[collapse.from]; a < adjacencyOffsets[collapse.from + 1] && valid; a++) {
+				const uint32_t* triangle = &outIndices[size_t(adjacency[a]) * 3];
+				if (triangle[0] == collapse.to || triangle[1] == collapse.to || triangle[2] == collapse.to) {
+					continue;
+				}
+				glm::dvec3 p[3], q[3];
+				for (int corner = 0; corner < 3; corner++) {
+					p[corner] = position(triangle[corner]);
+					q[corner] = triangle[corner] == collapse.from ? target : p[corner];
+				}
+				glm::dvec3 before = glm::cross(p[1] - p[0], p[2] - p[0]);
+				glm::dvec3 after = glm::cross(q[1] - q[0], q[2] - q[0]);
+				valid = glm::dot(before, after) > 0.25 * glm::length(before) * glm::length(after);
+			}
+			if (!valid) {
+				continue;
+			}
+			for (uint32_t a = adjacencyOffsets[collapse.from]; a < adjacencyOffsets[collapse.from + 1]; a++) {
+				const uint32_t* triangle = &outIndices[size_t(adjacency[a]) * 3];
+				touched[triangle[0]] = touched[triangle[1]] = touched[triangle[2]] = 1;
+			}
+			collapsed[collapse.from] = collapse.to;
+			quadrics[collapse.to].add(quadrics[collapse.from]);
+			outError = std::max(outError, collapse.error);
+			done++;
+		}
+		if (done == 0) {
+			break;
+		}
+
+		size_t write = 0;
+		for (size_t i = 0; i < count; i += 3) {
+			uint32_t a = collapsed[outIndices[i]], b = collapsed[outIndices[i + 1]], c = collapsed[outIndices[i + 2]];
+			if (a != b && b != c && a != c) {
+				outIndices[write++] = a;
+				outIndices[write++] = b;
+				outIndices[write++] = c;
+			}
+		}
+		count = write;
+	}
+	return count;
+}
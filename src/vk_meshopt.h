@@ -0,0 +1,36 @@
+#pragma once
+
+#include <vk_types.h>
+#include <vector>
+
+//index/vertex reordering for indexed triangle lists
+namespace vkmeshopt {
+
+	struct CacheStats {
+		//vertex transforms per triangle, 0.5 is the ideal for large regular meshes, 3 the worst
+		float acmr{ 0.0f };
+		//vertex transforms per referenced vertex, 1 is ideal
+		float atvr{ 0.0f };
+	};
+
+	//simulates a FIFO post-transform cache
+	CacheStats analyze_vertex_cache(const uint32_t* indices, size_t indexCount, size_t vertexCount, uint32_t cacheSize = 16);
+
+	//Forsyth's linear-speed vertex cache optimisation, reorders triangles in place
+	void optimize_vertex_cache(uint32_t* indices, size_t indexCount, size_t vertexCount);
+
+	//sorts the cache-friendly clusters of an already cache optimised index buffer so outward facing ones are drawn first,
+	//which cuts overdraw for convex-ish meshes while keeping most of the cache locality. positions are 3 floats every positionStride bytes
+	void optimize_overdraw(uint32_t* indices, size_t indexCount, const void* positions, size_t positionStride, size_t vertexCount);
+
+	//reorders vertices into first use order so fetches walk memory linearly, drops unreferenced vertices and rewrites the indices.
+	//returns the new vertex count
+	size_t optimize_vertex_fetch(void* vertices, size_t vertexStride, size_t vertexCount, uint32_t* indices, size_t indexCount);
+
+	//quadric error metric edge collapse towards targetIndexCount, collapses whose error exceeds maxError are not done.
+	//vertices only move onto existing ones, so the result indexes the same vertex buffer. open borders and attribute
+	//seams (several vertices on one position) are kept in place. writes at most indexCount indices to outIndices and
+	//returns their count, outError gets the object space deviation of the result
+	size_t simplify(const uint32_t* indices, size_t indexCount, const void* positions, size_t positionStride, size_t vertexCount,
+		size_t targetIndexCount, float maxError, uint32_t* outIndices, float& outError);
+}
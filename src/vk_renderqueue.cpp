@@ -0,0 +1,113 @@
+#include <vk_renderqueue.h>
+#include <algorithm>
+#include <cstring>
+
+namespace {
+
+	template<typename Handle>
+	uint32_t intern(std::unordered_map<Handle, uint32_t>& ids, Handle handle, uint32_t bits)
+	{
+		auto it = ids.find(handle);
+		if (it == ids.end()) {
+			it = ids.emplace(handle, static_cast<uint32_t>(ids.size())).first;
+		}
+		return it->second & ((1u << bits) - 1);
+	}
+}
+
+void RenderQueue::Stats::add(const Stats& other)
+{
+	draws += other.draws;
+	pipelineBinds += other.pipelineBinds;
+	descriptorSetBinds += other.descriptorSetBinds;
+	vertexBufferBinds += other.vertexBufferBinds;
+	indexBufferBinds += other.indexBufferBinds;
+	pushConstants += other.pushConstants;
+	instancedDraws += other.instancedDraws;
+	instances += other.instances;
+	triangles += other.triangles;
+	fullDetailTriangles += other.fullDetailTriangles;
+}
+
+uint32_t RenderQueue::pipelineId(VkPipeline pipeline)
+{
+	return intern(_pipelines, pipeline, PIPELINE_BITS);
+}
+
+uint32_t RenderQueue::setId(VkDescriptorSet set)
+{
+	//VK_NULL_HANDLE (no material set) gets an id like any other set
+	return intern(_sets, set, SET_BITS);
+}
+
+uint32_t RenderQueue::meshId(const void* mesh)
+{
+	return intern(_meshes, mesh, MESH_BITS);
+}
+
+uint64_t RenderQueue::makeKey(uint32_t pass, uint32_t pipeline, uint32_t set, uint32_t mesh, float depth01)
+{
+	const uint32_t depthMax = (1u << DEPTH_BITS) - 1;
+	float clamped = std::min(std::max(depth01, 0.0f), 1.0f);
+	uint32_t depth = static_cast<uint32_t>(clamped * depthMax);
+	if (pass == PASS_TRANSPARENT) {
+		depth = depthMax - depth;
+	}
+
+	uint64_t key = pass & 0xf;
+	key = (key << PIPELINE_BITS) | (pipeline & ((1u << PIPELINE_BITS) - 1));
+	key = (key << SET_BITS) | (set & ((1u << SET_BITS) - 1));
+	key = (key << MESH_BITS) | (mesh & ((1u << MESH_BITS) - 1));
+	key = (key << DEPTH_BITS) | depth;
+	return key;
+}
+
+void RenderQueue::sort()
+{
+	radix_sort(_items, _scratch);
+}
+
+void RenderQueue::radix_sort(std::vector<DrawItem>& items, std::vector<DrawItem>& scratch)
+{
+	const size_t count = items.size();
+	if (count < 2) {
+		return;
+	}
+	scratch.resize(count);
+
+	//histograms of all eight digits in one read
+	uint32_t histograms[8][256];
+	memset(histograms, 0, sizeof(histograms));
+	for (const DrawItem& item : items) {
+		uint64_t key = item.key;
+		for (int digit = 0; digit < 8; digit++) {
+			histograms[digit][(key >> (digit * 8)) & 0xff]++;
+		}
+	}
+
+	DrawItem* source = items.data();
+	DrawItem* target = scratch.data();
+	for (int digit = 0; digit < 8; digit++) {
+		uint32_t* histogram = histograms[digit];
+		//all keys share this byte, the pass would not move anything
+		if (histogram[(source[0].key >> (digit * 8)) & 0xff] == count) {
+			continue;
+		}
+
+		uint32_t offset = 0;
+		for (int bucket = 0; bucket < 256; bucket++) {
+			uint32_t bucketCount = histogram[bucket];
+			histogram[bucket] = offset;
+			offset += bucketCount;
+		}
+		for (size_t i = 0; i < count; i++) {
+			target[histogram[(source[i].key >> (digit * 8)) & 0xff]++] = source[i];
+		}
+		std::swap(source, target);
+	}
+
+	//odd number of passes, the result is in scratch
+	if (source != items.data()) {
+		items.swap(scratch);
+	}
+}
@@ -0,0 +1,78 @@
+#pragma once
+
+#include <vk_types.h>
+#include <vector>
+#include <unordered_map>
+#include <cstdint>
+
+//per frame list of draws ordered by a 64 bit key, most expensive state change in the highest bits:
+//pass (4) | pipeline (10) | material descriptor set (12) | mesh (14) | depth (24)
+//so a sorted walk switches pipelines once per pipeline, sets once per set within it and meshes once per mesh.
+//pipelines, sets and meshes get small ids the first time they are seen. ids past the width of their field wrap,
+//which only costs some binds, the recording compares the real handles
+class RenderQueue {
+public:
+	enum Pass : uint32_t {
+		PASS_BACKGROUND = 0,
+		PASS_OPAQUE = 1,
+		//depth is inverted, back to front
+		PASS_TRANSPARENT = 2,
+	};
+
+	struct DrawItem {
+		uint64_t key;
+		//index of the object in the caller's array
+		uint32_t object;
+	};
+
+	//commands recorded for the last sorted list
+	struct Stats {
+		uint32_t draws;
+		uint32_t pipelineBinds;
+		uint32_t descriptorSetBinds;
+		uint32_t vertexBufferBinds;
+		uint32_t indexBufferBinds;
+		uint32_t pushConstants;
+		//draws covering several objects and the objects they drew
+		uint32_t instancedDraws;
+		uint32_t instances;
+		//triangles submitted, and what the same draws cost at full detail
+		uint64_t triangles;
+		uint64_t fullDetailTriangles;
+
+		uint32_t stateChanges() const { return pipelineBinds + descriptorSetBinds + vertexBufferBinds + indexBufferBinds; }
+		//sums the counts of a list recorded in several parts
+		void add(const Stats& other);
+	};
+
+	static const uint32_t PIPELINE_BITS = 10;
+	static const uint32_t SET_BITS = 12;
+	static const uint32_t MESH_BITS = 14;
+	static const uint32_t DEPTH_BITS = 24;
+
+	uint32_t pipelineId(VkPipeline pipeline);
+	uint32_t setId(VkDescriptorSet set);
+	uint32_t meshId(const void* mesh);
+
+	//depth01 is the view distance divided by the far distance, clamped to 0..1
+	static uint64_t makeKey(uint32_t pass, uint32_t pipeline, uint32_t set, uint32_t mesh, float depth01);
+
+	void clear() { _items.clear(); }
+	void push(uint64_t key, uint32_t object) { _items.push_back({ key, object }); }
+
+	//stable LSD radix sort on the key, one byte per pass, passes where every key has the same byte are skipped
+	void sort();
+
+	const std::vector<DrawItem>& items() const { return _items; }
+
+	//the sort used by RenderQueue::sort, scratch is resized as needed
+	static void radix_sort(std::vector<DrawItem>& items, std::vector<DrawItem>& scratch);
+
+private:
+	std::vector<DrawItem> _items;
+	std::vector<DrawItem> _scratch;
+
+	std::unordered_map<VkPipeline, uint32_t> _pipelines;
+	std::unordered_map<VkDescriptorSet, uint32_t> _sets;
+	std::unordered_map<const void*, uint32_t> _meshes;
+};
@@ -0,0 +1,106 @@
+#include <vk_samplercache.h>
+#include <cstring>
+
+namespace {
+
+	//fields are compared bitwise, floats included, so -0 and 0 are different keys which only costs a duplicate sampler
+	static_assert(sizeof(float) == sizeof(uint32_t), "float keys are hashed as 32 bit words");
+
+	uint32_t word(float value)
+	{
+		uint32_t bits;
+		memcpy(&bits, &value, sizeof(bits));
+		return bits;
+	}
+}
+
+void SamplerCache::init(VkDevice device)
+{
+	_device = device;
+}
+
+void SamplerCache::cleanup()
+{
+	std::lock_guard<std::mutex> lock(_mutex);
+	for (auto& it : _samplers) {
+		vkDestroySampler(_device, it.second, nullptr);
+	}
+	_samplers.clear();
+	for (VkSampler sampler : _unshared) {
+		vkDestroySampler(_device, sampler, nullptr);
+	}
+	_unshared.clear();
+}
+
+SamplerCache::Key SamplerCache::make_key(const VkSamplerCreateInfo& info)
+{
+	Key key;
+	key.flags = info.flags;
+	key.magFilter = info.magFilter;
+	key.minFilter = info.minFilter;
+	key.mipmapMode = info.mipmapMode;
+	key.addressModeU = info.addressModeU;
+	key.addressModeV = info.addressModeV;
+	key.addressModeW = info.addressModeW;
+	key.mipLodBias = info.mipLodBias;
+	key.anisotropyEnable = info.anisotropyEnable;
+	//state the driver ignores is normalized so it does not split otherwise equal samplers
+	key.maxAnisotropy = info.anisotropyEnable ? info.maxAnisotropy : 1.0f;
+	key.compareEnable = info.compareEnable;
+	key.compareOp = info.compareEnable ? info.compareOp : VK_COMPARE_OP_ALWAYS;
+	key.minLod = info.minLod;
+	key.maxLod = info.maxLod;
+	key.borderColor = info.borderColor;
+	key.unnormalizedCoordinates = info.unnormalizedCoordinates;
+	return key;
+}
+
+bool SamplerCache::Key::operator==(const Key& other) const
+{
+	return flags == other.flags && magFilter == other.magFilter && minFilter == other.minFilter &&
+		mipmapMode == other.mipmapMode && addressModeU == other.addressModeU && addressModeV == other.addressModeV &&
+		addressModeW == other.addressModeW && word(mipLodBias) == word(other.mipLodBias) &&
+		anisotropyEnable == other.anisotropyEnable && word(maxAnisotropy) == word(other.maxAnisotropy) &&
+		compareEnable == other.compareEnable && compareOp == other.compareOp && word(minLod) == word(other.minLod) &&
+		word(maxLod) == word(other.maxLod) && borderColor == other.borderColor &&
+		unnormalizedCoordinates == other.unnormalizedCoordinates;
+}
+
+size_t SamplerCache::KeyHash::operator()(const Key& key) const
+{
+	const uint32_t words[] = {
+		uint32_t(key.flags), uint32_t(key.magFilter), uint32_t(key.minFilter), uint32_t(key.mipmapMode),
+		uint32_t(key.addressModeU), uint32_t(key.addressModeV), uint32_t(key.addressModeW), word(key.mipLodBias),
+		uint32_t(key.anisotropyEnable), word(key.maxAnisotropy), uint32_t(key.compareEnable), uint32_t(key.compareOp),
+		word(key.minLod), word(key.maxLod), uint32_t(key.borderColor), uint32_t(key.unnormalizedCoordinates)
+	};
+	//FNV-1a over the words
+	uint64_t hash = 14695981039346656037ull;
+	for (uint32_t w : words) {
+		hash = (hash ^ w) * 1099511628211ull;
+	}
+	return size_t(hash);
+}
+
+VkSampler SamplerCache::getSampler(const VkSamplerCreateInfo& info)
+{
+	std::lock_guard<std::mutex> lock(_mutex);
+	if (info.pNext != nullptr) {
+		//the key cannot tell two chains apart, a shared handle could carry the wrong extension state
+		VkSampler sampler{};
+		VK_CHECK(vkCreateSampler(_device, &info, nullptr, &sampler));
+		_unshared.push_back(sampler);
+		return sampler;
+	}
+
+	Key key = make_key(info);
+	auto it = _samplers.find(key);
+	if (it != _samplers.end()) {
+		return it->second;
+	}
+
+	VkSampler sampler{};
+	VK_CHECK(vkCreateSampler(_device, &info, nullptr, &sampler));
+	_samplers.emplace(key, sampler);
+	return sampler;
+}
@@ -0,0 +1,56 @@
+#pragma once
+
+#include <vk_types.h>
+#include <unordered_map>
+#include <vector>
+#include <mutex>
+
+//deduplicates VkSampler objects. samplers are looked up by the full VkSamplerCreateInfo state so every texture with the
+//same filtering shares one handle, which keeps the count far below maxSamplerAllocationCount. handles stay owned by
+//the cache and are destroyed together in cleanup, callers never destroy them
+class SamplerCache {
+public:
+	void init(VkDevice device);
+
+	void cleanup();
+
+	//returns the shared sampler for this state, creating it on first use. pNext chains (reduction mode, YCbCr conversion)
+	//are not part of the key, with one every call creates a sampler of its own that is never shared
+	VkSampler getSampler(const VkSamplerCreateInfo& info);
+
+	size_t size() const { return _samplers.size() + _unshared.size(); }
+
+private:
+	struct Key {
+		VkSamplerCreateFlags flags;
+		VkFilter magFilter;
+		VkFilter minFilter;
+		VkSamplerMipmapMode mipmapMode;
+		VkSamplerAddressMode addressModeU;
+		VkSamplerAddressMode addressModeV;
+		VkSamplerAddressMode addressModeW;
+		float mipLodBias;
+		VkBool32 anisotropyEnable;
+		float maxAnisotropy;
+		VkBool32 compareEnable;
+		VkCompareOp compareOp;
+		float minLod;
+		float maxLod;
+		VkBorderColor borderColor;
+		VkBool32 unnormalizedCoordinates;
+
+		bool operator==(const Key& other) const;
+	};
+
+	struct KeyHash {
+		size_t operator()(const Key& key) const;
+	};
+
+	static Key make_key(const VkSamplerCreateInfo& info);
+
+	VkDevice _device{ VK_NULL_HANDLE };
+	std::mutex _mutex;
+	std::unordered_map<Key, VkSampler, KeyHash> _samplers;
+	//samplers created with a pNext chain, only kept for cleanup
+	std::vector<VkSampler> _unshared;
+};
@@ -1,15 +1,32 @@
 #include <vk_texture.h>
 #include <iostream>
+#include <cstring>
+#include <cmath>
+#include <algorithm>
+#include <chrono>
 
 #include <vk_initializers.h>
+#include <vk_bcenc.h>
 
 #define STB_IMAGE_IMPLEMENTATION
 #include <stb_image.h>
 
+#if defined(__SSSE3__) || defined(__AVX__)
+#define VKTEXTURE_SSSE3 1
+#include <tmmintrin.h>
+#elif defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define VKTEXTURE_SSE2 1
+#include <emmintrin.h>
+#endif
+
 
 
 bool vkutil::load_image_from_file(VulkanEngine& engine, const char* file, AllocatedImage & outImage)
 {
+	if (load_compressed_image(engine, { file }, false, outImage)) {
+		return true;
+	}
+
 	int texWidth, texHeight, texChannels;
 
 	stbi_uc* pixels = stbi_load(file, &texWidth, &texHeight, &texChannels, STBI_rgb_alpha);	
@@ -19,60 +36,79 @@ bool vkutil::load_image_from_file(VulkanEngine& engine, const char* file, Alloca
 		return false;
 	}
 	
-	void* pixel_ptr = pixels;
 	VkDeviceSize imageSize = texWidth * texHeight * 4;
+	//the pixels are copied into the staging ring right away
+	bool loaded = load_image_from_buffer(engine, pixels, imageSize, texWidth, texHeight, outImage);
+	stbi_image_free(pixels);
+	return loaded;
+}
 
-	VkFormat image_format = VK_FORMAT_R8G8B8A8_SRGB;
-
-    struct StagingBuffer
-    {
-        /* data */
-        VkBuffer buffer;
-        VkDeviceMemory memory;
-    }stagingBuffer{};
-
-    engine.createBuffer(imageSize,VK_BUFFER_USAGE_TRANSFER_SRC_BIT,
-    VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT|VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
-    stagingBuffer.buffer,
-    stagingBuffer.memory,
-    pixel_ptr);
-
+ void vkutil::transitionImaglayout(VulkanEngine &engine,VkImage image,VkFormat format,VkImageLayout oldLayout,VkImageLayout newLayout,uint32_t layerCount)
+ {
+	//recorded into the engine upload batch, no submit/wait per transition anymore
+	engine._uploadQueue.transitionImage(image,oldLayout,newLayout,layerCount);
+ }
 
+ void vkutil::copyBuffertoImage(VulkanEngine& engine,VkBuffer buffer, VkImage image, uint32_t width, uint32_t height,uint32_t layerCount)
+ {
+	engine._uploadQueue.copyBufferToImage(buffer,image,width,height,layerCount);
+ }
 
-	stbi_image_free(pixels);
+ bool vkutil::load_image_from_buffer(VulkanEngine& engine, const void* buffer, VkDeviceSize size, uint32_t texWidth,uint32_t texHeight, AllocatedImage& outImage)
+ {
+	VkFormat image_format = VK_FORMAT_R8G8B8A8_SRGB;
+	
 
 	VkExtent3D imageExtent;
 	imageExtent.width = static_cast<uint32_t>(texWidth);
 	imageExtent.height = static_cast<uint32_t>(texHeight);
 	imageExtent.depth = 1;
+
+	uint32_t mipLevels = engine._textureMipmaps ? mip_levels(texWidth, texHeight) : 1;
 	
-	VkImageCreateInfo dimg_info = vkinit::image_create_info(image_format, VK_IMAGE_USAGE_SAMPLED_BIT | VK_IMAGE_USAGE_TRANSFER_DST_BIT, imageExtent);
+	//mip 0 is also the source of the blits that fill the chain
+	VkImageCreateInfo dimg_info = vkinit::image_create_info(image_format, VK_IMAGE_USAGE_SAMPLED_BIT | VK_IMAGE_USAGE_TRANSFER_DST_BIT | VK_IMAGE_USAGE_TRANSFER_SRC_BIT, imageExtent);
+	dimg_info.mipLevels = mipLevels;
 
 	AllocatedImage newImage;
 
-    engine.createImage(
-        imageExtent.width,
-        imageExtent.height,
-        image_format,
-        VK_IMAGE_TILING_OPTIMAL,
-        VK_IMAGE_USAGE_TRANSFER_DST_BIT|VK_IMAGE_USAGE_SAMPLED_BIT,
-        VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
-        newImage._image,
-        newImage._mem
-    );
-
-    transitionImaglayout(engine,newImage._image,image_format,VK_IMAGE_LAYOUT_UNDEFINED,
-    VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL
-    );
-    copyBuffertoImage(engine,stagingBuffer.buffer,newImage._image,imageExtent.width,imageExtent.height);
-    transitionImaglayout(engine,newImage._image,image_format,VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
-    VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL);
-
-    vkDestroyBuffer(engine._device,stagingBuffer.buffer,nullptr);
-    vkFreeMemory(engine._device,stagingBuffer.memory,nullptr);
-
-    newImage._view = engine.createImageView(newImage._image,image_format,VK_IMAGE_ASPECT_COLOR_BIT);
-    newImage._sampler  = engine.createSampler();
+    engine.createImage(dimg_info, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, newImage._image, newImage._mem);
+
+    engine._uploadQueue.transitionImage(newImage._image, VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, 1, mipLevels);
+    engine._uploadQueue.uploadImage(newImage._image,buffer,size,imageExtent.width,imageExtent.height);
+    if (mipLevels > 1 && can_blit_mipmaps(engine, image_format)) {
+        engine._uploadQueue.generateMipmaps(newImage._image, texWidth, texHeight, mipLevels);
+    }
+    else {
+        if (mipLevels > 1) {
+            //the format cannot be filtered by blits, build the chain on the cpu
+            std::vector<uint8_t> chain = build_mip_chain(static_cast<const uint8_t*>(buffer), texWidth, texHeight, mipLevels, true);
+            size_t offset = 0;
+            uint32_t width = texWidth;
+            uint32_t height = texHeight;
+            for (uint32_t level = 1; level < mipLevels; level++) {
+                width = std::max(width / 2, 1u);
+                height = std::max(height / 2, 1u);
+                VkDeviceSize levelSize = VkDeviceSize(width) * height * 4;
+                engine._uploadQueue.uploadImage(newImage._image, chain.data() + offset, levelSize, width, height, 0, level);
+                offset += levelSize;
+            }
+        }
+        engine._uploadQueue.transitionImage(newImage._image, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL, 1, mipLevels);
+    }
+
+    VkImageViewCreateInfo viewInfo{};
+    viewInfo.sType = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO;
+    viewInfo.image = newImage._image;
+    viewInfo.format = image_format;
+    viewInfo.viewType = VK_IMAGE_VIEW_TYPE_2D;
+    viewInfo.subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+    viewInfo.subresourceRange.baseMipLevel = 0;
+    viewInfo.subresourceRange.levelCount = mipLevels;
+    viewInfo.subresourceRange.baseArrayLayer = 0;
+    viewInfo.subresourceRange.layerCount = 1;
+    newImage._view = engine.createImageView(newImage._image, viewInfo);
+    newImage._sampler  = engine.createTextureSampler();
 	
     newImage.descriptor.imageLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
     newImage.descriptor.sampler = newImage._sampler;
@@ -80,170 +116,339 @@ bool vkutil::load_image_from_file(VulkanEngine& engine, const char* file, Alloca
 
     outImage = newImage;
 
-    engine._mainDeletionQueue.push_function([=](){
-        vkDestroySampler(engine._device,outImage._sampler,nullptr);
+    engine._mainDeletionQueue.push_function([=,&engine](){
         vkDestroyImageView(engine._device,outImage._view,nullptr);
         vkDestroyImage(engine._device,outImage._image,nullptr);
-		vkFreeMemory(engine._device,outImage._mem,nullptr);
+		engine._allocator.free(outImage._mem);
     });
 	
 	return true;
-}
-
- void vkutil::transitionImaglayout(VulkanEngine &engine,VkImage image,VkFormat format,VkImageLayout oldLayout,VkImageLayout newLayout)
- {
-    VkCommandBuffer commandBuffer = engine.beginSingleCommand();
+ }
 
-	VkImageMemoryBarrier barrier{};
-	barrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
-	barrier.oldLayout = oldLayout;
-	barrier.newLayout = newLayout;
-	barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
-	barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+namespace {
 
-	barrier.image = image;
-	barrier.subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
-	barrier.subresourceRange.baseMipLevel = 0;
-	barrier.subresourceRange.levelCount = 1;
-	barrier.subresourceRange.baseArrayLayer = 0;
-	barrier.subresourceRange.layerCount = 1;
-	barrier.srcAccessMask = 0; // TODO
-	barrier.dstAccessMask = 0;
+	struct SrgbTable {
+		float toLinear[256];
 
-	VkPipelineStageFlags sourceStage{};
-	VkPipelineStageFlags destinationStage{};
+		SrgbTable()
+		{
+			for (int i = 0; i < 256; i++) {
+				float c = i / 255.0f;
+				toLinear[i] = c <= 0.04045f ? c / 12.92f : std::pow((c + 0.055f) / 1.055f, 2.4f);
+			}
+		}
+	};
 
-	if (oldLayout == VK_IMAGE_LAYOUT_UNDEFINED && newLayout == VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL) {
-		barrier.srcAccessMask = 0;
-		barrier.dstAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+	const SrgbTable& srgb_table()
+	{
+		static SrgbTable table;
+		return table;
+	}
+}
 
-		sourceStage = VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT;
-		destinationStage = VK_PIPELINE_STAGE_TRANSFER_BIT;
+namespace {
+
+	//decodes the sources, builds the mips and encodes every level to BC1 (opaque) or BC3
+	bool cook_texture(VulkanEngine& engine, const std::vector<const char*>& files, const char* path)
+	{
+		auto start = std::chrono::high_resolution_clock::now();
+		SourceStamp stamp;
+		if (!vkcook::stamp_sources(files, stamp, true)) {
+			return false;
+		}
+
+		std::vector<stbi_uc*> layers;
+		int width = 0, height = 0;
+		bool ok = true;
+		for (const char* file : files) {
+			int layerWidth, layerHeight, channels;
+			stbi_uc* pixels = stbi_load(file, &layerWidth, &layerHeight, &channels, STBI_rgb_alpha);
+			if (!pixels || (!layers.empty() && (layerWidth != width || layerHeight != height))) {
+				std::cout << "Failed to load texture file " << file << std::endl;
+				stbi_image_free(pixels);
+				ok = false;
+				break;
+			}
+			width = layerWidth;
+			height = layerHeight;
+			layers.push_back(pixels);
+		}
+
+		vkcook::TextureHeader description{};
+		std::vector<std::vector<uint8_t>> levels;
+		if (ok) {
+			const uint32_t layerCount = static_cast<uint32_t>(layers.size());
+			const uint32_t levelCount = engine._textureMipmaps ? vkutil::mip_levels(width, height) : 1;
+			vkbc::BlockFormat format = vkbc::BlockFormat::BC1;
+			for (stbi_uc* pixels : layers) {
+				if (vkbc::color_format_for(pixels, size_t(width) * height) == vkbc::BlockFormat::BC3) {
+					format = vkbc::BlockFormat::BC3;
+				}
+			}
+
+			levels.resize(size_t(levelCount) * layerCount);
+			for (uint32_t layer = 0; layer < layerCount; layer++) {
+				std::vector<uint8_t> chain = vkutil::build_mip_chain(layers[layer], width, height, levelCount, true);
+				const uint8_t* src = layers[layer];
+				uint32_t levelWidth = width;
+				uint32_t levelHeight = height;
+				size_t chainOffset = 0;
+				for (uint32_t level = 0; level < levelCount; level++) {
+					if (level > 0) {
+						src = chain.data() + chainOffset;
+						chainOffset += size_t(levelWidth) * levelHeight * 4;
+					}
+					std::vector<uint8_t>& blocks = levels[level * layerCount + layer];
+					blocks.resize(vkbc::encoded_size(format, levelWidth, levelHeight));
+					vkbc::encode(format, src, levelWidth, levelHeight, blocks.data(), &engine._threadPool);
+					levelWidth = std::max(levelWidth / 2, 1u);
+					levelHeight = std::max(levelHeight / 2, 1u);
+				}
+			}
+
+			description.vkFormat = static_cast<uint32_t>(vkbc::vk_format(format, true));
+			description.blockFormat = static_cast<uint32_t>(format);
+			description.width = width;
+			description.height = height;
+			description.levelCount = levelCount;
+			description.layerCount = layerCount;
+		}
+		for (stbi_uc* pixels : layers) {
+			stbi_image_free(pixels);
+		}
+		if (!ok || !vkcook::write_texture(path, stamp, description, levels)) {
+			return false;
+		}
+		std::cout << "cooked " << path << " in " << std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - start).count() << " ms" << std::endl;
+		return true;
 	}
-	else if (oldLayout == VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL && newLayout == VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL) {
-		barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
-		barrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
+}
 
-		sourceStage = VK_PIPELINE_STAGE_TRANSFER_BIT;
-		destinationStage = VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT;
+ bool vkutil::load_cooked_texture(VulkanEngine& engine, const std::vector<const char*>& files, vkcook::CookedTexture& outTexture)
+ {
+	if (!engine._textureCompression || !engine._supportsBC || files.empty()) {
+		return false;
 	}
-	else {
-		//throw std::invalid_argument("unsupported layout transition!");
-		std::cout << "error" << std::endl;
+	std::string path = vkcook::cooked_texture_path(files[0]);
+	if (vkcook::load_texture(path.c_str(), files, outTexture)) {
+		return true;
 	}
-
-	
-	vkCmdPipelineBarrier(
-		commandBuffer,
-		sourceStage, destinationStage,
-		0,
-		0, nullptr,
-		0, nullptr,
-		1, &barrier
-	);
-
-	engine.endSingleCommand(commandBuffer);
+	return cook_texture(engine, files, path.c_str()) && vkcook::load_texture(path.c_str(), files, outTexture);
  }
 
- void vkutil::copyBuffertoImage(VulkanEngine& engine,VkBuffer buffer, VkImage image, uint32_t width, uint32_t height)
+ bool vkutil::load_compressed_image(VulkanEngine& engine, const std::vector<const char*>& files, bool cube, AllocatedImage& outImage)
  {
-    VkCommandBuffer commandBuffer = engine.beginSingleCommand();
-
-	VkBufferImageCopy region{};
-	region.bufferOffset = 0;
-	region.bufferRowLength = 0;
-	region.bufferImageHeight = 0;
-
-	region.imageSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
-	region.imageSubresource.mipLevel = 0;
-	region.imageSubresource.baseArrayLayer = 0;
-	region.imageSubresource.layerCount = 1;
-
-	region.imageOffset = { 0, 0, 0 };
-	region.imageExtent = {
-		width,
-		height,
-		1
-	};
+	vkcook::CookedTexture cooked;
+	if (!load_cooked_texture(engine, files, cooked)) {
+		return false;
+	}
+	const vkcook::TextureHeader& header = cooked.header;
+	if (header.layerCount != (cube ? 6u : 1u)) {
+		return false;
+	}
+	VkFormat image_format = static_cast<VkFormat>(header.vkFormat);
+
+	VkExtent3D imageExtent;
+	imageExtent.width = header.width;
+	imageExtent.height = header.height;
+	imageExtent.depth = 1;
 
-	vkCmdCopyBufferToImage(
-		commandBuffer,
-		buffer,
-		image,
-		VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
-		1,
-		&region
-	);
+	VkImageCreateInfo dimg_info = vkinit::image_create_info(image_format, VK_IMAGE_USAGE_SAMPLED_BIT | VK_IMAGE_USAGE_TRANSFER_DST_BIT, imageExtent);
+	dimg_info.mipLevels = header.levelCount;
+	dimg_info.arrayLayers = header.layerCount;
+	if (cube) {
+		dimg_info.flags = VK_IMAGE_CREATE_CUBE_COMPATIBLE_BIT;
+	}
 
-	engine.endSingleCommand(commandBuffer);
+	AllocatedImage newImage;
+	engine.createImage(dimg_info, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, newImage._image, newImage._mem);
+
+	engine._uploadQueue.transitionImage(newImage._image, VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, header.layerCount, header.levelCount);
+	//the blocks go from the mapping straight into the staging ring, rows of 4x4 blocks
+	uint32_t width = header.width;
+	uint32_t height = header.height;
+	for (uint32_t level = 0; level < header.levelCount; level++) {
+		for (uint32_t layer = 0; layer < header.layerCount; layer++) {
+			engine._uploadQueue.uploadImage(newImage._image, cooked.level_data(level, layer), cooked.level(level, layer).size, width, height, layer, level, 4);
+		}
+		width = std::max(width / 2, 1u);
+		height = std::max(height / 2, 1u);
+	}
+	engine._uploadQueue.transitionImage(newImage._image, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL, header.layerCount, header.levelCount);
+
+	VkImageViewCreateInfo viewInfo{};
+	viewInfo.sType = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO;
+	viewInfo.image = newImage._image;
+	viewInfo.format = image_format;
+	viewInfo.viewType = cube ? VK_IMAGE_VIEW_TYPE_CUBE : VK_IMAGE_VIEW_TYPE_2D;
+	viewInfo.subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+	viewInfo.subresourceRange.baseMipLevel = 0;
+	viewInfo.subresourceRange.levelCount = header.levelCount;
+	viewInfo.subresourceRange.baseArrayLayer = 0;
+	viewInfo.subresourceRange.layerCount = header.layerCount;
+	newImage._view = engine.createImageView(newImage._image, viewInfo);
+	newImage._sampler = engine.createTextureSampler();
+
+	newImage.descriptor.imageLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+	newImage.descriptor.sampler = newImage._sampler;
+	newImage.descriptor.imageView = newImage._view;
+
+	outImage = newImage;
+
+	engine._mainDeletionQueue.push_function([=,&engine](){
+		vkDestroyImageView(engine._device,outImage._view,nullptr);
+		vkDestroyImage(engine._device,outImage._image,nullptr);
+		engine._allocator.free(outImage._mem);
+	});
+	return true;
  }
 
- bool vkutil::load_image_from_buffer(VulkanEngine& engine, void* buffer, VkDeviceSize size, uint32_t texWidth,uint32_t texHeight, AllocatedImage& outImage)
+ uint32_t vkutil::mip_levels(uint32_t width, uint32_t height)
  {
-	VkFormat image_format = VK_FORMAT_R8G8B8A8_SRGB;
-	
-	 struct StagingBuffer
-    {
-        /* data */
-        VkBuffer buffer;
-        VkDeviceMemory memory;
-    }stagingBuffer{};
-
-    engine.createBuffer(size,VK_BUFFER_USAGE_TRANSFER_SRC_BIT,
-    VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT|VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
-    stagingBuffer.buffer,
-    stagingBuffer.memory,
-    buffer);
-
+	uint32_t levels = 1;
+	while ((width | height) >> levels) {
+		levels++;
+	}
+	return levels;
+ }
 
+ bool vkutil::can_blit_mipmaps(VulkanEngine& engine, VkFormat format)
+ {
+	VkFormatProperties properties{};
+	vkGetPhysicalDeviceFormatProperties(engine._chosenGPU, format, &properties);
+	VkFormatFeatureFlags required = VK_FORMAT_FEATURE_BLIT_SRC_BIT | VK_FORMAT_FEATURE_BLIT_DST_BIT | VK_FORMAT_FEATURE_SAMPLED_IMAGE_FILTER_LINEAR_BIT;
+	return (properties.optimalTilingFeatures & required) == required;
+ }
 
-	//stbi_image_free(pixels);
+ std::vector<uint8_t> vkutil::build_mip_chain(const uint8_t* rgba, uint32_t width, uint32_t height, uint32_t levelCount, bool srgb)
+ {
+	//srgb texels are averaged in linear space, otherwise every mip gets darker
+	const float* toLinear = srgb_table().toLinear;
+	auto toByte = [&](float linear) {
+		float c = srgb ? (linear <= 0.0031308f ? linear * 12.92f : 1.055f * std::pow(linear, 1.0f / 2.4f) - 0.055f) : linear;
+		return static_cast<uint8_t>(std::min(std::max(c * 255.0f + 0.5f, 0.0f), 255.0f));
+	};
 
-	VkExtent3D imageExtent;
-	imageExtent.width = static_cast<uint32_t>(texWidth);
-	imageExtent.height = static_cast<uint32_t>(texHeight);
-	imageExtent.depth = 1;
-	
-	VkImageCreateInfo dimg_info = vkinit::image_create_info(image_format, VK_IMAGE_USAGE_SAMPLED_BIT | VK_IMAGE_USAGE_TRANSFER_DST_BIT, imageExtent);
+	size_t total = 0;
+	for (uint32_t level = 1, w = width, h = height; level < levelCount; level++) {
+		w = std::max(w / 2, 1u);
+		h = std::max(h / 2, 1u);
+		total += size_t(w) * h * 4;
+	}
+	std::vector<uint8_t> chain(total);
+
+	const uint8_t* src = rgba;
+	uint32_t srcWidth = width;
+	uint32_t srcHeight = height;
+	size_t offset = 0;
+	for (uint32_t level = 1; level < levelCount; level++) {
+		uint32_t dstWidth = std::max(srcWidth / 2, 1u);
+		uint32_t dstHeight = std::max(srcHeight / 2, 1u);
+		uint8_t* dst = chain.data() + offset;
+		//2x2 box, odd edges clamp to the last texel
+		for (uint32_t y = 0; y < dstHeight; y++) {
+			uint32_t y0 = std::min(y * 2, srcHeight - 1);
+			uint32_t y1 = std::min(y * 2 + 1, srcHeight - 1);
+			for (uint32_t x = 0; x < dstWidth; x++) {
+				uint32_t x0 = std::min(x * 2, srcWidth - 1);
+				uint32_t x1 = std::min(x * 2 + 1, srcWidth - 1);
+				const uint8_t* texels[4] = {
+					src + (size_t(y0) * srcWidth + x0) * 4, src + (size_t(y0) * srcWidth + x1) * 4,
+					src + (size_t(y1) * srcWidth + x0) * 4, src + (size_t(y1) * srcWidth + x1) * 4
+				};
+				uint8_t* out = dst + (size_t(y) * dstWidth + x) * 4;
+				for (int c = 0; c < 3; c++) {
+					float sum = 0.0f;
+					for (const uint8_t* texel : texels) {
+						sum += srgb ? toLinear[texel[c]] : texel[c] / 255.0f;
+					}
+					out[c] = toByte(sum * 0.25f);
+				}
+				//alpha is always linear
+				out[3] = static_cast<uint8_t>((texels[0][3] + texels[1][3] + texels[2][3] + texels[3][3] + 2) / 4);
+			}
+		}
+		src = dst;
+		srcWidth = dstWidth;
+		srcHeight = dstHeight;
+		offset += size_t(dstWidth) * dstHeight * 4;
+	}
+	return chain;
+ }
 
-	AllocatedImage newImage;
+namespace {
+
+	//a word at a time from pixel i on, the 4th byte read belongs to the next pixel and is overwritten by alpha
+	void expand_rgb_to_rgba_tail(const uint8_t* rgb, uint8_t* rgba, size_t i, size_t pixelCount)
+	{
+		for (; i + 1 < pixelCount; i++) {
+			uint32_t pixel;
+			memcpy(&pixel, rgb + i * 3, sizeof(pixel));
+			pixel |= 0xff000000u;
+			memcpy(rgba + i * 4, &pixel, sizeof(pixel));
+		}
+		for (; i < pixelCount; i++) {
+			rgba[i * 4] = rgb[i * 3];
+			rgba[i * 4 + 1] = rgb[i * 3 + 1];
+			rgba[i * 4 + 2] = rgb[i * 3 + 2];
+			rgba[i * 4 + 3] = 255;
+		}
+	}
 
-    engine.createImage(
-        imageExtent.width,
-        imageExtent.height,
-        image_format,
-        VK_IMAGE_TILING_OPTIMAL,
-        VK_IMAGE_USAGE_TRANSFER_DST_BIT|VK_IMAGE_USAGE_SAMPLED_BIT,
-        VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
-        newImage._image,
-        newImage._mem
-    );
-
-    transitionImaglayout(engine,newImage._image,image_format,VK_IMAGE_LAYOUT_UNDEFINED,
-    VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL
-    );
-    copyBuffertoImage(engine,stagingBuffer.buffer,newImage._image,imageExtent.width,imageExtent.height);
-    transitionImaglayout(engine,newImage._image,image_format,VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
-    VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL);
-
-    vkDestroyBuffer(engine._device,stagingBuffer.buffer,nullptr);
-    vkFreeMemory(engine._device,stagingBuffer.memory,nullptr);
-
-    newImage._view = engine.createImageView(newImage._image,image_format,VK_IMAGE_ASPECT_COLOR_BIT);
-    newImage._sampler  = engine.createSampler();
-	
-    newImage.descriptor.imageLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
-    newImage.descriptor.sampler = newImage._sampler;
-    newImage.descriptor.imageView = newImage._view;
+#ifdef VKTEXTURE_SSE2
+	//the 4 pixels in the low 12 bytes of rgb, pixel k moved up by k bytes into lane k
+	inline __m128i expand_4_pixels(__m128i rgb, __m128i alpha)
+	{
+		const __m128i lane0 = _mm_setr_epi32(0x00ffffff, 0, 0, 0);
+		const __m128i lane1 = _mm_setr_epi32(0, 0x00ffffff, 0, 0);
+		const __m128i lane2 = _mm_setr_epi32(0, 0, 0x00ffffff, 0);
+		const __m128i lane3 = _mm_setr_epi32(0, 0, 0, 0x00ffffff);
+		__m128i out = _mm_or_si128(_mm_and_si128(rgb, lane0), _mm_and_si128(_mm_slli_si128(rgb, 1), lane1));
+		out = _mm_or_si128(out, _mm_and_si128(_mm_slli_si128(rgb, 2), lane2));
+		out = _mm_or_si128(out, _mm_and_si128(_mm_slli_si128(rgb, 3), lane3));
+		return _mm_or_si128(out, alpha);
+	}
+#endif
+}
 
-    outImage = newImage;
+void vkutil::expand_rgb_to_rgba_scalar(const uint8_t* rgb, uint8_t* rgba, size_t pixelCount)
+{
+	expand_rgb_to_rgba_tail(rgb, rgba, 0, pixelCount);
+}
 
-    engine._mainDeletionQueue.push_function([=](){
-        vkDestroySampler(engine._device,outImage._sampler,nullptr);
-        vkDestroyImageView(engine._device,outImage._view,nullptr);
-        vkDestroyImage(engine._device,outImage._image,nullptr);
-		vkFreeMemory(engine._device,outImage._mem,nullptr);
-    });
-	
-	return true;
- }
\ No newline at end of file
+ void vkutil::expand_rgb_to_rgba(const uint8_t* rgb, uint8_t* rgba, size_t pixelCount)
+ {
+	size_t i = 0;
+#ifdef VKTEXTURE_SSSE3
+	//16 pixels per iteration: 48 bytes in, 4 shuffles of 12 bytes each into 64 bytes out
+	const __m128i shuffle = _mm_setr_epi8(0, 1, 2, -1, 3, 4, 5, -1, 6, 7, 8, -1, 9, 10, 11, -1);
+	const __m128i alpha = _mm_set1_epi32(static_cast<int>(0xff000000));
+	for (; i + 16 <= pixelCount; i += 16) {
+		const __m128i* in = reinterpret_cast<const __m128i*>(rgb + i * 3);
+		__m128i a = _mm_loadu_si128(in);
+		__m128i b = _mm_loadu_si128(in + 1);
+		__m128i c = _mm_loadu_si128(in + 2);
+		__m128i* out = reinterpret_cast<__m128i*>(rgba + i * 4);
+		_mm_storeu_si128(out, _mm_or_si128(_mm_shuffle_epi8(a, shuffle), alpha));
+		_mm_storeu_si128(out + 1, _mm_or_si128(_mm_shuffle_epi8(_mm_alignr_epi8(b, a, 12), shuffle), alpha));
+		_mm_storeu_si128(out + 2, _mm_or_si128(_mm_shuffle_epi8(_mm_alignr_epi8(c, b, 8), shuffle), alpha));
+		_mm_storeu_si128(out + 3, _mm_or_si128(_mm_shuffle_epi8(_mm_srli_si128(c, 4), shuffle), alpha));
+	}
+#elif defined(VKTEXTURE_SSE2)
+	//the baseline of x86-64 builds without -mssse3: no byte shuffle, the 12 byte groups are lined up with whole
+	//register shifts and spread with masked ones
+	const __m128i alpha = _mm_set1_epi32(static_cast<int>(0xff000000));
+	for (; i + 16 <= pixelCount; i += 16) {
+		const __m128i* in = reinterpret_cast<const __m128i*>(rgb + i * 3);
+		__m128i a = _mm_loadu_si128(in);
+		__m128i b = _mm_loadu_si128(in + 1);
+		__m128i c = _mm_loadu_si128(in + 2);
+		__m128i* out = reinterpret_cast<__m128i*>(rgba + i * 4);
+		_mm_storeu_si128(out, expand_4_pixels(a, alpha));
+		_mm_storeu_si128(out + 1, expand_4_pixels(_mm_or_si128(_mm_srli_si128(a, 12), _mm_slli_si128(b, 4)), alpha));
+		_mm_storeu_si128(out + 2, expand_4_pixels(_mm_or_si128(_mm_srli_si128(b, 8), _mm_slli_si128(c, 8)), alpha));
+		_mm_storeu_si128(out + 3, expand_4_pixels(_mm_srli_si128(c, 4), alpha));
+	}
+#endif
+	expand_rgb_to_rgba_tail(rgb, rgba, i, pixelCount);
+ }
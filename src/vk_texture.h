@@ -5,10 +5,28 @@
 
 #include <vk_types.h>
 #include <vk_engine.h>
+#include <vk_texturecache.h>
 
 namespace vkutil {
 	bool load_image_from_file(VulkanEngine& engine, const char* file, AllocatedImage& outImage);
-    void transitionImaglayout(VulkanEngine &engine,VkImage image,VkFormat format,VkImageLayout oldLayout,VkImageLayout newLayout);
-    void copyBuffertoImage(VulkanEngine& engine,VkBuffer buffer, VkImage image, uint32_t width, uint32_t height);
-    bool load_image_from_buffer(VulkanEngine& engine, void* buffer,VkDeviceSize size,uint32_t texWidth,uint32_t texHeight ,AllocatedImage& outImage);
+    //both record into engine._uploadQueue, the work is done once the queue is submitted and its ticket completes
+    void transitionImaglayout(VulkanEngine &engine,VkImage image,VkFormat format,VkImageLayout oldLayout,VkImageLayout newLayout,uint32_t layerCount = 1);
+    void copyBuffertoImage(VulkanEngine& engine,VkBuffer buffer, VkImage image, uint32_t width, uint32_t height,uint32_t layerCount = 1);
+    //uploads rgba8 srgb pixels with a full mip chain when engine._textureMipmaps is set, blitted on the gpu when the format allows it
+    bool load_image_from_buffer(VulkanEngine& engine, const void* buffer,VkDeviceSize size,uint32_t texWidth,uint32_t texHeight ,AllocatedImage& outImage);
+    //BCn version of the sources (one per layer, 6 for a cube), cooked into <first source>.vktex on first use.
+    //false when compression is off or unsupported or a source cannot be read, the caller then loads uncompressed
+    //maps the cooked version of the sources, cooking them first when the cache is missing or stale
+    bool load_cooked_texture(VulkanEngine& engine, const std::vector<const char*>& files, vkcook::CookedTexture& outTexture);
+    bool load_compressed_image(VulkanEngine& engine, const std::vector<const char*>& files, bool cube, AllocatedImage& outImage);
+    //number of mips down to 1x1
+    uint32_t mip_levels(uint32_t width, uint32_t height);
+    bool can_blit_mipmaps(VulkanEngine& engine, VkFormat format);
+    //box filtered rgba8 mips 1..levelCount-1 stored one after another, for formats that cannot be blitted
+    std::vector<uint8_t> build_mip_chain(const uint8_t* rgba, uint32_t width, uint32_t height, uint32_t levelCount, bool srgb);
+    //tightly packed 8 bit rgb to rgba with alpha 255, rgba holds pixelCount * 4 bytes. thread safe
+    //SSSE3 when the build enables it, SSE2 on any other x86-64 build
+    void expand_rgb_to_rgba(const uint8_t* rgb, uint8_t* rgba, size_t pixelCount);
+    //reference version of expand_rgb_to_rgba, for the benchmark
+    void expand_rgb_to_rgba_scalar(const uint8_t* rgb, uint8_t* rgba, size_t pixelCount);
 }
\ No newline at end of file
@@ -0,0 +1,137 @@
+#include <vk_texturecache.h>
+#include <iostream>
+#include <fstream>
+#include <cstring>
+#include <algorithm>
+
+namespace {
+
+	const uint64_t DATA_ALIGNMENT = 16;
+
+	uint64_t align_up(uint64_t value, uint64_t alignment)
+	{
+		return (value + alignment - 1) & ~(alignment - 1);
+	}
+
+	bool rewrite_texture_header(const char* path, const vkcook::TextureHeader& header)
+	{
+		std::fstream file(path, std::ios::binary | std::ios::in | std::ios::out);
+		if (!file.is_open()) {
+			return false;
+		}
+		file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+		return file.good();
+	}
+}
+
+const vkcook::TextureLevel& vkcook::CookedTexture::level(uint32_t level, uint32_t layer) const
+{
+	const TextureLevel* table = reinterpret_cast<const TextureLevel*>(file->data() + sizeof(TextureHeader));
+	return table[level * header.layerCount + layer];
+}
+
+std::string vkcook::cooked_texture_path(const char* source)
+{
+	return std::string(source) + ".vktex";
+}
+
+bool vkcook::stamp_sources(const std::vector<const char*>& sources, SourceStamp& outStamp, bool hash)
+{
+	SourceStamp combined;
+	for (size_t i = 0; i < sources.size(); i++) {
+		const char* source = sources[i];
+		SourceStamp stamp;
+		if (!stamp_source(source, stamp)) {
+			return false;
+		}
+		combined.size += stamp.size;
+		//file clock epochs vary, the count can be negative
+		combined.mtime = i == 0 ? stamp.mtime : std::max(combined.mtime, stamp.mtime);
+		if (hash) {
+			if (!hash_file(source, stamp.hash)) {
+				return false;
+			}
+			combined.hash = combined.hash * 31 + stamp.hash;
+		}
+	}
+	outStamp = combined;
+	return true;
+}
+
+bool vkcook::write_texture(const char* path, const SourceStamp& stamp, const TextureHeader& description, const std::vector<std::vector<uint8_t>>& levels)
+{
+	const size_t levelCount = size_t(description.levelCount) * description.layerCount;
+	if (levels.size() != levelCount) {
+		return false;
+	}
+
+	TextureHeader header = description;
+	header.magic = TEXTURE_MAGIC;
+	header.version = TEXTURE_VERSION;
+	header.sourceSize = stamp.size;
+	header.sourceTime = stamp.mtime;
+	header.sourceHash = stamp.hash;
+
+	std::vector<TextureLevel> table(levelCount);
+	uint64_t offset = align_up(sizeof(TextureHeader) + levelCount * sizeof(TextureLevel), DATA_ALIGNMENT);
+	for (size_t i = 0; i < levelCount; i++) {
+		table[i] = { offset, levels[i].size() };
+		offset = align_up(offset + levels[i].size(), DATA_ALIGNMENT);
+	}
+	header.fileSize = offset;
+
+	std::vector<char> blob(header.fileSize, 0);
+	memcpy(blob.data(), &header, sizeof(header));
+	memcpy(blob.data() + sizeof(header), table.data(), table.size() * sizeof(TextureLevel));
+	for (size_t i = 0; i < levelCount; i++) {
+		if (!levels[i].empty()) {
+			memcpy(blob.data() + table[i].offset, levels[i].data(), levels[i].size());
+		}
+	}
+	return write_atomic(path, blob);
+}
+
+bool vkcook::load_texture(const char* path, const std::vector<const char*>& sources, CookedTexture& outTexture)
+{
+	auto file = std::make_shared<MappedFile>();
+	if (!file->open(path) || file->size() < sizeof(TextureHeader)) {
+		return false;
+	}
+
+	TextureHeader header;
+	memcpy(&header, file->data(), sizeof(header));
+	if (header.magic != TEXTURE_MAGIC || header.version != TEXTURE_VERSION || header.fileSize != file->size() ||
+		header.levelCount == 0 || header.layerCount == 0) {
+		return false;
+	}
+
+	const size_t levelCount = size_t(header.levelCount) * header.layerCount;
+	if (sizeof(TextureHeader) + levelCount * sizeof(TextureLevel) > file->size()) {
+		return false;
+	}
+	const TextureLevel* table = reinterpret_cast<const TextureLevel*>(file->data() + sizeof(TextureHeader));
+	for (size_t i = 0; i < levelCount; i++) {
+		if (table[i].offset % DATA_ALIGNMENT != 0 || table[i].offset + table[i].size > header.fileSize) {
+			return false;
+		}
+	}
+
+	//sources that are missing (cache shipped alone) are accepted as is
+	SourceStamp stamp;
+	if (stamp_sources(sources, stamp, false) && (stamp.size != header.sourceSize || stamp.mtime != header.sourceTime)) {
+		//the files were touched, only the content decides
+		if (!stamp_sources(sources, stamp, true) || stamp.hash != header.sourceHash) {
+			return false;
+		}
+		header.sourceSize = stamp.size;
+		header.sourceTime = stamp.mtime;
+		file->close();
+		if (!rewrite_texture_header(path, header) || !file->open(path)) {
+			return false;
+		}
+	}
+
+	outTexture.file = file;
+	outTexture.header = header;
+	return true;
+}
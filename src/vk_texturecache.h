@@ -0,0 +1,57 @@
+#pragma once
+
+#include <vk_meshcache.h>
+#include <vk_bcenc.h>
+#include <vector>
+#include <string>
+#include <memory>
+
+//cooked textures are the BCn blocks of every mip and layer in a versioned container written next to the first source
+//as <source>.vktex. like KTX2 the levels are stored largest first behind an offset table, so loading maps the file
+//and copies each level straight into the staging ring without decoding anything
+namespace vkcook {
+
+	const uint32_t TEXTURE_MAGIC = 0x58544b56; //"VKTX"
+	const uint32_t TEXTURE_VERSION = 1;
+
+	struct TextureHeader {
+		uint32_t magic;
+		uint32_t version;
+		uint64_t sourceSize;
+		int64_t sourceTime;
+		uint64_t sourceHash;
+		//VkFormat the blocks are uploaded as
+		uint32_t vkFormat;
+		uint32_t blockFormat;
+		uint32_t width;
+		uint32_t height;
+		uint32_t levelCount;
+		uint32_t layerCount;
+		uint64_t fileSize;
+	};
+
+	//one per mip and layer, index level * layerCount + layer
+	struct TextureLevel {
+		uint64_t offset;
+		uint64_t size;
+	};
+
+	struct CookedTexture {
+		std::shared_ptr<MappedFile> file;
+		TextureHeader header{};
+
+		const TextureLevel& level(uint32_t level, uint32_t layer) const;
+		const char* level_data(uint32_t level, uint32_t layer) const { return file->data() + this->level(level, layer).offset; }
+	};
+
+	std::string cooked_texture_path(const char* source);
+
+	//one source per layer, the stamp covers all of them: summed sizes, latest mtime and, when hashed, the combined content hash
+	bool stamp_sources(const std::vector<const char*>& sources, SourceStamp& outStamp, bool hash);
+
+	//levels holds the encoded blocks of every mip and layer in TextureLevel order
+	bool write_texture(const char* path, const SourceStamp& stamp, const TextureHeader& description, const std::vector<std::vector<uint8_t>>& levels);
+
+	//maps a cooked texture, a size/mtime mismatch falls back to comparing the source hash
+	bool load_texture(const char* path, const std::vector<const char*>& sources, CookedTexture& outTexture);
+}
@@ -0,0 +1,325 @@
+#include <vk_texturestream.h>
+#include <vk_engine.h>
+#include <vk_texture.h>
+#include <vk_initializers.h>
+#include <iostream>
+#include <algorithm>
+#include <cmath>
+
+void TextureStreamer::init(VulkanEngine& engine, VkDeviceSize budget, VkDeviceSize uploadBytesPerFrame)
+{
+	_engine = &engine;
+	_budget = budget;
+	_uploadBytesPerFrame = uploadBytesPerFrame;
+}
+
+void TextureStreamer::cleanup()
+{
+	for (Texture& texture : _textures) {
+		destroyImage(texture.image);
+		destroyImage(texture.pending);
+	}
+	_textures.clear();
+	_names.clear();
+}
+
+uint32_t TextureStreamer::addTexture(const std::string& name, const std::vector<const char*>& files, bool cube)
+{
+	Texture texture;
+	if (!vkutil::load_cooked_texture(*_engine, files, texture.source)) {
+		return INVALID_TEXTURE;
+	}
+	const vkcook::TextureHeader& header = texture.source.header;
+	if (header.layerCount != (cube ? 6u : 1u)) {
+		return INVALID_TEXTURE;
+	}
+	texture.name = name;
+	texture.cube = cube;
+	while (texture.tailMip + 1 < header.levelCount && (std::max(header.width, header.height) >> texture.tailMip) > TAIL_SIZE) {
+		texture.tailMip++;
+	}
+	texture.residentMip = texture.tailMip;
+	createResidency(texture, texture.tailMip, texture.image);
+
+	uint32_t index = static_cast<uint32_t>(_textures.size());
+	_textures.push_back(std::move(texture));
+	_names[name] = index;
+	return index;
+}
+
+uint32_t TextureStreamer::find(const std::string& name) const
+{
+	auto it = _names.find(name);
+	return it == _names.end() ? INVALID_TEXTURE : it->second;
+}
+
+void TextureStreamer::bindDescriptor(uint32_t texture, VkDescriptorSet set, uint32_t binding)
+{
+	_textures[texture].bindings.push_back({ set, binding });
+	VkDescriptorImageInfo descriptor = _textures[texture].image.descriptor;
+	VkWriteDescriptorSet write = vkinit::write_descriptor_image(VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, set, &descriptor, binding);
+	vkUpdateDescriptorSets(_engine->_device, 1, &write, 0, nullptr);
+}
+
+void TextureStreamer::setView(const glm::vec3& eye, float pixelsPerUnit)
+{
+	_eye = eye;
+	_pixelsPerUnit = pixelsPerUnit;
+}
+
+void TextureStreamer::requestTexture(uint32_t texture, const glm::vec3& center, float worldSize)
+{
+	Texture& t = _textures[texture];
+	//texels across the texture vs pixels it covers on screen, an object at the eye wants the top mip
+	const vkcook::TextureHeader& header = t.source.header;
+	float texels = static_cast<float>(std::max(header.width, header.height));
+	float distance = glm::length(center - _eye);
+	float pixels = distance > 0.0f ? worldSize * _pixelsPerUnit / distance : texels;
+	float demand = std::max(texels / std::max(pixels, 1.0f), 1.0f);
+	t.demand = t.demand < 0.0f ? demand : std::min(t.demand, demand);
+}
+
+void TextureStreamer::update()
+{
+	struct Candidate {
+		uint32_t texture;
+		uint32_t target;
+	};
+	std::vector<Candidate> candidates;
+	for (uint32_t i = 0; i < _textures.size(); i++) {
+		Texture& t = _textures[i];
+		if (t.demand < 0.0f) {
+			continue;
+		}
+		//every doubling of texels per pixel is one mip less
+		uint32_t target = std::min(static_cast<uint32_t>(std::floor(std::log2(t.demand))), t.tailMip);
+		t.lastRequested = _frame;
+		t.demand = -1.0f;
+		if (!t.uploading && target < t.residentMip) {
+			candidates.push_back({ i, target });
+		}
+	}
+
+	//the most undersampled textures first
+	std::sort(candidates.begin(), candidates.end(), [&](const Candidate& a, const Candidate& b) {
+		return _textures[a.texture].residentMip - a.target > _textures[b.texture].residentMip - b.target;
+	});
+
+	std::vector<uint32_t> issued;
+	VkDeviceSize issuedBytes = 0;
+	for (const Candidate& candidate : candidates) {
+		if (issuedBytes >= _uploadBytesPerFrame) {
+			break;
+		}
+		Texture& t = _textures[candidate.texture];
+		//one level per step, the texture sharpens progressively and each step is a bounded upload
+		uint32_t mip = t.residentMip - 1;
+		VkDeviceSize size = residencySize(t, mip);
+		VkDeviceSize current = t.image._mem.size;
+		if (!makeRoom(size > current ? size - current : 0, issued)) {
+			_budgetMisses++;
+			break;
+		}
+		createResidency(t, mip, t.pending);
+		t.pendingMip = mip;
+		t.uploading = true;
+		issued.push_back(candidate.texture);
+		issuedBytes += size;
+		_loads++;
+	}
+
+	if (!issued.empty()) {
+		uint64_t ticket = _engine->_uploadQueue.submit();
+		for (uint32_t texture : issued) {
+			_textures[texture].ticket = ticket;
+		}
+	}
+	_frame++;
+}
+
+bool TextureStreamer::makeRoom(VkDeviceSize needed, std::vector<uint32_t>& issued)
+{
+	while (committedBytes() + needed > _budget) {
+		//least recently requested texture holding more than its tail, textures wanted this frame are kept
+		uint32_t victim = INVALID_TEXTURE;
+		for (uint32_t i = 0; i < _textures.size(); i++) {
+			const Texture& t = _textures[i];
+			if (t.uploading || t.residentMip >= t.tailMip || t.lastRequested == _frame) {
+				continue;
+			}
+			if (victim == INVALID_TEXTURE || t.lastRequested < _textures[victim].lastRequested) {
+				victim = i;
+			}
+		}
+		if (victim == INVALID_TEXTURE) {
+			return false;
+		}
+		Texture& t = _textures[victim];
+		createResidency(t, t.tailMip, t.pending);
+		t.pendingMip = t.tailMip;
+		t.uploading = true;
+		issued.push_back(victim);
+		_evictions++;
+	}
+	return true;
+}
+
+VkDeviceSize TextureStreamer::committedBytes() const
+{
+	VkDeviceSize bytes = 0;
+	for (const Texture& t : _textures) {
+		bytes += t.uploading ? t.pending._mem.size : t.image._mem.size;
+	}
+	return bytes;
+}
+
+bool TextureStreamer::hasPendingSwaps()
+{
+	bool any = false;
+	for (Texture& t : _textures) {
+		if (t.uploading && !t.complete) {
+			t.complete = _engine->_uploadQueue.poll(t.ticket);
+		}
+		any |= t.complete;
+	}
+	return any;
+}
+
+void TextureStreamer::applySwaps()
+{
+	for (Texture& t : _textures) {
+		if (!t.complete) {
+			continue;
+		}
+		destroyImage(t.image);
+		t.image = t.pending;
+		t.pending = AllocatedImage{};
+		t.residentMip = t.pendingMip;
+		t.uploading = false;
+		t.complete = false;
+		writeDescriptors(t);
+	}
+}
+
+void TextureStreamer::createResidency(Texture& texture, uint32_t mip, AllocatedImage& out)
+{
+	const vkcook::TextureHeader& header = texture.source.header;
+	VkFormat format = static_cast<VkFormat>(header.vkFormat);
+	const uint32_t levelCount = header.levelCount - mip;
+
+	VkExtent3D extent;
+	extent.width = std::max(header.width >> mip, 1u);
+	extent.height = std::max(header.height >> mip, 1u);
+	extent.depth = 1;
+
+	VkImageCreateInfo imageInfo = vkinit::image_create_info(format, VK_IMAGE_USAGE_SAMPLED_BIT | VK_IMAGE_USAGE_TRANSFER_DST_BIT, extent);
+	imageInfo.mipLevels = levelCount;
+	imageInfo.arrayLayers = header.layerCount;
+	if (texture.cube) {
+		imageInfo.flags = VK_IMAGE_CREATE_CUBE_COMPATIBLE_BIT;
+	}
+
+	AllocatedImage image;
+	_engine->createImage(imageInfo, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, image._image, image._mem);
+
+	//every level comes from the mapping, the old image may still be in use and is never read back
+	UploadQueue& uploads = _engine->_uploadQueue;
+	uploads.transitionImage(image._image, VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, header.layerCount, levelCount);
+	uint32_t width = extent.width;
+	uint32_t height = extent.height;
+	for (uint32_t level = 0; level < levelCount; level++) {
+		for (uint32_t layer = 0; layer < header.layerCount; layer++) {
+			const vkcook::TextureLevel& source = texture.source.level(mip + level, layer);
+			uploads.uploadImage(image._image, texture.source.level_data(mip + level, layer), source.size, width, height, layer, level, 4);
+			_uploadedBytes += source.size;
+		}
+		width = std::max(width / 2, 1u);
+		height = std::max(height / 2, 1u);
+	}
+	uploads.transitionImage(image._image, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL, header.layerCount, levelCount);
+
+	VkImageViewCreateInfo viewInfo{};
+	viewInfo.sType = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO;
+	viewInfo.image = image._image;
+	viewInfo.format = format;
+	viewInfo.viewType = texture.cube ? VK_IMAGE_VIEW_TYPE_CUBE : VK_IMAGE_VIEW_TYPE_2D;
+	viewInfo.subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+	viewInfo.subresourceRange.baseMipLevel = 0;
+	viewInfo.subresourceRange.levelCount = levelCount;
+	viewInfo.subresourceRange.baseArrayLayer = 0;
+	viewInfo.subresourceRange.layerCount = header.layerCount;
+	image._view = _engine->createImageView(image._image, viewInfo);
+	image._sampler = _engine->createTextureSampler();
+
+	image.descriptor.imageLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+	image.descriptor.sampler = image._sampler;
+	image.descriptor.imageView = image._view;
+	out = image;
+}
+
+void TextureStreamer::destroyImage(AllocatedImage& image)
+{
+	if (image._image == VK_NULL_HANDLE) {
+		return;
+	}
+	vkDestroyImageView(_engine->_device, image._view, nullptr);
+	vkDestroyImage(_engine->_device, image._image, nullptr);
+	_engine->_allocator.free(image._mem);
+	image = AllocatedImage{};
+}
+
+void TextureStreamer::writeDescriptors(const Texture& texture)
+{
+	if (texture.bindings.empty()) {
+		return;
+	}
+	std::vector<VkWriteDescriptorSet> writes;
+	writes.reserve(texture.bindings.size());
+	VkDescriptorImageInfo descriptor = texture.image.descriptor;
+	for (const Binding& binding : texture.bindings) {
+		writes.push_back(vkinit::write_descriptor_image(VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, binding.set, &descriptor, binding.binding));
+	}
+	vkUpdateDescriptorSets(_engine->_device, static_cast<uint32_t>(writes.size()), writes.data(), 0, nullptr);
+}
+
+VkDeviceSize TextureStreamer::residencySize(const Texture& texture, uint32_t mip) const
+{
+	const vkcook::TextureHeader& header = texture.source.header;
+	VkDeviceSize size = 0;
+	for (uint32_t level = mip; level < header.levelCount; level++) {
+		for (uint32_t layer = 0; layer < header.layerCount; layer++) {
+			size += texture.source.level(level, layer).size;
+		}
+	}
+	return size;
+}
+
+TextureStreamer::Stats TextureStreamer::stats() const
+{
+	Stats stats{};
+	stats.textureCount = static_cast<uint32_t>(_textures.size());
+	stats.budgetBytes = _budget;
+	for (const Texture& t : _textures) {
+		stats.fullyResident += t.residentMip == 0 ? 1 : 0;
+		stats.residentBytes += t.image._mem.size;
+		if (t.uploading) {
+			stats.pendingUploads++;
+			stats.pendingBytes += t.pending._mem.size;
+		}
+		stats.fullBytes += residencySize(t, 0);
+	}
+	stats.uploadedBytes = _uploadedBytes;
+	stats.loads = _loads;
+	stats.evictions = _evictions;
+	stats.budgetMisses = _budgetMisses;
+	return stats;
+}
+
+void TextureStreamer::printStats() const
+{
+	Stats s = stats();
+	std::cout << "Texture streaming: " << s.fullyResident << "/" << s.textureCount << " textures fully resident, "
+		<< s.residentBytes / 1024 << " KiB resident (" << s.fullBytes / 1024 << " KiB fully loaded) of a "
+		<< s.budgetBytes / 1024 << " KiB budget, " << s.uploadedBytes / 1024 << " KiB streamed in " << s.loads << " loads, "
+		<< s.evictions << " evictions, " << s.budgetMisses << " loads over budget" << std::endl;
+}
@@ -0,0 +1,134 @@
+#pragma once
+
+#include <vk_types.h>
+#include <vk_texturecache.h>
+#include <glm/glm.hpp>
+#include <vector>
+#include <string>
+#include <unordered_map>
+
+class VulkanEngine;
+
+//keeps cooked textures partially resident under a VRAM budget. a texture starts with only its mip tail (levels of at most
+//TAIL_SIZE texels) so it can be drawn right away, higher mips are streamed from the mapped .vktex file one level at a time
+//as the camera asks for them. without sparse binding a residency change means a new image holding levels mip..last, the
+//old image stays bound until the upload has completed and every frame that used it has finished.
+//textures nobody requested recently drop back to their mip tail when a load would not fit the budget
+class TextureStreamer {
+public:
+	static const uint32_t INVALID_TEXTURE = UINT32_MAX;
+	//largest dimension of the levels that are always resident
+	static const uint32_t TAIL_SIZE = 64;
+
+	struct Stats {
+		uint32_t textureCount;
+		//textures with every mip resident
+		uint32_t fullyResident;
+		uint32_t pendingUploads;
+		VkDeviceSize budgetBytes;
+		//device memory of the bound images
+		VkDeviceSize residentBytes;
+		//device memory of images still uploading, they count against the budget in place of the bound ones
+		VkDeviceSize pendingBytes;
+		//memory every texture would take fully resident
+		VkDeviceSize fullBytes;
+		uint64_t uploadedBytes;
+		uint32_t loads;
+		uint32_t evictions;
+		//loads postponed because nothing could be evicted
+		uint32_t budgetMisses;
+	};
+
+	void init(VulkanEngine& engine, VkDeviceSize budget, VkDeviceSize uploadBytesPerFrame);
+
+	void cleanup();
+
+	//maps (cooking first if needed) the sources, one per layer, and records the upload of the mip tail.
+	//INVALID_TEXTURE when the sources cannot be cooked, the caller then loads the texture the regular way
+	uint32_t addTexture(const std::string& name, const std::vector<const char*>& files, bool cube);
+
+	uint32_t find(const std::string& name) const;
+
+	//currently bound image, changes when the residency does
+	const AllocatedImage& image(uint32_t texture) const { return _textures[texture].image; }
+
+	//writes the texture to set/binding now and again whenever its residency changes
+	void bindDescriptor(uint32_t texture, VkDescriptorSet set, uint32_t binding);
+
+	//camera of the frame the following requests are made for. pixelsPerUnit is the projected size in pixels of one unit
+	//at distance one (viewport height / 2 * proj[1][1])
+	void setView(const glm::vec3& eye, float pixelsPerUnit);
+
+	//screen space demand for this frame: the full width of the texture spans worldSize units on an object at center
+	void requestTexture(uint32_t texture, const glm::vec3& center, float worldSize);
+
+	//turns this frame's requests into target mips and records the uploads that fit the budget and the per frame limit
+	void update();
+
+	//true once an upload issued by update has completed and its image can be swapped in
+	bool hasPendingSwaps();
+
+	//binds the completed images, rewrites their descriptors and frees the replaced ones.
+	//the caller guarantees no submitted frame still uses the old images or descriptor sets
+	void applySwaps();
+
+	Stats stats() const;
+
+	void printStats() const;
+
+private:
+	struct Binding {
+		VkDescriptorSet set;
+		uint32_t binding;
+	};
+
+	struct Texture {
+		std::string name;
+		vkcook::CookedTexture source;
+		bool cube{ false };
+		AllocatedImage image{};
+		//first level held by image
+		uint32_t residentMip{ 0 };
+		uint32_t tailMip{ 0 };
+		//texels per screen pixel of the closest request this frame, negative when not requested
+		float demand{ -1.0f };
+		uint64_t lastRequested{ 0 };
+
+		AllocatedImage pending{};
+		uint32_t pendingMip{ 0 };
+		uint64_t ticket{ 0 };
+		bool uploading{ false };
+		bool complete{ false };
+
+		std::vector<Binding> bindings;
+	};
+
+	//creates out with levels mip..last and records their upload from the mapped file
+	void createResidency(Texture& texture, uint32_t mip, AllocatedImage& out);
+	void destroyImage(AllocatedImage& image);
+	void writeDescriptors(const Texture& texture);
+	//file size of levels mip..last, the estimate used before an image exists
+	VkDeviceSize residencySize(const Texture& texture, uint32_t mip) const;
+	//shrinks the least recently requested textures to their tail until needed bytes fit, false if that is not possible.
+	//shrunk textures are appended to issued
+	bool makeRoom(VkDeviceSize needed, std::vector<uint32_t>& issued);
+	//memory of every texture at the residency it is settling on, pending images replace the bound ones.
+	//the overlap while an image uploads is not counted
+	VkDeviceSize committedBytes() const;
+
+	VulkanEngine* _engine{ nullptr };
+	VkDeviceSize _budget{ 0 };
+	VkDeviceSize _uploadBytesPerFrame{ 0 };
+	glm::vec3 _eye{ 0.0f };
+	float _pixelsPerUnit{ 1.0f };
+	//starts at 1, lastRequested 0 means never requested
+	uint64_t _frame{ 1 };
+
+	std::vector<Texture> _textures;
+	std::unordered_map<std::string, uint32_t> _names;
+
+	uint64_t _uploadedBytes{ 0 };
+	uint32_t _loads{ 0 };
+	uint32_t _evictions{ 0 };
+	uint32_t _budgetMisses{ 0 };
+};
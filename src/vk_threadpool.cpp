@@ -0,0 +1,105 @@
+#include <vk_threadpool.h>
+#include <memory>
+#include <algorithm>
+
+void ThreadPool::init(uint32_t threadCount)
+{
+	if (threadCount == 0) {
+		uint32_t hardware = std::thread::hardware_concurrency();
+		threadCount = hardware > 1 ? hardware - 1 : 0;
+	}
+
+	_stop = false;
+	for (uint32_t i = 0; i < threadCount; i++) {
+		_workers.emplace_back([this]() { worker(); });
+	}
+}
+
+void ThreadPool::cleanup()
+{
+	{
+		std::lock_guard<std::mutex> lock(_mutex);
+		_stop = true;
+	}
+	_wake.notify_all();
+
+	for (auto& thread : _workers) {
+		thread.join();
+	}
+	_workers.clear();
+	_jobs.clear();
+}
+
+void ThreadPool::worker()
+{
+	while (true) {
+		std::function<void()> job;
+		{
+			std::unique_lock<std::mutex> lock(_mutex);
+			_wake.wait(lock, [this]() { return _stop || !_jobs.empty(); });
+			if (_stop && _jobs.empty()) {
+				return;
+			}
+			job = std::move(_jobs.front());
+			_jobs.pop_front();
+		}
+		job();
+	}
+}
+
+void ThreadPool::enqueue(std::function<void()>&& job)
+{
+	if (_workers.empty()) {
+		job();
+		return;
+	}
+	{
+		std::lock_guard<std::mutex> lock(_mutex);
+		_jobs.push_back(std::move(job));
+	}
+	_wake.notify_one();
+}
+
+void ThreadPool::parallel_for(uint32_t count, const std::function<void(uint32_t)>& func)
+{
+	if (count == 0) {
+		return;
+	}
+	if (_workers.empty() || count == 1) {
+		for (uint32_t i = 0; i < count; i++) {
+			func(i);
+		}
+		return;
+	}
+
+	struct Work {
+		std::atomic<uint32_t> next{ 0 };
+		std::atomic<uint32_t> finished{ 0 };
+		std::mutex mutex;
+		std::condition_variable done;
+	};
+	auto work = std::make_shared<Work>();
+
+	//helpers that start after every index was taken leave without touching func
+	auto run = [work, count, &func]() {
+		uint32_t completed = 0;
+		uint32_t i;
+		while ((i = work->next.fetch_add(1)) < count) {
+			func(i);
+			completed++;
+		}
+		if (completed > 0 && work->finished.fetch_add(completed) + completed == count) {
+			std::lock_guard<std::mutex> lock(work->mutex);
+			work->done.notify_all();
+		}
+	};
+
+	uint32_t helpers = std::min<uint32_t>(static_cast<uint32_t>(_workers.size()), count - 1);
+	for (uint32_t h = 0; h < helpers; h++) {
+		enqueue(run);
+	}
+	run();
+
+	std::unique_lock<std::mutex> lock(work->mutex);
+	work->done.wait(lock, [&]() { return work->finished.load() == count; });
+}
@@ -0,0 +1,35 @@
+#pragma once
+
+#include <vector>
+#include <deque>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+#include <atomic>
+
+//fixed set of worker threads for CPU side loading/preprocessing work
+class ThreadPool {
+public:
+	//0 uses one worker less than the hardware threads, the calling thread joins in on parallel_for
+	void init(uint32_t threadCount = 0);
+
+	void cleanup();
+
+	void enqueue(std::function<void()>&& job);
+
+	//runs func(i) for every i in [0,count) on the workers and the calling thread, returns once all calls finished
+	void parallel_for(uint32_t count, const std::function<void(uint32_t)>& func);
+
+	//number of threads taking part in parallel_for, including the caller
+	uint32_t concurrency() const { return static_cast<uint32_t>(_workers.size()) + 1; }
+
+private:
+	void worker();
+
+	std::vector<std::thread> _workers;
+	std::deque<std::function<void()>> _jobs;
+	std::mutex _mutex;
+	std::condition_variable _wake;
+	bool _stop{ false };
+};
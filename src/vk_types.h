@@ -9,10 +9,37 @@
 #include <string>
 #include <string.h>
 
+//we want to immediately abort when there is an error. In normal engines this would give an error message to the user, or perform a dump of state.
+#define VK_CHECK(x)                                                 \
+	do                                                              \
+	{                                                               \
+		VkResult err = x;                                           \
+		if (err)                                                    \
+		{                                                           \
+			std::cout <<"Detected Vulkan error: " << err << std::endl; \
+			abort();                                                \
+		}                                                           \
+	} while (0);
+
+//upper bound of VulkanEngine::_framesInFlight
+constexpr uint32_t MAX_FRAMES_IN_FLIGHT = 3;
+
+//a sub-range of a pooled VkDeviceMemory block handed out by MemoryAllocator
+struct Allocation {
+	VkDeviceMemory memory{ VK_NULL_HANDLE };
+	VkDeviceSize offset{ 0 };
+	VkDeviceSize size{ 0 };
+	//persistently mapped pointer to offset, only set for host visible memory
+	void* mapped{ nullptr };
+	uint32_t memoryType{ 0 };
+	uint32_t block{ 0 };
+	uint32_t pool{ 0 };
+};
+
 struct AllocatedImage {
 	VkImage _image;
 	VkImageView _view;
     VkSampler _sampler;
-    VkDeviceMemory _mem;
+    Allocation _mem;
     VkDescriptorImageInfo descriptor{};
 };
\ No newline at end of file
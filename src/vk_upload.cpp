@@ -0,0 +1,566 @@
+#include <vk_upload.h>
+#include <vk_initializers.h>
+#include <iostream>
+#include <algorithm>
+
+static VkDeviceSize align_up(VkDeviceSize value, VkDeviceSize alignment)
+{
+	return (value + alignment - 1) & ~(alignment - 1);
+}
+
+//access mask and stage a layout is written/read with. only transfer stages are valid on a transfer-only queue
+static void layout_access(VkImageLayout layout, VkAccessFlags& access, VkPipelineStageFlags& stage)
+{
+	switch (layout) {
+	case VK_IMAGE_LAYOUT_UNDEFINED:
+		access = 0;
+		stage = VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT;
+		break;
+	case VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL:
+		access = VK_ACCESS_TRANSFER_WRITE_BIT;
+		stage = VK_PIPELINE_STAGE_TRANSFER_BIT;
+		break;
+	case VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL:
+		access = VK_ACCESS_TRANSFER_READ_BIT;
+		stage = VK_PIPELINE_STAGE_TRANSFER_BIT;
+		break;
+	case VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL:
+		access = VK_ACCESS_SHADER_READ_BIT;
+		stage = VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT;
+		break;
+	default:
+		std::cout << "unsupported layout transition" << std::endl;
+		access = VK_ACCESS_MEMORY_READ_BIT | VK_ACCESS_MEMORY_WRITE_BIT;
+		stage = VK_PIPELINE_STAGE_ALL_COMMANDS_BIT;
+		break;
+	}
+}
+
+void UploadQueue::init(VkDevice device, MemoryAllocator& allocator, VkDeviceSize stagingSize,
+	uint32_t graphicsFamily, VkQueue graphicsQueue, uint32_t transferFamily, VkQueue transferQueue)
+{
+	_device = device;
+	_allocator = &allocator;
+	_graphicsFamily = graphicsFamily;
+	_graphicsQueue = graphicsQueue;
+	_transferFamily = transferFamily;
+	_transferQueue = transferQueue;
+
+	VkCommandPoolCreateInfo poolInfo = vkinit::command_pool_create_info(_transferFamily, VK_COMMAND_POOL_CREATE_RESET_COMMAND_BUFFER_BIT);
+	VK_CHECK(vkCreateCommandPool(_device, &poolInfo, nullptr, &_transferPool));
+
+	if (hasDedicatedTransfer()) {
+		poolInfo = vkinit::command_pool_create_info(_graphicsFamily, VK_COMMAND_POOL_CREATE_RESET_COMMAND_BUFFER_BIT);
+		VK_CHECK(vkCreateCommandPool(_device, &poolInfo, nullptr, &_graphicsPool));
+	}
+	else {
+		_graphicsPool = _transferPool;
+	}
+
+	//one persistently mapped staging buffer for every upload, only ever read by the transfer queue
+	VkBufferCreateInfo bufferInfo{};
+	bufferInfo.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
+	bufferInfo.size = stagingSize;
+	bufferInfo.usage = VK_BUFFER_USAGE_TRANSFER_SRC_BIT;
+	bufferInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+	VK_CHECK(vkCreateBuffer(_device, &bufferInfo, nullptr, &_stagingBuffer));
+
+	VkMemoryRequirements memRequirements{};
+	vkGetBufferMemoryRequirements(_device, _stagingBuffer, &memRequirements);
+	if (!_allocator->allocate(memRequirements, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, _stagingMemory)) {
+		std::cout << "Failed to allocate the staging ring" << std::endl;
+		abort();
+	}
+	VK_CHECK(vkBindBufferMemory(_device, _stagingBuffer, _stagingMemory.memory, _stagingMemory.offset));
+
+	_stagingMapped = static_cast<char*>(_stagingMemory.mapped);
+	_stagingSize = stagingSize;
+	_stagingHead = 0;
+	_stagingRegions.clear();
+}
+
+void UploadQueue::cleanup()
+{
+	while (!_inFlight.empty()) {
+		wait(_inFlight.back().ticket);
+	}
+
+	auto destroy = [&](Batch& batch) {
+		for (auto& func : batch.completions) {
+			func();
+		}
+		if (batch.fence != VK_NULL_HANDLE)
+			vkDestroyFence(_device, batch.fence, nullptr);
+		if (batch.semaphore != VK_NULL_HANDLE)
+			vkDestroySemaphore(_device, batch.semaphore, nullptr);
+	};
+
+	destroy(_recording);
+	_recording = Batch{};
+	for (auto& batch : _free) {
+		destroy(batch);
+	}
+	_free.clear();
+
+	vkDestroyBuffer(_device, _stagingBuffer, nullptr);
+	_allocator->free(_stagingMemory);
+	_stagingBuffer = VK_NULL_HANDLE;
+	_stagingMapped = nullptr;
+	_stagingRegions.clear();
+
+	//destroying the pools frees every command buffer allocated from them
+	if (_graphicsPool != _transferPool)
+		vkDestroyCommandPool(_device, _graphicsPool, nullptr);
+	vkDestroyCommandPool(_device, _transferPool, nullptr);
+	_graphicsPool = _transferPool = VK_NULL_HANDLE;
+}
+
+UploadQueue::Batch& UploadQueue::current()
+{
+	if (_recording.recording) {
+		return _recording;
+	}
+
+	if (_recording.fence == VK_NULL_HANDLE) {
+		if (!_free.empty()) {
+			_recording = std::move(_free.back());
+			_free.pop_back();
+		}
+		else {
+			VkCommandBufferAllocateInfo allocInfo = vkinit::command_buffer_allocate_info(_transferPool, 1);
+			VK_CHECK(vkAllocateCommandBuffers(_device, &allocInfo, &_recording.transferCmd));
+			if (hasDedicatedTransfer()) {
+				allocInfo = vkinit::command_buffer_allocate_info(_graphicsPool, 1);
+				VK_CHECK(vkAllocateCommandBuffers(_device, &allocInfo, &_recording.graphicsCmd));
+			}
+			else {
+				_recording.graphicsCmd = _recording.transferCmd;
+			}
+
+			VkFenceCreateInfo fenceInfo = vkinit::fence_create_info();
+			VK_CHECK(vkCreateFence(_device, &fenceInfo, nullptr, &_recording.fence));
+			VkSemaphoreCreateInfo semaphoreInfo = vkinit::semaphore_create_info();
+			VK_CHECK(vkCreateSemaphore(_device, &semaphoreInfo, nullptr, &_recording.semaphore));
+		}
+	}
+
+	VkCommandBufferBeginInfo beginInfo = vkinit::command_buffer_begin_info(VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT);
+	VK_CHECK(vkBeginCommandBuffer(_recording.transferCmd, &beginInfo));
+	_recording.recording = true;
+	_recording.graphicsUsed = false;
+	return _recording;
+}
+
+VkCommandBuffer UploadQueue::graphicsCommands()
+{
+	Batch& batch = current();
+	if (hasDedicatedTransfer() && !batch.graphicsUsed) {
+		VkCommandBufferBeginInfo beginInfo = vkinit::command_buffer_begin_info(VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT);
+		VK_CHECK(vkBeginCommandBuffer(batch.graphicsCmd, &beginInfo));
+	}
+	batch.graphicsUsed = true;
+	return batch.graphicsCmd;
+}
+
+void UploadQueue::releaseToGraphics(const VkImageMemoryBarrier* imageBarrier, const VkBufferMemoryBarrier* bufferBarrier, VkPipelineStageFlags dstStage)
+{
+	//release half on the transfer queue, the acquire half has to repeat the same ownership and layout change
+	vkCmdPipelineBarrier(current().transferCmd,
+		VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, 0,
+		0, nullptr,
+		bufferBarrier ? 1 : 0, bufferBarrier,
+		imageBarrier ? 1 : 0, imageBarrier);
+
+	VkImageMemoryBarrier acquireImage{};
+	VkBufferMemoryBarrier acquireBuffer{};
+	if (imageBarrier) {
+		acquireImage = *imageBarrier;
+		acquireImage.srcAccessMask = 0;
+	}
+	if (bufferBarrier) {
+		acquireBuffer = *bufferBarrier;
+		acquireBuffer.srcAccessMask = 0;
+	}
+
+	vkCmdPipelineBarrier(graphicsCommands(),
+		VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, dstStage, 0,
+		0, nullptr,
+		bufferBarrier ? 1 : 0, bufferBarrier ? &acquireBuffer : nullptr,
+		imageBarrier ? 1 : 0, imageBarrier ? &acquireImage : nullptr);
+}
+
+bool UploadQueue::tryAllocateStaging(VkDeviceSize size, VkDeviceSize alignment, VkDeviceSize& outOffset)
+{
+	if (_stagingRegions.empty()) {
+		_stagingHead = 0;
+	}
+
+	//live data is [tail, head) modulo the ring size, head == tail with live regions means the ring is full
+	VkDeviceSize tail = _stagingRegions.empty() ? 0 : _stagingRegions.front().begin;
+	VkDeviceSize offset = align_up(_stagingHead, alignment);
+
+	if (_stagingRegions.empty() || _stagingHead > tail) {
+		if (offset + size > _stagingSize) {
+			//wrap around, the end of the ring is skipped
+			offset = 0;
+			if (_stagingRegions.empty() || size > tail) {
+				return false;
+			}
+		}
+	}
+	else if (_stagingHead == tail || offset + size > tail) {
+		return false;
+	}
+
+	uint64_t ticket = _nextTicket;
+	if (!_stagingRegions.empty() && _stagingRegions.back().ticket == ticket && _stagingRegions.back().end <= offset) {
+		_stagingRegions.back().end = offset + size;
+	}
+	else {
+		_stagingRegions.push_back({ offset, offset + size, ticket });
+	}
+	_stagingHead = offset + size;
+	outOffset = offset;
+	return true;
+}
+
+void UploadQueue::reclaimStaging()
+{
+	poll(0);
+	while (!_stagingRegions.empty() && _stagingRegions.front().ticket <= _completedTicket) {
+		_stagingRegions.pop_front();
+	}
+}
+
+VkDeviceSize UploadQueue::allocateStaging(VkDeviceSize size, VkDeviceSize alignment)
+{
+	VkDeviceSize offset = 0;
+	if (tryAllocateStaging(size, alignment, offset)) {
+		return offset;
+	}
+	reclaimStaging();
+	if (tryAllocateStaging(size, alignment, offset)) {
+		return offset;
+	}
+
+	//ring is full, wait for the oldest batch. if that is the one being recorded it has to go out first
+	_stagingStalls++;
+	while (!tryAllocateStaging(size, alignment, offset)) {
+		uint64_t oldest = _stagingRegions.front().ticket;
+		if (oldest >= _nextTicket) {
+			submit();
+		}
+		wait(oldest);
+		reclaimStaging();
+	}
+	return offset;
+}
+
+void UploadQueue::uploadBuffer(VkBuffer dst, const void* data, VkDeviceSize size, VkDeviceSize dstOffset)
+{
+	const char* src = static_cast<const char*>(data);
+	//half the ring per chunk so the next chunk can be written while the previous one is copied
+	VkDeviceSize maxChunk = _stagingSize / 2;
+
+	while (size > 0) {
+		VkDeviceSize chunk = std::min(size, maxChunk);
+		VkDeviceSize offset = allocateStaging(chunk, 16);
+		memcpy(_stagingMapped + offset, src, chunk);
+		copyBuffer(_stagingBuffer, dst, chunk, offset, dstOffset);
+
+		src += chunk;
+		dstOffset += chunk;
+		size -= chunk;
+		_stagedBytes += chunk;
+	}
+}
+
+void UploadQueue::uploadImage(VkImage image, const void* data, VkDeviceSize size, uint32_t width, uint32_t height, uint32_t baseLayer, uint32_t mipLevel, uint32_t blockSize)
+{
+	const char* src = static_cast<const char*>(data);
+	uint32_t rowCount = (height + blockSize - 1) / blockSize;
+	VkDeviceSize rowPitch = size / rowCount;
+	if (rowPitch > _stagingSize / 2) {
+		std::cout << "Image row of " << rowPitch << " bytes does not fit the staging ring" << std::endl;
+		return;
+	}
+	uint32_t rowsPerChunk = static_cast<uint32_t>(std::min<VkDeviceSize>(rowCount, (_stagingSize / 2) / rowPitch));
+
+	for (uint32_t row = 0; row < rowCount; row += rowsPerChunk) {
+		uint32_t rows = std::min(rowsPerChunk, rowCount - row);
+		VkDeviceSize bytes = rows * rowPitch;
+		//16 is a multiple of every uncompressed texel size, of the BC block sizes and of 4 as required for buffer image copies
+		VkDeviceSize offset = allocateStaging(bytes, 16);
+		memcpy(_stagingMapped + offset, src + row * rowPitch, bytes);
+
+		uint32_t y = row * blockSize;
+		VkBufferImageCopy region{};
+		region.bufferOffset = offset;
+		region.imageSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+		region.imageSubresource.mipLevel = mipLevel;
+		region.imageSubresource.baseArrayLayer = baseLayer;
+		region.imageSubresource.layerCount = 1;
+		region.imageOffset = { 0, static_cast<int32_t>(y), 0 };
+		region.imageExtent = { width, std::min(rows * blockSize, height - y), 1 };
+
+		vkCmdCopyBufferToImage(current().transferCmd, _stagingBuffer, image, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, 1, &region);
+		_commandsRecorded++;
+		_stagedBytes += bytes;
+	}
+}
+
+void UploadQueue::copyBuffer(VkBuffer src, VkBuffer dst, VkDeviceSize size, VkDeviceSize srcOffset, VkDeviceSize dstOffset)
+{
+	VkBufferCopy region{};
+	region.srcOffset = srcOffset;
+	region.dstOffset = dstOffset;
+	region.size = size;
+	vkCmdCopyBuffer(current().transferCmd, src, dst, 1, &region);
+	_commandsRecorded++;
+
+	if (hasDedicatedTransfer()) {
+		VkBufferMemoryBarrier barrier{};
+		barrier.sType = VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER;
+		barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+		barrier.dstAccessMask = VK_ACCESS_VERTEX_ATTRIBUTE_READ_BIT | VK_ACCESS_INDEX_READ_BIT | VK_ACCESS_UNIFORM_READ_BIT | VK_ACCESS_SHADER_READ_BIT;
+		barrier.srcQueueFamilyIndex = _transferFamily;
+		barrier.dstQueueFamilyIndex = _graphicsFamily;
+		barrier.buffer = dst;
+		barrier.offset = dstOffset;
+		barrier.size = size;
+		releaseToGraphics(nullptr, &barrier, VK_PIPELINE_STAGE_ALL_COMMANDS_BIT);
+	}
+}
+
+void UploadQueue::copyBufferToImage(VkBuffer src, VkImage image, uint32_t width, uint32_t height, uint32_t layerCount, VkDeviceSize srcOffset, uint32_t mipLevel)
+{
+	VkBufferImageCopy region{};
+	region.bufferOffset = srcOffset;
+	region.bufferRowLength = 0;
+	region.bufferImageHeight = 0;
+
+	region.imageSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+	region.imageSubresource.mipLevel = mipLevel;
+	region.imageSubresource.baseArrayLayer = 0;
+	region.imageSubresource.layerCount = layerCount;
+
+	region.imageOffset = { 0, 0, 0 };
+	region.imageExtent = { width, height, 1 };
+
+	vkCmdCopyBufferToImage(current().transferCmd, src, image, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, 1, &region);
+	_commandsRecorded++;
+}
+
+void UploadQueue::transitionImage(VkImage image, VkImageLayout oldLayout, VkImageLayout newLayout, uint32_t layerCount, uint32_t levelCount)
+{
+	VkImageMemoryBarrier barrier{};
+	barrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+	barrier.oldLayout = oldLayout;
+	barrier.newLayout = newLayout;
+	barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+	barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+	barrier.image = image;
+	barrier.subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+	barrier.subresourceRange.baseMipLevel = 0;
+	barrier.subresourceRange.levelCount = levelCount;
+	barrier.subresourceRange.baseArrayLayer = 0;
+	barrier.subresourceRange.layerCount = layerCount;
+
+	VkPipelineStageFlags sourceStage{};
+	VkPipelineStageFlags destinationStage{};
+	layout_access(oldLayout, barrier.srcAccessMask, sourceStage);
+	layout_access(newLayout, barrier.dstAccessMask, destinationStage);
+	if (oldLayout == VK_IMAGE_LAYOUT_UNDEFINED) {
+		barrier.srcAccessMask = 0;
+	}
+	_commandsRecorded++;
+
+	//anything that ends up read by shaders is finished on the graphics queue
+	if (newLayout == VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL && hasDedicatedTransfer()) {
+		barrier.srcQueueFamilyIndex = _transferFamily;
+		barrier.dstQueueFamilyIndex = _graphicsFamily;
+		releaseToGraphics(&barrier, nullptr, destinationStage);
+		return;
+	}
+
+	vkCmdPipelineBarrier(current().transferCmd,
+		sourceStage, destinationStage, 0,
+		0, nullptr,
+		0, nullptr,
+		1, &barrier);
+}
+
+void UploadQueue::generateMipmaps(VkImage image, uint32_t width, uint32_t height, uint32_t levelCount, uint32_t layerCount)
+{
+	VkImageMemoryBarrier barrier{};
+	barrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+	barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+	barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+	barrier.image = image;
+	barrier.subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+	barrier.subresourceRange.baseMipLevel = 0;
+	barrier.subresourceRange.levelCount = levelCount;
+	barrier.subresourceRange.baseArrayLayer = 0;
+	barrier.subresourceRange.layerCount = layerCount;
+
+	if (hasDedicatedTransfer()) {
+		//blits need a graphics queue, the image is handed over as is right after its copies
+		barrier.oldLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+		barrier.newLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+		barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+		barrier.dstAccessMask = VK_ACCESS_TRANSFER_READ_BIT | VK_ACCESS_TRANSFER_WRITE_BIT;
+		barrier.srcQueueFamilyIndex = _transferFamily;
+		barrier.dstQueueFamilyIndex = _graphicsFamily;
+		releaseToGraphics(&barrier, nullptr, VK_PIPELINE_STAGE_TRANSFER_BIT);
+		barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+		barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+	}
+
+	VkCommandBuffer cmd = graphicsCommands();
+	barrier.subresourceRange.levelCount = 1;
+	int32_t mipWidth = static_cast<int32_t>(width);
+	int32_t mipHeight = static_cast<int32_t>(height);
+	for (uint32_t level = 1; level < levelCount; level++) {
+		//the previous mip becomes the blit source, it is final once the blit has read it
+		barrier.subresourceRange.baseMipLevel = level - 1;
+		barrier.oldLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+		barrier.newLayout = VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL;
+		barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+		barrier.dstAccessMask = VK_ACCESS_TRANSFER_READ_BIT;
+		vkCmdPipelineBarrier(cmd, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT, 0,
+			0, nullptr, 0, nullptr, 1, &barrier);
+
+		int32_t nextWidth = std::max(mipWidth / 2, 1);
+		int32_t nextHeight = std::max(mipHeight / 2, 1);
+		VkImageBlit blit{};
+		blit.srcOffsets[0] = { 0, 0, 0 };
+		blit.srcOffsets[1] = { mipWidth, mipHeight, 1 };
+		blit.srcSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+		blit.srcSubresource.mipLevel = level - 1;
+		blit.srcSubresource.baseArrayLayer = 0;
+		blit.srcSubresource.layerCount = layerCount;
+		blit.dstOffsets[0] = { 0, 0, 0 };
+		blit.dstOffsets[1] = { nextWidth, nextHeight, 1 };
+		blit.dstSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+		blit.dstSubresource.mipLevel = level;
+		blit.dstSubresource.baseArrayLayer = 0;
+		blit.dstSubresource.layerCount = layerCount;
+		vkCmdBlitImage(cmd, image, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL, image, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, 1, &blit, VK_FILTER_LINEAR);
+		_commandsRecorded++;
+
+		barrier.oldLayout = VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL;
+		barrier.newLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+		barrier.srcAccessMask = VK_ACCESS_TRANSFER_READ_BIT;
+		barrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
+		vkCmdPipelineBarrier(cmd, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT, 0,
+			0, nullptr, 0, nullptr, 1, &barrier);
+
+		mipWidth = nextWidth;
+		mipHeight = nextHeight;
+	}
+
+	//the smallest mip was only written
+	barrier.subresourceRange.baseMipLevel = levelCount - 1;
+	barrier.oldLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+	barrier.newLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+	barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+	barrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
+	vkCmdPipelineBarrier(cmd, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT, 0,
+		0, nullptr, 0, nullptr, 1, &barrier);
+	_commandsRecorded++;
+}
+
+void UploadQueue::onComplete(std::function<void()>&& func)
+{
+	current().completions.push_back(std::move(func));
+}
+
+uint64_t UploadQueue::submit()
+{
+	if (!_recording.recording) {
+		return 0;
+	}
+
+	Batch& batch = _recording;
+	batch.ticket = _nextTicket++;
+
+	if (!hasDedicatedTransfer()) {
+		//one queue: a single barrier makes every copy of the batch visible to later submissions
+		VkMemoryBarrier barrier{};
+		barrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+		barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+		barrier.dstAccessMask = VK_ACCESS_VERTEX_ATTRIBUTE_READ_BIT | VK_ACCESS_INDEX_READ_BIT | VK_ACCESS_UNIFORM_READ_BIT | VK_ACCESS_SHADER_READ_BIT;
+		vkCmdPipelineBarrier(batch.transferCmd,
+			VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_ALL_COMMANDS_BIT, 0,
+			1, &barrier, 0, nullptr, 0, nullptr);
+
+		VK_CHECK(vkEndCommandBuffer(batch.transferCmd));
+		VkSubmitInfo submit = vkinit::submit_info(&batch.transferCmd);
+		VK_CHECK(vkQueueSubmit(_graphicsQueue, 1, &submit, batch.fence));
+	}
+	else {
+		VK_CHECK(vkEndCommandBuffer(batch.transferCmd));
+		VkSubmitInfo submit = vkinit::submit_info(&batch.transferCmd);
+		if (batch.graphicsUsed) {
+			submit.signalSemaphoreCount = 1;
+			submit.pSignalSemaphores = &batch.semaphore;
+			VK_CHECK(vkQueueSubmit(_transferQueue, 1, &submit, VK_NULL_HANDLE));
+
+			VK_CHECK(vkEndCommandBuffer(batch.graphicsCmd));
+			VkPipelineStageFlags waitStage = VK_PIPELINE_STAGE_ALL_COMMANDS_BIT;
+			VkSubmitInfo graphicsSubmit = vkinit::submit_info(&batch.graphicsCmd);
+			graphicsSubmit.waitSemaphoreCount = 1;
+			graphicsSubmit.pWaitSemaphores = &batch.semaphore;
+			graphicsSubmit.pWaitDstStageMask = &waitStage;
+			VK_CHECK(vkQueueSubmit(_graphicsQueue, 1, &graphicsSubmit, batch.fence));
+		}
+		else {
+			VK_CHECK(vkQueueSubmit(_transferQueue, 1, &submit, batch.fence));
+		}
+	}
+
+	_batchesSubmitted++;
+	uint64_t ticket = batch.ticket;
+	_inFlight.push_back(std::move(batch));
+	_recording = Batch{};
+	return ticket;
+}
+
+void UploadQueue::retire(Batch& batch)
+{
+	for (auto& func : batch.completions) {
+		func();
+	}
+	batch.completions.clear();
+	VK_CHECK(vkResetFences(_device, 1, &batch.fence));
+	batch.recording = false;
+	batch.graphicsUsed = false;
+	_completedTicket = std::max(_completedTicket, batch.ticket);
+}
+
+bool UploadQueue::poll(uint64_t ticket)
+{
+	while (!_inFlight.empty() && vkGetFenceStatus(_device, _inFlight.front().fence) == VK_SUCCESS) {
+		retire(_inFlight.front());
+		_free.push_back(std::move(_inFlight.front()));
+		_inFlight.pop_front();
+	}
+	return ticket <= _completedTicket;
+}
+
+void UploadQueue::wait(uint64_t ticket)
+{
+	while (!_inFlight.empty() && _inFlight.front().ticket <= ticket) {
+		VK_CHECK(vkWaitForFences(_device, 1, &_inFlight.front().fence, VK_TRUE, UINT64_MAX));
+		retire(_inFlight.front());
+		_free.push_back(std::move(_inFlight.front()));
+		_inFlight.pop_front();
+	}
+}
+
+void UploadQueue::printStats() const
+{
+	std::cout << "Uploads: " << _batchesSubmitted << " batches, " << _commandsRecorded << " commands, "
+		<< _stagedBytes / 1024 << " KiB staged through a " << _stagingSize / 1024 << " KiB ring, "
+		<< _stagingStalls << " stalls" << (hasDedicatedTransfer() ? " (dedicated transfer queue)" : "") << std::endl;
+}
@@ -0,0 +1,123 @@
+#pragma once
+
+#include <vk_types.h>
+#include <vk_allocator.h>
+#include <vector>
+#include <deque>
+#include <functional>
+
+//batches buffer/image uploads into one command buffer per submit instead of a blocking submit per copy.
+//when the device exposes a dedicated transfer queue family the copies run there and ownership of the
+//destination resources is handed to the graphics family through a semaphore-ordered release/acquire pair.
+//source data is staged through one persistently mapped ring buffer whose regions are reclaimed by batch ticket.
+class UploadQueue {
+public:
+	void init(VkDevice device, MemoryAllocator& allocator, VkDeviceSize stagingSize,
+		uint32_t graphicsFamily, VkQueue graphicsQueue, uint32_t transferFamily, VkQueue transferQueue);
+
+	void cleanup();
+
+	//copies data into the staging ring and records the transfer to dst. data larger than the ring is streamed in chunks
+	void uploadBuffer(VkBuffer dst, const void* data, VkDeviceSize size, VkDeviceSize dstOffset = 0);
+
+	//same for one layer/mip of a tightly packed image already in TRANSFER_DST_OPTIMAL, large images are streamed by rows.
+	//blockSize is the texel height of one row of data, 4 for block compressed formats
+	void uploadImage(VkImage image, const void* data, VkDeviceSize size, uint32_t width, uint32_t height, uint32_t baseLayer = 0, uint32_t mipLevel = 0, uint32_t blockSize = 1);
+
+	//records a buffer copy, the destination is made visible to vertex/index/uniform/shader reads
+	void copyBuffer(VkBuffer src, VkBuffer dst, VkDeviceSize size, VkDeviceSize srcOffset = 0, VkDeviceSize dstOffset = 0);
+
+	//records a tightly packed buffer to image copy of every layer of one mip level, image must be in TRANSFER_DST_OPTIMAL
+	void copyBufferToImage(VkBuffer src, VkImage image, uint32_t width, uint32_t height, uint32_t layerCount = 1, VkDeviceSize srcOffset = 0, uint32_t mipLevel = 0);
+
+	//records a layout transition for all mips/layers. a transition to SHADER_READ_ONLY_OPTIMAL finishes on the graphics queue
+	void transitionImage(VkImage image, VkImageLayout oldLayout, VkImageLayout newLayout, uint32_t layerCount = 1, uint32_t levelCount = 1);
+
+	//fills mips 1..levelCount-1 from mip 0 with linear blits on the graphics queue and leaves every mip in
+	//SHADER_READ_ONLY_OPTIMAL. all mips must be in TRANSFER_DST_OPTIMAL and the format must support linear blits
+	void generateMipmaps(VkImage image, uint32_t width, uint32_t height, uint32_t levelCount, uint32_t layerCount = 1);
+
+	//command buffer executed on the graphics queue after the transfer work of the current batch, for blits etc.
+	VkCommandBuffer graphicsCommands();
+
+	//runs once the current batch has finished on the GPU, used to release staging resources
+	void onComplete(std::function<void()>&& func);
+
+	//submits everything recorded so far. returns a ticket for poll/wait, 0 if nothing was recorded
+	uint64_t submit();
+
+	//true once the batch with this ticket has completed, retires finished batches
+	bool poll(uint64_t ticket);
+
+	//blocks until the batch with this ticket has completed
+	void wait(uint64_t ticket);
+
+	//submit and wait for everything recorded so far
+	void flush() { wait(submit()); }
+
+	bool hasDedicatedTransfer() const { return _transferFamily != _graphicsFamily; }
+
+	uint32_t submittedBatches() const { return _batchesSubmitted; }
+	uint32_t recordedCommands() const { return _commandsRecorded; }
+	VkDeviceSize stagedBytes() const { return _stagedBytes; }
+	//times a staging allocation had to wait for the GPU to free ring space
+	uint32_t stagingStalls() const { return _stagingStalls; }
+
+	void printStats() const;
+
+private:
+	struct Batch {
+		VkCommandBuffer transferCmd{ VK_NULL_HANDLE };
+		VkCommandBuffer graphicsCmd{ VK_NULL_HANDLE };
+		VkFence fence{ VK_NULL_HANDLE };
+		VkSemaphore semaphore{ VK_NULL_HANDLE };
+		uint64_t ticket{ 0 };
+		bool recording{ false };
+		bool graphicsUsed{ false };
+		std::vector<std::function<void()>> completions;
+	};
+
+	struct StagingRegion {
+		VkDeviceSize begin;
+		VkDeviceSize end;
+		uint64_t ticket;
+	};
+
+	Batch& current();
+	//reserves ring space for the current batch, waits for older batches when the ring is full
+	VkDeviceSize allocateStaging(VkDeviceSize size, VkDeviceSize alignment);
+	bool tryAllocateStaging(VkDeviceSize size, VkDeviceSize alignment, VkDeviceSize& outOffset);
+	void reclaimStaging();
+	void retire(Batch& batch);
+	void releaseToGraphics(const VkImageMemoryBarrier* imageBarrier, const VkBufferMemoryBarrier* bufferBarrier,
+		VkPipelineStageFlags dstStage);
+
+	VkDevice _device{ VK_NULL_HANDLE };
+	uint32_t _graphicsFamily{ 0 };
+	uint32_t _transferFamily{ 0 };
+	VkQueue _graphicsQueue{ VK_NULL_HANDLE };
+	VkQueue _transferQueue{ VK_NULL_HANDLE };
+
+	VkCommandPool _transferPool{ VK_NULL_HANDLE };
+	VkCommandPool _graphicsPool{ VK_NULL_HANDLE };
+
+	Batch _recording;
+	std::deque<Batch> _inFlight;
+	//finished batches keep their command buffers/fence/semaphore for reuse
+	std::vector<Batch> _free;
+
+	MemoryAllocator* _allocator{ nullptr };
+	VkBuffer _stagingBuffer{ VK_NULL_HANDLE };
+	Allocation _stagingMemory;
+	char* _stagingMapped{ nullptr };
+	VkDeviceSize _stagingSize{ 0 };
+	VkDeviceSize _stagingHead{ 0 };
+	std::deque<StagingRegion> _stagingRegions;
+
+	uint64_t _nextTicket{ 1 };
+	uint64_t _completedTicket{ 0 };
+	uint32_t _batchesSubmitted{ 0 };
+	uint32_t _commandsRecorded{ 0 };
+	VkDeviceSize _stagedBytes{ 0 };
+	uint32_t _stagingStalls{ 0 };
+};
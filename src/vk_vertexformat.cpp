@@ -0,0 +1,216 @@
+#include <vk_vertexformat.h>
+#include <glm/gtx/transform.hpp>
+#include <glm/common.hpp>
+#include <cstring>
+#include <cmath>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define VKVERTEX_SSE2 1
+#include <emmintrin.h>
+#endif
+
+vkvertex::Quantization vkvertex::quantization_for(const glm::vec3& boundsMin, const glm::vec3& boundsMax)
+{
+	Quantization quantization;
+	quantization.center = (boundsMin + boundsMax) * 0.5f;
+	glm::vec3 extent = (boundsMax - boundsMin) * 0.5f;
+	quantization.scale = std::max(std::max(extent.x, extent.y), extent.z);
+	if (quantization.scale <= 0.0f) {
+		quantization.scale = 1.0f;
+	}
+	return quantization;
+}
+
+glm::mat4 vkvertex::dequantize_matrix(const Quantization& quantization)
+{
+	return glm::translate(quantization.center) * glm::scale(glm::vec3(quantization.scale));
+}
+
+uint16_t vkvertex::float_to_half(float value)
+{
+	uint32_t bits;
+	memcpy(&bits, &value, sizeof(bits));
+	uint32_t sign = (bits >> 16) & 0x8000;
+	uint32_t abs = bits & 0x7fffffff;
+
+	uint16_t result;
+	if (abs >= 0x47800000) {
+		//overflow to infinity, nan keeps a mantissa bit
+		result = static_cast<uint16_t>(abs > 0x7f800000 ? 0x7e00 : 0x7c00);
+	}
+	else if (abs < 0x38800000) {
+		//subnormal half: let the float adder do the rounding
+		float f;
+		memcpy(&f, &abs, sizeof(f));
+		uint32_t magicBits = ((127 - 15) + (23 - 10) + 1) << 23;
+		float magic;
+		memcpy(&magic, &magicBits, sizeof(magic));
+		f += magic;
+		uint32_t rounded;
+		memcpy(&rounded, &f, sizeof(rounded));
+		result = static_cast<uint16_t>(rounded - magicBits);
+	}
+	else {
+		uint32_t mantOdd = (abs >> 13) & 1;
+		abs += 0xfff - ((127 - 15) << 23) + mantOdd;
+		result = static_cast<uint16_t>(abs >> 13);
+	}
+	return static_cast<uint16_t>(result | sign);
+}
+
+float vkvertex::half_to_float(uint16_t value)
+{
+	uint32_t sign = (value & 0x8000u) << 16;
+	uint32_t exponent = (value >> 10) & 0x1f;
+	uint32_t mantissa = value & 0x3ff;
+
+	uint32_t bits;
+	if (exponent == 0x1f) {
+		bits = sign | 0x7f800000 | (mantissa << 13);
+	}
+	else if (exponent != 0) {
+		bits = sign | ((exponent + 127 - 15) << 23) | (mantissa << 13);
+	}
+	else {
+		//zero or subnormal
+		float f = std::ldexp(static_cast<float>(mantissa), -24);
+		memcpy(&bits, &f, sizeof(bits));
+		bits |= sign;
+	}
+	float result;
+	memcpy(&result, &bits, sizeof(result));
+	return result;
+}
+
+namespace {
+
+	inline int32_t round_clamp(float value, float limit)
+	{
+		value = std::min(std::max(value, -limit), limit);
+		return static_cast<int32_t>(std::nearbyint(value));
+	}
+
+#ifdef VKVERTEX_SSE2
+	//4 floats to 4 halfs in the low 16 bits of each lane, the lane-wise version of float_to_half
+	inline __m128i float_to_half_sse2(__m128 f)
+	{
+		const __m128i f16max = _mm_set1_epi32((127 + 16) << 23);
+		const __m128i minNormal = _mm_set1_epi32((127 - 14) << 23);
+		const __m128i subnormMagic = _mm_set1_epi32(((127 - 15) + (23 - 10) + 1) << 23);
+		const __m128i normalBias = _mm_set1_epi32(0xfff - ((127 - 15) << 23));
+
+		__m128 justSign = _mm_and_ps(f, _mm_set1_ps(-0.0f));
+		__m128 absf = _mm_xor_ps(f, justSign);
+		__m128i absi = _mm_castps_si128(absf);
+
+		__m128 isNan = _mm_cmpunord_ps(absf, absf);
+		__m128i isRegular = _mm_cmpgt_epi32(f16max, absi);
+		__m128i infOrNan = _mm_or_si128(_mm_and_si128(_mm_castps_si128(isNan), _mm_set1_epi32(0x200)), _mm_set1_epi32(0x7c00));
+
+		__m128i isSubnormal = _mm_cmpgt_epi32(minNormal, absi);
+		__m128 subnorm1 = _mm_add_ps(absf, _mm_castsi128_ps(subnormMagic));
+		__m128i subnorm = _mm_sub_epi32(_mm_castps_si128(subnorm1), subnormMagic);
+
+		__m128i mantOdd = _mm_srai_epi32(_mm_slli_epi32(absi, 31 - 13), 31);
+		__m128i normal = _mm_srli_epi32(_mm_sub_epi32(_mm_add_epi32(absi, normalBias), mantOdd), 13);
+
+		__m128i nonSpecial = _mm_or_si128(_mm_and_si128(subnorm, isSubnormal), _mm_andnot_si128(isSubnormal, normal));
+		__m128i joined = _mm_or_si128(_mm_and_si128(nonSpecial, isRegular), _mm_andnot_si128(isRegular, infOrNan));
+		return _mm_or_si128(joined, _mm_srli_epi32(_mm_castps_si128(justSign), 16));
+	}
+
+	inline __m128 clamp_unit(__m128 v)
+	{
+		return _mm_min_ps(_mm_max_ps(v, _mm_set1_ps(-1.0f)), _mm_set1_ps(1.0f));
+	}
+#endif
+}
+
+void vkvertex::encode_positions(const void* src, size_t srcStride, size_t count, const Quantization& quantization, void* dst, size_t dstStride)
+{
+	const char* in = static_cast<const char*>(src);
+	char* out = static_cast<char*>(dst);
+	const float invScale = 1.0f / quantization.scale;
+
+#ifdef VKVERTEX_SSE2
+	const __m128 center = _mm_set_ps(0.0f, quantization.center.z, quantization.center.y, quantization.center.x);
+	const __m128 scale = _mm_set1_ps(invScale);
+	//w is forced to 0 so the padding lane is deterministic
+	const __m128 xyzMask = _mm_castsi128_ps(_mm_set_epi32(0, -1, -1, -1));
+	for (size_t i = 0; i < count; i++) {
+		__m128 p = _mm_and_ps(_mm_loadu_ps(reinterpret_cast<const float*>(in + i * srcStride)), xyzMask);
+		__m128 q = _mm_mul_ps(clamp_unit(_mm_mul_ps(_mm_sub_ps(p, center), scale)), _mm_set1_ps(32767.0f));
+		__m128i packed = _mm_packs_epi32(_mm_cvtps_epi32(q), _mm_setzero_si128());
+		_mm_storel_epi64(reinterpret_cast<__m128i*>(out + i * dstStride), packed);
+	}
+#else
+	for (size_t i = 0; i < count; i++) {
+		float p[3];
+		memcpy(p, in + i * srcStride, sizeof(p));
+		int16_t q[4] = { 0, 0, 0, 0 };
+		for (int c = 0; c < 3; c++) {
+			float unit = std::min(std::max((p[c] - quantization.center[c]) * invScale, -1.0f), 1.0f);
+			q[c] = static_cast<int16_t>(round_clamp(unit * 32767.0f, 32767.0f));
+		}
+		memcpy(out + i * dstStride, q, sizeof(q));
+	}
+#endif
+}
+
+void vkvertex::encode_snorm8(const void* src, size_t srcStride, size_t count, uint32_t components, void* dst, size_t dstStride)
+{
+	const char* in = static_cast<const char*>(src);
+	char* out = static_cast<char*>(dst);
+
+#ifdef VKVERTEX_SSE2
+	const __m128 mask = _mm_castsi128_ps(_mm_set_epi32(components == 4 ? -1 : 0, -1, -1, -1));
+	for (size_t i = 0; i < count; i++) {
+		__m128 v = _mm_and_ps(_mm_loadu_ps(reinterpret_cast<const float*>(in + i * srcStride)), mask);
+		__m128i q = _mm_cvtps_epi32(_mm_mul_ps(clamp_unit(v), _mm_set1_ps(127.0f)));
+		__m128i packed = _mm_packs_epi16(_mm_packs_epi32(q, q), _mm_setzero_si128());
+		int32_t bytes = _mm_cvtsi128_si32(packed);
+		memcpy(out + i * dstStride, &bytes, sizeof(bytes));
+	}
+#else
+	for (size_t i = 0; i < count; i++) {
+		float v[4] = { 0.0f, 0.0f, 0.0f, 0.0f };
+		memcpy(v, in + i * srcStride, components * sizeof(float));
+		int8_t q[4];
+		for (int c = 0; c < 4; c++) {
+			q[c] = static_cast<int8_t>(round_clamp(std::min(std::max(v[c], -1.0f), 1.0f) * 127.0f, 127.0f));
+		}
+		memcpy(out + i * dstStride, q, sizeof(q));
+	}
+#endif
+}
+
+void vkvertex::encode_half2(const void* src, size_t srcStride, size_t count, void* dst, size_t dstStride)
+{
+	const char* in = static_cast<const char*>(src);
+	char* out = static_cast<char*>(dst);
+
+#ifdef VKVERTEX_SSE2
+	//two elements per iteration
+	size_t i = 0;
+	for (; i + 2 <= count; i += 2) {
+		__m128 a = _mm_castpd_ps(_mm_load_sd(reinterpret_cast<const double*>(in + i * srcStride)));
+		__m128 b = _mm_castpd_ps(_mm_load_sd(reinterpret_cast<const double*>(in + (i + 1) * srcStride)));
+		__m128i h = float_to_half_sse2(_mm_movelh_ps(a, b));
+		//pack the low 16 bits of each lane without signed saturation
+		h = _mm_shufflelo_epi16(h, _MM_SHUFFLE(3, 3, 2, 0));
+		h = _mm_shufflehi_epi16(h, _MM_SHUFFLE(3, 3, 2, 0));
+		uint32_t first = static_cast<uint32_t>(_mm_cvtsi128_si32(h));
+		uint32_t second = static_cast<uint32_t>(_mm_cvtsi128_si32(_mm_srli_si128(h, 8)));
+		memcpy(out + i * dstStride, &first, sizeof(first));
+		memcpy(out + (i + 1) * dstStride, &second, sizeof(second));
+	}
+	for (; i < count; i++) {
+#else
+	for (size_t i = 0; i < count; i++) {
+#endif
+		float uv[2];
+		memcpy(uv, in + i * srcStride, sizeof(uv));
+		uint16_t h[2] = { float_to_half(uv[0]), float_to_half(uv[1]) };
+		memcpy(out + i * dstStride, h, sizeof(h));
+	}
+}
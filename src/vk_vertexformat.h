@@ -0,0 +1,42 @@
+#pragma once
+
+#include <vk_types.h>
+#include <glm/vec3.hpp>
+#include <glm/mat4x4.hpp>
+
+//layout of the vertex buffers a mesh is uploaded with
+enum class VertexFormat : uint32_t {
+	//44 byte float Vertex
+	Full = 0,
+	//16 byte CompactVertex: snorm16 positions relative to the mesh bounds, snorm8 normals, half float uvs.
+	//the formats are expanded to floats by the input assembler so the shaders stay unchanged
+	Compact = 1,
+};
+
+//quantization shared by the compact formats
+namespace vkvertex {
+
+	//position = center + snorm * scale. the scale is uniform so the dequantize matrix does not distort normals
+	struct Quantization {
+		glm::vec3 center{ 0.0f };
+		float scale{ 1.0f };
+	};
+
+	Quantization quantization_for(const glm::vec3& boundsMin, const glm::vec3& boundsMax);
+
+	//folded into the model matrix when drawing
+	glm::mat4 dequantize_matrix(const Quantization& quantization);
+
+	//the encoders read count elements from src every srcStride bytes and write every dstStride bytes.
+	//each element is loaded as 4 floats (2 for encode_half2), so the field must not be the last one of the source struct
+	void encode_positions(const void* src, size_t srcStride, size_t count, const Quantization& quantization, void* dst, size_t dstStride);
+
+	//components is 3 or 4, with 3 the fourth byte is written as 0
+	void encode_snorm8(const void* src, size_t srcStride, size_t count, uint32_t components, void* dst, size_t dstStride);
+
+	void encode_half2(const void* src, size_t srcStride, size_t count, void* dst, size_t dstStride);
+
+	//round to nearest even, same result as the SIMD path
+	uint16_t float_to_half(float value);
+	float half_to_float(uint16_t value);
+}